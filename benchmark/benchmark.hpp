@@ -0,0 +1,31 @@
+#pragma once
+
+#include <chrono>
+#include <string>
+
+#include <time.h>
+
+#include "lib/logger.hpp"
+
+struct BenchmarkOptions {
+    Logger logger;
+
+    // If zero, the benchmark's default is used.
+    size_t iterations = 0;
+
+    std::string input;
+};
+
+// ThreadCPUTime returns the cpu time consumed by the calling thread.
+inline std::chrono::nanoseconds ThreadCPUTime() {
+    timespec ts{};
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return std::chrono::seconds{ts.tv_sec} + std::chrono::nanoseconds{ts.tv_nsec};
+}
+
+// Each benchmark prints its results to stdout and returns the process's exit code.
+
+int ConnectionStormBenchmark(const BenchmarkOptions& options);
+int DecodeBenchmark(const BenchmarkOptions& options);
+int RTMPBenchmark(const BenchmarkOptions& options);
+int ScaleBenchmark(const BenchmarkOptions& options);
@@ -0,0 +1,151 @@
+#include "benchmark.hpp"
+
+#include <algorithm>
+#include <future>
+#include <thread>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <fmt/format.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "lib/rtmp_connection.hpp"
+#include "lib/tcp_server.hpp"
+
+namespace {
+
+constexpr uint16_t Port = 19350;
+constexpr size_t DefaultConnectionCount = 200;
+
+struct Sample {
+    bool ok = false;
+    std::chrono::steady_clock::duration connect{0};
+    std::chrono::steady_clock::duration handshake{0};
+    std::chrono::steady_clock::time_point end;
+};
+
+bool ReadAll(int fd, void* data, size_t len) {
+    auto p = reinterpret_cast<uint8_t*>(data);
+    while (len > 0) {
+        auto n = recv(fd, p, len, 0);
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+// Connect opens a connection and performs the client side of the rtmp handshake. The handshake
+// latency is measured up to the receipt of s2.
+Sample Connect() {
+    Sample sample;
+    auto start = std::chrono::steady_clock::now();
+
+    auto fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd == -1) {
+        return sample;
+    }
+
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(Port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0) {
+        sample.connect = std::chrono::steady_clock::now() - start;
+
+        std::vector<uint8_t> c0c1(1 + RTMPChunkStream::HandshakeSize);
+        c0c1[0] = 3;
+        std::vector<uint8_t> s0s1s2(1 + 2 * RTMPChunkStream::HandshakeSize);
+        if (send(fd, c0c1.data(), c0c1.size(), MSG_NOSIGNAL) == static_cast<ssize_t>(c0c1.size()) && ReadAll(fd, s0s1s2.data(), s0s1s2.size())) {
+            sample.end = std::chrono::steady_clock::now();
+            sample.handshake = sample.end - start;
+            sample.ok = send(fd, &s0s1s2[1], RTMPChunkStream::HandshakeSize, MSG_NOSIGNAL) == static_cast<ssize_t>(RTMPChunkStream::HandshakeSize);
+        }
+    }
+
+    close(fd);
+    return sample;
+}
+
+double Milliseconds(std::chrono::steady_clock::duration d) {
+    return std::chrono::duration<double, std::milli>(d).count();
+}
+
+template <typename T>
+T Percentile(const std::vector<T>& sorted, double p) {
+    return sorted[std::min(sorted.size() - 1, static_cast<size_t>(p * sorted.size()))];
+}
+
+} // anonymous namespace
+
+int ConnectionStormBenchmark(const BenchmarkOptions& options) {
+    auto connectionCount = options.iterations ? options.iterations : DefaultConnectionCount;
+    auto cpuCount = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+
+    std::vector<size_t> acceptorCounts{1};
+    if (cpuCount > 1) {
+        acceptorCounts.emplace_back(cpuCount);
+    }
+
+    fmt::print("{} simultaneous connections, {} workers\n", connectionCount, cpuCount);
+    fmt::print("{:<10}{:>14}{:>14}{:>14}{:>14}{:>14}\n", "acceptors", "connects/s", "connect p99", "handshake p50", "handshake p90", "handshake p99");
+
+    for (auto acceptorCount : acceptorCounts) {
+        TCPServer<RTMPConnection, RTMPConnectionDelegate*> server{Logger::Void, nullptr};
+        TCPServerOptions serverOptions;
+        serverOptions.workerCount = cpuCount;
+        serverOptions.acceptorCount = acceptorCount;
+        if (!server.start(asio::ip::address_v4::loopback(), Port, serverOptions)) {
+            options.logger.error("unable to start server");
+            return 1;
+        }
+
+        std::promise<void> go;
+        auto goFuture = go.get_future().share();
+        std::vector<Sample> samples(connectionCount);
+        std::vector<std::thread> clients;
+        for (size_t i = 0; i < connectionCount; ++i) {
+            clients.emplace_back([&, i] {
+                goFuture.wait();
+                samples[i] = Connect();
+            });
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        go.set_value();
+        for (auto& client : clients) {
+            client.join();
+        }
+        server.stop();
+
+        std::vector<double> connectLatencies, handshakeLatencies;
+        auto end = start;
+        for (auto& sample : samples) {
+            if (!sample.ok) {
+                options.logger.error("connection failed");
+                return 1;
+            }
+            connectLatencies.emplace_back(Milliseconds(sample.connect));
+            handshakeLatencies.emplace_back(Milliseconds(sample.handshake));
+            end = std::max(end, sample.end);
+        }
+        std::sort(connectLatencies.begin(), connectLatencies.end());
+        std::sort(handshakeLatencies.begin(), handshakeLatencies.end());
+
+        auto seconds = std::chrono::duration<double>(end - start).count();
+        fmt::print("{:<10}{:>14.0f}{:>12.2f}ms{:>12.2f}ms{:>12.2f}ms{:>12.2f}ms\n",
+            acceptorCount,
+            connectionCount / seconds,
+            Percentile(connectLatencies, 0.99),
+            Percentile(handshakeLatencies, 0.5),
+            Percentile(handshakeLatencies, 0.9),
+            Percentile(handshakeLatencies, 0.99)
+        );
+    }
+
+    return 0;
+}
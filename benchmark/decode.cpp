@@ -0,0 +1,137 @@
+#include "benchmark.hpp"
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+#include <fmt/format.h>
+
+#include "lib/demuxer.hpp"
+#include "lib/video_decoder.hpp"
+
+namespace {
+
+constexpr int Rounds = 3;
+
+// Recording holds an input file's video so that it can be decoded repeatedly without demuxing.
+struct Recording : EncodedAVHandler {
+    virtual ~Recording() {}
+
+    virtual void handleEncodedVideoConfig(const void* data, size_t len) override {
+        auto p = reinterpret_cast<const uint8_t*>(data);
+        config.assign(p, p + len);
+    }
+
+    virtual void handleEncodedVideo(std::chrono::microseconds pts, std::chrono::microseconds dts, const void* data, size_t len) override {
+        auto p = reinterpret_cast<const uint8_t*>(data);
+        frames.emplace_back(Frame{pts, dts, std::vector<uint8_t>(p, p + len)});
+    }
+
+    struct Frame {
+        std::chrono::microseconds pts;
+        std::chrono::microseconds dts;
+        std::vector<uint8_t> data;
+    };
+
+    std::vector<uint8_t> config;
+    std::vector<Frame> frames;
+};
+
+struct Counter : VideoHandler {
+    virtual ~Counter() {}
+
+    virtual void handleVideo(std::chrono::microseconds pts, const AVFrame* frame) override {
+        isOrdered &= pts > lastPTS;
+        lastPTS = pts;
+        ++frames;
+    }
+
+    size_t frames = 0;
+    bool isOrdered = true;
+    std::chrono::microseconds lastPTS = std::chrono::microseconds::min();
+};
+
+struct Result {
+    size_t frames = 0;
+    bool isOrdered = false;
+    std::chrono::nanoseconds time{0};
+};
+
+Result Decode(const Recording& recording, VideoDecoder::Configuration configuration, size_t frameCount) {
+    Counter counter;
+    auto start = std::chrono::steady_clock::now();
+    {
+        VideoDecoder decoder{Logger::Void, &counter, configuration};
+        decoder.handleEncodedVideoConfig(recording.config.data(), recording.config.size());
+        for (size_t i = 0; i < frameCount; ++i) {
+            auto& frame = recording.frames[i];
+            decoder.handleEncodedVideo(frame.pts, frame.dts, frame.data.data(), frame.data.size());
+        }
+        decoder.flush();
+    }
+    Result ret;
+    ret.time = std::chrono::steady_clock::now() - start;
+    ret.frames = counter.frames;
+    ret.isOrdered = counter.isOrdered;
+    return ret;
+}
+
+} // anonymous namespace
+
+int DecodeBenchmark(const BenchmarkOptions& options) {
+    if (options.input.empty()) {
+        options.logger.error("the decode benchmark requires an --input file");
+        return 1;
+    }
+
+    Recording recording;
+    {
+        // the destructor waits for the whole file to be demuxed
+        Demuxer demuxer{options.logger, options.input, &recording};
+    }
+    if (recording.config.empty() || recording.frames.empty()) {
+        options.logger.error("no video found in input");
+        return 1;
+    }
+    auto frameCount = options.iterations ? std::min(options.iterations, recording.frames.size()) : recording.frames.size();
+
+    struct Mode {
+        int threadCount;
+        bool frameThreading;
+        bool sliceThreading;
+    };
+    std::vector<Mode> modes = {{1, false, false}};
+    auto cores = static_cast<int>(std::max(std::thread::hardware_concurrency(), 1u));
+    for (int threads = 2; threads <= std::max(cores, 2); threads *= 2) {
+        modes.push_back({threads, true, false});
+        modes.push_back({threads, false, true});
+    }
+    modes.push_back({0, true, true});
+
+    fmt::print("{} frames from {}, best of {} rounds\n", frameCount, options.input, Rounds);
+    fmt::print("{:<10}{:<14}{:>12}{:>12}\n", "threads", "threading", "fps", "frames");
+    for (auto& mode : modes) {
+        VideoDecoder::Configuration configuration;
+        configuration.threadCount = mode.threadCount;
+        configuration.frameThreading = mode.frameThreading;
+        configuration.sliceThreading = mode.sliceThreading;
+
+        Result best;
+        for (int round = 0; round < Rounds; ++round) {
+            auto result = Decode(recording, configuration, frameCount);
+            if (!result.isOrdered) {
+                options.logger.with("threads", mode.threadCount).error("decoder output was out of order");
+                return 1;
+            }
+            if (round == 0 || result.time < best.time) {
+                best = result;
+            }
+        }
+
+        auto threading = mode.threadCount == 1 ? "none" : mode.frameThreading && mode.sliceThreading ? "frame+slice" : mode.frameThreading ? "frame" : "slice";
+        auto threads = mode.threadCount ? std::to_string(mode.threadCount) : std::string("auto");
+        auto seconds = std::chrono::duration<double>(best.time).count();
+        fmt::print("{:<10}{:<14}{:>12.1f}{:>12}\n", threads, threading, best.frames / seconds, best.frames);
+    }
+    return 0;
+}
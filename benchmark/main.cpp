@@ -0,0 +1,72 @@
+#include <iostream>
+#include <string>
+
+#include <args.hxx>
+#include <fmt/format.h>
+
+#include "benchmark.hpp"
+
+namespace {
+
+struct Benchmark {
+    const char* name;
+    const char* description;
+    int (*run)(const BenchmarkOptions& options);
+};
+
+const Benchmark gBenchmarks[] = {
+    {"connection-storm", "connects per second and handshake latency when many rtmp clients connect at once, by acceptor count", ConnectionStormBenchmark},
+    {"decode", "video decoding fps of an --input file by decoder thread count and threading type", DecodeBenchmark},
+    {"rtmp", "per-message cpu cost of receiving a stream with the native chunk stream vs. librtmp", RTMPBenchmark},
+    {"scale", "per-frame cpu cost of downscaling yuv420p along the ladders with libswscale vs. each YUVScaler kernel", ScaleBenchmark},
+};
+
+void printBenchmarks() {
+    std::cout << "  Benchmarks:" << std::endl;
+    for (auto& benchmark : gBenchmarks) {
+        std::cout << fmt::format("    {:<20}{}", benchmark.name, benchmark.description) << std::endl;
+    }
+}
+
+} // anonymous namespace
+
+Logger gLogger;
+
+int main(int argc, const char* argv[]) {
+    args::ArgumentParser parser("This runs microbenchmarks for the library's hot paths.");
+    parser.helpParams.width = 120;
+    args::HelpFlag help(parser, "help", "display this help", {'h', "help"});
+    args::ValueFlag<size_t> iterations(parser, "count", "number of iterations (the default depends on the benchmark)", {"iterations"});
+    args::ValueFlag<std::string> input(parser, "path", "input file for benchmarks that use one", {"input"});
+    args::Positional<std::string> name(parser, "benchmark", "the benchmark to run (see below)");
+    try {
+        parser.ParseCLI(argc, argv);
+    } catch (args::Help&) {
+        std::cout << parser;
+        printBenchmarks();
+        return 0;
+    } catch (args::ParseError& e) {
+        gLogger.error(e.what());
+        std::cerr << parser;
+        return 1;
+    }
+
+    BenchmarkOptions options;
+    options.logger = gLogger;
+    if (iterations) {
+        options.iterations = args::get(iterations);
+    }
+    if (input) {
+        options.input = args::get(input);
+    }
+
+    for (auto& benchmark : gBenchmarks) {
+        if (args::get(name) == benchmark.name) {
+            return benchmark.run(options);
+        }
+    }
+
+    std::cerr << parser;
+    printBenchmarks();
+    return 1;
+}
@@ -0,0 +1,240 @@
+#include "benchmark.hpp"
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+#include <fmt/format.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "librtmp/rtmp.h"
+#include "lib/rtmp_chunk_stream.hpp"
+
+namespace {
+
+constexpr uint32_t ChunkSize = 4096;
+constexpr size_t DefaultMessageCount = 20000;
+constexpr int Rounds = 3;
+
+struct Result {
+    size_t messages = 0;
+    size_t bytes = 0;
+    uint64_t checksum = 0;
+    std::chrono::nanoseconds cpuTime{0};
+    bool ok = false;
+};
+
+// EncodeStream produces a synthetic publishing session: 60 fps video at roughly 6 Mbps with a key
+// frame every two seconds, interleaved with 128 Kbps of audio.
+std::vector<uint8_t> EncodeStream(size_t messageCount) {
+    std::vector<uint8_t> ret;
+    RTMPChunkStream encoder{Logger::Void, [&](const void* data, size_t len) {
+        auto p = reinterpret_cast<const uint8_t*>(data);
+        ret.insert(ret.end(), p, p + len);
+        return true;
+    }, [](const RTMPMessage& message) {
+        return true;
+    }};
+    encoder.setOutgoingChunkSize(ChunkSize);
+
+    std::vector<uint8_t> body(120000);
+    for (size_t i = 0; i < body.size(); ++i) {
+        body[i] = static_cast<uint8_t>(i * 31);
+    }
+
+    size_t frame = 0;
+    for (size_t i = 0; i < messageCount; ++i) {
+        if (i % 4 == 3) {
+            auto timestamp = static_cast<uint32_t>(i * 1000 / 188);
+            encoder.sendMessage(4, RTMPMessageType::Audio, 1, timestamp, body.data(), 372);
+        } else {
+            auto timestamp = static_cast<uint32_t>(frame * 1000 / 60);
+            encoder.sendMessage(6, RTMPMessageType::Video, 1, timestamp, body.data(), frame % 120 == 0 ? body.size() : 11000);
+            ++frame;
+        }
+    }
+
+    return ret;
+}
+
+bool WriteAll(int fd, const void* data, size_t len) {
+    auto p = reinterpret_cast<const uint8_t*>(data);
+    while (len > 0) {
+        auto n = send(fd, p, len, MSG_NOSIGNAL);
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+bool ReadAll(int fd, void* data, size_t len) {
+    auto p = reinterpret_cast<uint8_t*>(data);
+    while (len > 0) {
+        auto n = recv(fd, p, len, 0);
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+// RunClient performs a plain handshake, then publishes the stream and closes its side.
+void RunClient(int fd, const std::vector<uint8_t>& stream) {
+    std::vector<uint8_t> c0c1(1 + RTMPChunkStream::HandshakeSize);
+    c0c1[0] = 3;
+    std::vector<uint8_t> s0s1s2(1 + 2 * RTMPChunkStream::HandshakeSize);
+    if (!WriteAll(fd, c0c1.data(), c0c1.size()) || !ReadAll(fd, s0s1s2.data(), s0s1s2.size())) {
+        shutdown(fd, SHUT_WR);
+        return;
+    }
+
+    // acknowledgements have to be read, or the receiver will eventually block writing them
+    std::thread drain([fd] {
+        char buf[4096];
+        while (recv(fd, buf, sizeof(buf), 0) > 0) {}
+    });
+
+    // c2 echoes s1
+    if (WriteAll(fd, &s0s1s2[1], RTMPChunkStream::HandshakeSize)) {
+        WriteAll(fd, stream.data(), stream.size());
+    }
+    shutdown(fd, SHUT_WR);
+    drain.join();
+}
+
+bool WaitUntilReadable(int fd) {
+    pollfd fds{};
+    fds.fd = fd;
+    fds.events = POLLIN;
+    return poll(&fds, 1, -1) > 0;
+}
+
+void Count(Result* result, const uint8_t* data, size_t len) {
+    ++result->messages;
+    result->bytes += len;
+    if (len > 0) {
+        result->checksum += data[0] + data[len - 1];
+    }
+}
+
+Result RunNative(int fd) {
+    Result result;
+    auto start = ThreadCPUTime();
+
+    RTMPChunkStream stream{Logger::Void, [fd](const void* data, size_t len) {
+        return WriteAll(fd, data, len);
+    }, [&](const RTMPMessage& message) {
+        Count(&result, message.data(), message.size());
+        return true;
+    }};
+    while (WaitUntilReadable(fd) && stream.readFrom(fd)) {}
+
+    result.cpuTime = ThreadCPUTime() - start;
+    result.ok = stream.isClosed();
+    close(fd);
+    return result;
+}
+
+Result RunLibRTMP(int fd) {
+    Result result;
+    auto start = ThreadCPUTime();
+
+    RTMP* rtmp = RTMP_Alloc();
+    RTMP_Init(rtmp);
+    rtmp->m_sb.sb_socket = fd;
+    // the connection used to wait for readability before every read via the interrupt callback
+    rtmp->m_sb.sb_interrupt_callback = [](void* fd) {
+        return WaitUntilReadable(*reinterpret_cast<int*>(fd)) ? 0 : -1;
+    };
+    rtmp->m_sb.sb_context = &fd;
+
+    if (RTMP_Serve(rtmp)) {
+        RTMPPacket packet{0};
+        while (RTMP_IsConnected(rtmp) && RTMP_ReadPacket(rtmp, &packet)) {
+            if (!RTMPPacket_IsReady(&packet)) {
+                continue;
+            }
+            if (packet.m_packetType == RTMP_PACKET_TYPE_CHUNK_SIZE) {
+                if (packet.m_nBodySize >= 4) {
+                    rtmp->m_inChunkSize = AMF_DecodeInt32(packet.m_body);
+                }
+            } else {
+                Count(&result, reinterpret_cast<const uint8_t*>(packet.m_body), packet.m_nBodySize);
+            }
+            RTMPPacket_Free(&packet);
+        }
+        RTMPPacket_Free(&packet);
+        result.ok = true;
+    }
+
+    // this closes the descriptor
+    RTMP_Close(rtmp);
+    RTMP_Free(rtmp);
+
+    result.cpuTime = ThreadCPUTime() - start;
+    return result;
+}
+
+Result Run(const std::vector<uint8_t>& stream, Result (*receiver)(int)) {
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+        return {};
+    }
+    std::thread client([&] {
+        RunClient(fds[1], stream);
+    });
+    auto result = receiver(fds[0]);
+    client.join();
+    close(fds[1]);
+    return result;
+}
+
+} // anonymous namespace
+
+int RTMPBenchmark(const BenchmarkOptions& options) {
+    auto messageCount = options.iterations ? options.iterations : DefaultMessageCount;
+    auto stream = EncodeStream(messageCount);
+
+    struct Receiver {
+        const char* name;
+        Result (*run)(int);
+        Result best;
+    };
+    Receiver receivers[] = {
+        {"librtmp", RunLibRTMP, {}},
+        {"native", RunNative, {}},
+    };
+
+    for (int round = 0; round < Rounds; ++round) {
+        for (auto& receiver : receivers) {
+            auto result = Run(stream, receiver.run);
+            if (!result.ok || result.messages != messageCount) {
+                options.logger.with("receiver", receiver.name, "messages", result.messages).error("rtmp receiver failed");
+                return 1;
+            }
+            if (round == 0 || result.cpuTime < receiver.best.cpuTime) {
+                receiver.best = result;
+            }
+        }
+    }
+
+    if (receivers[0].best.checksum != receivers[1].best.checksum) {
+        options.logger.error("rtmp receivers disagree about message contents");
+        return 1;
+    }
+
+    fmt::print("{} messages, {:.1f} MB, chunk size {}, best of {} rounds\n", messageCount, stream.size() / 1e6, ChunkSize, Rounds);
+    fmt::print("{:<10}{:>16}{:>16}\n", "receiver", "cpu ns/message", "cpu MB/s");
+    for (auto& receiver : receivers) {
+        auto nanoseconds = static_cast<double>(receiver.best.cpuTime.count());
+        fmt::print("{:<10}{:>16.0f}{:>16.0f}\n", receiver.name, nanoseconds / receiver.best.messages, receiver.best.bytes / (nanoseconds / 1e3));
+    }
+    return 0;
+}
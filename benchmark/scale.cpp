@@ -0,0 +1,134 @@
+#include "benchmark.hpp"
+
+#include <functional>
+#include <vector>
+
+#include <fmt/format.h>
+
+extern "C" {
+    #include <libswscale/swscale.h>
+}
+
+#include "lib/yuv_scaler.hpp"
+
+namespace {
+
+constexpr size_t DefaultFrameCount = 200;
+constexpr int Rounds = 3;
+
+struct Size {
+    int width;
+    int height;
+};
+
+// The resolution changes that the encoding ladders make most often.
+const std::pair<Size, Size> Ratios[] = {
+    {{1920, 1080}, {1280, 720}},
+    {{1920, 1080}, {960, 540}},
+    {{1920, 1080}, {640, 360}},
+    {{1280, 720}, {854, 480}},
+    {{1280, 720}, {640, 360}},
+};
+
+AVFrame* NewFrame(int width, int height) {
+    auto frame = av_frame_alloc();
+    frame->format = AV_PIX_FMT_YUV420P;
+    frame->width = width;
+    frame->height = height;
+    av_frame_get_buffer(frame, 32);
+    return frame;
+}
+
+// Time returns the best per-frame thread cpu time for f over a few rounds.
+std::chrono::nanoseconds Time(size_t frameCount, const std::function<void()>& f) {
+    std::chrono::nanoseconds best{0};
+    for (int round = 0; round < Rounds; ++round) {
+        auto start = ThreadCPUTime();
+        for (size_t i = 0; i < frameCount; ++i) {
+            f();
+        }
+        auto elapsed = (ThreadCPUTime() - start) / frameCount;
+        if (round == 0 || elapsed < best) {
+            best = elapsed;
+        }
+    }
+    return best;
+}
+
+const char* KernelName(YUVScaler::Kernel kernel) {
+    switch (kernel) {
+        case YUVScaler::Kernel::Scalar: return "scalar";
+        case YUVScaler::Kernel::SSE41: return "sse4.1";
+        case YUVScaler::Kernel::AVX2: return "avx2";
+    }
+    return "";
+}
+
+} // anonymous namespace
+
+int ScaleBenchmark(const BenchmarkOptions& options) {
+    auto frameCount = options.iterations ? options.iterations : DefaultFrameCount;
+
+    const YUVScaler::Kernel kernels[] = {YUVScaler::Kernel::Scalar, YUVScaler::Kernel::SSE41, YUVScaler::Kernel::AVX2};
+    const struct {
+        const char* name;
+        int swsFlags;
+        YUVScaler::Filter filter;
+    } filters[] = {
+        {"bilinear", SWS_BILINEAR, YUVScaler::Filter::Bilinear},
+        {"area", SWS_AREA, YUVScaler::Filter::Area},
+    };
+
+    fmt::print("yuv420p, {} frames, best of {} rounds, cpu time per frame\n", frameCount, Rounds);
+    fmt::print("{:<24}{:<10}{:<10}{:>12}{:>10}\n", "resolution", "filter", "scaler", "us/frame", "speedup");
+    for (auto& ratio : Ratios) {
+        auto source = NewFrame(ratio.first.width, ratio.first.height);
+        auto dest = NewFrame(ratio.second.width, ratio.second.height);
+        for (int p = 0; p < 3; ++p) {
+            auto height = p ? (ratio.first.height + 1) / 2 : ratio.first.height;
+            for (int y = 0; y < height; ++y) {
+                for (int x = 0; x < source->linesize[p]; ++x) {
+                    source->data[p][y * source->linesize[p] + x] = static_cast<uint8_t>(x * 7 + y * 13);
+                }
+            }
+        }
+        auto resolution = fmt::format("{}x{} -> {}x{}", ratio.first.width, ratio.first.height, ratio.second.width, ratio.second.height);
+
+        for (auto& filter : filters) {
+            auto context = sws_getContext(
+                ratio.first.width, ratio.first.height, AV_PIX_FMT_YUV420P,
+                ratio.second.width, ratio.second.height, AV_PIX_FMT_YUV420P,
+                filter.swsFlags, nullptr, nullptr, nullptr
+            );
+            if (!context) {
+                options.logger.error("unable to create scaling context");
+                return 1;
+            }
+            auto baseline = Time(frameCount, [&] {
+                sws_scale(context, source->data, source->linesize, 0, source->height, dest->data, dest->linesize);
+            });
+            sws_freeContext(context);
+            fmt::print("{:<24}{:<10}{:<10}{:>12.1f}{:>10}\n", resolution, filter.name, "swscale", baseline.count() / 1000.0, "");
+
+            for (auto kernel : kernels) {
+                if (!YUVScaler::IsKernelSupported(kernel)) {
+                    continue;
+                }
+                YUVScaler scaler;
+                if (!scaler.configure(ratio.first.width, ratio.first.height, ratio.second.width, ratio.second.height, AV_PIX_FMT_YUV420P, filter.filter, kernel)) {
+                    options.logger.error("unable to configure scaler");
+                    return 1;
+                }
+                auto time = Time(frameCount, [&] {
+                    scaler.scale(source, dest);
+                });
+                auto speedup = static_cast<double>(baseline.count()) / time.count();
+                fmt::print("{:<24}{:<10}{:<10}{:>12.1f}{:>9.2f}x\n", resolution, filter.name, KernelName(kernel), time.count() / 1000.0, speedup);
+            }
+        }
+
+        av_frame_free(&source);
+        av_frame_free(&dest);
+    }
+    return 0;
+}
@@ -20,15 +20,39 @@ void signalHandler(int signal) {
 
 Logger gLogger;
 
+Packager::SegmentFormat ParseSegmentFormat(const std::string& format) {
+    if (format == "ts") {
+        return Packager::SegmentFormat::TS;
+    } else if (format == "cmaf") {
+        return Packager::SegmentFormat::CMAF;
+    }
+    throw std::invalid_argument("segment format must be \"ts\" or \"cmaf\"");
+}
+
 struct EncodingParser {
     // NOLINTNEXTLINE(misc-unused-parameters)
     void operator()(const std::string& name, const std::string& value, IngestServer::Configuration::Encoding& destination) {
         try {
             auto encoding = json::parse(value);
-            destination.video.codec = (encoding["video"]["codec"] == "h265") ? VideoCodec::x265 : (encoding["video"]["codec"] == "h264") ? VideoCodec::x264 : throw std::invalid_argument("codec not specified");
+            destination.video.codec = (encoding["video"]["codec"] == "h265") ? VideoCodec::x265 : (encoding["video"]["codec"] == "h264") ? VideoCodec::x264 : (encoding["video"]["codec"] == "copy") ? VideoCodec::copy : throw std::invalid_argument("codec not specified");
+            if (encoding["segment_format"].is_string()) {
+                destination.segmentFormat = ParseSegmentFormat(encoding["segment_format"].get<std::string>());
+            }
+            if (destination.video.codec == VideoCodec::copy) {
+                if (encoding["video"]["bitrate"].is_number()) {
+                    destination.video.bitrate = encoding["video"]["bitrate"].get<int>();
+                }
+                return;
+            }
+            if (encoding["segment_parallelism"].is_number()) {
+                destination.segmentParallelism = encoding["segment_parallelism"].get<size_t>();
+            }
             destination.video.bitrate = encoding["video"]["bitrate"].get<int>();
             destination.video.width = encoding["video"]["width"].get<int>();
             destination.video.height = encoding["video"]["height"].get<int>();
+            if (encoding["video"]["max_fps"].is_number()) {
+                destination.video.maxFrameRate = encoding["video"]["max_fps"].get<double>();
+            }
             if (encoding["video"]["h264_preset"].is_string()) {
                 destination.video.x264.h264Preset = encoding["video"]["h264_preset"].get<std::string>();
             }
@@ -38,6 +62,43 @@ struct EncodingParser {
             if (encoding["video"]["level"].is_number()) {
                 destination.video.x264.levelIDC = encoding["video"]["level"].get<int>();
             }
+            if (encoding["video"]["intra_refresh"].is_boolean()) {
+                destination.video.x264.intraRefresh = encoding["video"]["intra_refresh"].get<bool>();
+            }
+            if (encoding["video"]["intra_refresh_frames"].is_number()) {
+                destination.video.x264.intraRefreshFrames = encoding["video"]["intra_refresh_frames"].get<int>();
+            }
+
+            // threading is either a profile name or an object with a profile and overrides
+            auto& threading = encoding["video"]["threading"];
+            if (threading.is_string() && !VideoEncoderThreading::Profile(threading.get<std::string>(), &destination.video.threading)) {
+                throw std::invalid_argument("unknown threading profile");
+            } else if (threading.is_object()) {
+                if (threading["profile"].is_string() && !VideoEncoderThreading::Profile(threading["profile"].get<std::string>(), &destination.video.threading)) {
+                    throw std::invalid_argument("unknown threading profile");
+                }
+                if (threading["threads"].is_number()) {
+                    destination.video.threading.threads = threading["threads"].get<int>();
+                }
+                if (threading["pool_threads"].is_number()) {
+                    destination.video.threading.poolThreads = threading["pool_threads"].get<int>();
+                }
+                if (threading["frame_threads"].is_number()) {
+                    destination.video.threading.frameThreads = threading["frame_threads"].get<int>();
+                }
+                if (threading["sliced_threads"].is_boolean()) {
+                    destination.video.threading.slicedThreads = threading["sliced_threads"].get<bool>();
+                }
+                if (threading["wpp"].is_boolean()) {
+                    destination.video.threading.wpp = threading["wpp"].get<bool>();
+                }
+                if (threading["lookahead_threads"].is_number()) {
+                    destination.video.threading.lookaheadThreads = threading["lookahead_threads"].get<int>();
+                }
+                if (threading["zerolatency"].is_boolean()) {
+                    destination.video.threading.zeroLatency = threading["zerolatency"].get<bool>();
+                }
+            }
         } catch (...) {
             throw args::ParseError("invalid encoding");
         }
@@ -64,12 +125,20 @@ int main(int argc, const char* argv[]) {
             {"h264_preset", "medium"},
             {"profile_idc", 100},
             {"level_idc", 31},
+            {"threading", "default"},
         }},
     };
     args::ArgumentParser parser(
         "This is the ingest server. It receives RTMP connections, archives the raw streams, and redistributes the streams to the transcoders and CDNs.", (
         "Storage URIs can be of the form \"file:my-directory\" or \"s3:my-bucket\". "
-        "Encodings are JSON strings of the form " + exampleEncoding.dump() + "."
+        "Encodings are JSON strings of the form " + exampleEncoding.dump() + ". "
+        "A codec of \"copy\" packages the source video without transcoding it. Its \"bitrate\" should be the source's peak bitrate, and it's required with --hls-playlists, which advertises it as the bandwidth. "
+        "A top-level \"segment_parallelism\" greater than one encodes that many segments at once on separate encoder instances, for presets too slow to encode live otherwise. "
+        "A top-level \"segment_format\" of \"ts\" or \"cmaf\" overrides --segment-format for the encoding. "
+        "An optional \"max_fps\" drops frames evenly to keep the encoding's frame rate at or below it. "
+        "For h264, \"intra_refresh\" replaces IDRs with periodic intra refresh for lower latency, refreshing every \"intra_refresh_frames\" frames (default 60). "
+        "Threading is one of \"default\", \"throughput\", or \"low-latency\", or an object with an optional \"profile\" "
+        "and any of \"threads\", \"pool_threads\", \"frame_threads\", \"sliced_threads\", \"wpp\", \"lookahead_threads\", and \"zerolatency\" to override it."
     ));
     parser.helpParams.width = 120;
     args::HelpFlag help(parser, "help", "display this help", {'h', "help"});
@@ -78,7 +147,23 @@ int main(int argc, const char* argv[]) {
     args::ValueFlag<std::string> platformAccessToken(parser, "token", "platform access token", {"platform-access-token"});
     args::ValueFlag<std::shared_ptr<FileStorage>, FileStorageParser> archiveStorage(parser, "uri", "uri to archive to", {"archive-storage"});
     args::ValueFlagList<std::shared_ptr<FileStorage>, std::vector, FileStorageParser> segmentStorage(parser, "uri", "uris to write segments to", {"segment-storage"});
-    args::ValueFlagList<IngestServer::Configuration::Encoding, std::vector, EncodingParser> encodings(parser, "encoding", "a/v encoding configuration for h264/h265 as json (see below)", {"encoding"});
+    args::ValueFlagList<IngestServer::Configuration::Encoding, std::vector, EncodingParser> encodings(parser, "encoding", "a/v encoding configuration for h264/h265/copy as json (see below)", {"encoding"});
+    args::ValueFlag<int> ingressQueueDepth(parser, "ms", "queue up to this much media per stream ahead of segmenting and transcoding (0 to do them on the connection's thread)", {"ingress-queue-depth"}, 2000);
+    args::ValueFlag<size_t> encodingThreads(parser, "count", "encode each stream's renditions concurrently on a pool of this many threads (0 to encode them one after another)", {"encoding-threads"}, 0);
+    args::ValueFlag<int> decodingThreads(parser, "count", "decode each stream with this many threads (0 for one per core)", {"decoding-threads"}, 1);
+    args::Flag ingestIntraRefresh(parser, "ingest-intra-refresh", "accept ingest video that uses periodic intra refresh instead of idrs, segmenting it at recovery points", {"ingest-intra-refresh"});
+    args::Flag yuvScaler(parser, "yuv-scaler", "scale renditions with the built-in simd scaler instead of libswscale", {"yuv-scaler"});
+    args::Flag overloadControl(parser, "overload-control", "when encoders can't keep up, speed up presets, then halve frame rates and suspend the smaller renditions until they can", {"overload-control"});
+    args::Flag traceLatency(parser, "trace-latency", "measure per-stage video latency for each stream and log it at every segment boundary", {"trace-latency"});
+    args::ValueFlag<std::string> segmentFormat(parser, "format", "package segments as \"ts\" or as \"cmaf\" (fragmented mp4 with an init segment) unless an encoding specifies its own", {"segment-format"}, "ts");
+    args::ValueFlag<int> segmentDuration(parser, "ms", "cut segments at the source keyframes closest to this duration", {"segment-duration"}, 5000);
+    args::ValueFlag<int> maxSegmentDuration(parser, "ms", "end segments early rather than exceed this duration, as far as the source keyframes allow. it's the hls target duration (0 for one and a half times the segment duration)", {"max-segment-duration"}, 0);
+    args::ValueFlag<int> partDuration(parser, "ms", "also upload segments in parts of up to this duration as they're packaged, for ll-hls (0 to disable)", {"part-duration"}, 0);
+    args::Flag hlsPlaylists(parser, "hls-playlists", "write hls media playlists for each stream's encodings, and a master playlist, to the segment storage as segments complete", {"hls-playlists"});
+    args::ValueFlag<size_t> hlsPlaylistWindow(parser, "count", "keep this many segments in the hls media playlists (0 for event playlists that keep the whole stream)", {"hls-playlist-window"}, 6);
+    args::Flag noSegmentRegistration(parser, "no-segment-registration", "don't register segments with the platform, only streams", {"no-segment-registration"});
+    args::ValueFlag<size_t> rtmpAcceptors(parser, "count", "number of SO_REUSEPORT acceptors to shard new connections across", {"rtmp-acceptors"}, 1);
+    args::ValueFlag<size_t> rtmpWorkers(parser, "count", "multiplex rtmp connections onto this many threads (0 for one per core) instead of giving each connection its own thread. requires an ingress queue if there's segment storage", {"rtmp-workers"});
     try {
         parser.ParseCLI(argc, argv);
     } catch (args::Help&) {
@@ -108,6 +193,37 @@ int main(int argc, const char* argv[]) {
         configuration.encodings.emplace_back(encoding);
     }
 
+    configuration.ingressQueueDepth = std::chrono::milliseconds(args::get(ingressQueueDepth));
+    configuration.encodingThreads = args::get(encodingThreads);
+    configuration.decodingThreads = args::get(decodingThreads);
+    configuration.ingestIntraRefresh = args::get(ingestIntraRefresh);
+    configuration.useYUVScaler = args::get(yuvScaler);
+    configuration.overloadControl = args::get(overloadControl);
+    configuration.latencyTracing = args::get(traceLatency);
+    configuration.targetSegmentDuration = std::chrono::milliseconds(args::get(segmentDuration));
+    configuration.maxSegmentDuration = std::chrono::milliseconds(args::get(maxSegmentDuration));
+    configuration.partDuration = std::chrono::milliseconds(args::get(partDuration));
+    configuration.hlsPlaylists = args::get(hlsPlaylists);
+    configuration.hlsPlaylistWindow = args::get(hlsPlaylistWindow);
+    configuration.segmentRegistration = !args::get(noSegmentRegistration);
+    if (configuration.hlsPlaylists) {
+        for (auto& encoding : configuration.encodings) {
+            // the master playlist is written before any of the source's video arrives
+            if (encoding.video.codec == VideoCodec::copy && encoding.video.bitrate <= 0) {
+                gLogger.error("copy encodings need a bitrate for the hls master playlist");
+                std::cerr << parser;
+                return 1;
+            }
+        }
+    }
+    try {
+        configuration.segmentFormat = ParseSegmentFormat(args::get(segmentFormat));
+    } catch (std::invalid_argument& e) {
+        gLogger.error(e.what());
+        std::cerr << parser;
+        return 1;
+    }
+
     std::unique_ptr<PlatformAPI> platformAPI;
     if (platformURL) {
         if (!gameId) {
@@ -142,11 +258,27 @@ int main(int argc, const char* argv[]) {
         }
     }
 
+    if (rtmpWorkers && !configuration.segmentFileStorage.empty() && configuration.ingressQueueDepth.count() <= 0) {
+        // without the queue, segmenting and transcoding would be done on the workers, stalling every
+        // other connection on them
+        gLogger.error("--rtmp-workers can't be used with segment storage unless --ingress-queue-depth is non-zero");
+        std::cerr << parser;
+        return 1;
+    }
+
     IngestServer s{gLogger, configuration};
 
     std::signal(SIGINT, signalHandler);
 
-    if (!s.start(asio::ip::address_v4::any(), 1935)) {
+    IngestServer::Options options;
+    options.acceptorCount = args::get(rtmpAcceptors);
+    if (rtmpWorkers) {
+        options.workerCount = args::get(rtmpWorkers);
+    } else {
+        options.threadPerConnection = true;
+    }
+
+    if (!s.start(asio::ip::address_v4::any(), 1935, options)) {
         Logger{}.error("unable to start ingest server");
         return 1;
     }
@@ -6,6 +6,7 @@
 #include <args.hxx>
 
 #include "lib/demuxer.hpp"
+#include "lib/frame_descriptor.hpp"
 #include "lib/mpeg4.hpp"
 #include "lib/h26x/h264.hpp"
 #include "lib/h26x/sei.hpp"
@@ -38,63 +39,91 @@ public:
     }
 
     virtual void handleEncodedVideo(std::chrono::microseconds pts, std::chrono::microseconds dts, const void* data, size_t len) override {
-        _logger.with(
-            "pts", pts.count(),
-            "dts", dts.count()
-        ).info("video access unit");
+        handleEncodedVideoPacket(pts, dts, EncodedPacket::Borrow(data, len));
+    }
+
+    virtual void handleEncodedVideoPacket(std::chrono::microseconds pts, std::chrono::microseconds dts, const EncodedPacket& packet) override {
         if (!_videoConfig) {
+            _logger.with(
+                "pts", pts.count(),
+                "dts", dts.count()
+            ).info("video access unit");
             return;
         }
-        if (!h264::IterateAVCC(data, len, _videoConfig->lengthSizeMinusOne + 1, [this](const void* data, size_t len) {
-            printf("==== NALU ====\n");
 
-            h264::bitstream bs{data, len};
+        FrameDescriptor storage;
+        auto descriptor = DescribeFrame(packet, _videoConfig->lengthSizeMinusOne + 1, &storage);
+        if (!descriptor) {
+            _logger.error("unable to iterate avcc nalus");
+            return;
+        }
+        _logger.with(
+            "pts", pts.count(),
+            "dts", dts.count(),
+            "keyframe", descriptor->isKeyframe,
+            "reference", descriptor->isReference,
+            "slice_type", static_cast<int>(descriptor->sliceType),
+            "nalus", descriptor->naluCount
+        ).info("video access unit");
 
-            h264::nal_unit nalu;
-            auto err = nalu.decode(&bs, len);
-            if (err) {
-                _logger.error(err.message);
-                return;
+        if (descriptor->hasCompleteNALUTable()) {
+            for (size_t i = 0; i < descriptor->naluCount; ++i) {
+                _inspectNALU(packet.data() + descriptor->nalus[i].offset, descriptor->nalus[i].length);
             }
+        } else if (!h264::IterateAVCC(packet.data(), packet.size(), _videoConfig->lengthSizeMinusOne + 1, [this](const void* data, size_t len) {
+            _inspectNALU(data, len);
+        })) {
+            _logger.error("unable to iterate avcc nalus");
+        }
+    }
 
-            switch (nalu.nal_unit_type) {
-            case h264::NALUnitType::SEI: {
-                printf("nalu type: %d (sei)\n", int(nalu.nal_unit_type));
+private:
+    Logger _logger;
+    std::unique_ptr<AVCDecoderConfigurationRecord> _videoConfig;
 
-                h264::sei_rbsp rbsp;
-                h264::bitstream bs{nalu.rbsp_byte.data(), nalu.rbsp_byte.size()};
+    void _inspectNALU(const void* data, size_t len) {
+        printf("==== NALU ====\n");
 
-                auto err = rbsp.decode(&bs);
-                if (err) {
-                    _logger.error(err.message);
-                    break;
-                }
+        h264::bitstream bs{data, len};
 
-                for (auto& message : rbsp.sei_message) {
-                    printf("  payload type: %d\n", message.payloadType);
-                    printf("    ");
-                    for (size_t i = 0; i < message.sei_payload.size(); ++i) {
-                        if (i > 0 && (i % 16) == 0) {
-                            printf("\n    ");
-                        }
-                        printf("%02x ", message.sei_payload[i]);
-                    }
-                    printf("\n");
-                }
+        h264::nal_unit nalu;
+        auto err = nalu.decode(&bs, len);
+        if (err) {
+            _logger.error(err.message);
+            return;
+        }
+
+        switch (nalu.nal_unit_type) {
+        case h264::NALUnitType::SEI: {
+            printf("nalu type: %d (sei)\n", int(nalu.nal_unit_type));
 
+            h264::sei_rbsp rbsp;
+            h264::bitstream bs{nalu.rbsp_byte.data(), nalu.rbsp_byte.size()};
+
+            auto err = rbsp.decode(&bs);
+            if (err) {
+                _logger.error(err.message);
                 break;
             }
-            default:
-                printf("nalu type: %d\n", int(nalu.nal_unit_type));
+
+            for (auto& message : rbsp.sei_message) {
+                printf("  payload type: %d\n", message.payloadType);
+                printf("    ");
+                for (size_t i = 0; i < message.sei_payload.size(); ++i) {
+                    if (i > 0 && (i % 16) == 0) {
+                        printf("\n    ");
+                    }
+                    printf("%02x ", message.sei_payload[i]);
+                }
+                printf("\n");
             }
-        })) {
-            _logger.error("unable to iterate avcc nalus");
+
+            break;
+        }
+        default:
+            printf("nalu type: %d\n", int(nalu.nal_unit_type));
         }
     }
-
-private:
-    Logger _logger;
-    std::unique_ptr<AVCDecoderConfigurationRecord> _videoConfig;
 };
 
 int main(int argc, const char* argv[]) {
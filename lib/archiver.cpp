@@ -1,5 +1,7 @@
 #include "archiver.hpp"
 
+#include <cstring>
+
 Archiver::Archiver(Logger logger, FileStorage* storage, std::string pathFormat)
     : _logger{std::move(logger)}, _storage{storage}, _pathFormat{std::move(pathFormat)}
 {
@@ -18,41 +20,41 @@ Archiver::~Archiver() {
 }
 
 void Archiver::handleEncodedAudioConfig(const void* data, size_t len) {
-    _write(ArchiveDataType::AudioConfig, [&](uint8_t* dest) {
-        std::memcpy(dest, data, len);
-    }, len);
+    handleEncodedAudioConfigPacket(EncodedPacket::Borrow(data, len));
 }
 
 void Archiver::handleEncodedAudio(std::chrono::microseconds pts, const void* data, size_t len) {
-    _write(ArchiveDataType::Audio, [&](uint8_t* dest) {
-        for (int i = 0; i < 8; ++i) {
-            *(dest++) = (pts.count() >> ((7 - i) * 8)) & 0xff;
-        }
-        std::memcpy(dest, data, len);
-    }, len + 8);
+    handleEncodedAudioPacket(pts, EncodedPacket::Borrow(data, len));
 }
 
 void Archiver::handleEncodedVideoConfig(const void* data, size_t len) {
-    _write(ArchiveDataType::VideoConfig, [&](uint8_t* dest) {
-        std::memcpy(dest, data, len);
-    }, len);
+    handleEncodedVideoConfigPacket(EncodedPacket::Borrow(data, len));
 }
 
 void Archiver::handleEncodedVideo(std::chrono::microseconds pts, std::chrono::microseconds dts, const void* data, size_t len) {
-    _write(ArchiveDataType::Video, [&](uint8_t* dest) {
-        for (int i = 0; i < 8; ++i) {
-            *(dest++) = (pts.count() >> ((7 - i) * 8)) & 0xff;
-        }
-        for (int i = 0; i < 8; ++i) {
-            *(dest++) = (dts.count() >> ((7 - i) * 8)) & 0xff;
-        }
-        std::memcpy(dest, data, len);
-    }, len + 16);
+    handleEncodedVideoPacket(pts, dts, EncodedPacket::Borrow(data, len));
+}
+
+void Archiver::handleEncodedAudioConfigPacket(const EncodedPacket& packet) {
+    _write(ArchiveDataType::AudioConfig, {}, {}, packet);
+}
+
+void Archiver::handleEncodedAudioPacket(std::chrono::microseconds pts, const EncodedPacket& packet) {
+    _write(ArchiveDataType::Audio, pts, {}, packet);
+}
+
+void Archiver::handleEncodedVideoConfigPacket(const EncodedPacket& packet) {
+    _write(ArchiveDataType::VideoConfig, {}, {}, packet);
+}
+
+void Archiver::handleEncodedVideoPacket(std::chrono::microseconds pts, std::chrono::microseconds dts, const EncodedPacket& packet) {
+    _write(ArchiveDataType::Video, pts, dts, packet);
 }
 
 void Archiver::_run() {
     _logger.info("archiver thread running");
 
+    std::vector<Entry> entries;
     std::vector<uint8_t> uploadBuffer;
 
     std::shared_ptr<FileStorage::File> file;
@@ -61,14 +63,21 @@ void Archiver::_run() {
 
     std::unique_lock<std::mutex> l{_mutex};
     while (true) {
-        while (!_isDestructing && _buffer.empty()) {
+        while (!_isDestructing && _entries.empty()) {
             _cv.wait(l);
         }
 
-        uploadBuffer.clear();
-        uploadBuffer.swap(_buffer);
+        entries.clear();
+        entries.swap(_entries);
         l.unlock();
 
+        uploadBuffer.clear();
+        for (auto& entry : entries) {
+            _serialize(&uploadBuffer, entry);
+        }
+        // release the packets before waiting on the upload
+        entries.clear();
+
         auto now = std::chrono::steady_clock::now();
 
         if (file && (uploadBuffer.empty() || now - fileTime > std::chrono::minutes(5))) {
@@ -101,34 +110,64 @@ void Archiver::_run() {
     _logger.info("archiver thread exiting");
 }
 
-void Archiver::_write(ArchiveDataType type, const std::function<void(uint8_t*)>& write, size_t len) {
-    auto steadyTime = std::chrono::steady_clock::now();
-    auto systemTime = std::chrono::system_clock::now();
+void Archiver::_write(ArchiveDataType type, std::chrono::microseconds pts, std::chrono::microseconds dts, const EncodedPacket& packet) {
+    Entry entry;
+    entry.type = type;
+    entry.steadyTime = std::chrono::steady_clock::now();
+    entry.systemTime = std::chrono::system_clock::now();
+    entry.pts = pts;
+    entry.dts = dts;
+    entry.packet = packet.retained();
 
     {
         std::lock_guard<std::mutex> l{_mutex};
-        auto offset = _buffer.size();
-        auto totalLen = 1 + 16 + len;
-        _buffer.resize(offset + 4 + totalLen);
+        _entries.emplace_back(std::move(entry));
+    }
 
-        for (int i = 0; i < 4; ++i) {
-            _buffer[offset++] = (totalLen >> ((3 - i) * 8)) & 0xff;
-        }
+    _cv.notify_one();
+}
+
+void Archiver::_serialize(std::vector<uint8_t>* buffer, const Entry& entry) {
+    size_t len = entry.packet.size();
+    if (entry.type == ArchiveDataType::Audio) {
+        len += 8;
+    } else if (entry.type == ArchiveDataType::Video) {
+        len += 16;
+    }
+
+    auto offset = buffer->size();
+    auto totalLen = 1 + 16 + len;
+    buffer->resize(offset + 4 + totalLen);
+    auto dest = buffer->data() + offset;
+
+    for (int i = 0; i < 4; ++i) {
+        *(dest++) = (totalLen >> ((3 - i) * 8)) & 0xff;
+    }
 
-        _buffer[offset++] = static_cast<uint8_t>(type);
+    *(dest++) = static_cast<uint8_t>(entry.type);
 
-        auto steadyNano = std::chrono::duration_cast<std::chrono::nanoseconds>(steadyTime.time_since_epoch()).count();
+    auto steadyNano = std::chrono::duration_cast<std::chrono::nanoseconds>(entry.steadyTime.time_since_epoch()).count();
+    for (int i = 0; i < 8; ++i) {
+        *(dest++) = (steadyNano >> ((7 - i) * 8)) & 0xff;
+    }
+
+    auto systemNano = std::chrono::duration_cast<std::chrono::nanoseconds>(entry.systemTime.time_since_epoch()).count();
+    for (int i = 0; i < 8; ++i) {
+        *(dest++) = (systemNano >> ((7 - i) * 8)) & 0xff;
+    }
+
+    if (entry.type == ArchiveDataType::Audio || entry.type == ArchiveDataType::Video) {
         for (int i = 0; i < 8; ++i) {
-            _buffer[offset++] = (steadyNano >> ((7 - i) * 8)) & 0xff;
+            *(dest++) = (entry.pts.count() >> ((7 - i) * 8)) & 0xff;
         }
-
-        auto systemNano = std::chrono::duration_cast<std::chrono::nanoseconds>(systemTime.time_since_epoch()).count();
+    }
+    if (entry.type == ArchiveDataType::Video) {
         for (int i = 0; i < 8; ++i) {
-            _buffer[offset++] = (systemNano >> ((7 - i) * 8)) & 0xff;
+            *(dest++) = (entry.dts.count() >> ((7 - i) * 8)) & 0xff;
         }
-
-        write(&_buffer[offset]);
     }
 
-    _cv.notify_one();
+    if (!entry.packet.empty()) {
+        std::memcpy(dest, entry.packet.data(), entry.packet.size());
+    }
 }
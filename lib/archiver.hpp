@@ -1,6 +1,7 @@
 #pragma once
 
-#include <functional>
+#include <condition_variable>
+#include <mutex>
 #include <string>
 #include <thread>
 #include <vector>
@@ -29,6 +30,12 @@ public:
     virtual void handleEncodedVideoConfig(const void* data, size_t len) override;
     virtual void handleEncodedVideo(std::chrono::microseconds pts, std::chrono::microseconds dts, const void* data, size_t len) override;
 
+    // Shared packets are held until they're written out rather than being copied.
+    virtual void handleEncodedAudioConfigPacket(const EncodedPacket& packet) override;
+    virtual void handleEncodedAudioPacket(std::chrono::microseconds pts, const EncodedPacket& packet) override;
+    virtual void handleEncodedVideoConfigPacket(const EncodedPacket& packet) override;
+    virtual void handleEncodedVideoPacket(std::chrono::microseconds pts, std::chrono::microseconds dts, const EncodedPacket& packet) override;
+
 private:
     const Logger _logger;
     FileStorage* const _storage;
@@ -37,9 +44,22 @@ private:
     std::thread _thread;
     std::mutex _mutex;
     std::condition_variable _cv;
-    std::vector<uint8_t> _buffer;
     bool _isDestructing = false;
 
+    struct Entry {
+        ArchiveDataType type;
+        std::chrono::steady_clock::time_point steadyTime;
+        std::chrono::system_clock::time_point systemTime;
+        std::chrono::microseconds pts{0};
+        std::chrono::microseconds dts{0};
+        EncodedPacket packet;
+    };
+
+    std::vector<Entry> _entries;
+
     void _run();
-    void _write(ArchiveDataType type, const std::function<void(uint8_t*)>& write, size_t len);
+    void _write(ArchiveDataType type, std::chrono::microseconds pts, std::chrono::microseconds dts, const EncodedPacket& packet);
+
+    // _serialize appends the entry to the buffer in the archive format.
+    static void _serialize(std::vector<uint8_t>* buffer, const Entry& entry);
 };
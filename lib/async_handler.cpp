@@ -0,0 +1,223 @@
+#include "async_handler.hpp"
+
+#include <future>
+
+#include "utility.hpp"
+
+AsyncStage::AsyncStage(Logger logger, Configuration configuration)
+    : _logger{std::move(logger)}, _configuration{configuration}, _queue{configuration.capacity} {}
+
+AsyncStage::~AsyncStage() {
+    _stop();
+}
+
+void AsyncStage::post(std::function<void()> f) {
+    Item item;
+    item.function = std::move(f);
+    _push(std::move(item));
+}
+
+void AsyncStage::wait() {
+    std::promise<void> promise;
+    auto future = promise.get_future();
+    post([&promise] {
+        promise.set_value();
+    });
+    future.wait();
+}
+
+AsyncStage::Stats AsyncStage::stats() const {
+    Stats ret;
+    ret.capacity = _queue.capacity();
+    ret.occupancy = _queue.size();
+    ret.maxOccupancy = _maxOccupancy;
+    ret.stalls = _stalls;
+    ret.stallTime = std::chrono::microseconds{_stallMicroseconds.load()};
+    return ret;
+}
+
+void AsyncStage::_start() {
+    _thread = std::thread([this] {
+        _run();
+    });
+
+    if (_configuration.cpu >= 0 && !SetThreadAffinity(_thread, _configuration.cpu)) {
+        _logger.with("cpu", _configuration.cpu).warn("unable to set async stage thread affinity");
+    }
+}
+
+void AsyncStage::_stop() {
+    if (!_thread.joinable()) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> l{_mutex};
+        _isStopping = true;
+    }
+    _consumerCV.notify_one();
+    _thread.join();
+}
+
+void AsyncStage::_push(Item&& item) {
+    if (!_queue.tryPush(std::move(item))) {
+        ++_stalls;
+        auto start = std::chrono::steady_clock::now();
+        {
+            std::unique_lock<std::mutex> l{_mutex};
+            _isProducerWaiting = true;
+            // pairs with the fence in _run so that either we see the consumer's pop or it sees
+            // that we're waiting
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            while (!_queue.tryPush(std::move(item))) {
+                _producerCV.wait(l);
+            }
+            _isProducerWaiting = false;
+        }
+        _stallMicroseconds += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    auto occupancy = _queue.size();
+    if (occupancy > _maxOccupancy) {
+        _maxOccupancy = occupancy;
+    }
+
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (_isConsumerWaiting) {
+        std::lock_guard<std::mutex> l{_mutex};
+        _consumerCV.notify_one();
+    }
+}
+
+void AsyncStage::_run() {
+    Item item;
+    while (true) {
+        if (_queue.tryPop(&item)) {
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (_isProducerWaiting) {
+                std::lock_guard<std::mutex> l{_mutex};
+                _producerCV.notify_one();
+            }
+
+            if (item.function) {
+                item.function();
+            } else {
+                _dispatch(item);
+            }
+            item = Item{};
+            continue;
+        }
+
+        std::unique_lock<std::mutex> l{_mutex};
+        _isConsumerWaiting = true;
+        // pairs with the fence in _push
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        while (_queue.empty() && !_isStopping) {
+            _consumerCV.wait(l);
+        }
+        _isConsumerWaiting = false;
+        if (_queue.empty() && _isStopping) {
+            return;
+        }
+    }
+}
+
+AsyncEncodedAVHandler::AsyncEncodedAVHandler(Logger logger, EncodedAVHandler* handler, Configuration configuration)
+    : AsyncStage{std::move(logger), configuration}, _handler{handler}
+{
+    _start();
+}
+
+AsyncEncodedAVHandler::~AsyncEncodedAVHandler() {
+    _stop();
+}
+
+void AsyncEncodedAVHandler::handleEncodedAudioConfig(const void* data, size_t len) {
+    _push(AudioConfig, {}, {}, EncodedPacket::Borrow(data, len));
+}
+
+void AsyncEncodedAVHandler::handleEncodedAudio(std::chrono::microseconds pts, const void* data, size_t len) {
+    _push(Audio, pts, {}, EncodedPacket::Borrow(data, len));
+}
+
+void AsyncEncodedAVHandler::handleEncodedVideoConfig(const void* data, size_t len) {
+    _push(VideoConfig, {}, {}, EncodedPacket::Borrow(data, len));
+}
+
+void AsyncEncodedAVHandler::handleEncodedVideo(std::chrono::microseconds pts, std::chrono::microseconds dts, const void* data, size_t len) {
+    _push(Video, pts, dts, EncodedPacket::Borrow(data, len));
+}
+
+void AsyncEncodedAVHandler::handleEncodedVideoDiscontinuity() {
+    _push(VideoDiscontinuity, {}, {}, {});
+}
+
+void AsyncEncodedAVHandler::handleEncodedAudioConfigPacket(const EncodedPacket& packet) {
+    _push(AudioConfig, {}, {}, packet);
+}
+
+void AsyncEncodedAVHandler::handleEncodedAudioPacket(std::chrono::microseconds pts, const EncodedPacket& packet) {
+    _push(Audio, pts, {}, packet);
+}
+
+void AsyncEncodedAVHandler::handleEncodedVideoConfigPacket(const EncodedPacket& packet) {
+    _push(VideoConfig, {}, {}, packet);
+}
+
+void AsyncEncodedAVHandler::handleEncodedVideoPacket(std::chrono::microseconds pts, std::chrono::microseconds dts, const EncodedPacket& packet) {
+    _push(Video, pts, dts, packet);
+}
+
+void AsyncEncodedAVHandler::_push(ItemType type, std::chrono::microseconds pts, std::chrono::microseconds dts, const EncodedPacket& packet) {
+    Item item;
+    item.type = type;
+    item.pts = pts;
+    item.dts = dts;
+    item.packet = packet.retained();
+    AsyncStage::_push(std::move(item));
+}
+
+void AsyncEncodedAVHandler::_dispatch(Item& item) {
+    switch (item.type) {
+        case AudioConfig:
+            _handler->handleEncodedAudioConfigPacket(item.packet);
+            break;
+        case Audio:
+            _handler->handleEncodedAudioPacket(item.pts, item.packet);
+            break;
+        case VideoConfig:
+            _handler->handleEncodedVideoConfigPacket(item.packet);
+            break;
+        case Video:
+            _handler->handleEncodedVideoPacket(item.pts, item.dts, item.packet);
+            break;
+        case VideoDiscontinuity:
+            _handler->handleEncodedVideoDiscontinuity();
+            break;
+    }
+}
+
+AsyncVideoHandler::AsyncVideoHandler(Logger logger, VideoHandler* handler, Configuration configuration)
+    : AsyncStage{std::move(logger), configuration}, _handler{handler}
+{
+    _start();
+}
+
+AsyncVideoHandler::~AsyncVideoHandler() {
+    _stop();
+}
+
+void AsyncVideoHandler::handleVideo(std::chrono::microseconds pts, const AVFrame* frame) {
+    Item item;
+    item.pts = pts;
+    item.frame = av_frame_clone(frame);
+    if (!item.frame) {
+        _logger.error("unable to clone frame");
+        return;
+    }
+    _push(std::move(item));
+}
+
+void AsyncVideoHandler::_dispatch(Item& item) {
+    _handler->handleVideo(item.pts, item.frame);
+    av_frame_free(&item.frame);
+}
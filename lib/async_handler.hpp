@@ -0,0 +1,153 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "av_handler.hpp"
+#include "encoded_av_handler.hpp"
+#include "logger.hpp"
+#include "spsc_queue.hpp"
+
+// AsyncStage is the machinery shared by the asynchronous handlers below. Calls are recorded into a
+// fixed-capacity SPSCQueue and replayed in order on the stage's own thread. If the queue is full,
+// the caller blocks until there's room again; each time that happens is counted as a stall.
+//
+// Like the handlers they wrap, stages expect calls from one thread at a time. That includes post
+// and wait.
+class AsyncStage {
+public:
+    struct Configuration {
+        // The maximum number of calls that can be queued.
+        size_t capacity = 256;
+
+        // If non-negative, the stage's thread is pinned to this cpu.
+        int cpu = -1;
+    };
+
+    struct Stats {
+        size_t capacity = 0;
+
+        // The number of calls currently queued, and the most that have ever been queued at once.
+        size_t occupancy = 0;
+        size_t maxOccupancy = 0;
+
+        // The number of times a caller was blocked by a full queue, and for how long in total.
+        uint64_t stalls = 0;
+        std::chrono::microseconds stallTime{0};
+    };
+
+    AsyncStage(const AsyncStage& other) = delete;
+    AsyncStage& operator=(const AsyncStage& other) = delete;
+
+    // post queues f to be invoked on the stage's thread after everything queued before it. This is
+    // how other work (e.g. flushing an encoder) can be ordered relative to the handled calls.
+    void post(std::function<void()> f);
+
+    // wait blocks until everything queued so far has been handled.
+    void wait();
+
+    // stats may be invoked from any thread.
+    Stats stats() const;
+
+protected:
+    struct Item {
+        int type = 0;
+        std::chrono::microseconds pts{0};
+        std::chrono::microseconds dts{0};
+        EncodedPacket packet;
+        AVFrame* frame = nullptr;
+        std::function<void()> function;
+    };
+
+    AsyncStage(Logger logger, Configuration configuration);
+    virtual ~AsyncStage();
+
+    const Logger _logger;
+    const Configuration _configuration;
+
+    // Subclasses must invoke _start once they're fully constructed and _stop before they begin
+    // destructing. _stop returns once everything queued has been handled.
+    void _start();
+    void _stop();
+
+    void _push(Item&& item);
+
+    // _dispatch is invoked on the stage's thread for every pushed item.
+    virtual void _dispatch(Item& item) = 0;
+
+private:
+    SPSCQueue<Item> _queue;
+    std::thread _thread;
+
+    std::mutex _mutex;
+    std::condition_variable _consumerCV;
+    std::condition_variable _producerCV;
+    std::atomic<bool> _isConsumerWaiting{false};
+    std::atomic<bool> _isProducerWaiting{false};
+    bool _isStopping = false;
+
+    std::atomic<size_t> _maxOccupancy{0};
+    std::atomic<uint64_t> _stalls{0};
+    std::atomic<int64_t> _stallMicroseconds{0};
+
+    void _run();
+};
+
+// AsyncEncodedAVHandler invokes another handler from its own thread. Shared packets are queued as-is
+// and anything else is copied into pooled buffers, so callers may reuse their memory as soon as the
+// call returns.
+class AsyncEncodedAVHandler : public EncodedAVHandler, public AsyncStage {
+public:
+    AsyncEncodedAVHandler(Logger logger, EncodedAVHandler* handler, Configuration configuration = {});
+
+    // Anything still queued is handled before the destructor returns.
+    virtual ~AsyncEncodedAVHandler();
+
+    virtual void handleEncodedAudioConfig(const void* data, size_t len) override;
+    virtual void handleEncodedAudio(std::chrono::microseconds pts, const void* data, size_t len) override;
+    virtual void handleEncodedVideoConfig(const void* data, size_t len) override;
+    virtual void handleEncodedVideo(std::chrono::microseconds pts, std::chrono::microseconds dts, const void* data, size_t len) override;
+    virtual void handleEncodedVideoDiscontinuity() override;
+
+    virtual void handleEncodedAudioConfigPacket(const EncodedPacket& packet) override;
+    virtual void handleEncodedAudioPacket(std::chrono::microseconds pts, const EncodedPacket& packet) override;
+    virtual void handleEncodedVideoConfigPacket(const EncodedPacket& packet) override;
+    virtual void handleEncodedVideoPacket(std::chrono::microseconds pts, std::chrono::microseconds dts, const EncodedPacket& packet) override;
+
+private:
+    EncodedAVHandler* const _handler;
+
+    enum ItemType {
+        AudioConfig,
+        Audio,
+        VideoConfig,
+        Video,
+        VideoDiscontinuity,
+    };
+
+    void _push(ItemType type, std::chrono::microseconds pts, std::chrono::microseconds dts, const EncodedPacket& packet);
+    virtual void _dispatch(Item& item) override;
+};
+
+// AsyncVideoHandler invokes another handler from its own thread. Frames are queued as new references
+// to the same buffers (see av_frame_clone), so nothing is copied unless the frame isn't
+// reference-counted.
+class AsyncVideoHandler : public VideoHandler, public AsyncStage {
+public:
+    AsyncVideoHandler(Logger logger, VideoHandler* handler, Configuration configuration = {});
+
+    // Anything still queued is handled before the destructor returns.
+    virtual ~AsyncVideoHandler();
+
+    virtual void handleVideo(std::chrono::microseconds pts, const AVFrame* frame) override;
+
+private:
+    VideoHandler* const _handler;
+
+    virtual void _dispatch(Item& item) override;
+};
@@ -0,0 +1,121 @@
+#include <gtest/gtest.h>
+
+#include <future>
+#include <thread>
+
+#include "async_handler.hpp"
+#include "logger_test.hpp"
+
+namespace {
+
+struct TestHandler : EncodedAVHandler {
+    std::shared_future<void> gate;
+    std::thread::id threadId;
+    std::vector<std::string> received;
+
+    void record(const std::string& what) {
+        if (gate.valid()) {
+            gate.wait();
+        }
+        threadId = std::this_thread::get_id();
+        received.emplace_back(what);
+    }
+
+    virtual void handleEncodedAudioConfig(const void* data, size_t len) override {
+        record("audio config " + std::string(reinterpret_cast<const char*>(data), len));
+    }
+
+    virtual void handleEncodedAudio(std::chrono::microseconds pts, const void* data, size_t len) override {
+        record("audio " + std::to_string(pts.count()) + " " + std::string(reinterpret_cast<const char*>(data), len));
+    }
+
+    virtual void handleEncodedVideoConfig(const void* data, size_t len) override {
+        record("video config " + std::string(reinterpret_cast<const char*>(data), len));
+    }
+
+    virtual void handleEncodedVideo(std::chrono::microseconds pts, std::chrono::microseconds dts, const void* data, size_t len) override {
+        record("video " + std::to_string(pts.count()) + " " + std::to_string(dts.count()) + " " + std::string(reinterpret_cast<const char*>(data), len));
+    }
+
+    virtual void handleEncodedVideoDiscontinuity() override {
+        record("discontinuity");
+    }
+};
+
+} // anonymous namespace
+
+TEST(AsyncEncodedAVHandler, ordering) {
+    TestLogDestination logDestination;
+    TestHandler handler;
+
+    {
+        AsyncEncodedAVHandler async{&logDestination, &handler};
+
+        std::string buffer = "a";
+        async.handleEncodedAudioConfig(buffer.data(), buffer.size());
+        // the payload must have been copied
+        buffer = "b";
+        async.handleEncodedVideoConfig(buffer.data(), buffer.size());
+        async.handleEncodedAudio(std::chrono::microseconds(1), "c", 1);
+        async.handleEncodedVideo(std::chrono::microseconds(3), std::chrono::microseconds(2), "d", 1);
+        async.handleEncodedVideoDiscontinuity();
+
+        std::string posted;
+        async.post([&] {
+            posted = "posted";
+        });
+        async.wait();
+        EXPECT_EQ("posted", posted);
+        EXPECT_NE(std::this_thread::get_id(), handler.threadId);
+    }
+
+    std::vector<std::string> expected = {
+        "audio config a",
+        "video config b",
+        "audio 1 c",
+        "video 3 2 d",
+        "discontinuity",
+    };
+    EXPECT_EQ(expected, handler.received);
+}
+
+TEST(AsyncEncodedAVHandler, stalls) {
+    TestLogDestination logDestination;
+    TestHandler handler;
+
+    std::promise<void> gate;
+    handler.gate = gate.get_future().share();
+
+    AsyncEncodedAVHandler::Configuration configuration;
+    configuration.capacity = 4;
+
+    {
+        AsyncEncodedAVHandler async{&logDestination, &handler, configuration};
+
+        std::thread producer([&] {
+            for (int i = 0; i < 20; ++i) {
+                async.handleEncodedAudio(std::chrono::microseconds(i), "x", 1);
+            }
+        });
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        auto stats = async.stats();
+        EXPECT_EQ(4, stats.capacity);
+        EXPECT_EQ(4, stats.occupancy);
+        EXPECT_GE(stats.stalls, 1);
+
+        gate.set_value();
+        producer.join();
+        async.wait();
+
+        stats = async.stats();
+        EXPECT_EQ(0, stats.occupancy);
+        EXPECT_EQ(4, stats.maxOccupancy);
+        EXPECT_GT(stats.stallTime.count(), 0);
+    }
+
+    ASSERT_EQ(20, handler.received.size());
+    for (int i = 0; i < 20; ++i) {
+        EXPECT_EQ("audio " + std::to_string(i) + " x", handler.received[i]);
+    }
+}
@@ -0,0 +1,48 @@
+#include "buffer_pool.hpp"
+
+std::shared_ptr<BufferPool> BufferPool::Create(size_t maxFreeBuffers, size_t maxRetainedCapacity) {
+    return std::shared_ptr<BufferPool>(new BufferPool(maxFreeBuffers, maxRetainedCapacity));
+}
+
+const std::shared_ptr<BufferPool>& BufferPool::Default() {
+    static const auto pool = Create();
+    return pool;
+}
+
+std::shared_ptr<BufferPool::Buffer> BufferPool::acquire(size_t capacity) {
+    std::unique_ptr<Buffer> buffer;
+    {
+        std::lock_guard<std::mutex> l{_mutex};
+        if (!_free.empty()) {
+            buffer = std::move(_free.back());
+            _free.pop_back();
+        }
+    }
+    if (!buffer) {
+        buffer = std::make_unique<Buffer>();
+    }
+    buffer->reserve(capacity);
+
+    // the deleter keeps the pool alive for as long as any of its buffers are
+    return std::shared_ptr<Buffer>(buffer.release(), [pool = shared_from_this()](Buffer* buffer) {
+        pool->_release(buffer);
+    });
+}
+
+size_t BufferPool::freeBufferCount() const {
+    std::lock_guard<std::mutex> l{_mutex};
+    return _free.size();
+}
+
+void BufferPool::_release(Buffer* buffer) {
+    std::unique_ptr<Buffer> owned{buffer};
+    if (owned->capacity() > _maxRetainedCapacity) {
+        return;
+    }
+    owned->clear();
+
+    std::lock_guard<std::mutex> l{_mutex};
+    if (_free.size() < _maxFreeBuffers) {
+        _free.emplace_back(std::move(owned));
+    }
+}
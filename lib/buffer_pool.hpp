@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// DefaultInitAllocator makes std::vector::resize leave new elements uninitialized, which allows
+// buffers to be sized up front and then filled in place (e.g. by recv).
+template <typename T, typename A = std::allocator<T>>
+class DefaultInitAllocator : public A {
+public:
+    template <typename U>
+    struct rebind {
+        using other = DefaultInitAllocator<U, typename std::allocator_traits<A>::template rebind_alloc<U>>;
+    };
+
+    using A::A;
+
+    template <typename U>
+    void construct(U* ptr) noexcept(std::is_nothrow_default_constructible<U>::value) {
+        ::new(static_cast<void*>(ptr)) U;
+    }
+
+    template <typename U, typename... Args>
+    void construct(U* ptr, Args&&... args) {
+        std::allocator_traits<A>::construct(static_cast<A&>(*this), ptr, std::forward<Args>(args)...);
+    }
+};
+
+// BufferPool recycles byte buffers so that hot paths don't need to go to the allocator for every
+// message. Buffers are reference-counted and return to the pool once the last reference is dropped.
+class BufferPool : public std::enable_shared_from_this<BufferPool> {
+public:
+    using Buffer = std::vector<uint8_t, DefaultInitAllocator<uint8_t>>;
+
+    // Up to maxFreeBuffers buffers will be retained while unused. Buffers with a capacity larger than
+    // maxRetainedCapacity are released instead of being retained.
+    static std::shared_ptr<BufferPool> Create(size_t maxFreeBuffers = 256, size_t maxRetainedCapacity = 8 * 1024 * 1024);
+
+    // Default returns a process-wide pool.
+    static const std::shared_ptr<BufferPool>& Default();
+
+    // acquire returns an empty buffer with at least the given capacity.
+    std::shared_ptr<Buffer> acquire(size_t capacity = 0);
+
+    // Returns the number of buffers currently retained for reuse.
+    size_t freeBufferCount() const;
+
+private:
+    BufferPool(size_t maxFreeBuffers, size_t maxRetainedCapacity) : _maxFreeBuffers{maxFreeBuffers}, _maxRetainedCapacity{maxRetainedCapacity} {}
+
+    const size_t _maxFreeBuffers;
+    const size_t _maxRetainedCapacity;
+
+    mutable std::mutex _mutex;
+    std::vector<std::unique_ptr<Buffer>> _free;
+
+    void _release(Buffer* buffer);
+};
@@ -0,0 +1,88 @@
+#include "concurrent_video_splitter.hpp"
+
+ConcurrentVideoSplitter::~ConcurrentVideoSplitter() {
+    drain();
+}
+
+void ConcurrentVideoSplitter::addHandler(VideoHandler* handler) {
+    auto lane = std::make_unique<Lane>();
+    lane->handler = handler;
+    _lanes.emplace_back(std::move(lane));
+}
+
+void ConcurrentVideoSplitter::handleVideo(std::chrono::microseconds pts, const AVFrame* frame) {
+    // a lone handler only benefits from the pool if it's allowed to lag behind the caller
+    if (!_configuration.pool || (_lanes.size() < 2 && _configuration.maxLag == 0)) {
+        for (auto& lane : _lanes) {
+            lane->handler->handleVideo(pts, frame);
+        }
+        return;
+    }
+
+    auto clone = av_frame_clone(frame);
+    if (!clone) {
+        _logger.error("unable to reference frame. dropping it");
+        return;
+    }
+    std::shared_ptr<AVFrame> shared{clone, [](AVFrame* frame) {
+        av_frame_free(&frame);
+    }};
+
+    // without any lag allowed, the caller would just be waiting anyways, so it takes the first lane
+    auto isFirstLaneInline = _configuration.maxLag == 0;
+
+    std::unique_lock<std::mutex> l{_mutex};
+    for (size_t i = isFirstLaneInline ? 1 : 0; i < _lanes.size(); ++i) {
+        auto lane = _lanes[i].get();
+        lane->pending.emplace_back(Frame{pts, shared});
+        ++lane->outstanding;
+        if (!lane->isRunning) {
+            lane->isRunning = true;
+            _configuration.pool->post([this, lane] {
+                _runLane(lane);
+            });
+        }
+    }
+    shared.reset();
+
+    if (isFirstLaneInline) {
+        l.unlock();
+        _lanes[0]->handler->handleVideo(pts, frame);
+        l.lock();
+    }
+
+    _wait(l, _configuration.maxLag);
+}
+
+void ConcurrentVideoSplitter::drain() {
+    std::unique_lock<std::mutex> l{_mutex};
+    _wait(l, 0);
+}
+
+void ConcurrentVideoSplitter::_wait(std::unique_lock<std::mutex>& lock, size_t maxOutstanding) {
+    _cv.wait(lock, [&] {
+        for (auto& lane : _lanes) {
+            if (lane->outstanding > maxOutstanding) {
+                return false;
+            }
+        }
+        return true;
+    });
+}
+
+void ConcurrentVideoSplitter::_runLane(Lane* lane) {
+    std::unique_lock<std::mutex> l{_mutex};
+    while (!lane->pending.empty()) {
+        auto frame = std::move(lane->pending.front());
+        lane->pending.pop_front();
+        l.unlock();
+
+        lane->handler->handleVideo(frame.pts, frame.frame.get());
+        frame.frame.reset();
+
+        l.lock();
+        --lane->outstanding;
+        _cv.notify_all();
+    }
+    lane->isRunning = false;
+}
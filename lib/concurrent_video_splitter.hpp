@@ -0,0 +1,74 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "av_handler.hpp"
+#include "logger.hpp"
+#include "thread_pool.hpp"
+
+// ConcurrentVideoSplitter is a VideoSplitter that gives each frame to all of its handlers at once,
+// running them on a ThreadPool. Every handler gets a reference to the same frame, and each handler
+// still sees frames one at a time and in order.
+//
+// This is meant for fanning decoded video out to several encoders, which would otherwise need to
+// finish one after another within a single frame interval.
+class ConcurrentVideoSplitter : public VideoHandler {
+public:
+    struct Configuration {
+        // If null, handlers are invoked serially on the caller's thread.
+        ThreadPool* pool = nullptr;
+
+        // The number of frames any handler may fall behind before handleVideo blocks. If zero,
+        // every handler is done with a frame before handleVideo returns, and one of them runs on the
+        // caller's thread.
+        size_t maxLag = 0;
+    };
+
+    ConcurrentVideoSplitter(Logger logger, Configuration configuration)
+        : _logger{std::move(logger)}, _configuration{configuration} {}
+
+    // Waits for all handlers to finish.
+    virtual ~ConcurrentVideoSplitter();
+
+    // addHandler adds a handler. It is not safe to call this while other threads may be invoking
+    // the handle methods.
+    void addHandler(VideoHandler* handler);
+
+    virtual void handleVideo(std::chrono::microseconds pts, const AVFrame* frame) override;
+
+    // drain blocks until every handler has handled every frame. This must be called before doing
+    // anything else with the handlers (e.g. flushing encoders) from the caller's thread.
+    void drain();
+
+private:
+    const Logger _logger;
+    const Configuration _configuration;
+
+    struct Frame {
+        std::chrono::microseconds pts;
+        std::shared_ptr<AVFrame> frame;
+    };
+
+    struct Lane {
+        VideoHandler* handler;
+        std::deque<Frame> pending;
+
+        // The number of frames that have been given to the lane but not handled yet.
+        size_t outstanding = 0;
+
+        // Whether a pool thread is currently working through the pending frames.
+        bool isRunning = false;
+    };
+
+    std::vector<std::unique_ptr<Lane>> _lanes;
+
+    std::mutex _mutex;
+    std::condition_variable _cv;
+
+    void _wait(std::unique_lock<std::mutex>& lock, size_t maxOutstanding);
+    void _runLane(Lane* lane);
+};
@@ -0,0 +1,146 @@
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <future>
+#include <thread>
+
+#include "concurrent_video_splitter.hpp"
+#include "logger_test.hpp"
+
+namespace {
+
+// Rendezvous lets handlers check that they're running at the same time. Each arrival waits for the
+// rest, but gives up eventually so that a serial splitter fails instead of hanging.
+struct Rendezvous {
+    explicit Rendezvous(int count) : _count{count} {}
+
+    // Returns true if every expected arrival happened while this one was waiting.
+    bool arrive() {
+        std::unique_lock<std::mutex> l{_mutex};
+        ++_arrived;
+        _cv.notify_all();
+        return _cv.wait_for(l, std::chrono::seconds(5), [&] { return _arrived >= _count; });
+    }
+
+private:
+    const int _count;
+    std::mutex _mutex;
+    std::condition_variable _cv;
+    int _arrived = 0;
+};
+
+struct TestVideoHandler : VideoHandler {
+    Rendezvous* rendezvous = nullptr;
+    std::atomic<bool> didMeet{false};
+    std::shared_future<void> gate;
+
+    std::mutex mutex;
+    std::vector<std::chrono::microseconds> handled;
+
+    virtual void handleVideo(std::chrono::microseconds pts, const AVFrame* frame) override {
+        if (gate.valid()) {
+            gate.wait();
+        }
+        if (rendezvous && !didMeet) {
+            didMeet = rendezvous->arrive();
+        }
+        std::lock_guard<std::mutex> l{mutex};
+        handled.emplace_back(pts);
+    }
+
+    size_t handledCount() {
+        std::lock_guard<std::mutex> l{mutex};
+        return handled.size();
+    }
+};
+
+struct Frame {
+    Frame() {
+        frame = av_frame_alloc();
+        frame->format = AV_PIX_FMT_YUV420P;
+        frame->width = 16;
+        frame->height = 16;
+        av_frame_get_buffer(frame, 0);
+    }
+
+    ~Frame() {
+        av_frame_free(&frame);
+    }
+
+    AVFrame* frame;
+};
+
+} // anonymous namespace
+
+TEST(ConcurrentVideoSplitter, concurrency) {
+    TestLogDestination logDestination;
+    ThreadPool pool{4};
+
+    constexpr int kHandlers = 4;
+    constexpr int kFrames = 5;
+
+    // the handlers only meet at the rendezvous if they all handle the first frame at once
+    Rendezvous rendezvous{kHandlers};
+    TestVideoHandler handlers[kHandlers];
+
+    ConcurrentVideoSplitter::Configuration configuration;
+    configuration.pool = &pool;
+    ConcurrentVideoSplitter splitter{&logDestination, configuration};
+    for (auto& handler : handlers) {
+        handler.rendezvous = &rendezvous;
+        splitter.addHandler(&handler);
+    }
+
+    Frame frame;
+    for (int i = 0; i < kFrames; ++i) {
+        splitter.handleVideo(std::chrono::microseconds(i), frame.frame);
+        // without any lag, every handler is done when handleVideo returns
+        for (auto& handler : handlers) {
+            EXPECT_EQ(i + 1, handler.handledCount());
+        }
+    }
+
+    for (auto& handler : handlers) {
+        EXPECT_TRUE(handler.didMeet);
+        ASSERT_EQ(kFrames, handler.handled.size());
+        for (int i = 0; i < kFrames; ++i) {
+            EXPECT_EQ(std::chrono::microseconds(i), handler.handled[i]);
+        }
+    }
+}
+
+TEST(ConcurrentVideoSplitter, maxLag) {
+    TestLogDestination logDestination;
+    ThreadPool pool{2};
+
+    std::promise<void> gate;
+    TestVideoHandler fast, slow;
+    slow.gate = gate.get_future().share();
+
+    ConcurrentVideoSplitter::Configuration configuration;
+    configuration.pool = &pool;
+    configuration.maxLag = 2;
+    ConcurrentVideoSplitter splitter{&logDestination, configuration};
+    splitter.addHandler(&fast);
+    splitter.addHandler(&slow);
+
+    Frame frame;
+
+    // the slow handler can fall behind by two frames before the caller is blocked
+    splitter.handleVideo(std::chrono::microseconds(0), frame.frame);
+    splitter.handleVideo(std::chrono::microseconds(1), frame.frame);
+
+    auto blocked = std::async(std::launch::async, [&] {
+        splitter.handleVideo(std::chrono::microseconds(2), frame.frame);
+    });
+    EXPECT_EQ(std::future_status::timeout, blocked.wait_for(std::chrono::milliseconds(50)));
+    EXPECT_EQ(0, slow.handledCount());
+
+    gate.set_value();
+    blocked.get();
+    splitter.drain();
+
+    EXPECT_EQ(3, fast.handledCount());
+    EXPECT_EQ(3, slow.handledCount());
+}
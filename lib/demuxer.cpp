@@ -145,7 +145,12 @@ void Demuxer::_run(Logger logger, const std::string& in, EncodedAVHandler* handl
                 }
             }
 
-            handler->handleEncodedVideo(pts, dts, outputBuffer.data(), outputBuffer.size());
+            auto encodedPacket = EncodedPacket::Borrow(outputBuffer.data(), outputBuffer.size());
+            auto descriptor = std::make_shared<FrameDescriptor>();
+            if (descriptor->decode(outputBuffer.data(), outputBuffer.size(), videoConfig.lengthSizeMinusOne + 1)) {
+                encodedPacket.setFrameDescriptor(std::move(descriptor));
+            }
+            handler->handleEncodedVideoPacket(pts, dts, encodedPacket);
             ++_framesDemuxed;
         } else if (mediaType == AVMEDIA_TYPE_AUDIO) {
             if (!didOutputAudioConfig) {
@@ -3,8 +3,14 @@
 #include <chrono>
 #include <cstddef>
 
+#include "encoded_packet.hpp"
+
 // Simultaneous calls to EncodedAudioHandler's methods are not allowed. Handlers are expected to
 // return quickly from calls, performing expensive tasks asynchronously if needed.
+//
+// Each method has a counterpart that takes an EncodedPacket. By default those forward to the
+// methods that take raw bytes, so handlers only need to implement them if they want to retain the
+// data without copying it.
 struct EncodedAudioHandler {
     virtual ~EncodedAudioHandler() {}
 
@@ -13,10 +19,20 @@ struct EncodedAudioHandler {
 
     // handleEncodedAudio handles raw audio packets.
     virtual void handleEncodedAudio(std::chrono::microseconds pts, const void* data, size_t len) {}
+
+    virtual void handleEncodedAudioConfigPacket(const EncodedPacket& packet) {
+        handleEncodedAudioConfig(packet.data(), packet.size());
+    }
+
+    virtual void handleEncodedAudioPacket(std::chrono::microseconds pts, const EncodedPacket& packet) {
+        handleEncodedAudio(pts, packet.data(), packet.size());
+    }
 };
 
 // Simultaneous calls to EncodedVideoHandler's methods are not allowed. Handlers are expected to
 // return quickly from calls, performing expensive tasks asynchronously if needed.
+//
+// As with EncodedAudioHandler, the EncodedPacket methods forward to the raw ones by default.
 struct EncodedVideoHandler {
     virtual ~EncodedVideoHandler() {}
 
@@ -27,6 +43,14 @@ struct EncodedVideoHandler {
     virtual void handleEncodedVideo(std::chrono::microseconds pts, std::chrono::microseconds dts, const void* data, size_t len) {}
 
     virtual void handleEncodedVideoDiscontinuity() {}
+
+    virtual void handleEncodedVideoConfigPacket(const EncodedPacket& packet) {
+        handleEncodedVideoConfig(packet.data(), packet.size());
+    }
+
+    virtual void handleEncodedVideoPacket(std::chrono::microseconds pts, std::chrono::microseconds dts, const EncodedPacket& packet) {
+        handleEncodedVideo(pts, dts, packet.data(), packet.size());
+    }
 };
 
 struct EncodedAVHandler : EncodedAudioHandler, EncodedVideoHandler {
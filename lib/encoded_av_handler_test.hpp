@@ -3,7 +3,12 @@
 #include <tuple>
 #include <vector>
 
+#include <gtest/gtest.h>
+
+#include <h26x/h264.hpp>
+
 #include "encoded_av_handler.hpp"
+#include "mpeg4.hpp"
 
 struct TestEncodedAVHandler : EncodedAVHandler {
     virtual ~TestEncodedAVHandler() {}
@@ -30,5 +35,71 @@ struct TestEncodedAVHandler : EncodedAVHandler {
     std::vector<std::tuple<std::chrono::microseconds, std::chrono::microseconds, const void*, size_t>> handledVideo;
 };
 
+// RecordingEncodedAVHandler records the H.264 video and audio that it's given once the first
+// keyframe has gone by, which is what we expect to get back out of a segment. Parameter sets and
+// other NAL units that muxers may add or drop aren't recorded. Everything is passed on to next.
+struct RecordingEncodedAVHandler : EncodedAVHandler {
+    struct Frame {
+        std::chrono::microseconds pts;
+        std::chrono::microseconds dts;
+        std::vector<std::vector<uint8_t>> data;
+    };
+
+    explicit RecordingEncodedAVHandler(EncodedAVHandler* next = nullptr) : next{next} {}
+    virtual ~RecordingEncodedAVHandler() {}
+
+    virtual void handleEncodedAudioConfig(const void* data, size_t len) override {
+        if (next) {
+            next->handleEncodedAudioConfig(data, len);
+        }
+    }
+
+    virtual void handleEncodedAudio(std::chrono::microseconds pts, const void* data, size_t len) override {
+        if (hasKeyframe) {
+            auto bytes = reinterpret_cast<const uint8_t*>(data);
+            audio.push_back({pts, pts, {{bytes, bytes + len}}});
+        }
+        if (next) {
+            next->handleEncodedAudio(pts, data, len);
+        }
+    }
+
+    virtual void handleEncodedVideoConfig(const void* data, size_t len) override {
+        ASSERT_TRUE(config.decode(data, len));
+        if (next) {
+            next->handleEncodedVideoConfig(data, len);
+        }
+    }
+
+    virtual void handleEncodedVideo(std::chrono::microseconds pts, std::chrono::microseconds dts, const void* data, size_t len) override {
+        Frame frame{pts, dts};
+        EXPECT_TRUE(h264::IterateAVCC(data, len, config.lengthSizeMinusOne + 1, [&](const void* data, size_t len) {
+            auto bytes = reinterpret_cast<const uint8_t*>(data);
+            switch (bytes[0] & 0x1f) {
+                case h264::NALUnitType::SequenceParameterSet:
+                case h264::NALUnitType::PictureParameterSet:
+                case h264::NALUnitType::AccessUnitDelimiter:
+                case h264::NALUnitType::PrefixNALUnit:
+                    return;
+                case h264::NALUnitType::IDRSlice:
+                    hasKeyframe = true;
+            }
+            frame.data.emplace_back(bytes, bytes + len);
+        }));
+        if (hasKeyframe) {
+            video.emplace_back(std::move(frame));
+        }
+        if (next) {
+            next->handleEncodedVideo(pts, dts, data, len);
+        }
+    }
+
+    EncodedAVHandler* next;
+    AVCDecoderConfigurationRecord config;
+    bool hasKeyframe = false;
+    std::vector<Frame> audio;
+    std::vector<Frame> video;
+};
+
 // ExerciseEncodedAVHandler shotguns about 30s of actual video to the handler.
 void ExerciseEncodedAVHandler(EncodedAVHandler* handler);
@@ -32,6 +32,18 @@ public:
         }
     }
 
+    virtual void handleEncodedAudioConfigPacket(const EncodedPacket& packet) override {
+        for (auto r : _handlers) {
+            r->handleEncodedAudioConfigPacket(packet);
+        }
+    }
+
+    virtual void handleEncodedAudioPacket(std::chrono::microseconds pts, const EncodedPacket& packet) override {
+        for (auto r : _handlers) {
+            r->handleEncodedAudioPacket(pts, packet);
+        }
+    }
+
 private:
     std::vector<EncodedAudioHandler*> _handlers;
 };
@@ -69,6 +81,18 @@ public:
         }
     }
 
+    virtual void handleEncodedVideoConfigPacket(const EncodedPacket& packet) override {
+        for (auto r : _handlers) {
+            r->handleEncodedVideoConfigPacket(packet);
+        }
+    }
+
+    virtual void handleEncodedVideoPacket(std::chrono::microseconds pts, std::chrono::microseconds dts, const EncodedPacket& packet) override {
+        for (auto r : _handlers) {
+            r->handleEncodedVideoPacket(pts, dts, packet);
+        }
+    }
+
 private:
     std::vector<EncodedVideoHandler*> _handlers;
 };
@@ -98,6 +122,22 @@ struct EncodedAVSplitter : EncodedAudioSplitter, EncodedVideoSplitter, EncodedAV
         EncodedVideoSplitter::handleEncodedVideoDiscontinuity();
     }
 
+    virtual void handleEncodedAudioConfigPacket(const EncodedPacket& packet) override {
+        EncodedAudioSplitter::handleEncodedAudioConfigPacket(packet);
+    }
+
+    virtual void handleEncodedAudioPacket(std::chrono::microseconds pts, const EncodedPacket& packet) override {
+        EncodedAudioSplitter::handleEncodedAudioPacket(pts, packet);
+    }
+
+    virtual void handleEncodedVideoConfigPacket(const EncodedPacket& packet) override {
+        EncodedVideoSplitter::handleEncodedVideoConfigPacket(packet);
+    }
+
+    virtual void handleEncodedVideoPacket(std::chrono::microseconds pts, std::chrono::microseconds dts, const EncodedPacket& packet) override {
+        EncodedVideoSplitter::handleEncodedVideoPacket(pts, dts, packet);
+    }
+
     using EncodedAudioSplitter::addHandler;
     using EncodedVideoSplitter::addHandler;
 
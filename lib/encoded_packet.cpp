@@ -0,0 +1,48 @@
+#include "encoded_packet.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+EncodedPacket::EncodedPacket(std::shared_ptr<const BufferPool::Buffer> buffer)
+    : _buffer{std::move(buffer)}
+{
+    if (_buffer) {
+        _data = _buffer->data();
+        _size = _buffer->size();
+    }
+}
+
+EncodedPacket::EncodedPacket(std::shared_ptr<const BufferPool::Buffer> buffer, size_t offset, size_t len)
+    : _buffer{std::move(buffer)}
+{
+    if (_buffer && offset < _buffer->size()) {
+        _data = _buffer->data() + offset;
+        _size = std::min(len, _buffer->size() - offset);
+    }
+}
+
+EncodedPacket EncodedPacket::Copy(const void* data, size_t len, const std::shared_ptr<BufferPool>& pool) {
+    if (!len) {
+        return {};
+    }
+    auto buffer = pool->acquire(len);
+    buffer->resize(len);
+    std::memcpy(buffer->data(), data, len);
+    return EncodedPacket{std::move(buffer)};
+}
+
+EncodedPacket EncodedPacket::Borrow(const void* data, size_t len) {
+    EncodedPacket ret;
+    ret._data = reinterpret_cast<const uint8_t*>(data);
+    ret._size = len;
+    return ret;
+}
+
+EncodedPacket EncodedPacket::retained() const {
+    if (_buffer) {
+        return *this;
+    }
+    auto ret = Copy(_data, _size);
+    ret._frameDescriptor = _frameDescriptor;
+    return ret;
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+#include "buffer_pool.hpp"
+#include "frame_descriptor.hpp"
+
+// EncodedPacket is an immutable view of encoded audio or video. Packets either share ownership of
+// their storage, in which case copies of the packet are cheap and can be kept for as long as
+// needed, or they borrow it, in which case they're only valid for the duration of the call they
+// were given to.
+//
+// Handlers that need to keep a packet's bytes around should hold on to retained() rather than
+// copying the bytes themselves. That way a packet fanned out to several handlers is only ever
+// copied once, and not at all if it was shared to begin with.
+class EncodedPacket {
+public:
+    EncodedPacket() = default;
+
+    // Creates a packet that shares ownership of the given pooled buffer.
+    explicit EncodedPacket(std::shared_ptr<const BufferPool::Buffer> buffer);
+
+    // Creates a packet that shares ownership of a range of the given pooled buffer.
+    EncodedPacket(std::shared_ptr<const BufferPool::Buffer> buffer, size_t offset, size_t len);
+
+    // Copy copies the given bytes into pooled storage.
+    static EncodedPacket Copy(const void* data, size_t len, const std::shared_ptr<BufferPool>& pool = BufferPool::Default());
+
+    // Borrow creates a packet that refers to the given bytes without owning them.
+    static EncodedPacket Borrow(const void* data, size_t len);
+
+    const uint8_t* data() const { return _data; }
+    size_t size() const { return _size; }
+    bool empty() const { return _size == 0; }
+
+    // Returns true if the packet shares ownership of its storage.
+    bool isShared() const { return _buffer != nullptr; }
+
+    // retained returns a packet that may outlive the current call: either this packet if it's
+    // already shared, or a pooled copy of it if not.
+    EncodedPacket retained() const;
+
+    // Video packets may carry a description of their access unit. If so, it's kept by copies of the
+    // packet, including retained ones.
+    const FrameDescriptor* frameDescriptor() const { return _frameDescriptor.get(); }
+    void setFrameDescriptor(std::shared_ptr<const FrameDescriptor> descriptor) { _frameDescriptor = std::move(descriptor); }
+
+private:
+    std::shared_ptr<const BufferPool::Buffer> _buffer;
+    const uint8_t* _data = nullptr;
+    size_t _size = 0;
+    std::shared_ptr<const FrameDescriptor> _frameDescriptor;
+};
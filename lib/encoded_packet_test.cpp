@@ -0,0 +1,57 @@
+#include <gtest/gtest.h>
+
+#include <cstring>
+
+#include "encoded_packet.hpp"
+
+TEST(EncodedPacket, copy) {
+    const uint8_t data[] = {1, 2, 3};
+    auto packet = EncodedPacket::Copy(data, sizeof(data));
+    ASSERT_EQ(sizeof(data), packet.size());
+    EXPECT_NE(data, packet.data());
+    EXPECT_EQ(0, memcmp(data, packet.data(), sizeof(data)));
+    EXPECT_TRUE(packet.isShared());
+
+    // copies of shared packets share storage
+    auto retained = packet.retained();
+    EXPECT_EQ(packet.data(), retained.data());
+}
+
+TEST(EncodedPacket, borrow) {
+    const uint8_t data[] = {1, 2, 3};
+    auto packet = EncodedPacket::Borrow(data, sizeof(data));
+    EXPECT_EQ(data, packet.data());
+    EXPECT_EQ(sizeof(data), packet.size());
+    EXPECT_FALSE(packet.isShared());
+
+    auto retained = packet.retained();
+    EXPECT_TRUE(retained.isShared());
+    EXPECT_NE(data, retained.data());
+    ASSERT_EQ(sizeof(data), retained.size());
+    EXPECT_EQ(0, memcmp(data, retained.data(), sizeof(data)));
+}
+
+TEST(EncodedPacket, range) {
+    auto pool = BufferPool::Create();
+    auto buffer = pool->acquire(4);
+    buffer->assign({1, 2, 3, 4});
+    auto raw = buffer->data();
+
+    EncodedPacket packet{buffer, 1, 2};
+    ASSERT_EQ(2, packet.size());
+    EXPECT_EQ(raw + 1, packet.data());
+
+    // out of range lengths are truncated
+    EncodedPacket tail{buffer, 2, 100};
+    EXPECT_EQ(2, tail.size());
+    EncodedPacket past{buffer, 4, 1};
+    EXPECT_TRUE(past.empty());
+
+    // the buffer stays alive until the last packet referencing it is gone
+    buffer.reset();
+    EXPECT_EQ(0, pool->freeBufferCount());
+    packet = {};
+    tail = {};
+    past = {};
+    EXPECT_EQ(1, pool->freeBufferCount());
+}
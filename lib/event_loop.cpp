@@ -0,0 +1,189 @@
+#include "event_loop.hpp"
+
+#include <cerrno>
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "utility.hpp"
+
+EventLoop::~EventLoop() {
+    stop();
+}
+
+bool EventLoop::start(int cpu) {
+    stop();
+
+    _epoll = epoll_create1(EPOLL_CLOEXEC);
+    if (_epoll == -1) {
+        _logger.error("unable to create epoll instance (errno = {})", errno);
+        return false;
+    }
+
+    _eventfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (_eventfd == -1) {
+        _logger.error("unable to create eventfd (errno = {})", errno);
+        close(_epoll);
+        _epoll = -1;
+        return false;
+    }
+
+    epoll_event event{};
+    event.events = EPOLLIN;
+    event.data.fd = _eventfd;
+    if (epoll_ctl(_epoll, EPOLL_CTL_ADD, _eventfd, &event) == -1) {
+        _logger.error("unable to add eventfd to epoll instance (errno = {})", errno);
+        close(_eventfd);
+        close(_epoll);
+        _eventfd = _epoll = -1;
+        return false;
+    }
+
+    _isStopped = false;
+    _thread = std::thread([this] {
+        _run();
+    });
+
+    if (cpu >= 0 && !SetThreadAffinity(_thread, cpu)) {
+        _logger.with("cpu", cpu).warn("unable to set event loop thread affinity");
+    }
+
+    return true;
+}
+
+void EventLoop::stop() {
+    if (_thread.joinable()) {
+        _isStopped = true;
+        _wake();
+        _thread.join();
+    }
+
+    // anything posted after the thread exited never ran, but it may own registrations. those can
+    // post more in turn, for example by adding descriptors or from their close handlers
+    while (true) {
+        while (_runPosted()) {}
+        if (_registrations.empty()) {
+            break;
+        }
+        auto registrations = std::move(_registrations);
+        _registrations.clear();
+        for (auto& kv : registrations) {
+            if (kv.second.onClose) {
+                kv.second.onClose();
+            }
+        }
+    }
+    _size = 0;
+
+    if (_eventfd != -1) {
+        close(_eventfd);
+        _eventfd = -1;
+    }
+    if (_epoll != -1) {
+        close(_epoll);
+        _epoll = -1;
+    }
+}
+
+void EventLoop::add(int fd, std::function<bool()> onReadable, std::function<void()> onClose) {
+    post([this, fd, onReadable = std::move(onReadable), onClose = std::move(onClose)]() mutable {
+        epoll_event event{};
+        event.events = EPOLLIN | EPOLLRDHUP;
+        event.data.fd = fd;
+        if (_epoll == -1 || epoll_ctl(_epoll, EPOLL_CTL_ADD, fd, &event) == -1) {
+            _logger.error("unable to add descriptor to epoll instance (errno = {})", errno);
+            if (onClose) {
+                onClose();
+            }
+            return;
+        }
+        _registrations[fd] = Registration{std::move(onReadable), std::move(onClose)};
+        _size = _registrations.size();
+    });
+}
+
+void EventLoop::post(std::function<void()> f) {
+    {
+        std::lock_guard<std::mutex> l{_mutex};
+        _posted.emplace_back(std::move(f));
+    }
+    _wake();
+}
+
+void EventLoop::_run() {
+    constexpr int kMaxEvents = 64;
+    epoll_event events[kMaxEvents];
+
+    while (!_isStopped) {
+        auto n = epoll_wait(_epoll, events, kMaxEvents, -1);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            _logger.error("epoll_wait error (errno = {})", errno);
+            break;
+        }
+
+        auto didWake = false;
+        for (int i = 0; i < n && !_isStopped; ++i) {
+            auto fd = events[i].data.fd;
+            if (fd == _eventfd) {
+                didWake = true;
+                continue;
+            }
+
+            auto it = _registrations.find(fd);
+            if (it == _registrations.end()) {
+                // removed by an earlier handler in this batch
+                continue;
+            }
+            if (!it->second.onReadable()) {
+                _remove(fd);
+            }
+        }
+
+        if (didWake) {
+            uint64_t value;
+            while (read(_eventfd, &value, sizeof(value)) > 0) {}
+            _runPosted();
+        }
+    }
+}
+
+void EventLoop::_wake() {
+    if (_eventfd == -1) {
+        return;
+    }
+    uint64_t value = 1;
+    if (write(_eventfd, &value, sizeof(value)) == -1 && errno != EAGAIN) {
+        _logger.error("unable to write to eventfd (errno = {})", errno);
+    }
+}
+
+bool EventLoop::_runPosted() {
+    std::vector<std::function<void()>> posted;
+    {
+        std::lock_guard<std::mutex> l{_mutex};
+        posted.swap(_posted);
+    }
+    for (auto& f : posted) {
+        f();
+    }
+    return !posted.empty();
+}
+
+void EventLoop::_remove(int fd) {
+    auto it = _registrations.find(fd);
+    if (it == _registrations.end()) {
+        return;
+    }
+    auto registration = std::move(it->second);
+    _registrations.erase(it);
+    _size = _registrations.size();
+
+    epoll_ctl(_epoll, EPOLL_CTL_DEL, fd, nullptr);
+    if (registration.onClose) {
+        registration.onClose();
+    }
+}
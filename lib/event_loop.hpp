@@ -0,0 +1,69 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "logger.hpp"
+
+// EventLoop multiplexes many file descriptors onto a single thread using epoll. Wake-ups for posted
+// functions and for stopping are delivered through an eventfd, so they take effect immediately
+// instead of waiting for a timeout.
+//
+// All handlers are invoked from the loop's thread.
+class EventLoop {
+public:
+    explicit EventLoop(Logger logger) : _logger{std::move(logger)} {}
+    EventLoop(const EventLoop& other) = delete;
+    EventLoop& operator=(const EventLoop& other) = delete;
+    ~EventLoop();
+
+    // Starts the loop's thread. If cpu is non-negative, the thread is pinned to that cpu.
+    bool start(int cpu = -1);
+
+    // Stops the loop's thread. The close handlers of any descriptors that are still registered are
+    // invoked before this returns.
+    void stop();
+
+    // add registers a descriptor with the loop. onReadable is invoked whenever the descriptor is
+    // readable or has been hung up. If it returns false, the descriptor is unregistered and onClose
+    // is invoked. The loop never closes the descriptor itself. If the descriptor can't be
+    // registered, onClose is invoked right away.
+    //
+    // This may be called from any thread.
+    void add(int fd, std::function<bool()> onReadable, std::function<void()> onClose = {});
+
+    // post schedules f to be invoked on the loop's thread. This may be called from any thread.
+    void post(std::function<void()> f);
+
+    // Returns the number of registered descriptors.
+    size_t size() const { return _size; }
+
+private:
+    const Logger _logger;
+
+    int _epoll = -1;
+    int _eventfd = -1;
+    std::thread _thread;
+    std::atomic<bool> _isStopped{true};
+    std::atomic<size_t> _size{0};
+
+    std::mutex _mutex;
+    std::vector<std::function<void()>> _posted;
+
+    struct Registration {
+        std::function<bool()> onReadable;
+        std::function<void()> onClose;
+    };
+    std::unordered_map<int, Registration> _registrations;
+
+    void _run();
+    void _wake();
+    // Runs everything posted so far. Returns false if there was nothing to run.
+    bool _runPosted();
+    void _remove(int fd);
+};
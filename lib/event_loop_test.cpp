@@ -0,0 +1,103 @@
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <thread>
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "event_loop.hpp"
+#include "logger_test.hpp"
+
+TEST(EventLoop, readable) {
+    TestLogDestination logDestination;
+    EventLoop loop{&logDestination};
+    ASSERT_TRUE(loop.start());
+
+    int fds[2];
+    ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+
+    std::promise<std::string> received;
+    std::promise<void> closed;
+    loop.add(fds[0], [&] {
+        char buf[16];
+        auto n = read(fds[0], buf, sizeof(buf));
+        if (n <= 0) {
+            return false;
+        }
+        received.set_value(std::string(buf, n));
+        return true;
+    }, [&] {
+        close(fds[0]);
+        closed.set_value();
+    });
+
+    ASSERT_EQ(3, write(fds[1], "foo", 3));
+    auto future = received.get_future();
+    ASSERT_EQ(std::future_status::ready, future.wait_for(std::chrono::seconds(5)));
+    EXPECT_EQ("foo", future.get());
+    EXPECT_EQ(1, loop.size());
+
+    close(fds[1]);
+    ASSERT_EQ(std::future_status::ready, closed.get_future().wait_for(std::chrono::seconds(5)));
+    EXPECT_EQ(0, loop.size());
+}
+
+TEST(EventLoop, stopClosesRegistrations) {
+    TestLogDestination logDestination;
+    EventLoop loop{&logDestination};
+    ASSERT_TRUE(loop.start());
+
+    int fds[2];
+    ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+
+    std::atomic<int> closeCount{0};
+    loop.add(fds[0], [] { return true; }, [&] {
+        close(fds[0]);
+        ++closeCount;
+    });
+
+    std::promise<void> posted;
+    loop.post([&] { posted.set_value(); });
+    ASSERT_EQ(std::future_status::ready, posted.get_future().wait_for(std::chrono::seconds(5)));
+
+    // stopping shouldn't have to wait for any sort of timeout
+    auto start = std::chrono::steady_clock::now();
+    loop.stop();
+    EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(500));
+    EXPECT_EQ(1, closeCount);
+
+    close(fds[1]);
+}
+
+TEST(EventLoop, stopRunsNestedPosts) {
+    TestLogDestination logDestination;
+    EventLoop loop{&logDestination};
+    ASSERT_TRUE(loop.start());
+
+    int fds[2];
+    ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+
+    // the hand-off is posted as the loop stops, and adding the descriptor posts again
+    std::atomic<int> closeCount{0};
+    std::promise<void> started;
+    loop.post([&] {
+        started.set_value();
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        loop.post([&] {
+            loop.add(fds[0], [] { return true; }, [&] {
+                close(fds[0]);
+                ++closeCount;
+            });
+        });
+    });
+    ASSERT_EQ(std::future_status::ready, started.get_future().wait_for(std::chrono::seconds(5)));
+
+    loop.stop();
+    EXPECT_EQ(1, closeCount);
+    EXPECT_EQ(0, loop.size());
+
+    close(fds[1]);
+}
@@ -235,11 +235,11 @@ AsyncFile::AsyncFile(FileStorage* storage, const std::string& path) {
             if (_writes.empty()) {
                 break;
             }
-            auto next = _writes.front();
+            auto next = std::move(_writes.front());
             _writes.pop();
             l.unlock();
 
-            if (!f->write(next->data(), next->size())) {
+            if (!f->write(next.data(), next.size())) {
                 _isHealthy = false;
             }
 
@@ -258,10 +258,10 @@ AsyncFile::~AsyncFile() {
     _thread.join();
 }
 
-void AsyncFile::write(std::shared_ptr<std::vector<uint8_t>> data) {
+void AsyncFile::write(EncodedPacket data) {
     {
         std::lock_guard<std::mutex> l{_mutex};
-        _writes.emplace(data);
+        _writes.emplace(std::move(data));
     }
     _cv.notify_one();
 }
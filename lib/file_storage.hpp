@@ -15,6 +15,7 @@
 #include <simple-web-server/server_http.hpp>
 
 #include "aws.hpp"
+#include "encoded_packet.hpp"
 #include "logger.hpp"
 
 struct FileStorage {
@@ -119,7 +120,8 @@ public:
     AsyncFile(FileStorage* storage, const std::string& path);
     ~AsyncFile();
 
-    void write(std::shared_ptr<std::vector<uint8_t>> data);
+    // write queues the packet to be written. It must be shared (see EncodedPacket::retained).
+    void write(EncodedPacket data);
     void close();
 
     // Blocks until the file has been fully written and closed.
@@ -137,7 +139,7 @@ private:
     std::condition_variable _cv;
     mutable std::condition_variable _waiterCV;
 
-    std::queue<std::shared_ptr<std::vector<uint8_t>>> _writes;
+    std::queue<EncodedPacket> _writes;
     bool _isClosed = false;
     std::atomic<bool> _isComplete{false};
     std::atomic<bool> _isHealthy{true};
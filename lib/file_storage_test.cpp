@@ -156,7 +156,8 @@ TEST(AsyncFile, file) {
 
     {
         AsyncFile file{&storage, "foo"};
-        file.write(std::make_shared<std::vector<uint8_t>>(1024, 1));
+        std::vector<uint8_t> kilobyte(1024, 1);
+        file.write(EncodedPacket::Copy(kilobyte.data(), kilobyte.size()));
         EXPECT_FALSE(file.isComplete());
         file.close();
         file.wait();
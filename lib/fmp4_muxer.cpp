@@ -0,0 +1,471 @@
+#include "fmp4_muxer.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+constexpr uint32_t VideoTrackId = 1;
+constexpr uint32_t AudioTrackId = 2;
+constexpr uint32_t VideoTimescale = 90000;
+
+// AAC frames are always 1024 samples.
+constexpr uint32_t AudioSampleDuration = 1024;
+
+// This matches MPEGTSMuxer's offset.
+constexpr std::chrono::microseconds TimestampOffset{1400000};
+
+constexpr uint32_t SyncSampleFlags = 0x02000000 /* depends on no other samples */;
+constexpr uint32_t NonSyncSampleFlags = 0x01010000 /* depends on others, is non-sync */;
+
+// BoxWriter appends ISO BMFF boxes to a buffer.
+class BoxWriter {
+public:
+    explicit BoxWriter(std::vector<uint8_t>* dest) : _dest{dest} {}
+
+    void u8(uint8_t v) { _dest->push_back(v); }
+    void u16(uint16_t v) { u8(v >> 8); u8(v); }
+    void u24(uint32_t v) { u8(v >> 16); u16(v); }
+    void u32(uint32_t v) { u16(v >> 16); u16(v); }
+    void u64(uint64_t v) { u32(v >> 32); u32(v); }
+    void zeros(size_t n) { _dest->insert(_dest->end(), n, 0); }
+    void bytes(const void* data, size_t len) {
+        auto ptr = reinterpret_cast<const uint8_t*>(data);
+        _dest->insert(_dest->end(), ptr, ptr + len);
+    }
+    void fourcc(const char* type) { bytes(type, 4); }
+
+    // begin starts a box, returning its offset for end.
+    size_t begin(const char* type) {
+        auto offset = _dest->size();
+        u32(0);
+        fourcc(type);
+        return offset;
+    }
+
+    size_t beginFull(const char* type, uint8_t version, uint32_t flags) {
+        auto offset = begin(type);
+        u8(version);
+        u24(flags);
+        return offset;
+    }
+
+    // end fills in the size of the box that begins at offset.
+    void end(size_t offset) {
+        put32(offset, _dest->size() - offset);
+    }
+
+    void put32(size_t offset, uint32_t v) {
+        (*_dest)[offset] = v >> 24;
+        (*_dest)[offset + 1] = v >> 16;
+        (*_dest)[offset + 2] = v >> 8;
+        (*_dest)[offset + 3] = v;
+    }
+
+    size_t size() const { return _dest->size(); }
+
+    void matrix() {
+        for (uint32_t v : {0x00010000, 0, 0, 0, 0x00010000, 0, 0, 0, 0x40000000}) {
+            u32(v);
+        }
+    }
+
+private:
+    std::vector<uint8_t>* const _dest;
+};
+
+void WriteTrack(BoxWriter& w, uint32_t trackId, uint32_t timescale, bool isVideo, int width, int height, const std::function<void()>& writeSampleEntry) {
+    auto trak = w.begin("trak");
+
+    auto tkhd = w.beginFull("tkhd", 0, 0x000003 /* enabled, in movie */);
+    w.zeros(8); // creation and modification times
+    w.u32(trackId);
+    w.zeros(4);
+    w.u32(0); // duration
+    w.zeros(8);
+    w.u16(0); // layer
+    w.u16(0); // alternate group
+    w.u16(isVideo ? 0 : 0x0100); // volume
+    w.zeros(2);
+    w.matrix();
+    w.u32(width << 16);
+    w.u32(height << 16);
+    w.end(tkhd);
+
+    auto mdia = w.begin("mdia");
+
+    auto mdhd = w.beginFull("mdhd", 0, 0);
+    w.zeros(8);
+    w.u32(timescale);
+    w.u32(0);
+    w.u16(0x55c4); // "und"
+    w.u16(0);
+    w.end(mdhd);
+
+    auto hdlr = w.beginFull("hdlr", 0, 0);
+    w.u32(0);
+    w.fourcc(isVideo ? "vide" : "soun");
+    w.zeros(12);
+    const char* name = isVideo ? "VideoHandler" : "SoundHandler";
+    w.bytes(name, std::strlen(name) + 1);
+    w.end(hdlr);
+
+    auto minf = w.begin("minf");
+    if (isVideo) {
+        auto vmhd = w.beginFull("vmhd", 0, 1);
+        w.zeros(8);
+        w.end(vmhd);
+    } else {
+        auto smhd = w.beginFull("smhd", 0, 0);
+        w.zeros(4);
+        w.end(smhd);
+    }
+
+    auto dinf = w.begin("dinf");
+    auto dref = w.beginFull("dref", 0, 0);
+    w.u32(1);
+    auto url = w.beginFull("url ", 0, 1 /* self-contained */);
+    w.end(url);
+    w.end(dref);
+    w.end(dinf);
+
+    auto stbl = w.begin("stbl");
+    auto stsd = w.beginFull("stsd", 0, 0);
+    w.u32(1);
+    writeSampleEntry();
+    w.end(stsd);
+    for (auto type : {"stts", "stsc", "stco"}) {
+        auto box = w.beginFull(type, 0, 0);
+        w.u32(0);
+        w.end(box);
+    }
+    auto stsz = w.beginFull("stsz", 0, 0);
+    w.u32(0);
+    w.u32(0);
+    w.end(stsz);
+    w.end(stbl);
+
+    w.end(minf);
+    w.end(mdia);
+    w.end(trak);
+}
+
+// Writes an MPEG-4 descriptor header. All of ours are small enough for a one byte size.
+void WriteDescriptor(BoxWriter& w, uint8_t tag, size_t size) {
+    w.u8(tag);
+    w.u8(size);
+}
+
+} // anonymous namespace
+
+FMP4Muxer::FMP4Muxer(VideoCodec codec, std::shared_ptr<BufferPool> pool)
+    : _codec{codec}, _pool{std::move(pool)}
+{}
+
+void FMP4Muxer::setVideoConfig(const void* data, size_t len, int width, int height) {
+    auto bytes = reinterpret_cast<const uint8_t*>(data);
+    _videoConfig.assign(bytes, bytes + len);
+    _videoWidth = width;
+    _videoHeight = height;
+}
+
+bool FMP4Muxer::writeInitSegment(const WriteFunction& write) {
+    std::vector<uint8_t> buffer;
+    BoxWriter w{&buffer};
+
+    auto ftyp = w.begin("ftyp");
+    w.fourcc("iso6");
+    w.u32(0);
+    for (auto brand : {"iso6", "cmfc", "mp41"}) {
+        w.fourcc(brand);
+    }
+    w.end(ftyp);
+
+    auto moov = w.begin("moov");
+
+    auto mvhd = w.beginFull("mvhd", 0, 0);
+    w.zeros(8);
+    w.u32(1000); // timescale
+    w.u32(0); // duration
+    w.u32(0x00010000); // rate
+    w.u16(0x0100); // volume
+    w.zeros(10);
+    w.matrix();
+    w.zeros(24);
+    w.u32(AudioTrackId + 1); // next track id
+    w.end(mvhd);
+
+    WriteTrack(w, VideoTrackId, VideoTimescale, true, _videoWidth, _videoHeight, [&] {
+        auto entry = w.begin(_codec == VideoCodec::H265 ? "hvc1" : "avc1");
+        w.zeros(6);
+        w.u16(1); // data reference index
+        w.zeros(16);
+        w.u16(_videoWidth);
+        w.u16(_videoHeight);
+        w.u32(0x00480000); // 72 dpi
+        w.u32(0x00480000);
+        w.zeros(4);
+        w.u16(1); // frame count
+        w.zeros(32); // compressor name
+        w.u16(0x0018); // depth
+        w.u16(0xffff);
+        auto config = w.begin(_codec == VideoCodec::H265 ? "hvcC" : "avcC");
+        w.bytes(_videoConfig.data(), _videoConfig.size());
+        w.end(config);
+        w.end(entry);
+    });
+
+    WriteTrack(w, AudioTrackId, _audioConfig.frequency, false, 0, 0, [&] {
+        auto entry = w.begin("mp4a");
+        w.zeros(6);
+        w.u16(1); // data reference index
+        w.zeros(8);
+        w.u16(_audioConfig.channelCount());
+        w.u16(16); // sample size
+        w.zeros(4);
+        // the rate is 16.16 fixed point, so higher rates can't be represented here
+        w.u32(std::min(_audioConfig.frequency, 0xffffu) << 16);
+
+        auto asc = _audioConfig.encode();
+        auto esds = w.beginFull("esds", 0, 0);
+        WriteDescriptor(w, 0x03 /* ES_DescrTag */, 3 + 2 + 13 + 2 + asc.size() + 3);
+        w.u16(AudioTrackId);
+        w.u8(0);
+        WriteDescriptor(w, 0x04 /* DecoderConfigDescrTag */, 13 + 2 + asc.size());
+        w.u8(0x40); // mpeg-4 audio
+        w.u8(0x15); // audio stream
+        w.u24(0); // buffer size
+        w.u32(0); // max bitrate
+        w.u32(0); // average bitrate
+        WriteDescriptor(w, 0x05 /* DecSpecificInfoTag */, asc.size());
+        w.bytes(asc.data(), asc.size());
+        WriteDescriptor(w, 0x06 /* SLConfigDescrTag */, 1);
+        w.u8(0x02);
+        w.end(esds);
+
+        w.end(entry);
+    });
+
+    auto mvex = w.begin("mvex");
+    for (auto trackId : {VideoTrackId, AudioTrackId}) {
+        auto trex = w.beginFull("trex", 0, 0);
+        w.u32(trackId);
+        w.u32(1); // sample description index
+        w.u32(0);
+        w.u32(0);
+        w.u32(0);
+        w.end(trex);
+    }
+    w.end(mvex);
+
+    w.end(moov);
+
+    return write(buffer.data(), buffer.size());
+}
+
+void FMP4Muxer::begin(WriteFunction write) {
+    _write = std::move(write);
+    _didWriteSegmentType = false;
+    for (auto track : {&_audio, &_video}) {
+        track->data = _pool->acquire(track == &_video ? 1024 * 1024 : 64 * 1024);
+        track->samples.clear();
+    }
+}
+
+bool FMP4Muxer::writeAudio(std::chrono::microseconds pts, const void* data, size_t len) {
+    if (!_write) {
+        return false;
+    }
+    Sample sample{};
+    sample.size = len;
+    sample.decodeTime = (pts + TimestampOffset).count() * _audioConfig.frequency / 1000000;
+    sample.isSync = true;
+    _audio.samples.emplace_back(sample);
+    auto bytes = reinterpret_cast<const uint8_t*>(data);
+    _audio.data->insert(_audio.data->end(), bytes, bytes + len);
+    return true;
+}
+
+bool FMP4Muxer::writeVideo(std::chrono::microseconds pts, std::chrono::microseconds dts, const void* data, size_t len, bool isSync, int recoveryFrameCount) {
+    if (!_write) {
+        return false;
+    }
+    Sample sample{};
+    sample.size = len;
+    sample.decodeTime = (dts + TimestampOffset).count() * 9 / 100;
+    sample.compositionTimeOffset = (pts + TimestampOffset).count() * 9 / 100 - sample.decodeTime;
+    sample.isSync = isSync;
+    if (!isSync && recoveryFrameCount >= 0) {
+        // a roll distance of zero isn't allowed, and one is close enough for a recovery point that's
+        // correct right away
+        sample.rollDistance = static_cast<int16_t>(std::clamp(recoveryFrameCount, 1, 0x7fff));
+    }
+    _video.samples.emplace_back(sample);
+    auto bytes = reinterpret_cast<const uint8_t*>(data);
+    _video.data->insert(_video.data->end(), bytes, bytes + len);
+    return true;
+}
+
+bool FMP4Muxer::flush() {
+    if (!_write) {
+        return false;
+    }
+
+    if (_audio.samples.empty() && _video.samples.empty()) {
+        return true;
+    }
+
+    _header.clear();
+    BoxWriter w{&_header};
+
+    // only the segment's first fragment gets a styp
+    if (!_didWriteSegmentType) {
+        auto styp = w.begin("styp");
+        w.fourcc("cmfs");
+        w.u32(0);
+        for (auto brand : {"cmfs", "msdh"}) {
+            w.fourcc(brand);
+        }
+        w.end(styp);
+        _didWriteSegmentType = true;
+    }
+
+    auto moof = w.begin("moof");
+
+    auto mfhd = w.beginFull("mfhd", 0, 0);
+    w.u32(++_sequenceNumber);
+    w.end(mfhd);
+
+    size_t videoDataOffset = 0;
+    size_t audioDataOffset = 0;
+    if (!_video.samples.empty()) {
+        videoDataOffset = _writeTrackFragment(VideoTrackId, _video);
+    }
+    if (!_audio.samples.empty()) {
+        audioDataOffset = _writeTrackFragment(AudioTrackId, _audio);
+    }
+
+    w.end(moof);
+
+    // the data offsets are relative to the start of the moof, and the samples follow the mdat's
+    // header
+    auto moofSize = w.size() - moof;
+    if (videoDataOffset) {
+        w.put32(videoDataOffset, moofSize + 8);
+    }
+    if (audioDataOffset) {
+        w.put32(audioDataOffset, moofSize + 8 + _video.data->size());
+    }
+
+    w.u32(8 + _video.data->size() + _audio.data->size());
+    w.fourcc("mdat");
+
+    auto ok = _write(_header.data(), _header.size());
+    for (auto track : {&_video, &_audio}) {
+        if (ok && !track->data->empty()) {
+            ok = _write(track->data->data(), track->data->size());
+        }
+        track->data->clear();
+        track->samples.clear();
+    }
+    return ok;
+}
+
+bool FMP4Muxer::end() {
+    auto ok = flush();
+    _write = nullptr;
+    for (auto track : {&_video, &_audio}) {
+        track->data = nullptr;
+    }
+    return ok;
+}
+
+size_t FMP4Muxer::_writeTrackFragment(uint32_t trackId, const Track& track) {
+    BoxWriter w{&_header};
+    const auto isVideo = &track == &_video;
+
+    auto traf = w.begin("traf");
+
+    auto tfhd = w.beginFull("tfhd", 0, 0x020000 /* default base is moof */);
+    w.u32(trackId);
+    w.end(tfhd);
+
+    auto tfdt = w.beginFull("tfdt", 1, 0);
+    w.u64(track.samples.front().decodeTime);
+    w.end(tfdt);
+
+    const uint32_t flags = 0x000001 /* data offset */ | 0x000100 /* duration */ | 0x000200 /* size */ | (isVideo ? 0x000400 /* flags */ | 0x000800 /* composition time offset */ : 0);
+    auto trun = w.beginFull("trun", 1, flags);
+    w.u32(track.samples.size());
+    auto dataOffset = w.size();
+    w.u32(0);
+    for (size_t i = 0; i < track.samples.size(); ++i) {
+        auto& sample = track.samples[i];
+        if (!isVideo) {
+            w.u32(AudioSampleDuration);
+            w.u32(sample.size);
+            continue;
+        }
+        if (i + 1 < track.samples.size()) {
+            _lastVideoSampleDuration = track.samples[i + 1].decodeTime - sample.decodeTime;
+        }
+        w.u32(_lastVideoSampleDuration);
+        w.u32(sample.size);
+        w.u32(sample.isSync ? SyncSampleFlags : NonSyncSampleFlags);
+        w.u32(sample.compositionTimeOffset);
+    }
+    w.end(trun);
+
+    if (isVideo) {
+        _writeRollGroup(track);
+    }
+
+    w.end(traf);
+    return dataOffset;
+}
+
+void FMP4Muxer::_writeRollGroup(const Track& track) {
+    std::vector<int16_t> distances;
+    for (auto& sample : track.samples) {
+        if (sample.rollDistance > 0 && std::find(distances.begin(), distances.end(), sample.rollDistance) == distances.end()) {
+            distances.emplace_back(sample.rollDistance);
+        }
+    }
+    if (distances.empty()) {
+        return;
+    }
+
+    BoxWriter w{&_header};
+
+    // each run of samples maps to a description in this fragment's sgpd, whose indices start at
+    // 0x10001, or to no group at all
+    std::vector<std::pair<uint32_t, uint32_t>> runs;
+    for (auto& sample : track.samples) {
+        uint32_t index = 0;
+        if (sample.rollDistance > 0) {
+            index = 0x10001 + (std::find(distances.begin(), distances.end(), sample.rollDistance) - distances.begin());
+        }
+        if (runs.empty() || runs.back().second != index) {
+            runs.emplace_back(0, index);
+        }
+        ++runs.back().first;
+    }
+
+    auto sbgp = w.beginFull("sbgp", 0, 0);
+    w.fourcc("roll");
+    w.u32(runs.size());
+    for (auto& [count, index] : runs) {
+        w.u32(count);
+        w.u32(index);
+    }
+    w.end(sbgp);
+
+    auto sgpd = w.beginFull("sgpd", 1, 0);
+    w.fourcc("roll");
+    w.u32(2 /* default_length */);
+    w.u32(distances.size());
+    for (auto distance : distances) {
+        w.u16(static_cast<uint16_t>(distance));
+    }
+    w.end(sgpd);
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "buffer_pool.hpp"
+#include "mpeg4.hpp"
+
+// FMP4Muxer writes AAC audio and H.264 or H.265 video as fragmented MP4 in the CMAF layout: an init
+// segment holding the tracks' configs, and media segments made up of moof/mdat fragments (just
+// one unless the segment is flushed early). Video is track 1 with a 90 kHz timescale. Audio is
+// track 2 with its sample rate as its timescale.
+//
+// Timestamps are offset the same way MPEGTSMuxer offsets them, so a rendition's segments are on the
+// same timeline no matter which format they're in.
+class FMP4Muxer {
+public:
+    enum class VideoCodec {
+        H264,
+        H265,
+    };
+
+    // WriteFunction is invoked with the output. It should return false on failure.
+    using WriteFunction = std::function<bool(const void* data, size_t len)>;
+
+    explicit FMP4Muxer(VideoCodec codec, std::shared_ptr<BufferPool> pool = BufferPool::Default());
+
+    void setAudioConfig(const MPEG4AudioSpecificConfig& config) { _audioConfig = config; }
+
+    // setVideoConfig sets the video's avcC or hvcC box contents and its dimensions.
+    void setVideoConfig(const void* data, size_t len, int width, int height);
+
+    // writeInitSegment writes an init segment for the current configs.
+    bool writeInitSegment(const WriteFunction& write);
+
+    // begin starts a new media segment, which is output via write once it ends.
+    void begin(WriteFunction write);
+
+    // writeAudio adds a raw AAC frame to the segment.
+    bool writeAudio(std::chrono::microseconds pts, const void* data, size_t len);
+
+    // writeVideo adds an access unit to the segment. Its NAL units must be prefixed with lengths of
+    // the size given by the video config. Only IDRs should be sync samples. If recoveryFrameCount
+    // is non-negative, the access unit is a recovery point that decoding can begin at, correct after
+    // that many frames, and it's listed in a "roll" sample group.
+    bool writeVideo(std::chrono::microseconds pts, std::chrono::microseconds dts, const void* data, size_t len, bool isSync, int recoveryFrameCount = -1);
+
+    // flush writes everything added so far out as a moof/mdat fragment, so that it can be made
+    // available before the segment ends, as an LL-HLS part for example. The segment continues with
+    // a new fragment. The last video frame's duration isn't known yet, so it's assumed to be the
+    // same as the one before it. It returns false if the fragment couldn't be written.
+    bool flush();
+
+    // end flushes the segment's last fragment and ends the segment. It returns false if the
+    // fragment couldn't be written.
+    bool end();
+
+private:
+    struct Sample {
+        uint32_t size;
+        int64_t decodeTime;
+        int32_t compositionTimeOffset;
+        bool isSync;
+
+        // If positive, the sample is a recovery point that's this many samples from correct output.
+        int16_t rollDistance;
+    };
+
+    struct Track {
+        std::shared_ptr<BufferPool::Buffer> data;
+        std::vector<Sample> samples;
+    };
+
+    const VideoCodec _codec;
+    const std::shared_ptr<BufferPool> _pool;
+
+    MPEG4AudioSpecificConfig _audioConfig{};
+    std::vector<uint8_t> _videoConfig;
+    int _videoWidth = 0;
+    int _videoHeight = 0;
+
+    WriteFunction _write;
+    bool _didWriteSegmentType = false;
+    uint32_t _sequenceNumber = 0;
+    Track _audio;
+    Track _video;
+    uint32_t _lastVideoSampleDuration = 3000;
+
+    // The styp and moof for the fragment being written.
+    std::vector<uint8_t> _header;
+
+    // _writeTrackFragment appends a traf to _header, returning the position of its trun's data
+    // offset so that it can be filled in once the moof's size is known.
+    size_t _writeTrackFragment(uint32_t trackId, const Track& track);
+
+    // _writeRollGroup appends sbgp and sgpd boxes to _header listing the track's recovery points, if
+    // it has any.
+    void _writeRollGroup(const Track& track);
+};
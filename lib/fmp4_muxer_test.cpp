@@ -0,0 +1,336 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "demuxer.hpp"
+#include "encoded_av_handler_test.hpp"
+#include "fmp4_muxer.hpp"
+#include "logger_test.hpp"
+#include "packager.hpp"
+
+namespace {
+
+struct Box {
+    std::string type;
+    size_t offset;
+    const uint8_t* payload;
+    size_t payloadSize;
+};
+
+std::vector<Box> ParseBoxes(const uint8_t* data, size_t len, size_t baseOffset = 0) {
+    std::vector<Box> ret;
+    size_t offset = 0;
+    while (offset + 8 <= len) {
+        auto p = data + offset;
+        size_t size = (p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+        EXPECT_GE(size, 8);
+        EXPECT_LE(offset + size, len);
+        if (size < 8 || offset + size > len) {
+            break;
+        }
+        ret.push_back({std::string(p + 4, p + 8), baseOffset + offset, p + 8, size - 8});
+        offset += size;
+    }
+    EXPECT_EQ(len, offset);
+    return ret;
+}
+
+const Box* FindBox(const std::vector<Box>& boxes, const std::string& type) {
+    for (auto& box : boxes) {
+        if (box.type == type) {
+            return &box;
+        }
+    }
+    return nullptr;
+}
+
+uint32_t Read32(const uint8_t* p) {
+    return (uint32_t(p[0]) << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+uint64_t Read64(const uint8_t* p) {
+    return (uint64_t(Read32(p)) << 32) | Read32(p + 4);
+}
+
+} // anonymous namespace
+
+TEST(FMP4Muxer, boxes) {
+    FMP4Muxer muxer{FMP4Muxer::VideoCodec::H264, BufferPool::Create()};
+
+    MPEG4AudioSpecificConfig audioConfig{MPEG4AudioObjectType::AACLC, 48000, MPEG4ChannelConfiguration::TwoChannels};
+    muxer.setAudioConfig(audioConfig);
+
+    std::vector<uint8_t> avcc{0x01, 0x64, 0x00, 0x1f, 0xff, 0xe1, 0x00, 0x04, 0x67, 0x64, 0x00, 0x1f, 0x01, 0x00, 0x02, 0x68, 0xeb};
+    muxer.setVideoConfig(avcc.data(), avcc.size(), 1280, 720);
+
+    std::vector<uint8_t> init;
+    ASSERT_TRUE(muxer.writeInitSegment([&](const void* data, size_t len) {
+        auto bytes = reinterpret_cast<const uint8_t*>(data);
+        init.insert(init.end(), bytes, bytes + len);
+        return true;
+    }));
+
+    {
+        auto boxes = ParseBoxes(init.data(), init.size());
+        ASSERT_EQ(2, boxes.size());
+        EXPECT_EQ("ftyp", boxes[0].type);
+        EXPECT_EQ("moov", boxes[1].type);
+
+        auto moov = ParseBoxes(boxes[1].payload, boxes[1].payloadSize);
+        size_t traks = 0;
+        for (auto& box : moov) {
+            traks += box.type == "trak";
+        }
+        EXPECT_EQ(2, traks);
+        EXPECT_NE(nullptr, FindBox(moov, "mvex"));
+
+        // the avcc should be in there verbatim
+        auto it = std::search(init.begin(), init.end(), avcc.begin(), avcc.end());
+        ASSERT_NE(init.end(), it);
+        EXPECT_EQ("avcC", std::string(it - 4, it));
+    }
+
+    std::vector<uint8_t> segment;
+    muxer.begin([&](const void* data, size_t len) {
+        auto bytes = reinterpret_cast<const uint8_t*>(data);
+        segment.insert(segment.end(), bytes, bytes + len);
+        return true;
+    });
+
+    // frames are in decode order: I P B
+    std::vector<std::vector<uint8_t>> frames{
+        {0, 0, 0, 3, 0x65, 0x01, 0x02},
+        {0, 0, 0, 2, 0x41, 0x03},
+        {0, 0, 0, 4, 0x01, 0x04, 0x05, 0x06},
+    };
+    std::vector<std::pair<int64_t, int64_t>> timestamps{{0, -40000}, {80000, 0}, {40000, 40000}};
+    for (size_t i = 0; i < frames.size(); ++i) {
+        ASSERT_TRUE(muxer.writeVideo(std::chrono::microseconds(timestamps[i].first), std::chrono::microseconds(timestamps[i].second), frames[i].data(), frames[i].size(), i == 0));
+    }
+
+    std::vector<std::vector<uint8_t>> audio{{1, 2, 3}, {4, 5, 6, 7}};
+    for (size_t i = 0; i < audio.size(); ++i) {
+        ASSERT_TRUE(muxer.writeAudio(std::chrono::microseconds(i * 21333), audio[i].data(), audio[i].size()));
+    }
+
+    ASSERT_TRUE(muxer.end());
+
+    auto boxes = ParseBoxes(segment.data(), segment.size());
+    ASSERT_EQ(3, boxes.size());
+    EXPECT_EQ("styp", boxes[0].type);
+    EXPECT_EQ("moof", boxes[1].type);
+    ASSERT_EQ("mdat", boxes[2].type);
+    auto& moof = boxes[1];
+    auto& mdat = boxes[2];
+
+    auto trafs = ParseBoxes(moof.payload, moof.payloadSize, moof.offset + 8);
+    ASSERT_EQ(3, trafs.size());
+    EXPECT_EQ("mfhd", trafs[0].type);
+    EXPECT_EQ(1, Read32(trafs[0].payload + 4));
+
+    // video
+    {
+        ASSERT_EQ("traf", trafs[1].type);
+        auto traf = ParseBoxes(trafs[1].payload, trafs[1].payloadSize);
+        auto tfhd = FindBox(traf, "tfhd");
+        ASSERT_NE(nullptr, tfhd);
+        EXPECT_EQ(1, Read32(tfhd->payload + 4));
+
+        auto tfdt = FindBox(traf, "tfdt");
+        ASSERT_NE(nullptr, tfdt);
+        EXPECT_EQ((1400000 - 40000) * 9 / 100, Read64(tfdt->payload + 4));
+
+        auto trun = FindBox(traf, "trun");
+        ASSERT_NE(nullptr, trun);
+        ASSERT_EQ(frames.size(), Read32(trun->payload + 4));
+        auto dataOffset = Read32(trun->payload + 8);
+        EXPECT_EQ(mdat.offset + 8, moof.offset + dataOffset);
+
+        auto sample = trun->payload + 12;
+        auto data = &segment[moof.offset + dataOffset];
+        for (size_t i = 0; i < frames.size(); ++i, sample += 16) {
+            EXPECT_EQ(3600, Read32(sample)) << "frame " << i;
+            ASSERT_EQ(frames[i].size(), Read32(sample + 4)) << "frame " << i;
+            EXPECT_EQ(i == 0, !(Read32(sample + 8) & 0x00010000)) << "frame " << i;
+            auto pts = (1400000 + timestamps[i].first) * 9 / 100;
+            auto dts = (1400000 + timestamps[i].second) * 9 / 100;
+            EXPECT_EQ(pts - dts, int32_t(Read32(sample + 12))) << "frame " << i;
+            EXPECT_EQ(frames[i], std::vector<uint8_t>(data, data + frames[i].size())) << "frame " << i;
+            data += frames[i].size();
+        }
+    }
+
+    // audio
+    {
+        ASSERT_EQ("traf", trafs[2].type);
+        auto traf = ParseBoxes(trafs[2].payload, trafs[2].payloadSize);
+        auto tfhd = FindBox(traf, "tfhd");
+        ASSERT_NE(nullptr, tfhd);
+        EXPECT_EQ(2, Read32(tfhd->payload + 4));
+
+        auto tfdt = FindBox(traf, "tfdt");
+        ASSERT_NE(nullptr, tfdt);
+        EXPECT_EQ(int64_t(1400000) * 48000 / 1000000, Read64(tfdt->payload + 4));
+
+        auto trun = FindBox(traf, "trun");
+        ASSERT_NE(nullptr, trun);
+        ASSERT_EQ(audio.size(), Read32(trun->payload + 4));
+        auto data = &segment[moof.offset + Read32(trun->payload + 8)];
+        auto sample = trun->payload + 12;
+        for (size_t i = 0; i < audio.size(); ++i, sample += 8) {
+            EXPECT_EQ(1024, Read32(sample)) << "frame " << i;
+            ASSERT_EQ(audio[i].size(), Read32(sample + 4)) << "frame " << i;
+            EXPECT_EQ(audio[i], std::vector<uint8_t>(data, data + audio[i].size())) << "frame " << i;
+            data += audio[i].size();
+        }
+        EXPECT_EQ(segment.data() + segment.size(), data);
+    }
+}
+
+TEST(FMP4Muxer, recoveryPoints) {
+    FMP4Muxer muxer{FMP4Muxer::VideoCodec::H264, BufferPool::Create()};
+
+    std::vector<uint8_t> segment;
+    muxer.begin([&](const void* data, size_t len) {
+        auto bytes = reinterpret_cast<const uint8_t*>(data);
+        segment.insert(segment.end(), bytes, bytes + len);
+        return true;
+    });
+
+    // an intra refresh stream: only p-frames, some of which are recovery points
+    std::vector<uint8_t> frame{0, 0, 0, 2, 0x41, 0x01};
+    std::vector<int> recoveryFrameCounts{3, -1, -1, 3, -1, 0};
+    for (size_t i = 0; i < recoveryFrameCounts.size(); ++i) {
+        auto pts = std::chrono::microseconds(i * 40000);
+        ASSERT_TRUE(muxer.writeVideo(pts, pts, frame.data(), frame.size(), false, recoveryFrameCounts[i]));
+    }
+    ASSERT_TRUE(muxer.end());
+
+    auto boxes = ParseBoxes(segment.data(), segment.size());
+    ASSERT_EQ(3, boxes.size());
+    auto moof = ParseBoxes(boxes[1].payload, boxes[1].payloadSize);
+    auto trafBox = FindBox(moof, "traf");
+    ASSERT_NE(nullptr, trafBox);
+    auto traf = ParseBoxes(trafBox->payload, trafBox->payloadSize);
+
+    // recovery points aren't sync samples
+    auto trun = FindBox(traf, "trun");
+    ASSERT_NE(nullptr, trun);
+    auto sample = trun->payload + 12;
+    for (size_t i = 0; i < recoveryFrameCounts.size(); ++i, sample += 16) {
+        EXPECT_TRUE(Read32(sample + 8) & 0x00010000) << "frame " << i;
+    }
+
+    auto sbgp = FindBox(traf, "sbgp");
+    ASSERT_NE(nullptr, sbgp);
+    EXPECT_EQ("roll", std::string(sbgp->payload + 4, sbgp->payload + 8));
+    std::vector<std::pair<uint32_t, uint32_t>> runs;
+    for (uint32_t i = 0; i < Read32(sbgp->payload + 8); ++i) {
+        auto entry = sbgp->payload + 12 + i * 8;
+        runs.emplace_back(Read32(entry), Read32(entry + 4));
+    }
+    std::vector<std::pair<uint32_t, uint32_t>> expectedRuns{{1, 0x10001}, {2, 0}, {1, 0x10001}, {1, 0}, {1, 0x10002}};
+    EXPECT_EQ(expectedRuns, runs);
+
+    auto sgpd = FindBox(traf, "sgpd");
+    ASSERT_NE(nullptr, sgpd);
+    EXPECT_EQ("roll", std::string(sgpd->payload + 4, sgpd->payload + 8));
+    EXPECT_EQ(2, Read32(sgpd->payload + 8));
+    ASSERT_EQ(2, Read32(sgpd->payload + 12));
+    EXPECT_EQ(3, (sgpd->payload[16] << 8) | sgpd->payload[17]);
+    EXPECT_EQ(1, (sgpd->payload[18] << 8) | sgpd->payload[19]);
+}
+
+TEST(FMP4Muxer, packagerRoundTrip) {
+    // Storage appends everything to one file, so the init segment and media segments can be
+    // demuxed together.
+    struct Storage : SegmentStorage {
+        struct Segment : SegmentStorage::Segment {
+            virtual ~Segment() {}
+
+            virtual bool write(const void* data, size_t len) override {
+                return std::fwrite(data, 1, len, f) == len;
+            }
+
+            virtual bool close(std::chrono::microseconds duration) override {
+                return std::fclose(f) == 0;
+            }
+
+            std::FILE* f;
+        };
+
+        virtual std::shared_ptr<SegmentStorage::Segment> createSegment(const std::string& extension) override {
+            EXPECT_EQ("m4s", extension);
+            EXPECT_GT(initSegments, 0);
+            ++segments;
+            return open();
+        }
+
+        virtual std::shared_ptr<SegmentStorage::Segment> createInitSegment(const std::string& extension) override {
+            EXPECT_EQ("mp4", extension);
+            ++initSegments;
+            return open();
+        }
+
+        std::shared_ptr<Segment> open() {
+            auto segment = std::make_shared<Segment>();
+            segment->f = std::fopen(path.c_str(), "ab");
+            return segment;
+        }
+
+        std::string path;
+        size_t initSegments = 0;
+        size_t segments = 0;
+    };
+
+    std::string directory = ".FMP4Muxer-packagerRoundTrip-test";
+    system(("rm -rf " + directory + " && mkdir " + directory).c_str());
+
+    TestLogDestination logDestination;
+    Storage storage;
+    storage.path = directory + "/segments.mp4";
+
+    RecordingEncodedAVHandler input;
+    {
+        H264Packager packager{&logDestination, &storage, Packager::SegmentFormat::CMAF};
+        input.next = &packager;
+        ExerciseEncodedAVHandler(&input);
+    }
+    EXPECT_EQ(1, storage.initSegments);
+    ASSERT_EQ(1, storage.segments);
+
+    RecordingEncodedAVHandler output;
+    output.hasKeyframe = true;
+    {
+        Demuxer demuxer{&logDestination, storage.path, &output};
+    }
+
+    system(("rm -rf " + directory).c_str());
+
+    ASSERT_GT(input.video.size(), 10);
+    ASSERT_EQ(input.video.size(), output.video.size());
+    ASSERT_GT(input.audio.size(), 10);
+    ASSERT_EQ(input.audio.size(), output.audio.size());
+
+    // timestamps are offset by the muxer and rounded to 90khz
+    auto inputOrigin = input.video[0].dts;
+    auto outputOrigin = output.video[0].dts;
+
+    for (size_t i = 0; i < input.video.size(); ++i) {
+        auto& in = input.video[i];
+        auto& out = output.video[i];
+        EXPECT_NEAR((in.pts - inputOrigin).count(), (out.pts - outputOrigin).count(), 20) << "frame " << i;
+        EXPECT_NEAR((in.dts - inputOrigin).count(), (out.dts - outputOrigin).count(), 20) << "frame " << i;
+        EXPECT_EQ(in.data, out.data) << "frame " << i;
+    }
+
+    for (size_t i = 0; i < input.audio.size(); ++i) {
+        // unlike mpeg-ts, there are no adts headers
+        EXPECT_EQ(input.audio[i].data, output.audio[i].data) << "frame " << i;
+        EXPECT_NEAR((input.audio[i].pts - inputOrigin).count(), (output.audio[i].pts - outputOrigin).count(), 1000) << "frame " << i;
+    }
+}
@@ -0,0 +1,139 @@
+#include "frame_descriptor.hpp"
+
+#include <cstring>
+
+#include <h26x/h264.hpp>
+#include <h26x/nal_unit.hpp>
+#include <h26x/sei.hpp>
+
+#include "encoded_packet.hpp"
+
+namespace {
+
+// Returns the slice_type from the start of a slice NAL unit (after its header byte). Only a few
+// bytes are needed, so emulation prevention is removed from just those.
+FrameDescriptor::SliceType DecodeSliceType(const uint8_t* data, size_t len) {
+    uint8_t rbsp[16];
+    size_t rbspLen = 0;
+    auto zeros = 0;
+    for (size_t i = 0; i < len && rbspLen < sizeof(rbsp); ++i) {
+        if (zeros >= 2 && data[i] == 3) {
+            zeros = 0;
+            continue;
+        }
+        zeros = data[i] ? 0 : zeros + 1;
+        rbsp[rbspLen++] = data[i];
+    }
+
+    h264::bitstream bs{rbsp, rbspLen};
+    h264::ue firstMBInSlice, sliceType;
+    if (bs.decode(&firstMBInSlice, &sliceType) || sliceType.codeNum > 9) {
+        return FrameDescriptor::SliceType::Unknown;
+    }
+    return static_cast<FrameDescriptor::SliceType>(sliceType.codeNum % 5);
+}
+
+// Returns true if the SEI NAL unit contains a recovery point message, in which case its
+// recovery_frame_cnt is stored in recoveryFrameCount.
+bool DecodeRecoveryPoint(const uint8_t* data, size_t len, unsigned int* recoveryFrameCount) {
+    h264::nal_unit nalu;
+    h264::bitstream bs{data, len};
+    if (nalu.decode(&bs, len)) {
+        return false;
+    }
+    bs = {nalu.rbsp_byte.data(), nalu.rbsp_byte.size()};
+    h264::sei_rbsp sei;
+    // any messages decoded before an error are still worth looking at
+    sei.decode(&bs);
+    for (auto& message : sei.sei_message) {
+        if (message.payloadType == h264::SEIPayloadType::RecoveryPoint) {
+            h264::bitstream payload{message.sei_payload.data(), message.sei_payload.size()};
+            h264::ue count;
+            *recoveryFrameCount = payload.decode(&count) ? 0 : static_cast<unsigned int>(count.codeNum);
+            return true;
+        }
+    }
+    return false;
+}
+
+} // anonymous namespace
+
+bool FrameDescriptor::decode(const void* data, size_t len, size_t naluLengthSize) {
+    *this = {};
+
+    if (naluLengthSize > 8 || naluLengthSize < 1) {
+        return false;
+    }
+
+    auto begin = reinterpret_cast<const uint8_t*>(data);
+    auto ptr = begin;
+    while (len >= naluLengthSize) {
+        size_t naluSize = 0;
+        for (size_t i = 0; i < naluLengthSize; ++i) {
+            naluSize = (naluSize << 8) | ptr[i];
+        }
+        ptr += naluLengthSize;
+        len -= naluLengthSize;
+
+        if (len < naluSize) {
+            return false;
+        }
+
+        if (naluSize > 0) {
+            auto header = ptr[0];
+            auto type = header & 0x1f;
+
+            if (naluCount < MaxNALUs) {
+                nalus[naluCount] = NALU{static_cast<uint32_t>(ptr - begin), static_cast<uint32_t>(naluSize), header};
+            }
+            ++naluCount;
+
+            if (type >= 1 && type <= h264::NALUnitType::IDRSlice) {
+                isKeyframe |= (type == h264::NALUnitType::IDRSlice);
+                isReference |= (header & 0x60) != 0;
+                if (sliceType == SliceType::Unknown) {
+                    sliceType = DecodeSliceType(ptr + 1, naluSize - 1);
+                }
+            } else if (type == h264::NALUnitType::SequenceParameterSet || type == h264::NALUnitType::PictureParameterSet) {
+                hasParameterSets = true;
+            } else if (type == h264::NALUnitType::SEI && !isRecoveryPoint) {
+                isRecoveryPoint = DecodeRecoveryPoint(ptr, naluSize, &recoveryFrameCount);
+            }
+        }
+
+        ptr += naluSize;
+        len -= naluSize;
+    }
+
+    return true;
+}
+
+const FrameDescriptor* DescribeFrame(const EncodedPacket& packet, size_t naluLengthSize, FrameDescriptor* storage) {
+    if (auto descriptor = packet.frameDescriptor()) {
+        return descriptor;
+    }
+    return storage->decode(packet.data(), packet.size(), naluLengthSize) ? storage : nullptr;
+}
+
+bool AppendAnnexB(std::vector<uint8_t>* dest, const EncodedPacket& packet, size_t naluLengthSize, const FrameDescriptor* descriptor) {
+    if (!descriptor || !descriptor->hasCompleteNALUTable()) {
+        return h264::AVCCToAnnexB(dest, packet.data(), packet.size(), naluLengthSize);
+    }
+
+    auto size = dest->size();
+    for (size_t i = 0; i < descriptor->naluCount; ++i) {
+        size += 3 + descriptor->nalus[i].length;
+    }
+    auto offset = dest->size();
+    dest->resize(size);
+    auto ptr = dest->data() + offset;
+    for (size_t i = 0; i < descriptor->naluCount; ++i) {
+        auto& nalu = descriptor->nalus[i];
+        *(ptr++) = 0;
+        *(ptr++) = 0;
+        *(ptr++) = 1;
+        std::memcpy(ptr, packet.data() + nalu.offset, nalu.length);
+        ptr += nalu.length;
+    }
+    return true;
+}
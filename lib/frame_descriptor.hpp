@@ -0,0 +1,73 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class EncodedPacket;
+
+// FrameDescriptor summarizes an H.264 access unit in AVCC format. It's computed once where video
+// enters the process and travels with the access unit's EncodedPacket so that later stages don't
+// need to scan the access unit again.
+struct FrameDescriptor {
+    // Only this many NAL units are recorded individually. Access units with more are still
+    // described, but their NAL unit table is incomplete.
+    static constexpr size_t MaxNALUs = 16;
+
+    enum class SliceType : int8_t {
+        Unknown = -1,
+        P = 0,
+        B = 1,
+        I = 2,
+        SP = 3,
+        SI = 4,
+    };
+
+    struct NALU {
+        // The offset of the NAL unit within the access unit, after its length prefix.
+        uint32_t offset;
+        uint32_t length;
+        // The NAL unit's header byte.
+        uint8_t header;
+
+        unsigned int type() const { return header & 0x1f; }
+    };
+
+    // Whether the access unit contains an IDR slice.
+    bool isKeyframe = false;
+
+    // Whether any slice in the access unit has a non-zero nal_ref_idc.
+    bool isReference = false;
+
+    // Whether the access unit contains an SPS or PPS.
+    bool hasParameterSets = false;
+
+    // Whether the access unit contains a recovery point SEI message. Encoders using periodic intra
+    // refresh mark where decoding can begin with these instead of IDRs.
+    bool isRecoveryPoint = false;
+
+    // The recovery point's recovery_frame_cnt: the number of frames after it, in output order,
+    // before decoding is correct.
+    unsigned int recoveryFrameCount = 0;
+
+    // The slice type of the first slice.
+    SliceType sliceType = SliceType::Unknown;
+
+    // The total number of NAL units, which may be more than MaxNALUs.
+    size_t naluCount = 0;
+    std::array<NALU, MaxNALUs> nalus;
+
+    bool hasCompleteNALUTable() const { return naluCount <= MaxNALUs; }
+
+    // decode describes the given access unit. It returns false if the access unit isn't valid AVCC.
+    bool decode(const void* data, size_t len, size_t naluLengthSize);
+};
+
+// DescribeFrame returns the packet's descriptor if it carries one. Otherwise it decodes one into
+// storage and returns that. If the packet can't be described, nullptr is returned.
+const FrameDescriptor* DescribeFrame(const EncodedPacket& packet, size_t naluLengthSize, FrameDescriptor* storage);
+
+// AppendAnnexB converts the packet to Annex B and appends it to dest. If descriptor is non-null and
+// has a complete NAL unit table, the packet isn't scanned again.
+bool AppendAnnexB(std::vector<uint8_t>* dest, const EncodedPacket& packet, size_t naluLengthSize, const FrameDescriptor* descriptor);
@@ -0,0 +1,153 @@
+#include <gtest/gtest.h>
+
+#include <cstring>
+#include <vector>
+
+#include "encoded_packet.hpp"
+#include "frame_descriptor.hpp"
+
+namespace {
+
+void AppendNALU(std::vector<uint8_t>* dest, std::vector<uint8_t> nalu) {
+    dest->push_back(nalu.size() >> 24);
+    dest->push_back(nalu.size() >> 16);
+    dest->push_back(nalu.size() >> 8);
+    dest->push_back(nalu.size());
+    dest->insert(dest->end(), nalu.begin(), nalu.end());
+}
+
+} // anonymous namespace
+
+TEST(FrameDescriptor, keyframe) {
+    std::vector<uint8_t> au;
+    AppendNALU(&au, {0x09, 0xf0});
+    AppendNALU(&au, {0x67, 0x4d, 0x40, 0x1f});
+    AppendNALU(&au, {0x68, 0xee, 0x3c, 0x80});
+    // first_mb_in_slice = 0, slice_type = 7 (I)
+    AppendNALU(&au, {0x65, 0x88, 0x84, 0x00});
+
+    FrameDescriptor descriptor;
+    ASSERT_TRUE(descriptor.decode(au.data(), au.size(), 4));
+    EXPECT_TRUE(descriptor.isKeyframe);
+    EXPECT_TRUE(descriptor.isReference);
+    EXPECT_TRUE(descriptor.hasParameterSets);
+    EXPECT_EQ(FrameDescriptor::SliceType::I, descriptor.sliceType);
+    ASSERT_EQ(4, descriptor.naluCount);
+    ASSERT_TRUE(descriptor.hasCompleteNALUTable());
+    EXPECT_EQ(4, descriptor.nalus[0].offset);
+    EXPECT_EQ(2, descriptor.nalus[0].length);
+    EXPECT_EQ(9, descriptor.nalus[0].type());
+    EXPECT_EQ(5, descriptor.nalus[3].type());
+    EXPECT_EQ(0x65, au[descriptor.nalus[3].offset]);
+
+    std::vector<uint8_t> annexB;
+    ASSERT_TRUE(AppendAnnexB(&annexB, EncodedPacket::Borrow(au.data(), au.size()), 4, &descriptor));
+    std::vector<uint8_t> expected;
+    ASSERT_TRUE(AppendAnnexB(&expected, EncodedPacket::Borrow(au.data(), au.size()), 4, nullptr));
+    EXPECT_EQ(expected, annexB);
+}
+
+TEST(FrameDescriptor, nonReference) {
+    std::vector<uint8_t> au;
+    // nal_ref_idc = 0, first_mb_in_slice = 0, slice_type = 5 (P)
+    AppendNALU(&au, {0x01, 0x98, 0x00});
+
+    FrameDescriptor descriptor;
+    ASSERT_TRUE(descriptor.decode(au.data(), au.size(), 4));
+    EXPECT_FALSE(descriptor.isKeyframe);
+    EXPECT_FALSE(descriptor.isReference);
+    EXPECT_FALSE(descriptor.hasParameterSets);
+    EXPECT_EQ(FrameDescriptor::SliceType::P, descriptor.sliceType);
+}
+
+TEST(FrameDescriptor, emulationPrevention) {
+    std::vector<uint8_t> au;
+    // a large first_mb_in_slice whose encoding requires emulation prevention bytes, then
+    // slice_type = 7 (I)
+    AppendNALU(&au, {0x25, 0x00, 0x00, 0x03, 0x02, 0x00, 0x00, 0x03, 0x00, 0x88});
+
+    FrameDescriptor descriptor;
+    ASSERT_TRUE(descriptor.decode(au.data(), au.size(), 4));
+    EXPECT_EQ(FrameDescriptor::SliceType::I, descriptor.sliceType);
+}
+
+TEST(FrameDescriptor, recoveryPoint) {
+    std::vector<uint8_t> au;
+    // an unregistered user data message, which isn't a recovery point
+    AppendNALU(&au, {0x06, 0x05, 0x01, 0xaa, 0x80});
+    // first_mb_in_slice = 0, slice_type = 5 (P)
+    AppendNALU(&au, {0x21, 0x98, 0x00});
+
+    FrameDescriptor descriptor;
+    ASSERT_TRUE(descriptor.decode(au.data(), au.size(), 4));
+    EXPECT_FALSE(descriptor.isRecoveryPoint);
+
+    au.clear();
+    // a recovery point with recovery_frame_cnt = 0
+    AppendNALU(&au, {0x06, 0x06, 0x01, 0x84, 0x80});
+    AppendNALU(&au, {0x21, 0x98, 0x00});
+
+    ASSERT_TRUE(descriptor.decode(au.data(), au.size(), 4));
+    EXPECT_TRUE(descriptor.isRecoveryPoint);
+    EXPECT_EQ(0, descriptor.recoveryFrameCount);
+    EXPECT_FALSE(descriptor.isKeyframe);
+    EXPECT_EQ(FrameDescriptor::SliceType::P, descriptor.sliceType);
+
+    au.clear();
+    // a recovery point with recovery_frame_cnt = 3
+    AppendNALU(&au, {0x06, 0x06, 0x02, 0x20, 0x80, 0x80});
+    AppendNALU(&au, {0x21, 0x98, 0x00});
+
+    ASSERT_TRUE(descriptor.decode(au.data(), au.size(), 4));
+    EXPECT_TRUE(descriptor.isRecoveryPoint);
+    EXPECT_EQ(3, descriptor.recoveryFrameCount);
+}
+
+TEST(FrameDescriptor, manyNALUs) {
+    std::vector<uint8_t> au;
+    for (size_t i = 0; i < FrameDescriptor::MaxNALUs + 4; ++i) {
+        AppendNALU(&au, {0x06, static_cast<uint8_t>(i)});
+    }
+    AppendNALU(&au, {0x65, 0x88});
+
+    FrameDescriptor descriptor;
+    ASSERT_TRUE(descriptor.decode(au.data(), au.size(), 4));
+    EXPECT_TRUE(descriptor.isKeyframe);
+    EXPECT_EQ(FrameDescriptor::MaxNALUs + 5, descriptor.naluCount);
+    EXPECT_FALSE(descriptor.hasCompleteNALUTable());
+
+    // conversion still works, it just falls back to scanning
+    std::vector<uint8_t> annexB;
+    ASSERT_TRUE(AppendAnnexB(&annexB, EncodedPacket::Borrow(au.data(), au.size()), 4, &descriptor));
+    EXPECT_EQ(au.size() - 1 * (FrameDescriptor::MaxNALUs + 5), annexB.size());
+}
+
+TEST(FrameDescriptor, invalid) {
+    std::vector<uint8_t> au;
+    AppendNALU(&au, {0x65, 0x88});
+    au.pop_back();
+
+    FrameDescriptor descriptor;
+    EXPECT_FALSE(descriptor.decode(au.data(), au.size(), 4));
+
+    EXPECT_EQ(nullptr, DescribeFrame(EncodedPacket::Borrow(au.data(), au.size()), 4, &descriptor));
+}
+
+TEST(FrameDescriptor, travelsWithPacket) {
+    std::vector<uint8_t> au;
+    AppendNALU(&au, {0x65, 0x88});
+
+    auto attached = std::make_shared<FrameDescriptor>();
+    ASSERT_TRUE(attached->decode(au.data(), au.size(), 4));
+
+    auto packet = EncodedPacket::Borrow(au.data(), au.size());
+    packet.setFrameDescriptor(attached);
+
+    FrameDescriptor storage;
+    EXPECT_EQ(attached.get(), DescribeFrame(packet, 4, &storage));
+
+    // retained copies keep the descriptor
+    auto retained = packet.retained();
+    EXPECT_NE(packet.data(), retained.data());
+    EXPECT_EQ(attached.get(), retained.frameDescriptor());
+}
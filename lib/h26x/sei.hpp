@@ -6,6 +6,10 @@
 
 namespace h264 {
 
+namespace SEIPayloadType {
+    constexpr unsigned int RecoveryPoint = 6;
+}
+
 // ITU-T H.264, 04/2017, 7.3.2.3.1
 struct sei_message {
     unsigned int payloadType = 0;
@@ -0,0 +1,191 @@
+#include "hls_playlist.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+#include <fmt/format.h>
+
+namespace {
+
+double Seconds(std::chrono::microseconds duration) {
+    return std::chrono::duration<double>(duration).count();
+}
+
+} // anonymous namespace
+
+HLSMediaPlaylist::HLSMediaPlaylist(Configuration configuration)
+    : _configuration{std::move(configuration)}
+    , _targetDurationSeconds{std::max<int64_t>(1, static_cast<int64_t>(std::ceil(Seconds(_configuration.targetDuration))))}
+{}
+
+void HLSMediaPlaylist::addSegment(int64_t number, Segment segment) {
+    if (number < _nextSegmentNumber || _hasEnded) {
+        return;
+    }
+    _pendingSegments[number] = std::move(segment);
+    _advance();
+}
+
+void HLSMediaPlaylist::skipSegment(int64_t number) {
+    if (number < _nextSegmentNumber || _hasEnded) {
+        return;
+    }
+    _pendingSegments[number] = std::nullopt;
+    _advance();
+}
+
+void HLSMediaPlaylist::addPart(int64_t segmentNumber, int partNumber, Part part) {
+    if (_hasEnded || _configuration.partTargetDuration.count() <= 0) {
+        return;
+    }
+
+    if (segmentNumber < _nextSegmentNumber) {
+        // the segment's upload finished first
+        for (auto it = _entries.rbegin(); it != _entries.rend() && it->number >= segmentNumber; ++it) {
+            if (it->number == segmentNumber && !it->hasExpiredParts) {
+                it->parts[partNumber] = std::move(part);
+            }
+        }
+        return;
+    }
+
+    _pendingParts[segmentNumber][partNumber] = std::move(part);
+}
+
+void HLSMediaPlaylist::end() {
+    _hasEnded = true;
+    _pendingSegments.clear();
+    _pendingParts.clear();
+}
+
+void HLSMediaPlaylist::_advance() {
+    for (auto it = _pendingSegments.begin(); it != _pendingSegments.end() && it->first == _nextSegmentNumber; it = _pendingSegments.erase(it)) {
+        std::map<int, Part> parts;
+        if (auto partsIt = _pendingParts.find(_nextSegmentNumber); partsIt != _pendingParts.end()) {
+            parts = std::move(partsIt->second);
+            _pendingParts.erase(partsIt);
+        }
+        ++_nextSegmentNumber;
+
+        if (!it->second) {
+            _nextSegmentIsDiscontinuity = true;
+            continue;
+        }
+
+        Entry entry;
+        entry.number = it->first;
+        entry.segment = std::move(*it->second);
+        // there's nothing for the first segment to be discontinuous with
+        entry.segment.discontinuity = (entry.segment.discontinuity || _nextSegmentIsDiscontinuity) && _hasListedSegment;
+        entry.parts = std::move(parts);
+        _nextSegmentIsDiscontinuity = false;
+        _hasListedSegment = true;
+        _entries.emplace_back(std::move(entry));
+
+        if (_configuration.windowSize > 0 && _entries.size() > _configuration.windowSize) {
+            if (_entries.front().segment.discontinuity) {
+                ++_discontinuitySequence;
+            }
+            _entries.pop_front();
+            ++_mediaSequence;
+        }
+    }
+
+    // parts are only kept around for the segments within three target durations of the end
+    std::chrono::microseconds age{0};
+    auto maxAge = 3 * _configuration.targetDuration;
+    for (auto it = _entries.rbegin(); it != _entries.rend(); ++it) {
+        if (age > maxAge) {
+            if (it->hasExpiredParts) {
+                break;
+            }
+            it->parts.clear();
+            it->hasExpiredParts = true;
+        }
+        age += it->segment.duration;
+    }
+}
+
+std::string HLSMediaPlaylist::render() const {
+    std::string ret = "#EXTM3U\n#EXT-X-VERSION:6\n";
+    ret += fmt::format("#EXT-X-TARGETDURATION:{}\n", _targetDurationSeconds);
+    if (_configuration.windowSize == 0) {
+        ret += "#EXT-X-PLAYLIST-TYPE:EVENT\n";
+    }
+
+    auto hasParts = _configuration.partTargetDuration.count() > 0;
+    if (hasParts) {
+        auto partTarget = Seconds(_configuration.partTargetDuration);
+        ret += fmt::format("#EXT-X-SERVER-CONTROL:PART-HOLD-BACK={:.3f}\n", 3 * partTarget);
+        ret += fmt::format("#EXT-X-PART-INF:PART-TARGET={:.3f}\n", partTarget);
+    }
+
+    ret += fmt::format("#EXT-X-MEDIA-SEQUENCE:{}\n", _mediaSequence);
+    ret += fmt::format("#EXT-X-DISCONTINUITY-SEQUENCE:{}\n", _discontinuitySequence);
+
+    std::string initSegmentURI;
+    auto writeSegmentTags = [&](bool discontinuity, const std::string& uri) {
+        if (discontinuity) {
+            ret += "#EXT-X-DISCONTINUITY\n";
+        }
+        if (uri != initSegmentURI && !uri.empty()) {
+            ret += fmt::format("#EXT-X-MAP:URI=\"{}\"\n", uri);
+        }
+        initSegmentURI = uri;
+    };
+    // only the consecutive parts from the start of a segment can be listed
+    auto writeParts = [&](const std::map<int, Part>& parts) {
+        int next = 0;
+        for (auto& [number, part] : parts) {
+            if (number != next++) {
+                break;
+            }
+            ret += fmt::format("#EXT-X-PART:DURATION={:.3f},URI=\"{}\"{}\n", Seconds(part.duration), part.uri, part.isIndependent ? ",INDEPENDENT=YES" : "");
+        }
+    };
+
+    for (auto& entry : _entries) {
+        writeSegmentTags(entry.segment.discontinuity, entry.segment.initSegmentURI);
+        writeParts(entry.parts);
+        ret += fmt::format("#EXTINF:{:.3f},\n{}\n", Seconds(entry.segment.duration), entry.segment.uri);
+    }
+
+    if (_hasEnded) {
+        ret += "#EXT-X-ENDLIST\n";
+        return ret;
+    }
+
+    // the parts of the segment being written come after everything else
+    if (auto it = _pendingParts.find(_nextSegmentNumber); it != _pendingParts.end() && it->second.count(0)) {
+        auto& first = it->second.begin()->second;
+        writeSegmentTags((first.discontinuity || _nextSegmentIsDiscontinuity) && _hasListedSegment, first.initSegmentURI);
+        writeParts(it->second);
+    }
+
+    return ret;
+}
+
+std::string RenderHLSMasterPlaylist(const std::vector<HLSVariant>& variants) {
+    std::string ret = "#EXTM3U\n#EXT-X-VERSION:6\n";
+    if (std::all_of(variants.begin(), variants.end(), [](const HLSVariant& variant) { return variant.hasIndependentSegments; })) {
+        ret += "#EXT-X-INDEPENDENT-SEGMENTS\n";
+    }
+    for (auto& variant : variants) {
+        ret += fmt::format("#EXT-X-STREAM-INF:BANDWIDTH={}", variant.bandwidth);
+        if (variant.width > 0 && variant.height > 0) {
+            ret += fmt::format(",RESOLUTION={}x{}", variant.width, variant.height);
+        }
+        if (!variant.codecs.empty()) {
+            std::string codecs;
+            for (auto& codec : variant.codecs) {
+                codecs += (codecs.empty() ? "" : ",") + codec;
+            }
+            ret += fmt::format(",CODECS=\"{}\"", codecs);
+        }
+        if (variant.frameRate > 0.0) {
+            ret += fmt::format(",FRAME-RATE={:.3f}", variant.frameRate);
+        }
+        ret += "\n" + variant.uri + "\n";
+    }
+    return ret;
+}
@@ -0,0 +1,132 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <optional>
+#include <string>
+#include <vector>
+
+// HLSMediaPlaylist builds an HLS media playlist for a rendition as its segments complete. It's
+// either a sliding window of the most recent segments or an EVENT playlist that keeps every segment
+// so that clients can seek back through the whole stream.
+//
+// If a part target duration is configured, the parts of the most recent segments and of the
+// segment currently being written are listed as LL-HLS partial segments. Playlists are written to
+// plain file storage, so blocking reloads and preload hints aren't advertised.
+class HLSMediaPlaylist {
+public:
+    struct Configuration {
+        // The number of segments to keep in the playlist. If zero, segments are never removed and
+        // it's an EVENT playlist.
+        size_t windowSize = 0;
+
+        // The longest that segments can be. It's advertised as the EXT-X-TARGETDURATION, rounded
+        // up to whole seconds. Clients require it to stay the same, so it's never raised.
+        std::chrono::microseconds targetDuration{0};
+
+        // If non-zero, parts are listed with this PART-TARGET, which is never raised either. No part
+        // should be longer.
+        std::chrono::microseconds partTargetDuration{0};
+    };
+
+    struct Segment {
+        std::string uri;
+        std::chrono::microseconds duration{0};
+        bool discontinuity = false;
+
+        // If non-empty, the segment depends on this init segment, which is listed via EXT-X-MAP.
+        std::string initSegmentURI;
+    };
+
+    struct Part {
+        std::string uri;
+        std::chrono::microseconds duration{0};
+        bool isIndependent = false;
+
+        // These describe the part's segment, as for Segment, so that the parts of a segment can be
+        // listed before it completes.
+        bool discontinuity = false;
+        std::string initSegmentURI;
+    };
+
+    explicit HLSMediaPlaylist(Configuration configuration);
+
+    // addSegment adds a complete segment. Segments are numbered consecutively from zero, but they
+    // may complete out of order, so each is held back until all of the ones before it have been
+    // added or skipped.
+    void addSegment(int64_t number, Segment segment);
+
+    // skipSegment gives up on a segment, for example because it couldn't be uploaded. The next
+    // segment listed is marked as a discontinuity.
+    void skipSegment(int64_t number);
+
+    // addPart adds a complete part of a segment. Parts are numbered consecutively from zero within
+    // their segment and are only listed once all of the ones before them have been added. They may
+    // complete before or after their segment.
+    void addPart(int64_t segmentNumber, int partNumber, Part part);
+
+    // end marks the playlist as complete. No more segments should be added.
+    void end();
+
+    std::string render() const;
+
+private:
+    const Configuration _configuration;
+    const int64_t _targetDurationSeconds;
+
+    struct Entry {
+        int64_t number;
+        Segment segment;
+        std::map<int, Part> parts;
+
+        // Set once the segment is too old for its parts to be listed.
+        bool hasExpiredParts = false;
+    };
+
+    std::deque<Entry> _entries;
+    uint64_t _mediaSequence = 0;
+    uint64_t _discontinuitySequence = 0;
+
+    // The number of the next segment to be listed. Segments after it wait in _pendingSegments. Empty
+    // optionals are skipped segments.
+    int64_t _nextSegmentNumber = 0;
+    std::map<int64_t, std::optional<Segment>> _pendingSegments;
+    bool _nextSegmentIsDiscontinuity = false;
+
+    // Parts of segments that haven't been listed yet.
+    std::map<int64_t, std::map<int, Part>> _pendingParts;
+    bool _hasListedSegment = false;
+
+    bool _hasEnded = false;
+
+    // _advance lists pending segments until it reaches one that hasn't completed yet.
+    void _advance();
+};
+
+// HLSVariant describes one of the renditions in a master playlist.
+struct HLSVariant {
+    std::string uri;
+
+    // BANDWIDTH, in bits per second.
+    int bandwidth = 0;
+
+    // If positive, RESOLUTION is given.
+    int width = 0;
+    int height = 0;
+
+    // If non-empty, CODECS is given, such as {"mp4a.40.2", "avc1.64001f"}.
+    std::vector<std::string> codecs;
+
+    // If non-zero, FRAME-RATE is given.
+    double frameRate = 0.0;
+
+    // If false, segments may begin at recovery points instead of IDRs, so they can't be decoded on
+    // their own.
+    bool hasIndependentSegments = true;
+};
+
+// RenderHLSMasterPlaylist returns a master playlist listing the given variants. EXT-X-INDEPENDENT-
+// SEGMENTS is only given if every variant has independent segments.
+std::string RenderHLSMasterPlaylist(const std::vector<HLSVariant>& variants);
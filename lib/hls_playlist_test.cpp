@@ -0,0 +1,183 @@
+#include <gtest/gtest.h>
+
+#include "hls_playlist.hpp"
+
+TEST(HLSMediaPlaylist, slidingWindow) {
+    HLSMediaPlaylist::Configuration configuration;
+    configuration.windowSize = 2;
+    // the target duration is rounded up, and it's the same no matter how long the segments are
+    configuration.targetDuration = std::chrono::milliseconds(2700);
+    HLSMediaPlaylist playlist{configuration};
+
+    EXPECT_EQ(
+        "#EXTM3U\n"
+        "#EXT-X-VERSION:6\n"
+        "#EXT-X-TARGETDURATION:3\n"
+        "#EXT-X-MEDIA-SEQUENCE:0\n"
+        "#EXT-X-DISCONTINUITY-SEQUENCE:0\n",
+        playlist.render()
+    );
+
+    // segment 1 completes first, but isn't listed until segment 0 is
+    playlist.addSegment(1, {"1.ts", std::chrono::milliseconds(2002)});
+    EXPECT_EQ(std::string::npos, playlist.render().find("1.ts"));
+    // there's nothing for the first segment to be discontinuous with
+    playlist.addSegment(0, {"0.ts", std::chrono::milliseconds(2000), true});
+
+    // segment 2 fails, so segment 3 is a discontinuity
+    playlist.skipSegment(2);
+    playlist.addSegment(3, {"3.ts", std::chrono::milliseconds(2600)});
+
+    EXPECT_EQ(
+        "#EXTM3U\n"
+        "#EXT-X-VERSION:6\n"
+        "#EXT-X-TARGETDURATION:3\n"
+        "#EXT-X-MEDIA-SEQUENCE:1\n"
+        "#EXT-X-DISCONTINUITY-SEQUENCE:0\n"
+        "#EXTINF:2.002,\n"
+        "1.ts\n"
+        "#EXT-X-DISCONTINUITY\n"
+        "#EXTINF:2.600,\n"
+        "3.ts\n",
+        playlist.render()
+    );
+
+    playlist.addSegment(4, {"4.ts", std::chrono::seconds(2)});
+    playlist.addSegment(5, {"5.ts", std::chrono::seconds(2)});
+    playlist.end();
+
+    EXPECT_EQ(
+        "#EXTM3U\n"
+        "#EXT-X-VERSION:6\n"
+        "#EXT-X-TARGETDURATION:3\n"
+        "#EXT-X-MEDIA-SEQUENCE:3\n"
+        "#EXT-X-DISCONTINUITY-SEQUENCE:1\n"
+        "#EXTINF:2.000,\n"
+        "4.ts\n"
+        "#EXTINF:2.000,\n"
+        "5.ts\n"
+        "#EXT-X-ENDLIST\n",
+        playlist.render()
+    );
+}
+
+TEST(HLSMediaPlaylist, event) {
+    HLSMediaPlaylist::Configuration configuration;
+    configuration.targetDuration = std::chrono::seconds(4);
+    HLSMediaPlaylist playlist{configuration};
+
+    for (int i = 0; i < 10; ++i) {
+        playlist.addSegment(i, {std::to_string(i) + ".m4s", std::chrono::seconds(4), false, i < 5 ? "a.mp4" : "b.mp4"});
+    }
+
+    auto rendered = playlist.render();
+    EXPECT_NE(std::string::npos, rendered.find("#EXT-X-PLAYLIST-TYPE:EVENT\n"));
+    EXPECT_NE(std::string::npos, rendered.find("#EXT-X-MEDIA-SEQUENCE:0\n#EXT-X-DISCONTINUITY-SEQUENCE:0\n#EXT-X-MAP:URI=\"a.mp4\"\n#EXTINF:4.000,\n0.m4s\n"));
+    EXPECT_NE(std::string::npos, rendered.find("4.m4s\n#EXT-X-MAP:URI=\"b.mp4\"\n#EXTINF:4.000,\n5.m4s\n"));
+    EXPECT_NE(std::string::npos, rendered.find("#EXTINF:4.000,\n9.m4s\n"));
+
+    size_t maps = 0;
+    for (auto pos = rendered.find("#EXT-X-MAP"); pos != std::string::npos; pos = rendered.find("#EXT-X-MAP", pos + 1)) {
+        ++maps;
+    }
+    EXPECT_EQ(2, maps);
+}
+
+TEST(HLSMediaPlaylist, parts) {
+    HLSMediaPlaylist::Configuration configuration;
+    configuration.windowSize = 10;
+    configuration.targetDuration = std::chrono::seconds(1);
+    configuration.partTargetDuration = std::chrono::milliseconds(500);
+    HLSMediaPlaylist playlist{configuration};
+
+    for (int i = 0; i < 5; ++i) {
+        playlist.addPart(i, 0, {std::to_string(i) + ".0.ts", std::chrono::milliseconds(500), true});
+        if (i == 4) {
+            // a segment can finish uploading before its last part
+            playlist.addSegment(i, {std::to_string(i) + ".ts", std::chrono::seconds(1)});
+            playlist.addPart(i, 1, {std::to_string(i) + ".1.ts", std::chrono::milliseconds(500)});
+            continue;
+        }
+        playlist.addPart(i, 1, {std::to_string(i) + ".1.ts", std::chrono::milliseconds(500)});
+        playlist.addSegment(i, {std::to_string(i) + ".ts", std::chrono::seconds(1)});
+    }
+
+    // part 1 of segment 5 isn't listed until part 0 is
+    playlist.addPart(5, 1, {"5.1.ts", std::chrono::milliseconds(480)});
+    EXPECT_EQ(std::string::npos, playlist.render().find("5.1.ts"));
+    playlist.addPart(5, 0, {"5.0.ts", std::chrono::milliseconds(500), true});
+
+    EXPECT_EQ(
+        "#EXTM3U\n"
+        "#EXT-X-VERSION:6\n"
+        "#EXT-X-TARGETDURATION:1\n"
+        "#EXT-X-SERVER-CONTROL:PART-HOLD-BACK=1.500\n"
+        "#EXT-X-PART-INF:PART-TARGET=0.500\n"
+        "#EXT-X-MEDIA-SEQUENCE:0\n"
+        "#EXT-X-DISCONTINUITY-SEQUENCE:0\n"
+        "#EXTINF:1.000,\n"
+        "0.ts\n"
+        "#EXT-X-PART:DURATION=0.500,URI=\"1.0.ts\",INDEPENDENT=YES\n"
+        "#EXT-X-PART:DURATION=0.500,URI=\"1.1.ts\"\n"
+        "#EXTINF:1.000,\n"
+        "1.ts\n"
+        "#EXT-X-PART:DURATION=0.500,URI=\"2.0.ts\",INDEPENDENT=YES\n"
+        "#EXT-X-PART:DURATION=0.500,URI=\"2.1.ts\"\n"
+        "#EXTINF:1.000,\n"
+        "2.ts\n"
+        "#EXT-X-PART:DURATION=0.500,URI=\"3.0.ts\",INDEPENDENT=YES\n"
+        "#EXT-X-PART:DURATION=0.500,URI=\"3.1.ts\"\n"
+        "#EXTINF:1.000,\n"
+        "3.ts\n"
+        "#EXT-X-PART:DURATION=0.500,URI=\"4.0.ts\",INDEPENDENT=YES\n"
+        "#EXT-X-PART:DURATION=0.500,URI=\"4.1.ts\"\n"
+        "#EXTINF:1.000,\n"
+        "4.ts\n"
+        "#EXT-X-PART:DURATION=0.500,URI=\"5.0.ts\",INDEPENDENT=YES\n"
+        "#EXT-X-PART:DURATION=0.480,URI=\"5.1.ts\"\n",
+        playlist.render()
+    );
+}
+
+TEST(HLSMasterPlaylist, render) {
+    std::vector<HLSVariant> variants(2);
+    variants[0].uri = "0.m3u8";
+    variants[0].bandwidth = 4128000;
+    variants[0].width = 1280;
+    variants[0].height = 720;
+    variants[0].codecs = {"mp4a.40.2", "avc1.64001f"};
+    variants[0].frameRate = 30;
+    variants[1].uri = "1.m3u8";
+    variants[1].bandwidth = 128000;
+
+    EXPECT_EQ(
+        "#EXTM3U\n"
+        "#EXT-X-VERSION:6\n"
+        "#EXT-X-INDEPENDENT-SEGMENTS\n"
+        "#EXT-X-STREAM-INF:BANDWIDTH=4128000,RESOLUTION=1280x720,CODECS=\"mp4a.40.2,avc1.64001f\",FRAME-RATE=30.000\n"
+        "0.m3u8\n"
+        "#EXT-X-STREAM-INF:BANDWIDTH=128000\n"
+        "1.m3u8\n",
+        RenderHLSMasterPlaylist(variants)
+    );
+}
+
+TEST(HLSMasterPlaylist, recoveryPoints) {
+    std::vector<HLSVariant> variants(2);
+    variants[0].uri = "0.m3u8";
+    variants[0].bandwidth = 4128000;
+    variants[1].uri = "1.m3u8";
+    variants[1].bandwidth = 128000;
+    // segments that begin at intra refresh recovery points can't be decoded on their own
+    variants[1].hasIndependentSegments = false;
+
+    EXPECT_EQ(
+        "#EXTM3U\n"
+        "#EXT-X-VERSION:6\n"
+        "#EXT-X-STREAM-INF:BANDWIDTH=4128000\n"
+        "0.m3u8\n"
+        "#EXT-X-STREAM-INF:BANDWIDTH=128000\n"
+        "1.m3u8\n",
+        RenderHLSMasterPlaylist(variants)
+    );
+}
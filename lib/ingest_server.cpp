@@ -1,62 +1,123 @@
 #include "ingest_server.hpp"
 
+#include <algorithm>
+
 #include <fmt/format.h>
 
+#include <h26x/nal_unit.hpp>
+#include <h26x/seq_parameter_set.hpp>
+
 std::shared_ptr<EncodedAVHandler> IngestServer::authenticate(const std::string& connectionId) {
     auto logger = _logger.with("connection_id", connectionId);
 
     // TODO: actual authentication
 
-    auto stream = std::make_shared<Stream>(logger, _configuration, connectionId);
+    auto stream = std::make_shared<Stream>(logger, _configuration, connectionId, _encodingPool.get(), _backgroundPool.get());
 
     for (size_t i = 0; i < _configuration.encodings.size(); ++i) {
         auto& encoding = _configuration.encodings[i];
         std::string streamId;
 
-        if (_configuration.platformAPI) {
+        if (_configuration.platformAPI && encoding.video.codec != VideoCodec::copy) {
             PlatformAPI::AVStream stream;
             stream.bitrate = encoding.video.bitrate;
-            stream.codecs = { "mp4a.40.2" };
-            switch (encoding.video.codec) {
-                case VideoCodec::x264:
-                    stream.codecs.emplace_back(fmt::format("avc1.{:02x}00{:02x}", encoding.video.x264.profileIDC, encoding.video.x264.levelIDC));
-                    break;
-                case VideoCodec::x265:
-                    stream.codecs.emplace_back(fmt::format("hvc1")); // @TODO set correct flags
-                    break;
-                default:
-                    logger.error("unexpected value in encoding.video.codec");
-            }
+            stream.codecs = _codecs(logger, encoding.video);
             stream.maximumSegmentDuration = std::chrono::seconds(30);
             stream.videoHeight = encoding.video.height;
             stream.videoWidth = encoding.video.width;
+            // the stream is registered before the source's frame rate is known, and it can't be
+            // patched afterwards, so this is the cap. sources slower than it are reported as if
+            // they were capped
+            stream.frameRate = encoding.video.maxFrameRate;
             stream.gameId = _configuration.gameId;
             stream.isLive = true;
 
-            auto result = _configuration.platformAPI->createAVStream(stream);
-            if (!result.requestError.empty()) {
-                logger.error("createAVStream request error: {}", result.requestError);
+            streamId = _createAVStream(logger, _configuration.platformAPI, stream);
+            if (streamId.empty()) {
                 return nullptr;
             }
-            if (!result.errors.empty()) {
-                for (auto& err : result.errors) {
-                    logger.error("createAVStream error: {}", err.message);
-                }
-                return nullptr;
-            }
-            streamId = result.data.id;
-            logger.with("av_stream_id", streamId).info("created platform AVStream");
         }
 
         stream->addEncoding(i, encoding, streamId);
     }
 
+    if (_configuration.hlsPlaylists) {
+        stream->writeMasterPlaylist();
+    }
+
     return stream;
 }
 
-IngestServer::Stream::Stream(Logger logger, const Configuration& configuration, const std::string& connectionId)
-    : _logger{logger}, _configuration{configuration}
+void IngestServer::runBlocking(std::function<void()> f) {
+    if (_backgroundPool) {
+        _backgroundPool->post(std::move(f));
+    } else {
+        // the server is being destroyed
+        f();
+    }
+}
+
+std::vector<std::string> IngestServer::_codecs(const Logger& logger, const VideoEncoderConfiguration& configuration) {
+    std::vector<std::string> ret = { "mp4a.40.2" };
+    switch (configuration.codec) {
+        case VideoCodec::x264:
+            ret.emplace_back(fmt::format("avc1.{:02x}00{:02x}", configuration.x264.profileIDC, configuration.x264.levelIDC));
+            break;
+        case VideoCodec::x265:
+            ret.emplace_back(fmt::format("hvc1")); // @TODO set correct flags
+            break;
+        case VideoCodec::copy:
+            // the ingest's profile isn't known until its first video config arrives
+            return {};
+        default:
+            logger.error("unexpected value in encoding.video.codec");
+    }
+    return ret;
+}
+
+std::string IngestServer::_createAVStream(const Logger& logger, PlatformAPI* platformAPI, const PlatformAPI::AVStream& stream) {
+    auto result = platformAPI->createAVStream(stream);
+    if (!result.requestError.empty()) {
+        logger.error("createAVStream request error: {}", result.requestError);
+        return "";
+    }
+    if (!result.errors.empty()) {
+        for (auto& err : result.errors) {
+            logger.error("createAVStream error: {}", err.message);
+        }
+        return "";
+    }
+    logger.with("av_stream_id", result.data.id).info("created platform AVStream");
+    return result.data.id;
+}
+
+namespace {
+
+ScalingCascade::Configuration ScalingCascadeConfiguration(const IngestServer::Configuration& configuration, ThreadPool* encodingPool) {
+    ScalingCascade::Configuration ret;
+    ret.pool = encodingPool;
+    ret.useYUVScaler = configuration.useYUVScaler;
+    // lets the decoder move on to the next frame while the encoders are still busy with this one
+    ret.maxLag = 1;
+    return ret;
+}
+
+} // anonymous namespace
+
+IngestServer::Stream::Stream(Logger logger, const Configuration& configuration, const std::string& connectionId, ThreadPool* encodingPool, ThreadPool* backgroundPool)
+    : _logger{logger}, _configuration{configuration}, _connectionId{connectionId}, _backgroundPool{backgroundPool}, _scalingCascade{logger, ScalingCascadeConfiguration(configuration, encodingPool)}
 {
+    if (configuration.latencyTracing) {
+        _latencyTracer = std::make_unique<LatencyTracer>();
+    }
+    if (_configuration.maxSegmentDuration.count() <= 0) {
+        _configuration.maxSegmentDuration = _configuration.targetSegmentDuration * 3 / 2;
+    }
+
+    if (configuration.overloadControl) {
+        _overloadController = std::make_unique<OverloadController>(OverloadController::Configuration{});
+    }
+
     if (configuration.archiveFileStorage) {
         _archiver = std::make_unique<Archiver>(
             logger,
@@ -67,25 +128,79 @@ IngestServer::Stream::Stream(Logger logger, const Configuration& configuration,
     }
 
     if (!configuration.segmentFileStorage.empty()) {
-        _videoDecoder = std::make_unique<VideoDecoder>(logger, &_decodedSegmentSplitter);
-        _segmentSplitter.addHandler(_videoDecoder.get());
         _segmenter = std::make_unique<Segmenter>(logger, &_segmentSplitter, [this]{
-            _videoDecoder->flush();
+            if (_videoDecoder) {
+                _videoDecoder->flush();
+            }
+            _scalingCascade.drain();
             for (auto& encoding : _encodings) {
-                encoding->videoEncoder->flush();
+                if (encoding->parallelEncoder) {
+                    // the packager is told when this segment's output arrives
+                    encoding->parallelEncoder->flush();
+                    continue;
+                }
+                if (encoding->videoEncoder) {
+                    encoding->videoEncoder->flush();
+                }
                 encoding->packager->beginNewSegment();
             }
+            if (_overloadController) {
+                _controlOverload();
+            }
+            if (_ingressQueue) {
+                auto stats = _ingressQueue->stats();
+                _logger.with(
+                    "depth_ms", stats.depth.count(),
+                    "dropped_non_reference_frames", stats.droppedNonReferenceFrames,
+                    "dropped_gop_tail_frames", stats.droppedGOPTailFrames,
+                    "dropped_audio_frames", stats.droppedAudioFrames
+                ).info("ingress queue stats");
+            }
+            if (_latencyTracer) {
+                _logger.with("latency", _latencyTracer->json()).info("latency trace");
+            }
         });
-        addHandler(_segmenter.get());
+        _segmenter->setLatencyTracer(_latencyTracer.get());
+        _segmenter->setSegmentsAtRecoveryPoints(configuration.ingestIntraRefresh);
+        _segmenter->setTargetSegmentDuration(configuration.targetSegmentDuration);
+        _segmenter->setMaxSegmentDuration(_configuration.maxSegmentDuration);
+
+        if (configuration.ingressQueueDepth.count() > 0) {
+            IngressQueue::Configuration queueConfiguration;
+            queueConfiguration.maxDepth = configuration.ingressQueueDepth;
+            _ingressQueue = std::make_unique<IngressQueue>(logger, _segmenter.get(), queueConfiguration);
+            addHandler(_ingressQueue.get());
+        } else {
+            addHandler(_segmenter.get());
+        }
     }
 }
 
 IngestServer::Stream::~Stream() {
+    // finish up whatever's still queued before the streams are marked as no longer live
+    _ingressQueue.reset();
+
+    if (_segmenter) {
+        auto stats = _segmenter->stats();
+        if (stats.segments > 0) {
+            auto milliseconds = [](std::chrono::microseconds duration) {
+                return std::chrono::duration_cast<std::chrono::milliseconds>(duration).count();
+            };
+            _logger.with(
+                "segments", stats.segments,
+                "min_segment_duration_ms", milliseconds(stats.minSegmentDuration),
+                "max_segment_duration_ms", milliseconds(stats.maxSegmentDuration),
+                "average_segment_duration_ms", milliseconds(stats.totalSegmentDuration / stats.segments),
+                "keyframe_interval_ms", milliseconds(stats.keyframeInterval)
+            ).info("segment stats");
+        }
+    }
+
     PlatformAPI::AVStreamPatch patch;
     patch.isLive = false;
 
     for (auto& encoding : _encodings) {
-        if (auto streamId = encoding->segmentManager.configuration().streamId; !streamId.empty()) {
+        if (auto streamId = encoding->segmentManager.streamId(); !streamId.empty()) {
             auto result = _configuration.platformAPI->patchAVStreamById(streamId, patch);
             if (!result.requestError.empty()) {
                 _logger.error("patchAVStream request error: {}", result.requestError);
@@ -104,11 +219,228 @@ void IngestServer::Stream::addEncoding(size_t index, Configuration::Encoding con
     for (auto fs : _configuration.segmentFileStorage) {
         smConfig.storage.emplace_back(fs);
     }
-    smConfig.platformAPI = _configuration.platformAPI;
+    if (_configuration.segmentRegistration) {
+        smConfig.platformAPI = _configuration.platformAPI;
+    }
     smConfig.streamId = std::move(streamId);
+    smConfig.latencyTracer = _latencyTracer.get();
+    if (_configuration.hlsPlaylists) {
+        smConfig.playlistPath = fmt::format("{}/{}.m3u8", _connectionId, index);
+        smConfig.playlist.windowSize = _configuration.hlsPlaylistWindow;
+        smConfig.playlist.targetDuration = _configuration.maxSegmentDuration;
+        smConfig.playlist.partTargetDuration = _configuration.partDuration;
+    }
 
-    auto encoding = std::make_unique<Encoding>(_logger.with("encoding", index), smConfig, configuration.video);
-    _segmentSplitter.addHandler(dynamic_cast<EncodedAudioHandler*>(encoding->packager.get()));
-    _decodedSegmentSplitter.addHandler(encoding->videoEncoder.get());
+    // segment boundaries happen every few seconds, so encoders are kept open across them. segment-
+    // parallel encoders are the exception, since each segment needs to be encoded on its own
+    auto isSegmentParallel = configuration.segmentParallelism > 1 && configuration.video.codec != VideoCodec::copy;
+    configuration.video.forceIDROnFlush = !isSegmentParallel;
+    if (isSegmentParallel && configuration.video.x264.intraRefresh) {
+        _logger.with("encoding", index).warn("intra refresh can't be used with segment parallelism. using idrs");
+        configuration.video.x264.intraRefresh = false;
+    }
+    auto segmentFormat = configuration.segmentFormat.value_or(_configuration.segmentFormat);
+    auto encoding = std::make_unique<Encoding>(_logger.with("encoding", index), smConfig, configuration.video, configuration.segmentParallelism, segmentFormat);
+    encoding->packager->setPartDuration(_configuration.partDuration);
+    if (configuration.video.codec == VideoCodec::copy) {
+        encoding->packager->setSegmentsAtRecoveryPoints(_configuration.ingestIntraRefresh);
+        _segmentSplitter.addHandler(static_cast<EncodedAVHandler*>(encoding->packager.get()));
+    } else {
+        // the decoder is only needed if something is actually transcoded
+        if (!_videoDecoder) {
+            VideoDecoder::Configuration decoderConfiguration;
+            // kept open across segment boundaries, like the encoders above
+            decoderConfiguration.reuseContext = true;
+            decoderConfiguration.threadCount = _configuration.decodingThreads;
+            decoderConfiguration.startsAtRecoveryPoints = _configuration.ingestIntraRefresh;
+            _videoDecoder = std::make_unique<VideoDecoder>(_logger, &_scalingCascade, decoderConfiguration);
+            _videoDecoder->setLatencyTracer(_latencyTracer.get());
+            _segmentSplitter.addHandler(_videoDecoder.get());
+        }
+        if (configuration.video.codec == VideoCodec::x264) {
+            encoding->packager->setSegmentsAtRecoveryPoints(configuration.video.x264.intraRefresh);
+        }
+        if (isSegmentParallel) {
+            // the audio is held back with the video so that they're packaged together. these
+            // encodings are expected to lag, so they're left out of overload control
+            _segmentSplitter.addHandler(static_cast<EncodedAudioHandler*>(encoding->parallelEncoder.get()));
+            _scalingCascade.addHandler(encoding->parallelEncoder.get(), configuration.video.width, configuration.video.height);
+        } else {
+            _segmentSplitter.addHandler(dynamic_cast<EncodedAudioHandler*>(encoding->packager.get()));
+            // each resolution is only scaled once, no matter how many encodings use it
+            _scalingCascade.addHandler(encoding->videoEncoder.get(), configuration.video.width, configuration.video.height);
+            if (_overloadController) {
+                // bigger renditions are the ones viewers are most likely to be watching
+                encoding->rendition = _overloadController->addRendition(configuration.video.width * configuration.video.height);
+            }
+        }
+    }
     _encodings.emplace_back(std::move(encoding));
 }
+
+void IngestServer::Stream::_controlOverload() {
+    OverloadController::Sample sample;
+    for (auto& encoding : _encodings) {
+        if (!encoding->videoEncoder || _overloadController->state(encoding->rendition).isSuspended) {
+            continue;
+        }
+        auto lag = std::chrono::duration_cast<std::chrono::milliseconds>(encoding->packager->encoderLag());
+        sample.encoderLag = std::max(sample.encoderLag, lag);
+    }
+    if (_ingressQueue) {
+        sample.queueDepth = _ingressQueue->stats().depth;
+    }
+
+    if (!_overloadController->update(sample)) {
+        return;
+    }
+
+    _logger.with(
+        "encoder_lag_ms", sample.encoderLag.count(),
+        "queue_depth_ms", sample.queueDepth.count(),
+        "level", _overloadController->level()
+    ).warn("overload level changed");
+
+    for (auto& encoding : _encodings) {
+        if (!encoding->videoEncoder) {
+            continue;
+        }
+        auto& state = _overloadController->state(encoding->rendition);
+        encoding->videoEncoder->setPresetSteps(state.presetSteps);
+        encoding->videoEncoder->setFrameRateDivisor(state.frameRateDivisor);
+        if (state.isSuspended && !encoding->videoEncoder->isSuspended()) {
+            encoding->videoEncoder->setSuspended(true);
+            // the segment that was just begun would otherwise be left open with no video
+            encoding->packager->endSegment();
+        } else if (!state.isSuspended) {
+            encoding->videoEncoder->setSuspended(false);
+        }
+    }
+}
+
+void IngestServer::Stream::writeMasterPlaylist() {
+    std::vector<HLSVariant> variants;
+    for (size_t i = 0; i < _configuration.encodings.size(); ++i) {
+        auto& encoding = _configuration.encodings[i].video;
+        HLSVariant variant;
+        variant.uri = fmt::format("{}.m3u8", i);
+        // passthrough bitrates aren't known upfront, so the configured bitrate is advertised as-is.
+        // it's required for them when playlists are written
+        variant.bandwidth = encoding.bitrate;
+        if (encoding.codec != VideoCodec::copy) {
+            variant.width = encoding.width;
+            variant.height = encoding.height;
+            variant.frameRate = encoding.maxFrameRate;
+        }
+        variant.codecs = _codecs(_logger, encoding);
+        auto& packager = _encodings[i]->packager;
+        variant.hasIndependentSegments = !packager || !packager->segmentsAtRecoveryPoints();
+        variants.emplace_back(std::move(variant));
+    }
+    auto playlist = RenderHLSMasterPlaylist(variants);
+
+    auto path = _connectionId + "/master.m3u8";
+    for (auto fs : _configuration.segmentFileStorage) {
+        auto file = fs->createFile(path);
+        if (!file) {
+            _logger.error("unable to create master playlist file");
+            continue;
+        }
+        auto ok = file->write(playlist.data(), playlist.size());
+        if (!file->close() || !ok) {
+            _logger.error("error writing master playlist");
+            continue;
+        }
+        _logger.with("url", fs->downloadURL(path)).info("wrote master playlist");
+    }
+}
+
+void IngestServer::Stream::handleEncodedVideoConfig(const void* data, size_t len) {
+    _registerPassthroughEncodings(data, len);
+    EncodedAVSplitter::handleEncodedVideoConfig(data, len);
+}
+
+void IngestServer::Stream::handleEncodedVideo(std::chrono::microseconds pts, std::chrono::microseconds dts, const void* data, size_t len) {
+    if (_latencyTracer) {
+        _latencyTracer->stamp(LatencyTracer::Stage::Ingest, pts);
+    }
+    EncodedAVSplitter::handleEncodedVideo(pts, dts, data, len);
+}
+
+void IngestServer::Stream::handleEncodedVideoPacket(std::chrono::microseconds pts, std::chrono::microseconds dts, const EncodedPacket& packet) {
+    if (_latencyTracer) {
+        _latencyTracer->stamp(LatencyTracer::Stage::Ingest, pts);
+    }
+    EncodedAVSplitter::handleEncodedVideoPacket(pts, dts, packet);
+}
+
+void IngestServer::Stream::handleEncodedVideoConfigPacket(const EncodedPacket& packet) {
+    _registerPassthroughEncodings(packet.data(), packet.size());
+    EncodedAVSplitter::handleEncodedVideoConfigPacket(packet);
+}
+
+void IngestServer::Stream::_registerPassthroughEncodings(const void* data, size_t len) {
+    if (!_configuration.platformAPI) {
+        return;
+    }
+
+    auto hasPending = std::any_of(_encodings.begin(), _encodings.end(), [](const std::unique_ptr<Encoding>& encoding) {
+        return encoding->configuration.codec == VideoCodec::copy && encoding->segmentManager.streamId().empty();
+    });
+    if (!hasPending) {
+        return;
+    }
+
+    AVCDecoderConfigurationRecord config;
+    if (!config.decode(data, len) || config.sequenceParameterSets.empty()) {
+        _logger.error("unable to decode video config for passthrough encoding");
+        return;
+    }
+
+    auto& spsData = config.sequenceParameterSets[0];
+    h264::nal_unit nalu;
+    h264::bitstream bs{spsData.data(), spsData.size()};
+    if (auto err = nalu.decode(&bs, spsData.size())) {
+        _logger.error("error decoding sps nalu for passthrough encoding: {}", err.message);
+        return;
+    }
+    bs = {nalu.rbsp_byte.data(), nalu.rbsp_byte.size()};
+    h264::seq_parameter_set_rbsp sps;
+    if (auto err = sps.decode(&bs)) {
+        _logger.error("error decoding sps rbsp for passthrough encoding: {}", err.message);
+        return;
+    }
+
+    PlatformAPI::AVStream stream;
+    stream.codecs = { "mp4a.40.2", config.codecString() };
+    stream.maximumSegmentDuration = std::chrono::seconds(30);
+    stream.videoHeight = sps.FrameCroppingRectangleHeight();
+    stream.videoWidth = sps.FrameCroppingRectangleWidth();
+    stream.gameId = _configuration.gameId;
+    stream.isLive = true;
+
+    // encodings that are already being registered are left alone
+    std::vector<Encoding*> pending;
+    for (auto& encoding : _encodings) {
+        if (encoding->configuration.codec == VideoCodec::copy && encoding->segmentManager.expectStreamId()) {
+            pending.emplace_back(encoding.get());
+        }
+    }
+    if (pending.empty()) {
+        return;
+    }
+
+    auto registerEncodings = [self = shared_from_this(), pending, stream]() mutable {
+        for (auto encoding : pending) {
+            // the ingest bitrate isn't known upfront, so the configured bitrate is advertised as-is
+            stream.bitrate = encoding->configuration.bitrate;
+            // if this fails, the stream id stays empty and the next video config tries again
+            encoding->segmentManager.setStreamId(_createAVStream(self->_logger, self->_configuration.platformAPI, stream));
+        }
+    };
+    if (_backgroundPool) {
+        _backgroundPool->post(std::move(registerEncodings));
+    } else {
+        registerEncodings();
+    }
+}
@@ -1,17 +1,23 @@
 #pragma once
 
 #include <memory>
+#include <optional>
 
 #include "archiver.hpp"
-#include "av_splitter.hpp"
 #include "encoded_av_splitter.hpp"
 #include "file_storage.hpp"
+#include "ingress_queue.hpp"
+#include "latency_tracer.hpp"
+#include "overload_controller.hpp"
 #include "packager.hpp"
 #include "platform_api.hpp"
 #include "rtmp_connection.hpp"
+#include "scaling_cascade.hpp"
+#include "segment_parallel_encoder.hpp"
 #include "segmenter.hpp"
 #include "segment_manager.hpp"
 #include "tcp_server.hpp"
+#include "thread_pool.hpp"
 #include "video_decoder.hpp"
 #include "video_encoder.hpp"
 
@@ -23,8 +29,82 @@ public:
         PlatformAPI* platformAPI = nullptr;
         std::string gameId;
 
+        // If non-zero, segmenting and transcoding are done on a separate thread per stream, behind
+        // a queue that holds up to this much media. See IngressQueue. Otherwise they're done on the
+        // connection's thread, which blocks event-driven workers, so this is required for them.
+        std::chrono::milliseconds ingressQueueDepth{0};
+
+        // If non-zero, each stream's encodings are run concurrently on a pool of this many threads
+        // shared by all streams. Otherwise they're run one after another.
+        size_t encodingThreads = 0;
+
+        // The number of threads shared by all streams for work that blocks on the platform API or
+        // storage, such as registering passthrough encodings and tearing streams down, so that it
+        // doesn't hold up the connections' threads.
+        size_t backgroundThreads = 4;
+
+        // The number of threads each stream's decoder uses. If zero, one per core is used.
+        int decodingThreads = 1;
+
+        // If true, ingest video may use periodic intra refresh instead of IDRs, and it's segmented
+        // at recovery points. This doesn't affect transcoded encodings, which are segmented at
+        // whatever their own encoders produce.
+        bool ingestIntraRefresh = false;
+
+        // If true, renditions are scaled with YUVScaler instead of libswscale.
+        bool useYUVScaler = false;
+
+        // If true, streams whose encoders can't keep up with realtime shed work from their less
+        // important renditions until they can. See OverloadController.
+        bool overloadControl = false;
+
+        // If true, each stream measures how long its video frames take to get through each stage
+        // of the pipeline and logs a summary at every segment boundary. See LatencyTracer.
+        bool latencyTracing = false;
+
+        // The duration that segments are cut as close to as the source's keyframes allow. See
+        // Segmenter.
+        std::chrono::microseconds targetSegmentDuration = Segmenter::DefaultTargetSegmentDuration;
+
+        // The longest that segments may be, as far as the source's keyframes allow. HLS media
+        // playlists advertise it as their target duration. If zero, it's one and a half times
+        // targetSegmentDuration.
+        std::chrono::microseconds maxSegmentDuration{0};
+
+        // The format of encodings' segments unless they specify their own.
+        Packager::SegmentFormat segmentFormat = Packager::SegmentFormat::TS;
+
+        // If non-zero, segments are also uploaded in parts of up to this duration as they're
+        // packaged, for LL-HLS. See Packager::setPartDuration.
+        std::chrono::milliseconds partDuration{0};
+
+        // If true, each segment storage gets an HLS media playlist per encoding at
+        // "<connection id>/<encoding index>.m3u8" and a master playlist at
+        // "<connection id>/master.m3u8". Media playlists are rewritten as segments complete, so
+        // segments are playable without a round trip to the platform API. Passthrough encodings
+        // need a bitrate for the master playlist's BANDWIDTH.
+        bool hlsPlaylists = false;
+
+        // The number of segments kept in the media playlists. If zero, they're EVENT playlists that
+        // keep the whole stream.
+        size_t hlsPlaylistWindow = 6;
+
+        // If false, segment replicas aren't registered with the platform API, which is only used
+        // for AVStreams.
+        bool segmentRegistration = true;
+
         struct Encoding {
+            // If video.codec is VideoCodec::copy, the ingest video is packaged without transcoding
+            // and video's other fields are ignored.
             VideoEncoderConfiguration video;
+
+            // If greater than one, consecutive segments are encoded in parallel by this many
+            // encoder instances, at the cost of a segment or so of latency. This is for presets
+            // too slow for a single encoder to keep up with. See SegmentParallelEncoder.
+            size_t segmentParallelism = 0;
+
+            // If set, overrides Configuration::segmentFormat for this encoding.
+            std::optional<Packager::SegmentFormat> segmentFormat;
         };
 
         std::vector<Encoding> encodings;
@@ -39,57 +119,139 @@ public:
         if (!_configuration.segmentFileStorage.empty() && _configuration.encodings.empty()) {
             _logger.warn("segment storage was provided without encodings. segments will not be created");
         }
+        if (_configuration.encodingThreads > 0) {
+            _encodingPool = std::make_unique<ThreadPool>(_configuration.encodingThreads);
+        }
+        _backgroundPool = std::make_unique<ThreadPool>(std::max<size_t>(_configuration.backgroundThreads, 1));
     }
 
-    virtual ~IngestServer() {}
+    // Connections are stopped here so that their streams are gone before the encoding pool is. Some
+    // may still be finishing up on the background pool, so that's waited for too.
+    virtual ~IngestServer() {
+        stop();
+        _backgroundPool.reset();
+    }
 
     virtual std::shared_ptr<EncodedAVHandler> authenticate(const std::string& connectionId) override;
+    virtual void runBlocking(std::function<void()> f) override;
 
 private:
     const Logger _logger;
     const Configuration _configuration;
+    std::unique_ptr<ThreadPool> _encodingPool;
+    std::unique_ptr<ThreadPool> _backgroundPool;
 
-    class Stream : public EncodedAVSplitter {
+    class Stream : public EncodedAVSplitter, public std::enable_shared_from_this<Stream> {
     public:
-        Stream(Logger logger, const Configuration& configuration, const std::string& connectionId);
+        Stream(Logger logger, const Configuration& configuration, const std::string& connectionId, ThreadPool* encodingPool, ThreadPool* backgroundPool);
         virtual ~Stream();
 
         void addEncoding(size_t index, Configuration::Encoding configuration, std::string streamId = "");
 
+        // writeMasterPlaylist writes the master playlist to each segment storage. It should be
+        // invoked once all of the encodings have been added.
+        void writeMasterPlaylist();
+
+        virtual void handleEncodedVideoConfig(const void* data, size_t len) override;
+        virtual void handleEncodedVideo(std::chrono::microseconds pts, std::chrono::microseconds dts, const void* data, size_t len) override;
+        virtual void handleEncodedVideoConfigPacket(const EncodedPacket& packet) override;
+        virtual void handleEncodedVideoPacket(std::chrono::microseconds pts, std::chrono::microseconds dts, const EncodedPacket& packet) override;
+
     private:
         Logger _logger;
         Configuration _configuration;
+        const std::string _connectionId;
+        ThreadPool* const _backgroundPool;
+
+        // Null unless latency tracing is enabled. This must outlive everything below it.
+        std::unique_ptr<LatencyTracer> _latencyTracer;
 
         std::unique_ptr<Archiver> _archiver;
 
         struct Encoding {
-            Encoding(Logger logger, SegmentManager::Configuration smConfiguration, VideoEncoderConfiguration encoderConfiguration)
-                : segmentManager{logger, std::move(smConfiguration)}
+            Encoding(Logger logger, SegmentManager::Configuration smConfiguration, VideoEncoderConfiguration encoderConfiguration, size_t segmentParallelism = 0, Packager::SegmentFormat segmentFormat = Packager::SegmentFormat::TS)
+                : configuration{encoderConfiguration}, segmentManager{logger, smConfiguration}
             {
                 switch(encoderConfiguration.codec) {
+                    case VideoCodec::copy:
+                        packager = std::make_unique<H264Packager>(logger, &segmentManager, segmentFormat);
+                        break;
                     case VideoCodec::x264:
-                        packager = std::make_unique<H264Packager>(logger, &segmentManager);
-                        videoEncoder = std::make_shared<H264VideoEncoder>(logger, packager.get(), std::move(encoderConfiguration));
+                        packager = std::make_unique<H264Packager>(logger, &segmentManager, segmentFormat);
                         break;
                     case VideoCodec::x265:
-                        packager = std::make_unique<H265Packager>(logger, &segmentManager);
-                        videoEncoder = std::make_shared<H265VideoEncoder>(logger, packager.get(), std::move(encoderConfiguration));
+                        packager = std::make_unique<H265Packager>(logger, &segmentManager, segmentFormat);
                         break;
                     default:
                         logger.error("encoderConfiguration.codec is null. expect a segfault soon");
                         break;
                 }
+                if (packager) {
+                    packager->setLatencyTracer(smConfiguration.latencyTracer);
+                }
+
+                if (encoderConfiguration.codec != VideoCodec::x264 && encoderConfiguration.codec != VideoCodec::x265) {
+                    return;
+                }
+                auto factory = [logger, encoderConfiguration](EncodedVideoHandler* handler) -> std::unique_ptr<VideoEncoder> {
+                    if (encoderConfiguration.codec == VideoCodec::x265) {
+                        return std::make_unique<H265VideoEncoder>(logger, handler, encoderConfiguration);
+                    }
+                    return std::make_unique<H264VideoEncoder>(logger, handler, encoderConfiguration);
+                };
+                if (segmentParallelism > 1) {
+                    SegmentParallelEncoder::Configuration parallelConfiguration;
+                    parallelConfiguration.instances = segmentParallelism;
+                    auto segmentPackager = packager.get();
+                    parallelEncoder = std::make_unique<SegmentParallelEncoder>(logger, packager.get(), factory, parallelConfiguration, [segmentPackager] {
+                        segmentPackager->beginNewSegment();
+                    });
+                } else {
+                    videoEncoder = factory(packager.get());
+                    videoEncoder->setLatencyTracer(smConfiguration.latencyTracer);
+                }
             }
 
+            const VideoEncoderConfiguration configuration;
             SegmentManager segmentManager;
             std::shared_ptr<Packager> packager;
+
+            // Null for passthrough encodings, which package the ingest video as-is, and for
+            // segment-parallel encodings.
             std::shared_ptr<VideoEncoder> videoEncoder;
+
+            // Only set for segment-parallel encodings. It feeds the packager its audio too.
+            std::unique_ptr<SegmentParallelEncoder> parallelEncoder;
+
+            // The encoding's index within the overload controller, if it has one.
+            size_t rendition = 0;
         };
 
         std::vector<std::unique_ptr<Encoding>> _encodings;
-        VideoSplitter _decodedSegmentSplitter;
+        ScalingCascade _scalingCascade;
         std::unique_ptr<VideoDecoder> _videoDecoder;
         EncodedAVSplitter _segmentSplitter;
         std::unique_ptr<Segmenter> _segmenter;
+        std::unique_ptr<IngressQueue> _ingressQueue;
+
+        // Null unless overload control is enabled.
+        std::unique_ptr<OverloadController> _overloadController;
+
+        // _controlOverload feeds the overload controller a sample and applies any changes it makes.
+        // It's invoked at segment boundaries, once the encoders have been flushed.
+        void _controlOverload();
+
+        // Passthrough encodings can't be registered with the platform until the ingest's
+        // resolution and profile are known, so that's done on the background pool when the first
+        // video config arrives. Their segments wait for it before they're registered.
+        void _registerPassthroughEncodings(const void* data, size_t len);
     };
+
+    // _codecs returns the RFC 6381 codecs of an encoding's audio and video, or an empty vector if
+    // they aren't known upfront.
+    static std::vector<std::string> _codecs(const Logger& logger, const VideoEncoderConfiguration& configuration);
+
+    // _createAVStream registers a stream with the platform API, returning its id or an empty string
+    // on failure.
+    static std::string _createAVStream(const Logger& logger, PlatformAPI* platformAPI, const PlatformAPI::AVStream& stream);
 };
@@ -0,0 +1,195 @@
+#include "ingress_queue.hpp"
+
+#include <algorithm>
+
+#include "mpeg4.hpp"
+
+IngressQueue::IngressQueue(Logger logger, EncodedAVHandler* handler, Configuration configuration)
+    : _logger{std::move(logger)}, _handler{handler}, _configuration{configuration}
+{
+    _thread = std::thread([this] {
+        _run();
+    });
+}
+
+IngressQueue::~IngressQueue() {
+    {
+        std::lock_guard<std::mutex> l{_mutex};
+        _isDestructing = true;
+    }
+    _cv.notify_one();
+    _thread.join();
+}
+
+void IngressQueue::handleEncodedAudioConfig(const void* data, size_t len) {
+    handleEncodedAudioConfigPacket(EncodedPacket::Borrow(data, len));
+}
+
+void IngressQueue::handleEncodedAudio(std::chrono::microseconds pts, const void* data, size_t len) {
+    handleEncodedAudioPacket(pts, EncodedPacket::Borrow(data, len));
+}
+
+void IngressQueue::handleEncodedVideoConfig(const void* data, size_t len) {
+    handleEncodedVideoConfigPacket(EncodedPacket::Borrow(data, len));
+}
+
+void IngressQueue::handleEncodedVideo(std::chrono::microseconds pts, std::chrono::microseconds dts, const void* data, size_t len) {
+    handleEncodedVideoPacket(pts, dts, EncodedPacket::Borrow(data, len));
+}
+
+void IngressQueue::handleEncodedVideoDiscontinuity() {
+    _push(ItemType::VideoDiscontinuity, {}, {}, std::nullopt, {});
+}
+
+void IngressQueue::handleEncodedAudioConfigPacket(const EncodedPacket& packet) {
+    _push(ItemType::AudioConfig, {}, {}, std::nullopt, packet);
+}
+
+void IngressQueue::handleEncodedAudioPacket(std::chrono::microseconds pts, const EncodedPacket& packet) {
+    {
+        std::lock_guard<std::mutex> l{_mutex};
+        if (_depth(pts) > _configuration.maxDepth * 2) {
+            ++_droppedAudioFrames;
+            return;
+        }
+    }
+    _push(ItemType::Audio, pts, {}, pts, packet);
+}
+
+void IngressQueue::handleEncodedVideoConfigPacket(const EncodedPacket& packet) {
+    AVCDecoderConfigurationRecord config;
+    if (config.decode(packet.data(), packet.size())) {
+        _naluLengthSize = config.lengthSizeMinusOne + 1;
+    } else {
+        _logger.error("unable to decode video config");
+    }
+    _push(ItemType::VideoConfig, {}, {}, std::nullopt, packet);
+}
+
+void IngressQueue::handleEncodedVideoPacket(std::chrono::microseconds pts, std::chrono::microseconds dts, const EncodedPacket& packet) {
+    auto frameType = _frameType(packet);
+
+    if (frameType == FrameType::IDR) {
+        _isDroppingGOPTail = false;
+    } else if (_isDroppingGOPTail) {
+        // once part of a gop is gone, nothing else in it can be decoded
+        ++_droppedGOPTailFrames;
+        return;
+    } else {
+        std::lock_guard<std::mutex> l{_mutex};
+        auto depth = _depth(dts);
+        if (depth > _configuration.maxDepth && !_isOverloaded) {
+            _isOverloaded = true;
+            _logger.with("depth_ms", std::chrono::duration_cast<std::chrono::milliseconds>(depth).count()).warn("ingress queue is overloaded. dropping frames");
+        }
+        if (depth > _configuration.maxDepth * 3 / 2) {
+            _isDroppingGOPTail = true;
+            ++_droppedGOPTailFrames;
+            return;
+        } else if (depth > _configuration.maxDepth && frameType == FrameType::NonReference) {
+            ++_droppedNonReferenceFrames;
+            return;
+        }
+    }
+
+    _push(ItemType::Video, pts, dts, dts, packet);
+}
+
+IngressQueue::Stats IngressQueue::stats() const {
+    Stats ret;
+    ret.depth = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::microseconds{_depthMicroseconds.load()});
+    ret.droppedNonReferenceFrames = _droppedNonReferenceFrames;
+    ret.droppedGOPTailFrames = _droppedGOPTailFrames;
+    ret.droppedAudioFrames = _droppedAudioFrames;
+    return ret;
+}
+
+IngressQueue::FrameType IngressQueue::_frameType(const EncodedPacket& packet) const {
+    FrameDescriptor storage;
+    auto descriptor = DescribeFrame(packet, _naluLengthSize, &storage);
+    if (!descriptor) {
+        // if we can't tell, play it safe
+        return FrameType::Reference;
+    }
+    return descriptor->isKeyframe ? FrameType::IDR : descriptor->isReference ? FrameType::Reference : FrameType::NonReference;
+}
+
+std::chrono::microseconds IngressQueue::_depth(std::chrono::microseconds timestamp) const {
+    // configuration records are rare, so there are never many to skip
+    auto oldest = std::find_if(_queue.begin(), _queue.end(), [](const Item& item) { return item.timestamp.has_value(); });
+    if (oldest == _queue.end() || timestamp < *oldest->timestamp) {
+        return std::chrono::microseconds{0};
+    }
+    return timestamp - *oldest->timestamp;
+}
+
+std::chrono::microseconds IngressQueue::_queuedDepth() const {
+    auto newest = std::find_if(_queue.rbegin(), _queue.rend(), [](const Item& item) { return item.timestamp.has_value(); });
+    return newest == _queue.rend() ? std::chrono::microseconds{0} : _depth(*newest->timestamp);
+}
+
+void IngressQueue::_push(ItemType type, std::chrono::microseconds pts, std::chrono::microseconds dts, std::optional<std::chrono::microseconds> timestamp, const EncodedPacket& packet) {
+    Item item;
+    item.type = type;
+    item.pts = pts;
+    item.dts = dts;
+    item.timestamp = timestamp;
+    item.packet = packet.retained();
+
+    {
+        std::lock_guard<std::mutex> l{_mutex};
+        _queue.emplace_back(std::move(item));
+        _depthMicroseconds = _queuedDepth().count();
+    }
+    _cv.notify_one();
+}
+
+void IngressQueue::_run() {
+    std::unique_lock<std::mutex> l{_mutex};
+
+    while (true) {
+        _cv.wait(l, [&]{ return !_queue.empty() || _isDestructing; });
+        if (_queue.empty()) {
+            break;
+        }
+
+        auto item = std::move(_queue.front());
+        _queue.pop_front();
+
+        auto depth = _queuedDepth();
+        _depthMicroseconds = depth.count();
+        if (_isOverloaded && depth < _configuration.maxDepth / 2) {
+            _isOverloaded = false;
+            _logger.with(
+                "dropped_non_reference_frames", _droppedNonReferenceFrames.load(),
+                "dropped_gop_tail_frames", _droppedGOPTailFrames.load(),
+                "dropped_audio_frames", _droppedAudioFrames.load()
+            ).info("ingress queue recovered");
+        }
+
+        l.unlock();
+        _dispatch(item);
+        item.packet = {};
+        l.lock();
+    }
+}
+
+void IngressQueue::_dispatch(const Item& item) {
+    switch (item.type) {
+    case ItemType::AudioConfig:
+        _handler->handleEncodedAudioConfigPacket(item.packet);
+        break;
+    case ItemType::Audio:
+        _handler->handleEncodedAudioPacket(item.pts, item.packet);
+        break;
+    case ItemType::VideoConfig:
+        _handler->handleEncodedVideoConfigPacket(item.packet);
+        break;
+    case ItemType::Video:
+        _handler->handleEncodedVideoPacket(item.pts, item.dts, item.packet);
+        break;
+    case ItemType::VideoDiscontinuity:
+        _handler->handleEncodedVideoDiscontinuity();
+        break;
+    }
+}
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+
+#include "encoded_av_handler.hpp"
+#include "logger.hpp"
+
+// IngressQueue moves the handling of encoded audio and video onto its own thread so that a slow
+// handler doesn't stall whoever is feeding it. The queue is bounded by the span of media that it
+// holds, and when it's overloaded it sheds whole frames such that what remains is still decodable:
+//
+// 1. Beyond maxDepth, non-reference video frames are dropped.
+// 2. Beyond 1.5 times maxDepth, the rest of the current GOP is dropped up to the next IDR frame.
+// 3. Beyond twice maxDepth, audio is dropped as well.
+//
+// Configuration records and IDR frames are never dropped. Video is expected to be H.264.
+class IngressQueue : public EncodedAVHandler {
+public:
+    struct Configuration {
+        std::chrono::milliseconds maxDepth{2000};
+    };
+
+    struct Stats {
+        // The span of media currently queued, measured by decode timestamps.
+        std::chrono::milliseconds depth{0};
+
+        uint64_t droppedNonReferenceFrames = 0;
+        uint64_t droppedGOPTailFrames = 0;
+        uint64_t droppedAudioFrames = 0;
+    };
+
+    IngressQueue(Logger logger, EncodedAVHandler* handler, Configuration configuration);
+
+    // Anything still queued is handled before the destructor returns.
+    virtual ~IngressQueue();
+
+    virtual void handleEncodedAudioConfig(const void* data, size_t len) override;
+    virtual void handleEncodedAudio(std::chrono::microseconds pts, const void* data, size_t len) override;
+    virtual void handleEncodedVideoConfig(const void* data, size_t len) override;
+    virtual void handleEncodedVideo(std::chrono::microseconds pts, std::chrono::microseconds dts, const void* data, size_t len) override;
+    virtual void handleEncodedVideoDiscontinuity() override;
+
+    // Shared packets are queued as-is. Borrowed ones are copied.
+    virtual void handleEncodedAudioConfigPacket(const EncodedPacket& packet) override;
+    virtual void handleEncodedAudioPacket(std::chrono::microseconds pts, const EncodedPacket& packet) override;
+    virtual void handleEncodedVideoConfigPacket(const EncodedPacket& packet) override;
+    virtual void handleEncodedVideoPacket(std::chrono::microseconds pts, std::chrono::microseconds dts, const EncodedPacket& packet) override;
+
+    // stats may be invoked from any thread.
+    Stats stats() const;
+
+private:
+    const Logger _logger;
+    EncodedAVHandler* const _handler;
+    const Configuration _configuration;
+
+    enum class ItemType {
+        AudioConfig,
+        Audio,
+        VideoConfig,
+        Video,
+        VideoDiscontinuity,
+    };
+
+    struct Item {
+        ItemType type;
+        std::chrono::microseconds pts{0};
+        std::chrono::microseconds dts{0};
+        // The timestamp used to measure depth. Configuration records and discontinuities don't have
+        // one, so they don't count towards it.
+        std::optional<std::chrono::microseconds> timestamp;
+        EncodedPacket packet;
+    };
+
+    enum class FrameType {
+        IDR,
+        Reference,
+        NonReference,
+    };
+
+    // These are only accessed by the producer.
+    size_t _naluLengthSize = 4;
+    bool _isDroppingGOPTail = false;
+
+    std::thread _thread;
+    mutable std::mutex _mutex;
+    std::condition_variable _cv;
+    std::deque<Item> _queue;
+    bool _isDestructing = false;
+    bool _isOverloaded = false;
+
+    std::atomic<int64_t> _depthMicroseconds{0};
+    std::atomic<uint64_t> _droppedNonReferenceFrames{0};
+    std::atomic<uint64_t> _droppedGOPTailFrames{0};
+    std::atomic<uint64_t> _droppedAudioFrames{0};
+
+    FrameType _frameType(const EncodedPacket& packet) const;
+    // _depth returns the span from the oldest queued timestamp to the given one. _queuedDepth returns
+    // the span of everything queued. The mutex must be held.
+    std::chrono::microseconds _depth(std::chrono::microseconds timestamp) const;
+    std::chrono::microseconds _queuedDepth() const;
+    void _push(ItemType type, std::chrono::microseconds pts, std::chrono::microseconds dts, std::optional<std::chrono::microseconds> timestamp, const EncodedPacket& packet);
+    void _run();
+    void _dispatch(const Item& item);
+};
@@ -0,0 +1,150 @@
+#include <gtest/gtest.h>
+
+#include <future>
+
+#include "ingress_queue.hpp"
+#include "logger_test.hpp"
+#include "mpeg4.hpp"
+
+namespace {
+
+struct TestHandler : EncodedAVHandler {
+    std::shared_future<void> gate;
+    std::vector<std::string> received;
+
+    virtual void handleEncodedAudioConfig(const void* data, size_t len) override {
+        received.emplace_back("audio config");
+    }
+
+    virtual void handleEncodedAudio(std::chrono::microseconds pts, const void* data, size_t len) override {
+        received.emplace_back("audio");
+    }
+
+    virtual void handleEncodedVideoConfig(const void* data, size_t len) override {
+        if (gate.valid()) {
+            gate.wait();
+        }
+        received.emplace_back("video config");
+    }
+
+    virtual void handleEncodedVideo(std::chrono::microseconds pts, std::chrono::microseconds dts, const void* data, size_t len) override {
+        auto header = reinterpret_cast<const uint8_t*>(data)[4];
+        received.emplace_back((header & 0x1f) == 5 ? "idr" : (header & 0x60) ? "p" : "b");
+    }
+};
+
+std::vector<uint8_t> VideoConfig() {
+    AVCDecoderConfigurationRecord config;
+    config.avcProfileIndication = 100;
+    config.profileCompatibility = 0;
+    config.avcLevelIndication = 31;
+    config.lengthSizeMinusOne = 3;
+    config.sequenceParameterSets.push_back({0x67, 0x64, 0x00, 0x1f});
+    config.pictureParameterSets.push_back({0x68, 0xee, 0x3c, 0x80});
+    return config.encode();
+}
+
+// Frame returns a single-slice avcc frame with the given nal unit header.
+std::vector<uint8_t> Frame(uint8_t header) {
+    return {0x00, 0x00, 0x00, 0x02, header, 0x88};
+}
+
+const auto IDR = Frame(0x65);
+const auto P = Frame(0x41);
+const auto B = Frame(0x01);
+
+} // anonymous namespace
+
+TEST(IngressQueue, passthrough) {
+    TestLogDestination logDestination;
+    TestHandler handler;
+    auto config = VideoConfig();
+
+    {
+        IngressQueue queue{&logDestination, &handler, {}};
+        queue.handleEncodedVideoConfig(config.data(), config.size());
+        queue.handleEncodedAudioConfig("x", 1);
+        queue.handleEncodedVideo(std::chrono::milliseconds(0), std::chrono::milliseconds(0), IDR.data(), IDR.size());
+        queue.handleEncodedAudio(std::chrono::milliseconds(10), "x", 1);
+        queue.handleEncodedVideo(std::chrono::milliseconds(66), std::chrono::milliseconds(33), P.data(), P.size());
+        queue.handleEncodedVideo(std::chrono::milliseconds(33), std::chrono::milliseconds(66), B.data(), B.size());
+    }
+
+    EXPECT_EQ(handler.received, (std::vector<std::string>{"video config", "audio config", "idr", "audio", "p", "b"}));
+}
+
+TEST(IngressQueue, dropPolicy) {
+    TestHandler handler;
+    std::promise<void> gate;
+    handler.gate = gate.get_future().share();
+    auto config = VideoConfig();
+
+    IngressQueue::Stats stats;
+    {
+        IngressQueue::Configuration configuration;
+        configuration.maxDepth = std::chrono::milliseconds(1000);
+        IngressQueue queue{Logger::Void, &handler, configuration};
+
+        // the handler blocks on the first config, so everything after it stays queued
+        queue.handleEncodedVideoConfig(config.data(), config.size());
+
+        // ipbpb... with an idr every two seconds, for five seconds
+        for (int i = 0; i < 150; ++i) {
+            auto dts = std::chrono::milliseconds(i * 1000 / 30);
+            auto& frame = i % 60 == 0 ? IDR : i % 2 ? P : B;
+            if (i == 90) {
+                queue.handleEncodedVideoConfig(config.data(), config.size());
+            }
+            queue.handleEncodedVideo(dts, dts, frame.data(), frame.size());
+        }
+        queue.handleEncodedAudio(std::chrono::milliseconds(5000), "x", 1);
+
+        stats = queue.stats();
+        gate.set_value();
+    }
+
+    EXPECT_GT(stats.depth, std::chrono::milliseconds(1000));
+    EXPECT_GT(stats.droppedNonReferenceFrames, 0);
+    EXPECT_GT(stats.droppedGOPTailFrames, 0);
+    EXPECT_EQ(stats.droppedAudioFrames, 1);
+
+    EXPECT_EQ(std::count(handler.received.begin(), handler.received.end(), "idr"), 3);
+    EXPECT_EQ(std::count(handler.received.begin(), handler.received.end(), "video config"), 2);
+    EXPECT_EQ(std::count(handler.received.begin(), handler.received.end(), "audio"), 0);
+    EXPECT_EQ(handler.received.size() + stats.droppedNonReferenceFrames + stats.droppedGOPTailFrames, 152);
+
+    // within the first second nothing is dropped
+    EXPECT_EQ(std::vector<std::string>(handler.received.begin(), handler.received.begin() + 5), (std::vector<std::string>{"video config", "idr", "p", "b", "p"}));
+}
+
+TEST(IngressQueue, configDepth) {
+    TestLogDestination logDestination;
+    TestHandler handler;
+    std::promise<void> gate;
+    handler.gate = gate.get_future().share();
+    auto config = VideoConfig();
+
+    IngressQueue::Stats stats;
+    {
+        IngressQueue::Configuration configuration;
+        configuration.maxDepth = std::chrono::milliseconds(1000);
+        IngressQueue queue{&logDestination, &handler, configuration};
+
+        // configs arrive before any media, which doesn't start at zero
+        queue.handleEncodedVideoConfig(config.data(), config.size());
+        queue.handleEncodedAudioConfig("x", 1);
+        for (int i = 0; i < 15; ++i) {
+            auto dts = std::chrono::seconds(100) + std::chrono::milliseconds(i * 1000 / 30);
+            auto& frame = i == 0 ? IDR : i % 2 ? P : B;
+            queue.handleEncodedVideo(dts, dts, frame.data(), frame.size());
+        }
+
+        stats = queue.stats();
+        gate.set_value();
+    }
+
+    EXPECT_LT(stats.depth, std::chrono::milliseconds(500));
+    EXPECT_EQ(stats.droppedNonReferenceFrames, 0);
+    EXPECT_EQ(stats.droppedGOPTailFrames, 0);
+    EXPECT_EQ(handler.received.size(), 17);
+}
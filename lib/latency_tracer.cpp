@@ -0,0 +1,156 @@
+#include "latency_tracer.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <iterator>
+
+#include <nlohmann/json.hpp>
+
+void LatencyHistogram::record(std::chrono::microseconds value) {
+    auto v = static_cast<uint64_t>(std::max<int64_t>(value.count(), 0));
+    ++_buckets[_bucketIndex(v)];
+    if (!_count || v < _min) {
+        _min = v;
+    }
+    if (v > _max) {
+        _max = v;
+    }
+    ++_count;
+    _sum += v;
+}
+
+std::chrono::microseconds LatencyHistogram::min() const {
+    return std::chrono::microseconds{static_cast<int64_t>(_min)};
+}
+
+std::chrono::microseconds LatencyHistogram::max() const {
+    return std::chrono::microseconds{static_cast<int64_t>(_max)};
+}
+
+std::chrono::microseconds LatencyHistogram::mean() const {
+    return std::chrono::microseconds{_count ? static_cast<int64_t>(_sum / _count) : 0};
+}
+
+std::chrono::microseconds LatencyHistogram::percentile(double p) const {
+    if (!_count) {
+        return std::chrono::microseconds{0};
+    }
+    auto target = static_cast<uint64_t>(std::clamp(p, 0.0, 100.0) / 100.0 * _count + 0.5);
+    target = std::max<uint64_t>(target, 1);
+    uint64_t seen = 0;
+    for (size_t i = 0; i < BucketCount; ++i) {
+        seen += _buckets[i];
+        if (seen >= target) {
+            return std::chrono::microseconds{static_cast<int64_t>(std::clamp(_bucketValue(i), _min, _max))};
+        }
+    }
+    return max();
+}
+
+size_t LatencyHistogram::_bucketIndex(uint64_t value) {
+    if (value < SubBucketCount) {
+        return value;
+    }
+    value = std::min<uint64_t>(value, (uint64_t(2) << MaxExponent) - 1);
+    int exponent = 63 - __builtin_clzll(value);
+    auto shift = exponent - SubBucketBits + 1;
+    return SubBucketCount + (exponent - SubBucketBits) * (SubBucketCount / 2) + ((value >> shift) - SubBucketCount / 2);
+}
+
+uint64_t LatencyHistogram::_bucketValue(size_t index) {
+    if (index < SubBucketCount) {
+        return index;
+    }
+    index -= SubBucketCount;
+    auto exponent = index / (SubBucketCount / 2) + SubBucketBits;
+    auto shift = exponent - SubBucketBits + 1;
+    auto subBucket = index % (SubBucketCount / 2) + SubBucketCount / 2;
+    return ((subBucket + 1) << shift) - 1;
+}
+
+const char* LatencyTracer::StageName(Stage stage) {
+    switch (stage) {
+        case Stage::Ingest:
+            return "ingest";
+        case Stage::Segmenter:
+            return "segmenter";
+        case Stage::Decoder:
+            return "decoder";
+        case Stage::Encoder:
+            return "encoder";
+        case Stage::Packager:
+            return "packager";
+        case Stage::Upload:
+            return "upload";
+        case Stage::Registration:
+            return "registration";
+    }
+    return "unknown";
+}
+
+void LatencyTracer::stamp(Stage stage, std::chrono::microseconds pts, std::chrono::steady_clock::time_point time) {
+    std::lock_guard<std::mutex> l{_mutex};
+
+    if (stage == Stage::Ingest) {
+        if (_arrivals.emplace(pts.count(), time).second) {
+            _arrivalOrder.emplace_back(pts.count());
+            if (_arrivalOrder.size() > _configuration.capacity) {
+                _arrivals.erase(_arrivalOrder.front());
+                _arrivalOrder.pop_front();
+            }
+        }
+        return;
+    }
+
+    auto index = static_cast<size_t>(stage);
+
+    // find the nearest ingested pts on either side
+    auto it = _arrivals.lower_bound(pts.count());
+    auto best = _arrivals.end();
+    if (it != _arrivals.end()) {
+        best = it;
+    }
+    if (it != _arrivals.begin()) {
+        auto prev = std::prev(it);
+        if (best == _arrivals.end() || pts.count() - prev->first < best->first - pts.count()) {
+            best = prev;
+        }
+    }
+    if (best == _arrivals.end() || std::abs(best->first - pts.count()) > _configuration.tolerance.count()) {
+        ++_misses[index];
+        return;
+    }
+
+    _histograms[index].record(std::chrono::duration_cast<std::chrono::microseconds>(time - best->second));
+}
+
+LatencyHistogram LatencyTracer::histogram(Stage stage) const {
+    std::lock_guard<std::mutex> l{_mutex};
+    return _histograms[static_cast<size_t>(stage)];
+}
+
+uint64_t LatencyTracer::misses(Stage stage) const {
+    std::lock_guard<std::mutex> l{_mutex};
+    return _misses[static_cast<size_t>(stage)];
+}
+
+std::string LatencyTracer::json() const {
+    std::lock_guard<std::mutex> l{_mutex};
+
+    auto ret = nlohmann::json::object();
+    for (size_t i = static_cast<size_t>(Stage::Segmenter); i < StageCount; ++i) {
+        auto& histogram = _histograms[i];
+        ret[StageName(static_cast<Stage>(i))] = {
+            {"count", histogram.count()},
+            {"misses", _misses[i]},
+            {"min_us", histogram.min().count()},
+            {"mean_us", histogram.mean().count()},
+            {"p50_us", histogram.percentile(50.0).count()},
+            {"p90_us", histogram.percentile(90.0).count()},
+            {"p99_us", histogram.percentile(99.0).count()},
+            {"p999_us", histogram.percentile(99.9).count()},
+            {"max_us", histogram.max().count()},
+        };
+    }
+    return ret.dump();
+}
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+
+// LatencyHistogram counts durations in buckets whose width grows with their magnitude, in the style
+// of HdrHistogram. Recorded values are kept to within 1/32 (about 3%) of their true value, and
+// anything up to about 19 hours can be recorded.
+class LatencyHistogram {
+public:
+    void record(std::chrono::microseconds value);
+
+    uint64_t count() const { return _count; }
+    std::chrono::microseconds min() const;
+    std::chrono::microseconds max() const;
+    std::chrono::microseconds mean() const;
+
+    // percentile returns a value that p percent of the recorded values are less than or equal to.
+    std::chrono::microseconds percentile(double p) const;
+
+private:
+    static constexpr int SubBucketBits = 6;
+    static constexpr int SubBucketCount = 1 << SubBucketBits;
+    static constexpr int MaxExponent = 36;
+    static constexpr size_t BucketCount = SubBucketCount + (MaxExponent - SubBucketBits + 1) * (SubBucketCount / 2);
+
+    std::array<uint64_t, BucketCount> _buckets{};
+    uint64_t _count = 0;
+    uint64_t _min = 0;
+    uint64_t _max = 0;
+    double _sum = 0.0;
+
+    static size_t _bucketIndex(uint64_t value);
+
+    // _bucketValue returns the highest value that's counted in the given bucket.
+    static uint64_t _bucketValue(size_t index);
+};
+
+// LatencyTracer measures how long a stream's video frames take to get from ingest to each stage of
+// the pipeline. Ingest records when each frame arrived, keyed by its pts, and every later stage
+// records how long after that it saw the frame. Stages may round timestamps (encoders do, for
+// example), so stamps are matched to the nearest ingested pts within a small tolerance. Stamps that
+// can't be matched are counted as misses.
+//
+// Components take a nullable LatencyTracer pointer, so tracing costs a single branch per stage when
+// it's disabled. All methods may be invoked from any thread.
+class LatencyTracer {
+public:
+    enum class Stage {
+        // The frame was handed to the stream by its RTMP connection.
+        Ingest,
+        Segmenter,
+        // The frame was output by the decoder.
+        Decoder,
+        // The frame was output by an encoder.
+        Encoder,
+        // The frame was written to a segment.
+        Packager,
+        // The frame's segment was fully written to storage.
+        Upload,
+        // The frame's segment was posted to the platform API.
+        Registration,
+    };
+
+    static constexpr size_t StageCount = static_cast<size_t>(Stage::Registration) + 1;
+
+    static const char* StageName(Stage stage);
+
+    struct Configuration {
+        // The number of frames whose arrival time is remembered. This needs to cover the time it
+        // takes segments to be uploaded and posted.
+        size_t capacity = 4096;
+
+        // Stamps are matched to ingested frames whose pts are within this much of theirs.
+        std::chrono::microseconds tolerance = std::chrono::milliseconds(10);
+    };
+
+    LatencyTracer() : LatencyTracer(Configuration{}) {}
+    explicit LatencyTracer(Configuration configuration) : _configuration{configuration} {}
+
+    // stamp records that the frame with the given pts reached the stage.
+    void stamp(Stage stage, std::chrono::microseconds pts) {
+        stamp(stage, pts, std::chrono::steady_clock::now());
+    }
+
+    void stamp(Stage stage, std::chrono::microseconds pts, std::chrono::steady_clock::time_point time);
+
+    // histogram returns a snapshot of the latencies recorded for the stage.
+    LatencyHistogram histogram(Stage stage) const;
+
+    uint64_t misses(Stage stage) const;
+
+    // json returns the histograms' summaries as a JSON object with a key for each stage.
+    std::string json() const;
+
+private:
+    const Configuration _configuration;
+
+    mutable std::mutex _mutex;
+    std::map<int64_t, std::chrono::steady_clock::time_point> _arrivals;
+    std::deque<int64_t> _arrivalOrder;
+    std::array<LatencyHistogram, StageCount> _histograms;
+    std::array<uint64_t, StageCount> _misses{};
+};
@@ -0,0 +1,82 @@
+#include <gtest/gtest.h>
+
+#include "latency_tracer.hpp"
+
+TEST(LatencyHistogram, percentiles) {
+    LatencyHistogram histogram;
+    EXPECT_EQ(0, histogram.percentile(50.0).count());
+
+    for (int i = 1; i <= 1000; ++i) {
+        histogram.record(std::chrono::microseconds(i * 1000));
+    }
+    EXPECT_EQ(1000, histogram.count());
+    EXPECT_EQ(1000, histogram.min().count());
+    EXPECT_EQ(1000000, histogram.max().count());
+    EXPECT_NEAR(500500, histogram.mean().count(), 1);
+
+    // values are only kept to within 1/32 of their true value
+    EXPECT_NEAR(500000, histogram.percentile(50.0).count(), 500000 / 32);
+    EXPECT_NEAR(990000, histogram.percentile(99.0).count(), 990000 / 32);
+    EXPECT_EQ(1000000, histogram.percentile(100.0).count());
+    EXPECT_NEAR(1000, histogram.percentile(0.0).count(), 1000 / 32);
+}
+
+TEST(LatencyHistogram, smallAndLargeValues) {
+    LatencyHistogram histogram;
+    histogram.record(std::chrono::microseconds(-5));
+    histogram.record(std::chrono::microseconds(3));
+    histogram.record(std::chrono::hours(100));
+    EXPECT_EQ(0, histogram.min().count());
+    EXPECT_EQ(0, histogram.percentile(33.0).count());
+    EXPECT_EQ(3, histogram.percentile(66.0).count());
+    EXPECT_EQ(std::chrono::microseconds(std::chrono::hours(100)), histogram.max());
+}
+
+TEST(LatencyTracer, stamps) {
+    LatencyTracer tracer;
+    auto start = std::chrono::steady_clock::now();
+
+    for (int i = 0; i < 100; ++i) {
+        auto pts = std::chrono::milliseconds(i * 33);
+        auto arrival = start + std::chrono::milliseconds(i * 33);
+        tracer.stamp(LatencyTracer::Stage::Ingest, pts, arrival);
+        tracer.stamp(LatencyTracer::Stage::Segmenter, pts, arrival + std::chrono::milliseconds(2));
+        // encoders round timestamps, which shouldn't matter
+        tracer.stamp(LatencyTracer::Stage::Encoder, pts - std::chrono::microseconds(8000 / 3), arrival + std::chrono::milliseconds(40));
+    }
+
+    // nothing was ingested with this pts
+    tracer.stamp(LatencyTracer::Stage::Upload, std::chrono::seconds(1000), start);
+
+    auto segmenter = tracer.histogram(LatencyTracer::Stage::Segmenter);
+    EXPECT_EQ(100, segmenter.count());
+    EXPECT_NEAR(2000, segmenter.percentile(50.0).count(), 2000 / 32);
+
+    auto encoder = tracer.histogram(LatencyTracer::Stage::Encoder);
+    EXPECT_EQ(100, encoder.count());
+    EXPECT_NEAR(40000, encoder.percentile(99.0).count(), 40000 / 32);
+
+    EXPECT_EQ(0, tracer.histogram(LatencyTracer::Stage::Upload).count());
+    EXPECT_EQ(1, tracer.misses(LatencyTracer::Stage::Upload));
+
+    auto json = tracer.json();
+    EXPECT_NE(std::string::npos, json.find("\"segmenter\""));
+    EXPECT_NE(std::string::npos, json.find("\"registration\""));
+    EXPECT_EQ(std::string::npos, json.find("\"ingest\""));
+}
+
+TEST(LatencyTracer, capacity) {
+    LatencyTracer::Configuration configuration;
+    configuration.capacity = 10;
+    LatencyTracer tracer{configuration};
+
+    for (int i = 0; i < 20; ++i) {
+        tracer.stamp(LatencyTracer::Stage::Ingest, std::chrono::seconds(i));
+    }
+
+    // only the most recent frames are remembered
+    tracer.stamp(LatencyTracer::Stage::Packager, std::chrono::seconds(5));
+    tracer.stamp(LatencyTracer::Stage::Packager, std::chrono::seconds(15));
+    EXPECT_EQ(1, tracer.misses(LatencyTracer::Stage::Packager));
+    EXPECT_EQ(1, tracer.histogram(LatencyTracer::Stage::Packager).count());
+}
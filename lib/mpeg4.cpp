@@ -1,6 +1,7 @@
 #include "mpeg4.hpp"
 
 #include <h26x/bitstream.hpp>
+#include <fmt/format.h>
 #include <algorithm>
 #include <bitset>
 
@@ -13,21 +14,25 @@ std::ostream& operator<<(std::ostream& os, const MPEG4ChannelConfiguration& cc)
 }
 
 std::vector<uint8_t> MPEG4AudioSpecificConfig::adtsHeader(size_t aacLength) const {
-    const auto frameLength = 7 + aacLength;
-    std::vector<uint8_t> ret(7);
-    ret[0] = 0xff /* syncword */;
-    ret[1] = 0xf0 /* syncword */ | 1 /* protection absent */;
-    ret[2] = (static_cast<unsigned int>(objectType) - 1) << 6;
-    ret[2] |= static_cast<unsigned int>(frequencyIndex()) << 2;
-    ret[2] |= static_cast<unsigned int>(channelConfiguration) >> 2;
-    ret[3] = static_cast<unsigned int>(channelConfiguration) << 6;
-    ret[3] |= frameLength >> 11;
-    ret[4] = (frameLength >> 3);
-    ret[5] = (frameLength << 5) | 0x1f /* buffer fullness */;
-    ret[6] = 0xfc /* buffer fullness */ | 0 /* raw data blocks */;
+    std::vector<uint8_t> ret(ADTSHeaderSize);
+    writeADTSHeader(ret.data(), aacLength);
     return ret;
 }
 
+void MPEG4AudioSpecificConfig::writeADTSHeader(uint8_t* dest, size_t aacLength) const {
+    const auto frameLength = ADTSHeaderSize + aacLength;
+    dest[0] = 0xff /* syncword */;
+    dest[1] = 0xf0 /* syncword */ | 1 /* protection absent */;
+    dest[2] = (static_cast<unsigned int>(objectType) - 1) << 6;
+    dest[2] |= static_cast<unsigned int>(frequencyIndex()) << 2;
+    dest[2] |= static_cast<unsigned int>(channelConfiguration) >> 2;
+    dest[3] = static_cast<unsigned int>(channelConfiguration) << 6;
+    dest[3] |= frameLength >> 11;
+    dest[4] = (frameLength >> 3);
+    dest[5] = (frameLength << 5) | 0x1f /* buffer fullness */;
+    dest[6] = 0xfc /* buffer fullness */ | 0 /* raw data blocks */;
+}
+
 MPEG4SamplingFrequency MPEG4AudioSpecificConfig::frequencyIndex() const {
     switch (frequency) {
         case 96000: return MPEG4SamplingFrequency::F96000Hz;
@@ -234,6 +239,10 @@ std::vector<uint8_t> AVCDecoderConfigurationRecord::encode() const {
     return ret;
 }
 
+std::string AVCDecoderConfigurationRecord::codecString() const {
+    return fmt::format("avc1.{:02x}{:02x}{:02x}", avcProfileIndication & 0xff, profileCompatibility & 0xff, avcLevelIndication & 0xff);
+}
+
 bool HEVCDecoderConfigurationRecord::operator==(const HEVCDecoderConfigurationRecord &other) const {
     return configurationVersion == other.configurationVersion
         && general_profile_space == other.general_profile_space
@@ -306,6 +315,43 @@ std::vector<uint8_t> HEVCDecoderConfigurationRecord::encode() const {
     return ret;
 }
 
+std::vector<uint8_t> HEVCDecoderConfigurationRecord::encodeHVCC() const {
+    std::vector<uint8_t> ret;
+
+    ret.emplace_back(configurationVersion);
+    ret.emplace_back(general_profile_space << 6 | general_tier_flag << 5 | general_profile_idc);
+    for (int i = 1; i <= 4; i++) {
+        ret.emplace_back(general_profile_compatibility_flags >> (32 - i * 8) & 0xff);
+    }
+    for (int i = 1; i <= 6; i++) {
+        ret.emplace_back(general_constraint_indicator_flags >> (48 - i * 8) & 0xff);
+    }
+    ret.emplace_back(general_level_idc);
+    ret.emplace_back(0xf0 | min_spatial_segmentation_dc >> 8);
+    ret.emplace_back(min_spatial_segmentation_dc & 0xff);
+    ret.emplace_back(0xfc | parallelismType);
+    ret.emplace_back(0xfc | chromaFormat);
+    ret.emplace_back(0xf8 | bitDepthLumaMinus8);
+    ret.emplace_back(0xf8 | bitDepthChromaMinus8);
+    ret.emplace_back(avgFrameRate >> 8);
+    ret.emplace_back(avgFrameRate & 0xff);
+    ret.emplace_back(constantFrameRate << 6 | numTemporalLayers << 3 | temporalIdNested << 2 | lengthSizeMinusOne);
+    ret.emplace_back(naluArrays.size());
+
+    for (auto& array : naluArrays) {
+        ret.emplace_back(array.array_completeness << 7 | array.NAL_unit_type);
+        ret.emplace_back(array.nalUnit.size() >> 8);
+        ret.emplace_back(array.nalUnit.size() & 0xff);
+        for (auto& nalu : array.nalUnit) {
+            ret.emplace_back(nalu.size() >> 8);
+            ret.emplace_back(nalu.size() & 0xff);
+            ret.insert(ret.end(), nalu.begin(), nalu.end());
+        }
+    }
+
+    return ret;
+}
+
 bool HEVCDecoderConfigurationRecord::decode(const void *data, size_t len) {
     h264::bitstream b{data, len};
 
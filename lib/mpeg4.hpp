@@ -1,6 +1,7 @@
 #pragma once
 
 #include <ostream>
+#include <string>
 #include <vector>
 #include <h26x/nal_unit.hpp>
 
@@ -64,8 +65,13 @@ struct MPEG4AudioSpecificConfig {
         return objectType == other.objectType && frequency == other.frequency && channelConfiguration == other.channelConfiguration;
     }
 
+    static constexpr size_t ADTSHeaderSize = 7;
+
     std::vector<uint8_t> adtsHeader(size_t aacLength) const;
 
+    // writeADTSHeader writes an ADTSHeaderSize-byte header for a frame of the given length to dest.
+    void writeADTSHeader(uint8_t* dest, size_t aacLength) const;
+
     bool decode(const void* data, size_t len);
 
     std::vector<uint8_t> encode() const;
@@ -86,6 +92,9 @@ struct AVCDecoderConfigurationRecord {
     bool decode(const void* data, size_t len);
 
     std::vector<uint8_t> encode() const;
+
+    // codecString returns the RFC 6381 codecs parameter for the stream (e.g. "avc1.4d401f").
+    std::string codecString() const;
 };
 
 struct HEVCProfileTierLevel {
@@ -143,6 +152,10 @@ struct HEVCDecoderConfigurationRecord {
     bool decode(const void* data, size_t len);
     std::vector<uint8_t> encode() const;
 
+    // encodeHVCC encodes the record as the contents of an ISO/IEC 14496-15 hvcC box, which is what
+    // MP4 demuxers expect. encode's output is only meant to be read by decode.
+    std::vector<uint8_t> encodeHVCC() const;
+
     h264::error parseVPS(const h265::nal_unit& vps);
     h264::error parseSPS(const h265::nal_unit& sps);
     h264::error parsePPS(const h265::nal_unit& pps);
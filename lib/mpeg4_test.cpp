@@ -53,6 +53,8 @@ TEST(AVCDecoderConfigurationRecord, decode) {
     ASSERT_EQ(1, config.pictureParameterSets.size());
     ASSERT_EQ(4, config.pictureParameterSets[0].size());
     EXPECT_EQ(0, memcmp(data + sizeof(data) - 4, config.pictureParameterSets[0].data(), config.pictureParameterSets[0].size()));
+
+    EXPECT_EQ("avc1.4d401f", config.codecString());
 }
 
 TEST(HEVCDecoderConfigurationRecord, encode_and_decode) {
@@ -95,4 +97,28 @@ TEST(HEVCDecoderConfigurationRecord, encode_and_decode) {
     ASSERT_TRUE(config2.decode(encoded.data(), encoded.size()));
 
     ASSERT_TRUE(config == config2);
-}
\ No newline at end of file
+}
+
+TEST(HEVCDecoderConfigurationRecord, encodeHVCC) {
+    HEVCDecoderConfigurationRecord config;
+    config.general_profile_idc = 1;
+    config.general_profile_compatibility_flags = 0x60'00'00'00;
+    config.general_constraint_indicator_flags = 0x90'00'00'00'00'00;
+    config.general_level_idc = 93;
+    config.chromaFormat = 1;
+    config.numTemporalLayers = 1;
+    config.temporalIdNested = 1;
+
+    std::vector<uint8_t> vps{0x40, 0x01, 0x0c};
+    std::vector<uint8_t> sps{0x42, 0x01, 0x01, 0x01};
+    config.addNalu(vps.data(), vps.size());
+    config.addNalu(sps.data(), sps.size());
+
+    std::vector<uint8_t> expected{
+        0x01, 0x01, 0x60, 0x00, 0x00, 0x00, 0x90, 0x00, 0x00, 0x00, 0x00, 0x00, 0x5d,
+        0xf0, 0x00, 0xfc, 0xfd, 0xf8, 0xf8, 0x00, 0x00, 0x0f, 0x02,
+        0x20, 0x00, 0x01, 0x00, 0x03, 0x40, 0x01, 0x0c,
+        0x21, 0x00, 0x01, 0x00, 0x04, 0x42, 0x01, 0x01, 0x01,
+    };
+    EXPECT_EQ(expected, config.encodeHVCC());
+}
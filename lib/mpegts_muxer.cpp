@@ -0,0 +1,377 @@
+#include "mpegts_muxer.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+constexpr uint16_t PATPID = 0x0000;
+constexpr uint16_t PMTPID = 0x1000;
+constexpr uint16_t AudioPID = 0x0100;
+constexpr uint16_t VideoPID = 0x0101;
+
+constexpr uint8_t StreamTypeAAC = 0x0f;
+constexpr uint8_t StreamTypeH264 = 0x1b;
+constexpr uint8_t StreamTypeH265 = 0x24;
+
+// Timestamps are offset by 1.4 seconds and the PCR trails the dts by 0.7 seconds, which are the
+// defaults that FFmpeg uses. This gives decoders room to buffer B-frames and audio.
+constexpr int64_t TimestampOffset = 126000;
+constexpr int64_t PCRDelay = 63000;
+constexpr int64_t TimestampMask = (int64_t(1) << 33) - 1;
+
+// These are the limits FFmpeg's defaults impose on audio PES packets.
+constexpr size_t MaxAudioPayloadSize = 2930;
+constexpr int64_t MaxAudioPayloadDuration = 31500;
+
+constexpr std::array<uint32_t, 256> CRCTable = [] {
+    std::array<uint32_t, 256> table{};
+    for (uint32_t i = 0; i < 256; ++i) {
+        uint32_t crc = i << 24;
+        for (int bit = 0; bit < 8; ++bit) {
+            crc = (crc & 0x80000000) ? (crc << 1) ^ 0x04c11db7 : crc << 1;
+        }
+        table[i] = crc;
+    }
+    return table;
+}();
+
+uint32_t CRC32(const uint8_t* data, size_t len) {
+    uint32_t crc = 0xffffffff;
+    for (size_t i = 0; i < len; ++i) {
+        crc = (crc << 8) ^ CRCTable[(crc >> 24) ^ data[i]];
+    }
+    return crc;
+}
+
+int64_t Timestamp(std::chrono::microseconds t) {
+    return t.count() * 9 / 100 + TimestampOffset;
+}
+
+void WriteTimestamp(uint8_t* dest, uint8_t prefix, int64_t ts) {
+    ts &= TimestampMask;
+    dest[0] = (prefix << 4) | ((ts >> 29) & 0x0e) | 1;
+    dest[1] = ts >> 22;
+    dest[2] = ((ts >> 14) & 0xfe) | 1;
+    dest[3] = ts >> 7;
+    dest[4] = ((ts << 1) & 0xfe) | 1;
+}
+
+// TablePacket returns a packet containing the given PSI section, which should include everything
+// up to the CRC. The continuity counter is left as zero.
+std::array<uint8_t, MPEGTSMuxer::PacketSize> TablePacket(uint16_t pid, const uint8_t* section, size_t len) {
+    std::array<uint8_t, MPEGTSMuxer::PacketSize> ret;
+    ret.fill(0xff);
+    ret[0] = 0x47;
+    ret[1] = 0x40 /* payload unit start */ | (pid >> 8);
+    ret[2] = pid;
+    ret[3] = 0x10 /* payload only */;
+    ret[4] = 0 /* pointer field */;
+    std::memcpy(&ret[5], section, len);
+    auto crc = CRC32(section, len);
+    ret[5 + len] = crc >> 24;
+    ret[6 + len] = crc >> 16;
+    ret[7 + len] = crc >> 8;
+    ret[8 + len] = crc;
+    return ret;
+}
+
+// Returns the header of the access unit's first NAL unit, or -1 if there isn't one.
+int FirstNALUHeader(const uint8_t* data, size_t len) {
+    size_t i = 0;
+    while (i < len && data[i] == 0) {
+        ++i;
+    }
+    if (i < 2 || i + 1 >= len || data[i] != 1) {
+        return -1;
+    }
+    return data[i + 1];
+}
+
+const uint8_t H264AccessUnitDelimiter[] = {0x00, 0x00, 0x00, 0x01, 0x09, 0xf0};
+const uint8_t H265AccessUnitDelimiter[] = {0x00, 0x00, 0x00, 0x01, 0x46, 0x01, 0x50};
+
+} // anonymous namespace
+
+MPEGTSMuxer::MPEGTSMuxer(VideoCodec codec, std::shared_ptr<BufferPool> pool, size_t chunkSize)
+    : _codec{codec}, _pool{std::move(pool)}, _chunkSize{std::max(chunkSize, PacketSize)}
+{
+    _audio.pid = AudioPID;
+    _audio.streamId = 0xc0;
+    _video.pid = VideoPID;
+    _video.streamId = 0xe0;
+
+    const uint8_t pat[] = {
+        0x00 /* table id */, 0xb0, 13 /* section length */,
+        0x00, 0x01 /* transport stream id */,
+        0xc1 /* version 0, current */, 0x00, 0x00,
+        0x00, 0x01 /* program number */, 0xe0 | (PMTPID >> 8), PMTPID & 0xff,
+    };
+    _pat = TablePacket(PATPID, pat, sizeof(pat));
+
+    const uint8_t pmt[] = {
+        0x02 /* table id */, 0xb0, 23 /* section length */,
+        0x00, 0x01 /* program number */,
+        0xc1 /* version 0, current */, 0x00, 0x00,
+        0xe0 | (VideoPID >> 8), VideoPID & 0xff /* pcr pid */,
+        0xf0, 0x00 /* program info length */,
+        StreamTypeAAC, 0xe0 | (AudioPID >> 8), AudioPID & 0xff, 0xf0, 0x00,
+        codec == VideoCodec::H265 ? StreamTypeH265 : StreamTypeH264, 0xe0 | (VideoPID >> 8), VideoPID & 0xff, 0xf0, 0x00,
+    };
+    _pmt = TablePacket(PMTPID, pmt, sizeof(pmt));
+
+    _audioPayload.reserve(MaxAudioPayloadSize);
+}
+
+void MPEGTSMuxer::setVideoParameterSets(const void* data, size_t len) {
+    auto bytes = reinterpret_cast<const uint8_t*>(data);
+    _videoParameterSets.assign(bytes, bytes + len);
+}
+
+void MPEGTSMuxer::begin(WriteFunction write) {
+    _write = std::move(write);
+    _didFail = false;
+    _chunk = _pool->acquire(_chunkSize);
+    _audioPayload.clear();
+
+    _patContinuityCounter = 0;
+    _pmtContinuityCounter = 0;
+    _audio.continuityCounter = 0;
+    _video.continuityCounter = 0;
+
+    _writeTables();
+}
+
+bool MPEGTSMuxer::writeAudio(std::chrono::microseconds pts, const void* data, size_t len) {
+    if (!_chunk) {
+        return false;
+    }
+
+    auto timestamp = Timestamp(pts);
+    auto size = MPEG4AudioSpecificConfig::ADTSHeaderSize + len;
+
+    if (!_audioPayload.empty() && (_audioPayload.size() + size > MaxAudioPayloadSize || timestamp - _audioPayloadPTS >= MaxAudioPayloadDuration)) {
+        _flushAudio();
+    }
+
+    if (size > MaxAudioPayloadSize) {
+        // too big to buffer, so it gets a packet of its own
+        uint8_t header[MPEG4AudioSpecificConfig::ADTSHeaderSize];
+        _audioConfig.writeADTSHeader(header, len);
+        const Span spans[] = {
+            {header, sizeof(header)},
+            {reinterpret_cast<const uint8_t*>(data), len},
+        };
+        _writePES(&_audio, timestamp, timestamp, spans, 2, false, false);
+        return !_didFail;
+    }
+
+    if (_audioPayload.empty()) {
+        _audioPayloadPTS = timestamp;
+    }
+    auto offset = _audioPayload.size();
+    _audioPayload.resize(offset + size);
+    _audioConfig.writeADTSHeader(&_audioPayload[offset], len);
+    std::memcpy(&_audioPayload[offset + MPEG4AudioSpecificConfig::ADTSHeaderSize], data, len);
+    return !_didFail;
+}
+
+bool MPEGTSMuxer::writeVideo(std::chrono::microseconds pts, std::chrono::microseconds dts, const void* data, size_t len, bool isRandomAccessPoint, bool hasParameterSets) {
+    if (!_chunk) {
+        return false;
+    }
+
+    if (isRandomAccessPoint) {
+        _writeTables();
+    }
+
+    auto bytes = reinterpret_cast<const uint8_t*>(data);
+    auto header = FirstNALUHeader(bytes, len);
+
+    Span spans[3];
+    size_t spanCount = 0;
+    if (_codec == VideoCodec::H265) {
+        if (header < 0 || ((header >> 1) & 0x3f) != 35 /* AUD_NUT */) {
+            spans[spanCount++] = {H265AccessUnitDelimiter, sizeof(H265AccessUnitDelimiter)};
+        }
+    } else if (header < 0 || (header & 0x1f) != 9 /* access unit delimiter */) {
+        spans[spanCount++] = {H264AccessUnitDelimiter, sizeof(H264AccessUnitDelimiter)};
+    }
+    if (isRandomAccessPoint && !hasParameterSets && !_videoParameterSets.empty()) {
+        spans[spanCount++] = {_videoParameterSets.data(), _videoParameterSets.size()};
+    }
+    spans[spanCount++] = {bytes, len};
+
+    _writePES(&_video, Timestamp(pts), Timestamp(dts), spans, spanCount, isRandomAccessPoint, true);
+    return !_didFail;
+}
+
+bool MPEGTSMuxer::flush() {
+    if (!_chunk) {
+        return false;
+    }
+    _flushAudio();
+    _flushChunk();
+    _shouldWriteTables = true;
+    return !_didFail;
+}
+
+bool MPEGTSMuxer::end() {
+    if (!_chunk) {
+        return false;
+    }
+    _flushAudio();
+    _flushChunk();
+    _chunk = nullptr;
+    _write = nullptr;
+    return !_didFail;
+}
+
+void MPEGTSMuxer::_writeTables() {
+    auto packet = _nextPacket();
+    std::memcpy(packet, _pat.data(), PacketSize);
+    packet[3] |= _patContinuityCounter;
+    _patContinuityCounter = (_patContinuityCounter + 1) & 0x0f;
+
+    packet = _nextPacket();
+    std::memcpy(packet, _pmt.data(), PacketSize);
+    packet[3] |= _pmtContinuityCounter;
+    _pmtContinuityCounter = (_pmtContinuityCounter + 1) & 0x0f;
+
+    _shouldWriteTables = false;
+}
+
+void MPEGTSMuxer::_flushAudio() {
+    if (_audioPayload.empty()) {
+        return;
+    }
+    const Span span{_audioPayload.data(), _audioPayload.size()};
+    _writePES(&_audio, _audioPayloadPTS, _audioPayloadPTS, &span, 1, false, false);
+    _audioPayload.clear();
+}
+
+void MPEGTSMuxer::_writePES(Stream* stream, int64_t pts, int64_t dts, const Span* spans, size_t spanCount, bool isRandomAccessPoint, bool hasPCR) {
+    if (_shouldWriteTables) {
+        _writeTables();
+    }
+
+    size_t payloadSize = 0;
+    for (size_t i = 0; i < spanCount; ++i) {
+        payloadSize += spans[i].len;
+    }
+
+    const auto hasDTS = dts != pts;
+    const size_t headerDataSize = hasDTS ? 10 : 5;
+
+    uint8_t header[19];
+    header[0] = 0x00;
+    header[1] = 0x00;
+    header[2] = 0x01;
+    header[3] = stream->streamId;
+    // video packets are left unbounded, as they can easily exceed the maximum
+    auto pesLength = payloadSize + 3 + headerDataSize;
+    if (stream == &_video || pesLength > 0xffff) {
+        pesLength = 0;
+    }
+    header[4] = pesLength >> 8;
+    header[5] = pesLength;
+    header[6] = 0x84 /* data alignment */;
+    header[7] = hasDTS ? 0xc0 : 0x80;
+    header[8] = headerDataSize;
+    WriteTimestamp(&header[9], hasDTS ? 3 : 2, pts);
+    if (hasDTS) {
+        WriteTimestamp(&header[14], 1, dts);
+    }
+    const auto headerSize = 9 + headerDataSize;
+
+    auto remaining = headerSize + payloadSize;
+    size_t headerOffset = 0;
+    size_t span = 0;
+    size_t spanOffset = 0;
+    auto isFirst = true;
+
+    while (remaining > 0) {
+        auto packet = _nextPacket();
+        const auto hasPacketPCR = isFirst && hasPCR;
+        const auto hasRandomAccessIndicator = isFirst && isRandomAccessPoint;
+
+        // the adaptation field's size, including its length byte
+        size_t adaptationFieldSize = 0;
+        if (hasPacketPCR || hasRandomAccessIndicator) {
+            adaptationFieldSize = 2 + (hasPacketPCR ? 6 : 0);
+        }
+        auto packetPayloadSize = PacketSize - 4 - adaptationFieldSize;
+        if (remaining < packetPayloadSize) {
+            // the last packet is padded with stuffing bytes
+            adaptationFieldSize += packetPayloadSize - remaining;
+            packetPayloadSize = remaining;
+        }
+
+        packet[0] = 0x47;
+        packet[1] = (isFirst ? 0x40 /* payload unit start */ : 0x00) | (stream->pid >> 8);
+        packet[2] = stream->pid;
+        packet[3] = (adaptationFieldSize ? 0x30 : 0x10) | stream->continuityCounter;
+        stream->continuityCounter = (stream->continuityCounter + 1) & 0x0f;
+
+        auto ptr = packet + 4;
+        if (adaptationFieldSize) {
+            auto end = ptr + adaptationFieldSize;
+            *(ptr++) = adaptationFieldSize - 1;
+            if (adaptationFieldSize > 1) {
+                *(ptr++) = (hasRandomAccessIndicator ? 0x40 : 0x00) | (hasPacketPCR ? 0x10 : 0x00);
+                if (hasPacketPCR) {
+                    const auto base = (dts - PCRDelay) & TimestampMask;
+                    *(ptr++) = base >> 25;
+                    *(ptr++) = base >> 17;
+                    *(ptr++) = base >> 9;
+                    *(ptr++) = base >> 1;
+                    *(ptr++) = ((base << 7) & 0x80) | 0x7e /* reserved */;
+                    *(ptr++) = 0x00 /* extension */;
+                }
+                std::memset(ptr, 0xff, end - ptr);
+            }
+            ptr = end;
+        }
+
+        remaining -= packetPayloadSize;
+        while (packetPayloadSize > 0) {
+            size_t n;
+            if (headerOffset < headerSize) {
+                n = std::min(packetPayloadSize, headerSize - headerOffset);
+                std::memcpy(ptr, header + headerOffset, n);
+                headerOffset += n;
+            } else {
+                n = std::min(packetPayloadSize, spans[span].len - spanOffset);
+                std::memcpy(ptr, spans[span].data + spanOffset, n);
+                spanOffset += n;
+                if (spanOffset == spans[span].len) {
+                    ++span;
+                    spanOffset = 0;
+                }
+            }
+            ptr += n;
+            packetPayloadSize -= n;
+        }
+
+        isFirst = false;
+    }
+}
+
+uint8_t* MPEGTSMuxer::_nextPacket() {
+    if (_chunk->size() + PacketSize > _chunkSize) {
+        _flushChunk();
+    }
+    auto offset = _chunk->size();
+    _chunk->resize(offset + PacketSize);
+    return _chunk->data() + offset;
+}
+
+void MPEGTSMuxer::_flushChunk() {
+    if (_chunk->empty()) {
+        return;
+    }
+    if (!_write(_chunk->data(), _chunk->size())) {
+        _didFail = true;
+    }
+    _chunk->clear();
+}
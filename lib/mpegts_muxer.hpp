@@ -0,0 +1,106 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "buffer_pool.hpp"
+#include "mpeg4.hpp"
+
+// MPEGTSMuxer writes AAC audio and H.264 or H.265 video as an MPEG-TS stream. The stream is laid
+// out the way FFmpeg's mpegts muxer lays it out by default: a single program whose PMT is on PID
+// 0x1000, with audio on PID 0x100 and video on PID 0x101. The video PID also carries the PCR.
+//
+// The PAT and PMT are computed up front, and packets are packed directly into large chunks from a
+// BufferPool, so writing frames doesn't allocate.
+class MPEGTSMuxer {
+public:
+    enum class VideoCodec {
+        H264,
+        H265,
+    };
+
+    // WriteFunction is invoked with each chunk of output. It should return false on failure.
+    using WriteFunction = std::function<bool(const void* data, size_t len)>;
+
+    static constexpr size_t PacketSize = 188;
+
+    explicit MPEGTSMuxer(VideoCodec codec, std::shared_ptr<BufferPool> pool = BufferPool::Default(), size_t chunkSize = 64 * 1024);
+
+    // setAudioConfig sets the config that the audio's ADTS headers are written from.
+    void setAudioConfig(const MPEG4AudioSpecificConfig& config) { _audioConfig = config; }
+
+    // setVideoParameterSets sets the Annex B parameter sets that are inserted into random access
+    // points that don't carry their own.
+    void setVideoParameterSets(const void* data, size_t len);
+
+    // begin starts a new stream, which is output via write. Continuity counters start over and the
+    // PAT and PMT are written first, so each stream can be decoded on its own.
+    void begin(WriteFunction write);
+
+    // writeAudio writes a raw AAC frame. Like FFmpeg, consecutive frames are combined into PES
+    // packets of up to about 3 KB or 350 ms.
+    bool writeAudio(std::chrono::microseconds pts, const void* data, size_t len);
+
+    // writeVideo writes an Annex B access unit. An access unit delimiter is inserted if the access
+    // unit doesn't begin with one. Random access points are preceded by the PAT and PMT.
+    bool writeVideo(std::chrono::microseconds pts, std::chrono::microseconds dts, const void* data, size_t len, bool isRandomAccessPoint, bool hasParameterSets);
+
+    // flush writes any buffered audio and output without ending the stream, so that everything
+    // written so far can be made available on its own, as an LL-HLS part for example. The PAT and
+    // PMT are repeated before whatever is written next. It returns false if any of the stream's
+    // output couldn't be written.
+    bool flush();
+
+    // end writes any buffered audio and output, and ends the stream. It returns false if any of the
+    // stream's output couldn't be written.
+    bool end();
+
+private:
+    struct Stream {
+        uint16_t pid;
+        uint8_t streamId;
+        uint8_t continuityCounter = 0;
+    };
+
+    struct Span {
+        const uint8_t* data;
+        size_t len;
+    };
+
+    const VideoCodec _codec;
+    const std::shared_ptr<BufferPool> _pool;
+    const size_t _chunkSize;
+
+    std::array<uint8_t, PacketSize> _pat;
+    std::array<uint8_t, PacketSize> _pmt;
+    uint8_t _patContinuityCounter = 0;
+    uint8_t _pmtContinuityCounter = 0;
+
+    Stream _audio;
+    Stream _video;
+
+    MPEG4AudioSpecificConfig _audioConfig{};
+    std::vector<uint8_t> _videoParameterSets;
+
+    // Audio frames, with their ADTS headers, waiting to be written as a single PES packet.
+    std::vector<uint8_t> _audioPayload;
+    int64_t _audioPayloadPTS = 0;
+
+    WriteFunction _write;
+    std::shared_ptr<BufferPool::Buffer> _chunk;
+    bool _didFail = false;
+    bool _shouldWriteTables = false;
+
+    void _writeTables();
+    void _flushAudio();
+    void _writePES(Stream* stream, int64_t pts, int64_t dts, const Span* spans, size_t spanCount, bool isRandomAccessPoint, bool hasPCR);
+
+    // _nextPacket returns the next PacketSize bytes of the chunk, writing the chunk out first if
+    // it's full.
+    uint8_t* _nextPacket();
+    void _flushChunk();
+};
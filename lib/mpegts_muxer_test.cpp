@@ -0,0 +1,284 @@
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <vector>
+
+#include "demuxer.hpp"
+#include "encoded_av_handler_test.hpp"
+#include "logger_test.hpp"
+#include "mpegts_muxer.hpp"
+#include "packager.hpp"
+
+namespace {
+
+struct TSPacket {
+    uint16_t pid;
+    bool isPayloadUnitStart;
+    unsigned int continuityCounter;
+    bool isRandomAccessPoint = false;
+    bool hasPCR = false;
+    int64_t pcrBase = 0;
+    std::vector<uint8_t> payload;
+};
+
+std::vector<TSPacket> ParseTS(const std::vector<uint8_t>& data) {
+    std::vector<TSPacket> ret;
+    EXPECT_EQ(0, data.size() % MPEGTSMuxer::PacketSize);
+    for (size_t i = 0; i + MPEGTSMuxer::PacketSize <= data.size(); i += MPEGTSMuxer::PacketSize) {
+        auto p = &data[i];
+        EXPECT_EQ(0x47, p[0]);
+
+        TSPacket packet;
+        packet.pid = ((p[1] & 0x1f) << 8) | p[2];
+        packet.isPayloadUnitStart = p[1] & 0x40;
+        packet.continuityCounter = p[3] & 0x0f;
+
+        size_t offset = 4;
+        if (p[3] & 0x20) {
+            auto length = p[4];
+            if (length > 0) {
+                packet.isRandomAccessPoint = p[5] & 0x40;
+                packet.hasPCR = p[5] & 0x10;
+                if (packet.hasPCR) {
+                    packet.pcrBase = (int64_t(p[6]) << 25) | (p[7] << 17) | (p[8] << 9) | (p[9] << 1) | (p[10] >> 7);
+                }
+            }
+            offset += 1 + length;
+        }
+        EXPECT_LE(offset, MPEGTSMuxer::PacketSize);
+        packet.payload.assign(p + offset, p + MPEGTSMuxer::PacketSize);
+        ret.emplace_back(std::move(packet));
+    }
+    return ret;
+}
+
+int64_t ParseTimestamp(const uint8_t* p) {
+    return (int64_t(p[0] & 0x0e) << 29) | (p[1] << 22) | ((p[2] & 0xfe) << 14) | (p[3] << 7) | (p[4] >> 1);
+}
+
+uint32_t CRC32(const uint8_t* data, size_t len) {
+    uint32_t crc = 0xffffffff;
+    for (size_t i = 0; i < len; ++i) {
+        crc ^= uint32_t(data[i]) << 24;
+        for (int bit = 0; bit < 8; ++bit) {
+            crc = (crc & 0x80000000) ? (crc << 1) ^ 0x04c11db7 : crc << 1;
+        }
+    }
+    return crc;
+}
+
+struct PES {
+    size_t length;
+    int64_t pts;
+    int64_t dts;
+    bool isRandomAccessPoint;
+    std::vector<uint8_t> payload;
+};
+
+} // anonymous namespace
+
+TEST(MPEGTSMuxer, packetization) {
+    MPEGTSMuxer muxer{MPEGTSMuxer::VideoCodec::H264, BufferPool::Create(), 4 * MPEGTSMuxer::PacketSize};
+
+    MPEG4AudioSpecificConfig audioConfig{MPEG4AudioObjectType::AACLC, 44100, MPEG4ChannelConfiguration::TwoChannels};
+    muxer.setAudioConfig(audioConfig);
+    const uint8_t parameterSets[] = {0, 0, 0, 1, 0x67, 0x42, 0, 0, 0, 1, 0x68, 0xce};
+    muxer.setVideoParameterSets(parameterSets, sizeof(parameterSets));
+
+    std::vector<uint8_t> output;
+    size_t writes = 0;
+    muxer.begin([&](const void* data, size_t len) {
+        EXPECT_LE(len, 4 * MPEGTSMuxer::PacketSize);
+        auto bytes = reinterpret_cast<const uint8_t*>(data);
+        output.insert(output.end(), bytes, bytes + len);
+        ++writes;
+        return true;
+    });
+
+    // a keyframe, a frame that exactly fills its packet after the pcr, pes header, and aud, one that
+    // needs a single stuffing byte, and a big one
+    std::vector<std::vector<uint8_t>> frames;
+    for (size_t size : {1000, 184 - 8 - 19 - 6, 184 - 8 - 19 - 6 - 1, 50000}) {
+        std::vector<uint8_t> frame(size, 0xab);
+        frame[0] = 0;
+        frame[1] = 0;
+        frame[2] = 1;
+        frame[3] = frames.empty() ? 0x65 : 0x41;
+        frames.emplace_back(std::move(frame));
+    }
+    std::vector<uint8_t> audio(300, 0xcd);
+
+    for (size_t i = 0; i < frames.size(); ++i) {
+        auto pts = std::chrono::milliseconds(i * 33);
+        EXPECT_TRUE(muxer.writeVideo(pts + std::chrono::milliseconds(66), pts, frames[i].data(), frames[i].size(), i == 0, false));
+        EXPECT_TRUE(muxer.writeAudio(pts, audio.data(), audio.size()));
+    }
+    EXPECT_TRUE(muxer.end());
+    EXPECT_GT(writes, 1);
+
+    // these are the exact bytes that ffmpeg writes
+    const uint8_t pat[] = {0x47, 0x40, 0x00, 0x10, 0x00, 0x00, 0xb0, 0x0d, 0x00, 0x01, 0xc1, 0x00, 0x00, 0x00, 0x01, 0xf0, 0x00, 0x2a, 0xb1, 0x04, 0xb2};
+    ASSERT_GE(output.size(), sizeof(pat));
+    EXPECT_EQ(0, memcmp(output.data(), pat, sizeof(pat)));
+
+    auto packets = ParseTS(output);
+    std::map<uint16_t, unsigned int> continuityCounters;
+    std::map<uint16_t, std::vector<PES>> streams;
+    size_t tables = 0;
+
+    for (auto& packet : packets) {
+        auto it = continuityCounters.find(packet.pid);
+        if (it != continuityCounters.end()) {
+            EXPECT_EQ((it->second + 1) & 0x0f, packet.continuityCounter) << "pid " << packet.pid;
+        } else {
+            EXPECT_EQ(0, packet.continuityCounter) << "pid " << packet.pid;
+        }
+        continuityCounters[packet.pid] = packet.continuityCounter;
+
+        if (packet.pid == 0x0000 || packet.pid == 0x1000) {
+            ASSERT_TRUE(packet.isPayloadUnitStart);
+            auto section = &packet.payload[1];
+            auto sectionLength = ((section[1] & 0x0f) << 8) | section[2];
+            EXPECT_EQ(0, CRC32(section, 3 + sectionLength));
+            ++tables;
+            continue;
+        }
+
+        auto& stream = streams[packet.pid];
+        if (packet.isPayloadUnitStart) {
+            auto& p = packet.payload;
+            ASSERT_EQ(0x000001, (p[0] << 16) | (p[1] << 8) | p[2]);
+            PES pes;
+            pes.length = (p[4] << 8) | p[5];
+            pes.pts = ParseTimestamp(&p[9]);
+            pes.dts = (p[7] & 0x40) ? ParseTimestamp(&p[14]) : pes.pts;
+            pes.isRandomAccessPoint = packet.isRandomAccessPoint;
+            pes.payload.assign(p.begin() + 9 + p[8], p.end());
+
+            if (packet.pid == 0x101) {
+                EXPECT_TRUE(packet.hasPCR);
+                EXPECT_EQ(pes.dts - 63000, packet.pcrBase);
+                EXPECT_EQ(0, pes.length);
+            } else {
+                EXPECT_FALSE(packet.hasPCR);
+                // only the header's size for now
+                pes.length -= 3 + p[8];
+            }
+            stream.emplace_back(std::move(pes));
+        } else {
+            ASSERT_FALSE(stream.empty());
+            EXPECT_FALSE(packet.hasPCR);
+            stream.back().payload.insert(stream.back().payload.end(), packet.payload.begin(), packet.payload.end());
+        }
+    }
+
+    // at the start, and again before the keyframe
+    EXPECT_EQ(4, tables);
+
+    auto& video = streams[0x101];
+    ASSERT_EQ(frames.size(), video.size());
+    for (size_t i = 0; i < frames.size(); ++i) {
+        EXPECT_EQ(i == 0, video[i].isRandomAccessPoint);
+        EXPECT_EQ(126000 + 3 * i * 990, video[i].dts);
+        EXPECT_EQ(video[i].dts + 66 * 90, video[i].pts);
+
+        std::vector<uint8_t> expected = {0, 0, 0, 1, 0x09, 0xf0};
+        if (i == 0) {
+            expected.insert(expected.end(), parameterSets, parameterSets + sizeof(parameterSets));
+        }
+        expected.insert(expected.end(), frames[i].begin(), frames[i].end());
+        EXPECT_EQ(expected, video[i].payload);
+    }
+
+    // everything fits in one audio packet
+    auto& audioPackets = streams[0x100];
+    ASSERT_EQ(1, audioPackets.size());
+    EXPECT_EQ(126000, audioPackets[0].pts);
+    EXPECT_EQ(audioPackets[0].length, audioPackets[0].payload.size());
+    ASSERT_EQ(frames.size() * (7 + audio.size()), audioPackets[0].payload.size());
+    for (size_t i = 0; i < frames.size(); ++i) {
+        auto frame = &audioPackets[0].payload[i * (7 + audio.size())];
+        EXPECT_EQ(audioConfig.adtsHeader(audio.size()), std::vector<uint8_t>(frame, frame + 7));
+        EXPECT_EQ(audio, std::vector<uint8_t>(frame + 7, frame + 7 + audio.size()));
+    }
+}
+
+TEST(MPEGTSMuxer, segmentRoundTrip) {
+    struct Storage : SegmentStorage {
+        struct Segment : SegmentStorage::Segment {
+            virtual ~Segment() {}
+
+            virtual bool write(const void* data, size_t len) override {
+                return std::fwrite(data, 1, len, f) == len;
+            }
+
+            virtual bool close(std::chrono::microseconds duration) override {
+                return std::fclose(f) == 0;
+            }
+
+            std::FILE* f;
+        };
+
+        virtual std::shared_ptr<SegmentStorage::Segment> createSegment(const std::string& extension) override {
+            auto segment = std::make_shared<Segment>();
+            segment->f = std::fopen(path.c_str(), "wb");
+            ++segments;
+            return segment;
+        }
+
+        std::string path;
+        size_t segments = 0;
+    };
+
+    std::string directory = ".MPEGTSMuxer-segmentRoundTrip-test";
+    system(("rm -rf " + directory + " && mkdir " + directory).c_str());
+
+    TestLogDestination logDestination;
+    Storage storage;
+    storage.path = directory + "/segment.ts";
+
+    RecordingEncodedAVHandler input;
+    {
+        H264Packager packager{&logDestination, &storage};
+        input.next = &packager;
+        ExerciseEncodedAVHandler(&input);
+    }
+    ASSERT_EQ(1, storage.segments);
+
+    RecordingEncodedAVHandler output;
+    output.hasKeyframe = true;
+    {
+        Demuxer demuxer{&logDestination, storage.path, &output};
+    }
+
+    system(("rm -rf " + directory).c_str());
+
+    ASSERT_GT(input.video.size(), 10);
+    ASSERT_EQ(input.video.size(), output.video.size());
+    ASSERT_GT(input.audio.size(), 10);
+    ASSERT_EQ(input.audio.size(), output.audio.size());
+
+    // timestamps are offset by the muxer and rounded to 90khz
+    auto inputOrigin = input.video[0].dts;
+    auto outputOrigin = output.video[0].dts;
+
+    for (size_t i = 0; i < input.video.size(); ++i) {
+        auto& in = input.video[i];
+        auto& out = output.video[i];
+        EXPECT_NEAR((in.pts - inputOrigin).count(), (out.pts - outputOrigin).count(), 20) << "frame " << i;
+        EXPECT_NEAR((in.dts - inputOrigin).count(), (out.dts - outputOrigin).count(), 20) << "frame " << i;
+        EXPECT_EQ(in.data, out.data) << "frame " << i;
+    }
+
+    for (size_t i = 0; i < input.audio.size(); ++i) {
+        auto& in = input.audio[i].data[0];
+        auto& out = output.audio[i].data[0];
+        // the demuxer leaves the adts header on
+        ASSERT_EQ(in.size() + 7, out.size()) << "frame " << i;
+        EXPECT_TRUE(std::equal(in.begin(), in.end(), out.begin() + 7)) << "frame " << i;
+        EXPECT_NEAR((input.audio[i].pts - inputOrigin).count(), (output.audio[i].pts - outputOrigin).count(), 1000) << "frame " << i;
+    }
+}
@@ -0,0 +1,75 @@
+#include "overload_controller.hpp"
+
+#include <algorithm>
+#include <numeric>
+
+size_t OverloadController::addRendition(int priority) {
+    while (_level > 0) {
+        _apply(_steps[--_level], true);
+    }
+    _overloadedSamples = 0;
+    _headroomSamples = 0;
+
+    _priorities.push_back(priority);
+    _states.emplace_back();
+
+    // least important first. the most important rendition is never slowed down or suspended
+    std::vector<size_t> order(_priorities.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        return _priorities[a] < _priorities[b];
+    });
+    order.pop_back();
+
+    _steps.clear();
+    for (int i = 0; i < MaxPresetSteps; ++i) {
+        _steps.push_back({StepType::Preset, 0});
+    }
+    for (auto rendition : order) {
+        _steps.push_back({StepType::FrameRate, rendition});
+    }
+    for (auto rendition : order) {
+        _steps.push_back({StepType::Suspend, rendition});
+    }
+
+    return _priorities.size() - 1;
+}
+
+bool OverloadController::update(const Sample& sample) {
+    auto isOverloaded = sample.encoderLag > _configuration.maxEncoderLag || sample.queueDepth > _configuration.maxQueueDepth;
+    auto hasHeadroom = sample.encoderLag * 2 < _configuration.maxEncoderLag && sample.queueDepth * 2 < _configuration.maxQueueDepth;
+
+    _overloadedSamples = isOverloaded ? _overloadedSamples + 1 : 0;
+    _headroomSamples = hasHeadroom ? _headroomSamples + 1 : 0;
+
+    if (_overloadedSamples >= _configuration.overloadedSamples && _level < _steps.size()) {
+        _apply(_steps[_level++], false);
+        // give the step a chance to take effect before taking another
+        _overloadedSamples = 0;
+        return true;
+    }
+
+    if (_headroomSamples >= _configuration.headroomSamples && _level > 0) {
+        _apply(_steps[--_level], true);
+        _headroomSamples = 0;
+        return true;
+    }
+
+    return false;
+}
+
+void OverloadController::_apply(const Step& step, bool undo) {
+    switch (step.type) {
+        case StepType::Preset:
+            for (auto& state : _states) {
+                state.presetSteps += undo ? -1 : 1;
+            }
+            break;
+        case StepType::FrameRate:
+            _states[step.rendition].frameRateDivisor = undo ? 1 : 2;
+            break;
+        case StepType::Suspend:
+            _states[step.rendition].isSuspended = !undo;
+            break;
+    }
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <chrono>
+#include <vector>
+
+// OverloadController decides how to shed encoding work when a stream's renditions can't keep up
+// with realtime. It's fed a sample at each segment boundary. Once overload has been sustained, it
+// takes one step at a time, in order:
+//
+// 1. Every rendition's preset is made one step faster, up to MaxPresetSteps times.
+// 2. The frame rate of each rendition but the most important one is halved, least important first.
+// 3. Renditions other than the most important one are suspended, least important first.
+//
+// Once there's been headroom for a while, steps are undone one at a time in reverse order.
+//
+// OverloadController isn't thread-safe.
+class OverloadController {
+public:
+    static constexpr int MaxPresetSteps = 2;
+
+    struct Configuration {
+        // A stream is overloaded when either its encoder lag or its ingress queue depth exceeds
+        // these.
+        std::chrono::milliseconds maxEncoderLag{500};
+        std::chrono::milliseconds maxQueueDepth{1000};
+
+        // A step is taken after this many overloaded samples in a row.
+        int overloadedSamples = 2;
+
+        // A step is undone after this many samples in a row with both measurements under half of
+        // their limits.
+        int headroomSamples = 3;
+    };
+
+    struct Sample {
+        // How far encoded video trailed the source at the last segment boundary.
+        std::chrono::milliseconds encoderLag{0};
+
+        // How much media was waiting to be segmented and transcoded.
+        std::chrono::milliseconds queueDepth{0};
+    };
+
+    // State is what a rendition should currently be doing.
+    struct State {
+        // How many steps faster than configured the rendition's preset should be.
+        int presetSteps = 0;
+
+        // Only one out of every frameRateDivisor frames should be encoded.
+        int frameRateDivisor = 1;
+
+        bool isSuspended = false;
+
+        bool operator==(const State& other) const {
+            return presetSteps == other.presetSteps && frameRateDivisor == other.frameRateDivisor && isSuspended == other.isSuspended;
+        }
+        bool operator!=(const State& other) const { return !(*this == other); }
+    };
+
+    explicit OverloadController(Configuration configuration) : _configuration{configuration} {}
+
+    // addRendition adds a rendition and returns its index. Renditions with higher priorities are
+    // more important. Adding a rendition restores everything.
+    size_t addRendition(int priority);
+
+    // update takes a new sample and returns true if any rendition's state changed.
+    bool update(const Sample& sample);
+
+    const State& state(size_t rendition) const { return _states[rendition]; }
+
+    // level returns the number of steps currently taken.
+    size_t level() const { return _level; }
+
+private:
+    const Configuration _configuration;
+
+    enum class StepType {
+        Preset,
+        FrameRate,
+        Suspend,
+    };
+
+    struct Step {
+        StepType type;
+        size_t rendition;
+    };
+
+    std::vector<int> _priorities;
+    std::vector<State> _states;
+    std::vector<Step> _steps;
+    size_t _level = 0;
+
+    int _overloadedSamples = 0;
+    int _headroomSamples = 0;
+
+    void _apply(const Step& step, bool undo);
+};
@@ -0,0 +1,114 @@
+#include <gtest/gtest.h>
+
+#include "overload_controller.hpp"
+
+namespace {
+
+OverloadController::Sample Overloaded() {
+    OverloadController::Sample ret;
+    ret.encoderLag = std::chrono::milliseconds(800);
+    return ret;
+}
+
+OverloadController::Sample Idle() {
+    return {};
+}
+
+} // anonymous namespace
+
+TEST(OverloadController, shedding) {
+    OverloadController::Configuration configuration;
+    configuration.overloadedSamples = 2;
+    configuration.headroomSamples = 3;
+    OverloadController controller{configuration};
+
+    auto hd = controller.addRendition(1280 * 720);
+    auto sd = controller.addRendition(640 * 360);
+    auto fhd = controller.addRendition(1920 * 1080);
+
+    // a single overloaded sample isn't enough
+    EXPECT_FALSE(controller.update(Overloaded()));
+    EXPECT_FALSE(controller.update(Idle()));
+    EXPECT_FALSE(controller.update(Overloaded()));
+    EXPECT_FALSE(controller.update(Idle()));
+    EXPECT_EQ(0, controller.level());
+
+    auto step = [&] {
+        EXPECT_FALSE(controller.update(Overloaded()));
+        EXPECT_TRUE(controller.update(Overloaded()));
+    };
+
+    // presets first, for everyone
+    step();
+    step();
+    for (auto rendition : {hd, sd, fhd}) {
+        EXPECT_EQ(2, controller.state(rendition).presetSteps);
+        EXPECT_EQ(1, controller.state(rendition).frameRateDivisor);
+    }
+
+    // then frame rates, least important first
+    step();
+    EXPECT_EQ(2, controller.state(sd).frameRateDivisor);
+    EXPECT_EQ(1, controller.state(hd).frameRateDivisor);
+    step();
+    EXPECT_EQ(2, controller.state(hd).frameRateDivisor);
+
+    // then suspensions
+    step();
+    EXPECT_TRUE(controller.state(sd).isSuspended);
+    EXPECT_FALSE(controller.state(hd).isSuspended);
+    step();
+    EXPECT_TRUE(controller.state(hd).isSuspended);
+
+    // the most important rendition is never touched beyond its preset
+    EXPECT_FALSE(controller.update(Overloaded()));
+    EXPECT_FALSE(controller.update(Overloaded()));
+    EXPECT_FALSE(controller.state(fhd).isSuspended);
+    EXPECT_EQ(1, controller.state(fhd).frameRateDivisor);
+    EXPECT_EQ(6, controller.level());
+
+    // moderate load neither sheds nor restores
+    OverloadController::Sample moderate;
+    moderate.encoderLag = std::chrono::milliseconds(300);
+    for (int i = 0; i < 5; ++i) {
+        EXPECT_FALSE(controller.update(moderate));
+    }
+
+    // headroom restores in reverse order
+    EXPECT_FALSE(controller.update(Idle()));
+    EXPECT_FALSE(controller.update(Idle()));
+    EXPECT_TRUE(controller.update(Idle()));
+    EXPECT_FALSE(controller.state(hd).isSuspended);
+    EXPECT_TRUE(controller.state(sd).isSuspended);
+
+    for (int i = 0; i < 3 * 5; ++i) {
+        controller.update(Idle());
+    }
+    EXPECT_EQ(0, controller.level());
+    for (auto rendition : {hd, sd, fhd}) {
+        EXPECT_EQ(OverloadController::State{}, controller.state(rendition));
+    }
+}
+
+TEST(OverloadController, queueDepth) {
+    OverloadController controller{OverloadController::Configuration{}};
+    controller.addRendition(0);
+
+    OverloadController::Sample sample;
+    sample.queueDepth = std::chrono::milliseconds(1500);
+    EXPECT_FALSE(controller.update(sample));
+    EXPECT_TRUE(controller.update(sample));
+    EXPECT_EQ(1, controller.state(0).presetSteps);
+}
+
+TEST(OverloadController, addingRenditionsRestores) {
+    OverloadController controller{OverloadController::Configuration{}};
+    controller.addRendition(0);
+    controller.update(Overloaded());
+    controller.update(Overloaded());
+    EXPECT_EQ(1, controller.level());
+
+    controller.addRendition(1);
+    EXPECT_EQ(0, controller.level());
+    EXPECT_EQ(OverloadController::State{}, controller.state(0));
+}
@@ -1,16 +1,12 @@
 #include "packager.hpp"
 
-#include <cstring>
-
-#include "ffmpeg.hpp"
-
-Packager::Packager(Logger logger, SegmentStorage* storage)
-    : _logger{std::move(logger)}, _storage{storage}
-{
-    constexpr size_t kBufferSize = 4 * 1024;
-    _ioContextBuffer = av_malloc(kBufferSize);
-    _ioContext = avio_alloc_context(reinterpret_cast<unsigned char*>(_ioContextBuffer), kBufferSize, 1, this, nullptr, &_writePacket, nullptr);
-}
+Packager::Packager(Logger logger, SegmentStorage* storage, MPEGTSMuxer::VideoCodec codec, SegmentFormat format)
+    : _logger{std::move(logger)}
+    , _storage{storage}
+    , _segmentFormat{format}
+    , _tsMuxer{codec}
+    , _fmp4Muxer{codec == MPEGTSMuxer::VideoCodec::H264 ? FMP4Muxer::VideoCodec::H264 : FMP4Muxer::VideoCodec::H265}
+{}
 
 void Packager::handleEncodedVideoDiscontinuity() {
     std::lock_guard<std::mutex> l{_mutex};
@@ -23,8 +19,6 @@ void Packager::handleEncodedVideoDiscontinuity() {
 
 Packager::~Packager() {
     _endSegment();
-    av_free(_ioContext);
-    av_free(_ioContextBuffer);
 }
 
 void Packager::beginNewSegment() {
@@ -32,22 +26,79 @@ void Packager::beginNewSegment() {
     _shouldBeginNewSegment = true;
 }
 
-void Packager::_endSegment(bool writeTrailer, std::chrono::microseconds nextSegmentPTS) {
-    if (_outputContext) {
-        if (writeTrailer) {
-            av_write_trailer(_outputContext);
+void Packager::endSegment() {
+    std::lock_guard<std::mutex> l{_mutex};
+    _endSegment();
+    _shouldMarkNextSegmentDiscontinuous = true;
+}
+
+void Packager::setPartDuration(std::chrono::microseconds duration) {
+    std::lock_guard<std::mutex> l{_mutex};
+    _partDuration = duration;
+}
+
+std::chrono::microseconds Packager::encoderLag() {
+    std::lock_guard<std::mutex> l{_mutex};
+    return _encoderLag;
+}
+
+bool Packager::_openSegment(std::chrono::microseconds pts) {
+    if(_shouldMarkNextSegmentDiscontinuous) {
+        _logger.info("segment created with discontinuity");
+    }
+
+    if (_segmentFormat == SegmentFormat::CMAF && _shouldWriteInitSegment) {
+        auto initSegment = _storage->createInitSegment("mp4");
+        if (!initSegment) {
+            _logger.error("unable to create init segment");
+            return false;
+        }
+        auto didWrite = _fmp4Muxer.writeInitSegment([&](const void* data, size_t len) {
+            return initSegment->write(data, len);
+        });
+        if (!initSegment->close(std::chrono::microseconds::zero()) || !didWrite) {
+            _logger.error("unable to write init segment");
+            return false;
         }
-        avformat_free_context(_outputContext);
-        _outputContext = nullptr;
-        _audioStream = nullptr;
-        _videoStream = nullptr;
+        _shouldWriteInitSegment = false;
     }
 
+    _segment = _storage->createSegment(_segmentExtension());
+    if (!_segment) {
+        _logger.error("unable to create segment");
+        return false;
+    }
+    _segment->metadata.discontinuity = _shouldMarkNextSegmentDiscontinuous;
+    _shouldMarkNextSegmentDiscontinuous = false;
+
+    _segmentPTS = pts;
+    _nextPartNumber = 0;
+    auto write = [this](const void* data, size_t len) {
+        auto ok = _segment->write(data, len);
+        if (_part) {
+            ok = _part->write(data, len) && ok;
+        }
+        return ok;
+    };
+    if (_segmentFormat == SegmentFormat::CMAF) {
+        _fmp4Muxer.begin(write);
+    } else {
+        _tsMuxer.begin(write);
+    }
+    return true;
+}
+
+void Packager::_endSegment(std::chrono::microseconds nextSegmentPTS) {
     if (_segment) {
+        if (!(_segmentFormat == SegmentFormat::CMAF ? _fmp4Muxer.end() : _tsMuxer.end())) {
+            _logger.error("unable to write to segment");
+        }
+
         std::chrono::microseconds duration;
 
         if (nextSegmentPTS != std::chrono::microseconds::zero()) {
-            auto gap = std::chrono::duration_cast<std::chrono::milliseconds>(nextSegmentPTS - _maxVideoPTS);
+            _encoderLag = nextSegmentPTS - _maxVideoPTS;
+            auto gap = std::chrono::duration_cast<std::chrono::milliseconds>(_encoderLag);
             if (gap.count() > 100) {
                 _logger.with("_nextSegmentPTS - _maxVideoPTS", gap.count()).warn("encoder might not be keeping up; duration may not be accurate");
             }
@@ -56,6 +107,11 @@ void Packager::_endSegment(bool writeTrailer, std::chrono::microseconds nextSegm
             duration = _maxVideoPTS - _lastMaxVideoPTS;
         }
 
+        if (_part) {
+            _endPart(_segmentPTS + duration);
+        }
+
+        _segment->maxVideoPTS = _maxVideoPTS;
         _logger.with("duration_ms", std::chrono::duration_cast<std::chrono::milliseconds>(duration).count()).info("closing segment");
         if (!_segment->close(duration)) {
             _logger.error("unable to close segment");
@@ -65,6 +121,48 @@ void Packager::_endSegment(bool writeTrailer, std::chrono::microseconds nextSegm
     _lastMaxVideoPTS = _maxVideoPTS;
 }
 
+void Packager::_updatePart(std::chrono::microseconds pts, bool isIndependent) {
+    if (_partDuration.count() <= 0) {
+        return;
+    }
+
+    if (_part) {
+        // parts only begin at frames that are presented after everything before them. playlists
+        // advertise the part duration as the PART-TARGET, which parts can't exceed, so the part
+        // ends here if the next such frame is expected to be past it
+        if (pts <= _partMaxPTS) {
+            return;
+        }
+        auto step = pts - _partMaxPTS;
+        _partMaxPTS = pts;
+        if (pts + step - _partPTS <= _partDuration) {
+            return;
+        }
+        if (!(_segmentFormat == SegmentFormat::CMAF ? _fmp4Muxer.flush() : _tsMuxer.flush())) {
+            _logger.error("unable to write to part");
+        }
+        _endPart(pts);
+    }
+
+    _part = _storage->createPart(_segment.get(), _nextPartNumber++, _segmentExtension());
+    if (!_part) {
+        _logger.warn("segment storage doesn't support parts. disabling them");
+        _partDuration = std::chrono::microseconds{0};
+        return;
+    }
+    _part->isIndependent = isIndependent;
+    _partPTS = pts;
+    _partMaxPTS = pts;
+}
+
+void Packager::_endPart(std::chrono::microseconds endPTS) {
+    _part->maxVideoPTS = _maxVideoPTS;
+    if (!_part->close(endPTS - _partPTS)) {
+        _logger.error("unable to close part");
+    }
+    _part = nullptr;
+}
+
 void Packager::handleEncodedAudioConfig(const void* data, size_t len) {
     std::lock_guard<std::mutex> l{_mutex};
 
@@ -79,40 +177,19 @@ void Packager::handleEncodedAudioConfig(const void* data, size_t len) {
     }
 
     _audioConfig = std::move(config);
+    _tsMuxer.setAudioConfig(*_audioConfig);
+    _fmp4Muxer.setAudioConfig(*_audioConfig);
+    _shouldWriteInitSegment = true;
 }
 
 void Packager::handleEncodedAudio(std::chrono::microseconds pts, const void* data, size_t len) {
     std::lock_guard<std::mutex> l{_mutex};
-    if (!_audioConfig || !_audioStream) {
+    if (!_audioConfig || !_segment) {
         return;
     }
 
-    auto adts = _audioConfig->adtsHeader(len);
-    _inputBuffer.resize(adts.size() + len);
-    std::memcpy(&_inputBuffer[0], adts.data(), adts.size());
-    std::memcpy(&_inputBuffer[adts.size()], data, len);
-
-    AVPacket packet{};
-    av_init_packet(&packet);
-    packet.data = _inputBuffer.data();
-    packet.size = _inputBuffer.size();
-    packet.stream_index = _audioStream->index;
-    packet.pts = pts.count() / 1000000.0 / av_q2d(_audioStream->time_base);
-    packet.dts = packet.pts;
-
-    auto err = av_interleaved_write_frame(_outputContext, &packet);
-    if (err != 0) {
-        _logger.error("error writing audio frame: {}", FFmpegErrorString(err));
-    }
-}
-
-int Packager::_writePacket(void* opaque, uint8_t* buf, int len) {
-    auto self = reinterpret_cast<Packager*>(opaque);
-    if (self->_segment) {
-        if (!self->_segment->write(buf, len)) {
-            self->_logger.error("unable to write to segment");
-            return AVERROR_UNKNOWN;
-        }
+    auto ok = _segmentFormat == SegmentFormat::CMAF ? _fmp4Muxer.writeAudio(pts, data, len) : _tsMuxer.writeAudio(pts, data, len);
+    if (!ok) {
+        _logger.error("error writing audio frame");
     }
-    return len;
 }
@@ -5,26 +5,57 @@
 #include <mutex>
 #include <variant>
 
-extern "C" {
-    #include <libavformat/avformat.h>
-}
-
 #include <h26x/seq_parameter_set.hpp>
 
 #include "encoded_av_handler.hpp"
+#include "fmp4_muxer.hpp"
+#include "latency_tracer.hpp"
 #include "logger.hpp"
 #include "mpeg4.hpp"
+#include "mpegts_muxer.hpp"
 #include "segment_storage.hpp"
 
-// Packager takes incoming audio and video, and synchronously muxes them into MPEG-TS segments.
+// Packager takes incoming audio and video, and synchronously muxes them into MPEG-TS or CMAF
+// segments.
 class Packager : public EncodedAVHandler {
 public:
-    Packager(Logger logger, SegmentStorage* storage);
+    enum class SegmentFormat {
+        // Self-contained MPEG-TS segments.
+        TS,
+
+        // Fragmented MP4 media segments, each preceded in storage by an init segment whenever the
+        // audio or video config changes.
+        CMAF,
+    };
+
+    Packager(Logger logger, SegmentStorage* storage, MPEGTSMuxer::VideoCodec codec, SegmentFormat format);
     virtual ~Packager();
 
     // beginNewSegment instructs the packager to begin a new segment at the next IDR.
     void beginNewSegment();
 
+    // If set, video frames are stamped with LatencyTracer::Stage::Packager once they're written.
+    void setLatencyTracer(LatencyTracer* tracer) { _latencyTracer = tracer; }
+
+    // If set, segments can begin at recovery points as well as at IDRs. This is for video encoded
+    // with periodic intra refresh. Only H.264 is supported.
+    void setSegmentsAtRecoveryPoints(bool segmentsAtRecoveryPoints) { _segmentsAtRecoveryPoints = segmentsAtRecoveryPoints; }
+    bool segmentsAtRecoveryPoints() const { return _segmentsAtRecoveryPoints; }
+
+    // endSegment ends the current segment immediately instead of at the next IDR. This is for
+    // suspending the video, after which the next segment begins at the next IDR and is marked as
+    // discontinuous.
+    void endSegment();
+
+    // If non-zero, segments are also written out in parts of up to this duration as they're muxed,
+    // for LL-HLS. Parts end before the video frame that would take them past the duration, so they
+    // run a little short. It's only exceeded if a single frame is longer than it.
+    void setPartDuration(std::chrono::microseconds duration);
+
+    // encoderLag returns how far short of the next segment's start the last segment's video fell.
+    // If this is more than a frame interval or so, the encoder isn't keeping up.
+    std::chrono::microseconds encoderLag();
+
     virtual void handleEncodedAudioConfig(const void* data, size_t len) override;
     virtual void handleEncodedAudio(std::chrono::microseconds pts, const void* data, size_t len) override;
 
@@ -35,10 +66,12 @@ public:
 protected:
     const Logger _logger;
     SegmentStorage* const _storage;
+    LatencyTracer* _latencyTracer = nullptr;
 
     std::mutex _mutex;
 
     bool _shouldBeginNewSegment = false;
+    bool _segmentsAtRecoveryPoints = false;
     bool _shouldMarkNextSegmentDiscontinuous = true;
 
     std::vector<uint8_t> _inputBuffer;
@@ -49,31 +82,48 @@ protected:
     using UniqueHEVCDecoderRecord = std::unique_ptr<HEVCDecoderConfigurationRecord>;
     std::variant<std::nullptr_t, UniqueAVCDecoderRecord, UniqueHEVCDecoderRecord> _decoderRecord = nullptr;
 
-    AVFormatContext* _outputContext = nullptr;
-    void* _ioContextBuffer = nullptr;
-    AVIOContext* _ioContext = nullptr;
-    AVStream* _audioStream = nullptr;
-    AVStream* _videoStream = nullptr;
+    const SegmentFormat _segmentFormat;
+    MPEGTSMuxer _tsMuxer;
+    FMP4Muxer _fmp4Muxer;
+    bool _shouldWriteInitSegment = true;
     std::shared_ptr<SegmentStorage::Segment> _segment;
 
+    std::chrono::microseconds _partDuration{0};
+    std::shared_ptr<SegmentStorage::Segment> _part;
+    int _nextPartNumber = 0;
+    std::chrono::microseconds _partPTS{};
+    std::chrono::microseconds _partMaxPTS{};
+
     std::chrono::microseconds _segmentPTS{};
     std::chrono::microseconds _maxVideoPTS = std::chrono::microseconds::min();
     std::chrono::microseconds _lastMaxVideoPTS = std::chrono::microseconds::zero();
+    std::chrono::microseconds _encoderLag{0};
 
     virtual void _beginSegment(std::chrono::microseconds pts) = 0;
-    void _endSegment(bool writeTrailer = true, std::chrono::microseconds nextSegmentPTS = std::chrono::microseconds::zero());
 
-    static int _writePacket(void* opaque, uint8_t* buf, int len);
+    // _openSegment creates a segment and begins muxing into it. For CMAF, an init segment is written
+    // first if the configs have changed. It returns false on failure.
+    bool _openSegment(std::chrono::microseconds pts);
+    void _endSegment(std::chrono::microseconds nextSegmentPTS = std::chrono::microseconds::zero());
+
+    // _updatePart must be invoked before each video frame is written to the segment. It begins the
+    // segment's first part, or flushes the muxer and moves on to the next part if the frame would
+    // make the current one too long.
+    void _updatePart(std::chrono::microseconds pts, bool isIndependent);
+    void _endPart(std::chrono::microseconds endPTS);
+
+    const char* _segmentExtension() const { return _segmentFormat == SegmentFormat::CMAF ? "m4s" : "ts"; }
 };
 
 
 class H264Packager : public Packager {
 public:
-    H264Packager(Logger logger, SegmentStorage* storage) : Packager(std::move(logger), storage) {}
+    H264Packager(Logger logger, SegmentStorage* storage, SegmentFormat format = SegmentFormat::TS) : Packager(std::move(logger), storage, MPEGTSMuxer::VideoCodec::H264, format) {}
     virtual ~H264Packager() {}
 
     virtual void handleEncodedVideoConfig(const void* data, size_t len) override;
     virtual void handleEncodedVideo(std::chrono::microseconds pts, std::chrono::microseconds dts, const void* data, size_t len) override;
+    virtual void handleEncodedVideoPacket(std::chrono::microseconds pts, std::chrono::microseconds dts, const EncodedPacket& packet) override;
 
 protected:
     std::unique_ptr<h264::seq_parameter_set_rbsp> _videoConfigSPS;
@@ -82,7 +132,7 @@ protected:
 
 class H265Packager : public Packager {
 public:
-    H265Packager(Logger logger, SegmentStorage* storage) : Packager(std::move(logger), storage) {}
+    H265Packager(Logger logger, SegmentStorage* storage, SegmentFormat format = SegmentFormat::TS) : Packager(std::move(logger), storage, MPEGTSMuxer::VideoCodec::H265, format) {}
     virtual ~H265Packager() {}
 
     virtual void handleEncodedVideoConfig(const void* data, size_t len) override;
@@ -28,6 +28,10 @@ struct TestSegmentStorage : SegmentStorage {
         bool closed = false;
         size_t bytesWritten = 0;
         std::chrono::microseconds duration;
+
+        // Only set for parts.
+        Segment* segment = nullptr;
+        int partNumber = 0;
     };
 
     virtual std::shared_ptr<SegmentStorage::Segment> createSegment(const std::string& extension) override {
@@ -37,7 +41,17 @@ struct TestSegmentStorage : SegmentStorage {
         return segment;
     }
 
+    virtual std::shared_ptr<SegmentStorage::Segment> createPart(SegmentStorage::Segment* segment, int partNumber, const std::string& extension) override {
+        auto part = std::make_shared<Segment>();
+        part->extension = extension;
+        part->segment = static_cast<Segment*>(segment);
+        part->partNumber = partNumber;
+        parts.emplace_back(part);
+        return part;
+    }
+
     std::vector<std::shared_ptr<Segment>> segments;
+    std::vector<std::shared_ptr<Segment>> parts;
 };
 
 struct TestH264Packager : H264Packager {
@@ -93,3 +107,48 @@ TEST(Packager, packaging) {
         EXPECT_GT(storage.segments[i]->bytesWritten, 100 * 1024) << "segment " << i << " should probably be larger (" << storage.segments.size() << " segments were opened)";
     }
 }
+
+TEST(Packager, parts) {
+    TestSegmentStorage storage;
+    TestLogDestination logDestination;
+
+    {
+        H264Packager packager{&logDestination, &storage};
+        packager.setPartDuration(std::chrono::milliseconds(500));
+        Segmenter segmenter{&logDestination, &packager, [&]{
+            packager.beginNewSegment();
+        }};
+        ExerciseEncodedAVHandler(&segmenter);
+    }
+
+    ASSERT_GT(storage.segments.size(), 0);
+    EXPECT_GT(storage.parts.size(), storage.segments.size());
+
+    size_t nextPart = 0;
+    for (size_t i = 0; i < storage.segments.size(); ++i) {
+        auto& segment = storage.segments[i];
+        size_t bytesWritten = 0;
+        std::chrono::microseconds duration{0};
+        for (int partNumber = 0; nextPart < storage.parts.size() && storage.parts[nextPart]->segment == segment.get(); ++partNumber) {
+            auto& part = storage.parts[nextPart++];
+            EXPECT_EQ(partNumber, part->partNumber) << "segment " << i;
+            EXPECT_EQ("ts", part->extension) << "segment " << i;
+            EXPECT_TRUE(part->closed) << "segment " << i << " part " << partNumber;
+            if (partNumber == 0) {
+                EXPECT_TRUE(part->isIndependent) << "segment " << i;
+            }
+            // parts are never longer than the part duration, which is advertised as the PART-TARGET
+            EXPECT_LE(part->duration, std::chrono::milliseconds(500)) << "segment " << i << " part " << partNumber;
+            if (nextPart < storage.parts.size() && storage.parts[nextPart]->segment == segment.get()) {
+                // only the segment's last part can be much shorter
+                EXPECT_GT(part->duration, std::chrono::milliseconds(250)) << "segment " << i << " part " << partNumber;
+            }
+            EXPECT_EQ(0, part->bytesWritten % MPEGTSMuxer::PacketSize) << "segment " << i << " part " << partNumber;
+            bytesWritten += part->bytesWritten;
+            duration += part->duration;
+        }
+        EXPECT_EQ(segment->bytesWritten, bytesWritten) << "segment " << i;
+        EXPECT_EQ(segment->duration, duration) << "segment " << i;
+    }
+    EXPECT_EQ(storage.parts.size(), nextPart);
+}
@@ -1,14 +1,9 @@
 #include "packager.hpp"
 
-#include <cstring>
-
 #include <h26x/nal_unit.hpp>
 
-#include "ffmpeg.hpp"
-
 void H264Packager::_beginSegment(std::chrono::microseconds pts) {
-    _endSegment(true, pts);
-    InitFFmpeg();
+    _endSegment(pts);
 
     if (!_audioConfig || !std::holds_alternative<UniqueAVCDecoderRecord>(_decoderRecord)) {
         return;
@@ -26,73 +21,8 @@ void H264Packager::_beginSegment(std::chrono::microseconds pts) {
             "video_width", _videoConfigSPS->FrameCroppingRectangleWidth()
     ).info("beginning new segment");
 
-    if(_shouldMarkNextSegmentDiscontinuous) {
-        _logger.info("segment created with discontinuity");
-    }
-
-    _segment = _storage->createSegment("ts");
-    _segment->metadata.discontinuity = _shouldMarkNextSegmentDiscontinuous;
-    _shouldMarkNextSegmentDiscontinuous = false;
-
-    if (!_segment) {
-        _logger.error("unable to create segment");
-        _endSegment();
-        return;
-    }
-
-    auto err = avformat_alloc_output_context2(&_outputContext, nullptr, "mpegts", nullptr);
-    if (err < 0) {
-        _logger.error("unable to allocate output context: {}", FFmpegErrorString(err));
+    if (!_openSegment(pts)) {
         _endSegment();
-        return;
-    }
-
-    _segmentPTS = pts;
-
-    _audioStream = avformat_new_stream(_outputContext, nullptr);
-    _audioStream->codecpar->codec_id = AV_CODEC_ID_AAC;
-    _audioStream->codecpar->codec_type = AVMEDIA_TYPE_AUDIO;
-    _audioStream->codecpar->sample_rate = _audioConfig->frequency;
-    _audioStream->codecpar->channels = _audioConfig->channelCount();
-
-    _videoStream = avformat_new_stream(_outputContext, nullptr);
-    _videoStream->codecpar->codec_id = AV_CODEC_ID_H264;
-    _videoStream->codecpar->codec_type = AVMEDIA_TYPE_VIDEO;
-    _videoStream->codecpar->width = _videoConfigSPS->FrameCroppingRectangleWidth();
-    _videoStream->codecpar->height = _videoConfigSPS->FrameCroppingRectangleHeight();
-
-    size_t extraDataSize = 0;
-    for (auto const& sps : videoConfig->sequenceParameterSets) {
-        extraDataSize += 3 + sps.size();
-    }
-    for (auto const& pps : videoConfig->pictureParameterSets) {
-        extraDataSize += 3 + pps.size();
-    }
-    auto ptr = reinterpret_cast<uint8_t*>(av_malloc(extraDataSize + AV_INPUT_BUFFER_PADDING_SIZE));
-    _videoStream->codecpar->extradata = ptr;
-    _videoStream->codecpar->extradata_size = extraDataSize;
-    for (auto sps : videoConfig->sequenceParameterSets) {
-        ptr[0] = 0;
-        ptr[1] = 0;
-        ptr[2] = 1;
-        std::memcpy(ptr + 3, sps.data(), sps.size());
-        ptr += 3 + sps.size();
-    }
-    for (auto pps : videoConfig->pictureParameterSets) {
-        ptr[0] = 0;
-        ptr[1] = 0;
-        ptr[2] = 1;
-        std::memcpy(ptr + 3, pps.data(), pps.size());
-        ptr += 3 + pps.size();
-    }
-
-    _outputContext->pb = _ioContext;
-
-    err = avformat_write_header(_outputContext, nullptr);
-    if (err < 0) {
-        _logger.error("unable to write header: {}", FFmpegErrorString(err));
-        _endSegment(false);
-        return;
     }
 }
 
@@ -141,11 +71,30 @@ void H264Packager::handleEncodedVideoConfig(const void* data, size_t len) {
         return;
     }
 
+    // the parameter sets are given to the muxer in annex b form for it to insert at random access
+    // points that don't have their own
+    _inputBuffer.clear();
+    for (auto& nalus : {&config->sequenceParameterSets, &config->pictureParameterSets}) {
+        for (auto& nalu : *nalus) {
+            _inputBuffer.insert(_inputBuffer.end(), {0, 0, 0, 1});
+            _inputBuffer.insert(_inputBuffer.end(), nalu.begin(), nalu.end());
+        }
+    }
+    _tsMuxer.setVideoParameterSets(_inputBuffer.data(), _inputBuffer.size());
+
+    auto avcc = config->encode();
+    _fmp4Muxer.setVideoConfig(avcc.data(), avcc.size(), configSPS->FrameCroppingRectangleWidth(), configSPS->FrameCroppingRectangleHeight());
+    _shouldWriteInitSegment = true;
+
     _decoderRecord = std::move(config);
     _videoConfigSPS = std::move(configSPS);
 }
 
 void H264Packager::handleEncodedVideo(std::chrono::microseconds pts, std::chrono::microseconds dts, const void* data, size_t len) {
+    handleEncodedVideoPacket(pts, dts, EncodedPacket::Borrow(data, len));
+}
+
+void H264Packager::handleEncodedVideoPacket(std::chrono::microseconds pts, std::chrono::microseconds dts, const EncodedPacket& encodedPacket) {
     std::lock_guard<std::mutex> l{_mutex};
     if (!std::holds_alternative<UniqueAVCDecoderRecord>(_decoderRecord)) {
         return;
@@ -153,47 +102,45 @@ void H264Packager::handleEncodedVideo(std::chrono::microseconds pts, std::chrono
 
     auto& videoConfig = std::get<UniqueAVCDecoderRecord>(_decoderRecord);
 
-    auto isIDR = false;
-    if (!h264::IterateAVCC(data, len, videoConfig->lengthSizeMinusOne + 1, [&](const void* data, size_t len) {
-        if (len < 1) {
-            return;
-        }
-        auto naluType = *reinterpret_cast<const uint8_t*>(data) & 0x1f;
-        isIDR |= (naluType == h264::NALUnitType::IDRSlice);
-    })) {
+    FrameDescriptor storage;
+    auto descriptor = DescribeFrame(encodedPacket, videoConfig->lengthSizeMinusOne + 1, &storage);
+    if (!descriptor) {
         _logger.error("unable to iterate avcc");
         return;
     }
+    auto isRandomAccessPoint = descriptor->isKeyframe || (_segmentsAtRecoveryPoints && descriptor->isRecoveryPoint);
 
-    if (isIDR && (!_videoStream || _shouldBeginNewSegment)) {
+    if (isRandomAccessPoint && (!_segment || _shouldBeginNewSegment)) {
         _shouldBeginNewSegment = false;
         _beginSegment(pts);
     }
 
-    if (!_videoStream) {
+    if (!_segment) {
         return;
     }
 
-    _inputBuffer.clear();
-    if (!h264::AVCCToAnnexB(&_inputBuffer, data, len, videoConfig->lengthSizeMinusOne + 1)) {
-        _logger.error("unable to convert avcc to annex-b");
-        return;
-    }
+    // recovery points can begin segments, but only IDRs are independent. for cmaf, recovery points
+    // are listed in a roll group instead of being made sync samples
+    _updatePart(pts, descriptor->isKeyframe);
 
-    AVPacket packet{};
-    av_init_packet(&packet);
-    packet.data = _inputBuffer.data();
-    packet.size = _inputBuffer.size();
-    packet.stream_index = _videoStream->index;
-    packet.pts = pts.count() / 1000000.0 / av_q2d(_videoStream->time_base);
-    packet.dts = dts.count() / 1000000.0 / av_q2d(_videoStream->time_base);
-    if (isIDR) {
-        packet.flags |= AV_PKT_FLAG_KEY;
+    bool ok;
+    if (_segmentFormat == SegmentFormat::CMAF) {
+        // the packet is already length-prefixed the way the avcc in the init segment says it is
+        auto recoveryFrameCount = _segmentsAtRecoveryPoints && descriptor->isRecoveryPoint ? static_cast<int>(descriptor->recoveryFrameCount) : -1;
+        ok = _fmp4Muxer.writeVideo(pts, dts, encodedPacket.data(), encodedPacket.size(), descriptor->isKeyframe, recoveryFrameCount);
+    } else {
+        _inputBuffer.clear();
+        if (!AppendAnnexB(&_inputBuffer, encodedPacket, videoConfig->lengthSizeMinusOne + 1, descriptor)) {
+            _logger.error("unable to convert avcc to annex-b");
+            return;
+        }
+        ok = _tsMuxer.writeVideo(pts, dts, _inputBuffer.data(), _inputBuffer.size(), isRandomAccessPoint, descriptor->hasParameterSets);
     }
 
-    auto err = av_interleaved_write_frame(_outputContext, &packet);
-    if (err != 0) {
-        _logger.error("error writing video frame: {}", FFmpegErrorString(err));
+    if (!ok) {
+        _logger.error("error writing video frame");
+    } else if (_latencyTracer) {
+        _latencyTracer->stamp(LatencyTracer::Stage::Packager, pts);
     }
 
     if (pts > _maxVideoPTS) {
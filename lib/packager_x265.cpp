@@ -1,10 +1,9 @@
 #include "packager.hpp"
-#include "ffmpeg.hpp"
+
 #include <h26x/h265.hpp>
 
 void H265Packager::_beginSegment(std::chrono::microseconds pts) {
-    _endSegment(true, pts);
-    InitFFmpeg();
+    _endSegment(pts);
 
     if (!_audioConfig || !std::holds_alternative<UniqueHEVCDecoderRecord>(_decoderRecord)) {
         return;
@@ -22,79 +21,8 @@ void H265Packager::_beginSegment(std::chrono::microseconds pts) {
             "video_width", videoConfig->height
     ).info("beginning new segment");
 
-    _segment = _storage->createSegment("ts");
-    _segment->metadata.discontinuity = _shouldMarkNextSegmentDiscontinuous;
-    _shouldMarkNextSegmentDiscontinuous = false;
-
-    if (!_segment) {
-        _logger.error("unable to create segment");
+    if (!_openSegment(pts)) {
         _endSegment();
-        return;
-    }
-
-    auto err = avformat_alloc_output_context2(&_outputContext, nullptr, "mpegts", nullptr);
-    if (err < 0) {
-        _logger.error("unable to allocate output context: {}", FFmpegErrorString(err));
-    }
-
-    _segmentPTS = pts;
-
-    _audioStream = avformat_new_stream(_outputContext, nullptr);
-    _audioStream->codecpar->codec_id = AV_CODEC_ID_AAC;
-    _audioStream->codecpar->codec_type = AVMEDIA_TYPE_AUDIO;
-    _audioStream->codecpar->sample_rate = _audioConfig->frequency;
-    _audioStream->codecpar->channels = _audioConfig->channelCount();
-
-    _videoStream = avformat_new_stream(_outputContext, nullptr);
-    _videoStream->codecpar->codec_id = AV_CODEC_ID_HEVC;
-    _videoStream->codecpar->codec_type = AVMEDIA_TYPE_VIDEO;
-    _videoStream->codecpar->width = videoConfig->width;
-    _videoStream->codecpar->height = videoConfig->height;
-
-    size_t extraDataSize = 0;
-    auto vps_nals = videoConfig->fetchNalus(h265::NALUnitType::VideoParameterSet);
-    auto sps_nals = videoConfig->fetchNalus(h265::NALUnitType::VideoParameterSet);
-    auto pps_nals = videoConfig->fetchNalus(h265::NALUnitType::VideoParameterSet);
-    for (auto& vps : *vps_nals) {
-        extraDataSize += 3 + vps.size();
-    }
-    for (auto& sps : *sps_nals) {
-        extraDataSize += 3 + sps.size();
-    }
-    for (auto& pps : *pps_nals) {
-        extraDataSize += 3 + pps.size();
-    }
-    auto ptr = reinterpret_cast<uint8_t*>(av_malloc(extraDataSize + AV_INPUT_BUFFER_PADDING_SIZE));
-    _videoStream->codecpar->extradata = ptr;
-    _videoStream->codecpar->extradata_size = extraDataSize;
-    for (auto& vps : *vps_nals) {
-        ptr[0] = 0;
-        ptr[1] = 0;
-        ptr[2] = 1;
-        std::memcpy(ptr + 3, vps.data(), vps.size());
-        ptr += 3 + vps.size();
-    }
-    for (auto& sps : *sps_nals) {
-        ptr[0] = 0;
-        ptr[1] = 0;
-        ptr[2] = 1;
-        std::memcpy(ptr + 3, sps.data(), sps.size());
-        ptr += 3 + sps.size();
-    }
-    for (auto& pps : *pps_nals) {
-        ptr[0] = 0;
-        ptr[1] = 0;
-        ptr[2] = 0;
-        std::memcpy(ptr + 3, pps.data(), pps.size());
-        ptr += 3 + pps.size();
-    }
-    _outputContext->pb = _ioContext;
-
-    err = avformat_write_header(_outputContext, nullptr);
-    if (err < 0) {
-        _logger.error("unable to write header: {}", FFmpegErrorString(err));
-        _endSegment(false);
-        return;
     }
 }
 
@@ -108,6 +36,12 @@ void H265Packager::handleEncodedVideoConfig(const void *data, size_t len) {
         _decoderRecord = nullptr;
         return;
     }
+    if (std::holds_alternative<UniqueHEVCDecoderRecord>(_decoderRecord)) {
+        auto& videoConfig = std::get<UniqueHEVCDecoderRecord>(_decoderRecord);
+        if (*config == *videoConfig) {
+            return;
+        }
+    }
     _decoderRecord = nullptr;
 
     /// do some sanity checking? the decoder record should tell us everything we need to know
@@ -120,6 +54,26 @@ void H265Packager::handleEncodedVideoConfig(const void *data, size_t len) {
         _endSegment();
         return;
     }
+
+    // the parameter sets are given to the muxer in annex b form for it to insert at random access
+    // points that don't have their own
+    _inputBuffer.clear();
+    for (auto& nalus : {vps_nals, sps_nals, pps_nals}) {
+        for (auto& nalu : *nalus) {
+            _inputBuffer.insert(_inputBuffer.end(), {0, 0, 0, 1});
+            _inputBuffer.insert(_inputBuffer.end(), nalu.begin(), nalu.end());
+        }
+    }
+    _tsMuxer.setVideoParameterSets(_inputBuffer.data(), _inputBuffer.size());
+
+    // frames are converted to 4-byte length prefixes for cmaf, so the hvcc has to say so regardless
+    // of what the encoder's config says
+    auto hvccRecord = *config;
+    hvccRecord.lengthSizeMinusOne = 3;
+    auto hvcc = hvccRecord.encodeHVCC();
+    _fmp4Muxer.setVideoConfig(hvcc.data(), hvcc.size(), config->width, config->height);
+    _shouldWriteInitSegment = true;
+
     _decoderRecord = std::move(config);
 }
 
@@ -130,6 +84,7 @@ void H265Packager::handleEncodedVideo(std::chrono::microseconds pts, std::chrono
     }
 
     auto isRandomAccess = false;
+    auto hasParameterSets = false;
     if (!h264::IterateAnnexB(data, len, [&](const void* data, size_t len) {
         if (len < 1) {
             return;
@@ -140,37 +95,42 @@ void H265Packager::handleEncodedVideo(std::chrono::microseconds pts, std::chrono
                 naluType == h265::NALUnitType::IDR_W_RADL ||
                 naluType == h265::NALUnitType::IDR_N_LP ||
                 naluType == h265::NALUnitType::CRA_NUT;
+        hasParameterSets |=
+                naluType == h265::NALUnitType::VideoParameterSet ||
+                naluType == h265::NALUnitType::SequenceParameterSet ||
+                naluType == h265::NALUnitType::PictureParameterSet;
     })) {
         _logger.error("unable to iterate annexB");
         return;
     }
 
-    if( isRandomAccess && (!_videoStream || _shouldBeginNewSegment)) {
+    if( isRandomAccess && (!_segment || _shouldBeginNewSegment)) {
         _shouldBeginNewSegment = false;
         _beginSegment(pts);
     }
 
-    if (!_videoStream) {
+    if (!_segment) {
         return;
     }
 
-    AVPacket packet{};
-    av_init_packet(&packet);
-    _inputBuffer.clear();
-    _inputBuffer.insert(_inputBuffer.end(), reinterpret_cast<const uint8_t*>(data), reinterpret_cast<const uint8_t*>(data) + len);
-    packet.data = _inputBuffer.data();
-    packet.size = _inputBuffer.size();
-    packet.stream_index = _videoStream->index;
-
-    packet.pts = pts.count() / 1000000.0 / av_q2d(_videoStream->time_base);
-    packet.dts = dts.count() / 1000000.0 / av_q2d(_videoStream->time_base);
-    if (isRandomAccess) {
-        packet.flags |= AV_PKT_FLAG_KEY;
+    _updatePart(pts, isRandomAccess);
+
+    bool ok;
+    if (_segmentFormat == SegmentFormat::CMAF) {
+        _inputBuffer.clear();
+        if (!h264::AnnexBToAVCC(&_inputBuffer, data, len)) {
+            _logger.error("unable to convert annex-b to length-prefixed nal units");
+            return;
+        }
+        ok = _fmp4Muxer.writeVideo(pts, dts, _inputBuffer.data(), _inputBuffer.size(), isRandomAccess);
+    } else {
+        ok = _tsMuxer.writeVideo(pts, dts, data, len, isRandomAccess, hasParameterSets);
     }
 
-    auto err = av_interleaved_write_frame(_outputContext, &packet);
-    if (err != 0) {
-        _logger.error("error writing video frame: {}", FFmpegErrorString(err));
+    if (!ok) {
+        _logger.error("error writing video frame");
+    } else if (_latencyTracer) {
+        _latencyTracer->stamp(LatencyTracer::Stage::Packager, pts);
     }
 
     if (pts > _maxVideoPTS) {
@@ -42,7 +42,7 @@ PlatformAPI::Result<T> PlatformAPI::_doGraphQL(const json& body, std::function<v
 
 PlatformAPI::Result<PlatformAPI::CreateAVStreamData> PlatformAPI::createAVStream(const PlatformAPI::AVStream& stream) {
     auto query = R"query(
-      mutation CreateAVStream($gameId: ID!, $codecs: [String]!, $bitrate: Int!, $videoWidth: Int!, $videoHeight: Int!, $maximumSegmentDurationMilliseconds: Int!, $isLive: Boolean!) {
+      mutation CreateAVStream($gameId: ID!, $codecs: [String]!, $bitrate: Int!, $videoWidth: Int!, $videoHeight: Int!, $maximumSegmentDurationMilliseconds: Int!, $isLive: Boolean!, $frameRate: Float) {
         createAVStream(
           stream: {
             gameId: $gameId,
@@ -52,6 +52,7 @@ PlatformAPI::Result<PlatformAPI::CreateAVStreamData> PlatformAPI::createAVStream
             videoHeight: $videoHeight,
             maximumSegmentDurationMilliseconds: $maximumSegmentDurationMilliseconds,
             isLive: $isLive,
+            frameRate: $frameRate,
           },
         ) {
           id
@@ -70,6 +71,7 @@ PlatformAPI::Result<PlatformAPI::CreateAVStreamData> PlatformAPI::createAVStream
             {"gameId", stream.gameId},
             {"maximumSegmentDurationMilliseconds", std::chrono::milliseconds(stream.maximumSegmentDuration).count()},
             {"isLive", stream.isLive},
+            {"frameRate", stream.frameRate > 0.0 ? json(stream.frameRate) : json(nullptr)},
         }},
     };
 
@@ -109,7 +111,7 @@ PlatformAPI::Result<PlatformAPI::PatchAVStreamData> PlatformAPI::patchAVStreamBy
 
 PlatformAPI::Result<PlatformAPI::CreateAVStreamSegmentReplicaData> PlatformAPI::createAVStreamSegmentReplica(const PlatformAPI::AVStreamSegmentReplica& replica) {
     auto query = R"query(
-      mutation CreateAVStreamSegmentReplica($streamId: ID!, $segmentNumber: Int!, $url: String!, $durationMilliseconds: Int!, $discontinuity: Boolean, $time: DateTime!) {
+      mutation CreateAVStreamSegmentReplica($streamId: ID!, $segmentNumber: Int!, $url: String!, $durationMilliseconds: Int!, $discontinuity: Boolean, $initSegmentUrl: String, $time: DateTime!) {
         createAVStreamSegmentReplica(
           replica: {
             streamId: $streamId,
@@ -117,6 +119,7 @@ PlatformAPI::Result<PlatformAPI::CreateAVStreamSegmentReplicaData> PlatformAPI::
             url: $url,
             durationMilliseconds: $durationMilliseconds,
             discontinuity: $discontinuity,
+            initSegmentUrl: $initSegmentUrl,
             time: $time,
           },
         ) {
@@ -141,6 +144,7 @@ PlatformAPI::Result<PlatformAPI::CreateAVStreamSegmentReplicaData> PlatformAPI::
             {"url", replica.url},
             {"durationMilliseconds", std::chrono::milliseconds(replica.duration).count()},
             {"discontinuity", replica.discontinuity},
+            {"initSegmentUrl", replica.initSegmentURL.empty() ? json(nullptr) : json(replica.initSegmentURL)},
             {"time", timeString.str()},
         }},
     };
@@ -34,6 +34,9 @@ public:
         int videoHeight = 0;
         int videoWidth = 0;
         int bitrate = 0;
+        // The maximum frame rate of the video, or zero if it's the same as the source's. This is an
+        // upper bound. The video's actual frame rate is lower if the source's is.
+        double frameRate = 0.0;
         std::string gameId;
         bool isLive = false;
     };
@@ -60,6 +63,10 @@ public:
         std::chrono::system_clock::time_point time;
         std::string gameId;
         bool discontinuity = false;
+
+        // For fragmented MP4 segments, the URL of the init segment that the segment must be
+        // preceded by.
+        std::string initSegmentURL;
     };
 
     struct CreateAVStreamSegmentReplicaData {
@@ -7,6 +7,9 @@ TEST(PlatformAPI, createAVStream) {
         virtual HTTPResult request(const HTTPRequest& request) override {
             EXPECT_EQ("https://example.com/v1/graphql", request.url);
             EXPECT_EQ("token access-token", request.headers.at("Authorization"));
+            auto variables = nlohmann::json::parse(request.body)["variables"];
+            EXPECT_EQ(6000000, variables["bitrate"].get<int>());
+            EXPECT_EQ(30.0, variables["frameRate"].get<double>());
             HTTPResult result;
             result.statusCode = 200;
             result.body = R"response(
@@ -26,6 +29,7 @@ TEST(PlatformAPI, createAVStream) {
 
     PlatformAPI::AVStream stream;
     stream.bitrate = 6000000;
+    stream.frameRate = 30;
 
     auto result = api.createAVStream(stream);
     EXPECT_TRUE(result.requestError.empty()) << result.requestError;
@@ -66,6 +70,8 @@ TEST(PlatformAPI, createAVStreamSegmentReplica) {
         virtual HTTPResult request(const HTTPRequest& request) override {
             EXPECT_EQ("https://example.com/v1/graphql", request.url);
             EXPECT_EQ("token access-token", request.headers.at("Authorization"));
+            auto variables = nlohmann::json::parse(request.body)["variables"];
+            EXPECT_EQ("http://foo/init.mp4", variables["initSegmentUrl"].get<std::string>());
             HTTPResult result;
             result.statusCode = 200;
             result.body = R"response(
@@ -88,6 +94,7 @@ TEST(PlatformAPI, createAVStreamSegmentReplica) {
     replica.segmentNumber = 1;
     replica.url = "http://foo/bar";
     replica.duration = std::chrono::milliseconds(123);
+    replica.initSegmentURL = "http://foo/init.mp4";
 
     auto result = api.createAVStreamSegmentReplica(replica);
     EXPECT_TRUE(result.requestError.empty()) << result.requestError;
@@ -0,0 +1,429 @@
+#include "rtmp_chunk_stream.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+
+#include <sys/socket.h>
+
+namespace {
+
+constexpr size_t ReadBufferSize = 64 * 1024;
+
+// Outstanding chunk payloads at least this large are read directly into the message buffer rather
+// than going through the read buffer.
+constexpr size_t DirectReadThreshold = 1024;
+
+constexpr size_t MessageHeaderSizes[] = {11, 7, 3, 0};
+
+uint32_t ReadUInt24(const uint8_t* p) {
+    return (static_cast<uint32_t>(p[0]) << 16) | (static_cast<uint32_t>(p[1]) << 8) | p[2];
+}
+
+uint32_t ReadUInt32(const uint8_t* p) {
+    return (static_cast<uint32_t>(p[0]) << 24) | ReadUInt24(p + 1);
+}
+
+void AppendUInt24(std::vector<uint8_t>* dest, uint32_t n) {
+    dest->push_back(n >> 16);
+    dest->push_back(n >> 8);
+    dest->push_back(n);
+}
+
+void AppendUInt32(std::vector<uint8_t>* dest, uint32_t n) {
+    dest->push_back(n >> 24);
+    AppendUInt24(dest, n);
+}
+
+size_t BasicHeaderLength(uint8_t firstByte) {
+    switch (firstByte & 0x3f) {
+    case 0:
+        return 2;
+    case 1:
+        return 3;
+    default:
+        return 1;
+    }
+}
+
+uint32_t BasicHeaderChunkStreamId(const uint8_t* header) {
+    switch (header[0] & 0x3f) {
+    case 0:
+        return 64 + header[1];
+    case 1:
+        return 64 + header[1] + (static_cast<uint32_t>(header[2]) << 8);
+    default:
+        return header[0] & 0x3f;
+    }
+}
+
+} // anonymous namespace
+
+RTMPChunkStream::RTMPChunkStream(Logger logger, WriteFunction write, MessageHandler handler, std::shared_ptr<BufferPool> pool)
+    : _logger{std::move(logger)}, _write{std::move(write)}, _handler{std::move(handler)}, _pool{std::move(pool)}
+    , _random{static_cast<std::minstd_rand::result_type>(std::chrono::steady_clock::now().time_since_epoch().count())}
+{}
+
+bool RTMPChunkStream::consume(const void* data, size_t len) {
+    auto p = reinterpret_cast<const uint8_t*>(data);
+    auto remaining = len;
+
+    while (remaining > 0) {
+        size_t n = 0;
+        switch (_state) {
+        case State::HandshakeC0C1:
+        case State::HandshakeC2:
+            if (!_consumeHandshake(p, remaining, &n)) {
+                return false;
+            }
+            break;
+        case State::Header:
+            if (!_consumeHeader(p, remaining, &n)) {
+                return false;
+            }
+            break;
+        case State::Payload:
+            n = std::min(remaining, _chunkRemaining);
+            std::memcpy(_chunkStream->body->data() + _chunkStream->received, p, n);
+            if (!_commitPayload(n)) {
+                return false;
+            }
+            break;
+        }
+        p += n;
+        remaining -= n;
+    }
+
+    return _didReceive(len);
+}
+
+bool RTMPChunkStream::readFrom(int fd) {
+    ssize_t n;
+
+    if (_state == State::Payload && _chunkRemaining >= DirectReadThreshold) {
+        n = recv(fd, _chunkStream->body->data() + _chunkStream->received, _chunkRemaining, MSG_DONTWAIT);
+        if (n > 0) {
+            return _commitPayload(n) && _didReceive(n);
+        }
+    } else {
+        _readBuffer.resize(ReadBufferSize);
+        n = recv(fd, _readBuffer.data(), _readBuffer.size(), MSG_DONTWAIT);
+        if (n > 0) {
+            return consume(_readBuffer.data(), n);
+        }
+    }
+
+    if (n == 0) {
+        _isClosed = true;
+        return false;
+    } else if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+        return true;
+    }
+    _logger.error("rtmp read error (errno = {})", errno);
+    return false;
+}
+
+bool RTMPChunkStream::sendMessage(uint32_t chunkStreamId, uint8_t type, uint32_t streamId, uint32_t timestamp, const void* body, size_t len) {
+    if (chunkStreamId < 2 || chunkStreamId > 65599 || len > 0xffffff) {
+        _logger.with("chunk_stream_id", chunkStreamId, "length", len).error("invalid outgoing rtmp message");
+        return false;
+    }
+
+    auto p = reinterpret_cast<const uint8_t*>(body);
+    auto isExtended = timestamp >= 0xffffff;
+
+    _writeBuffer.clear();
+    size_t offset = 0;
+    do {
+        uint8_t fmt = offset == 0 ? 0 : 3;
+        if (chunkStreamId < 64) {
+            _writeBuffer.push_back((fmt << 6) | chunkStreamId);
+        } else if (chunkStreamId < 320) {
+            _writeBuffer.push_back(fmt << 6);
+            _writeBuffer.push_back(chunkStreamId - 64);
+        } else {
+            _writeBuffer.push_back((fmt << 6) | 1);
+            _writeBuffer.push_back((chunkStreamId - 64) & 0xff);
+            _writeBuffer.push_back((chunkStreamId - 64) >> 8);
+        }
+
+        if (fmt == 0) {
+            AppendUInt24(&_writeBuffer, isExtended ? 0xffffff : timestamp);
+            AppendUInt24(&_writeBuffer, len);
+            _writeBuffer.push_back(type);
+            // the message stream id is the one little-endian field
+            _writeBuffer.push_back(streamId);
+            _writeBuffer.push_back(streamId >> 8);
+            _writeBuffer.push_back(streamId >> 16);
+            _writeBuffer.push_back(streamId >> 24);
+        }
+        if (isExtended) {
+            AppendUInt32(&_writeBuffer, timestamp);
+        }
+
+        auto n = std::min<size_t>(len - offset, _outChunkSize);
+        _writeBuffer.insert(_writeBuffer.end(), p + offset, p + offset + n);
+        offset += n;
+    } while (offset < len);
+
+    return _write(_writeBuffer.data(), _writeBuffer.size());
+}
+
+bool RTMPChunkStream::setOutgoingChunkSize(uint32_t size) {
+    if (size == 0 || size > 0x7fffffff) {
+        return false;
+    }
+    uint8_t body[4] = {
+        static_cast<uint8_t>(size >> 24),
+        static_cast<uint8_t>(size >> 16),
+        static_cast<uint8_t>(size >> 8),
+        static_cast<uint8_t>(size),
+    };
+    if (!sendMessage(2, RTMPMessageType::SetChunkSize, 0, 0, body, sizeof(body))) {
+        return false;
+    }
+    _outChunkSize = size;
+    return true;
+}
+
+bool RTMPChunkStream::_consumeHandshake(const uint8_t* data, size_t len, size_t* consumed) {
+    auto n = std::min(len, _handshakeRemaining);
+    if (_state == State::HandshakeC0C1) {
+        _handshake.insert(_handshake.end(), data, data + n);
+    }
+    _handshakeRemaining -= n;
+    *consumed = n;
+
+    if (_handshakeRemaining > 0) {
+        return true;
+    }
+
+    if (_state == State::HandshakeC2) {
+        // there's nothing in c2 that we need
+        _state = State::Header;
+        return true;
+    }
+
+    if (_handshake[0] != 3) {
+        // versions 6 and 8 are for encrypted rtmp, which we don't support
+        _logger.with("version", static_cast<int>(_handshake[0])).error("unsupported rtmp version");
+        return false;
+    }
+
+    // s0, then s1 (time and zero fields followed by random bytes), then s2 (an echo of c1)
+    std::vector<uint8_t> response(1 + 2 * HandshakeSize);
+    response[0] = 3;
+    for (size_t i = 9; i < 1 + HandshakeSize; ++i) {
+        response[i] = static_cast<uint8_t>(_random() >> 8);
+    }
+    std::memcpy(&response[1 + HandshakeSize], &_handshake[1], HandshakeSize);
+
+    _handshake.clear();
+    _handshake.shrink_to_fit();
+
+    if (!_write(response.data(), response.size())) {
+        _logger.error("unable to write rtmp handshake");
+        return false;
+    }
+
+    _state = State::HandshakeC2;
+    _handshakeRemaining = HandshakeSize;
+    return true;
+}
+
+bool RTMPChunkStream::_consumeHeader(const uint8_t* data, size_t len, size_t* consumed) {
+    *consumed = 0;
+
+    while (*consumed < len) {
+        auto n = std::min(len - *consumed, _headerNeeded - _headerLength);
+        std::memcpy(_header + _headerLength, data + *consumed, n);
+        _headerLength += n;
+        *consumed += n;
+
+        if (_headerLength < _headerNeeded) {
+            return true;
+        }
+
+        auto basicHeaderLength = BasicHeaderLength(_header[0]);
+        auto headerLength = basicHeaderLength + MessageHeaderSizes[_header[0] >> 6];
+        if (_headerLength < headerLength) {
+            // we now know how big the rest of the header is
+            _headerNeeded = headerLength;
+            continue;
+        }
+
+        if (_headerNeeded == headerLength) {
+            bool hasExtendedTimestamp;
+            if ((_header[0] >> 6) < 3) {
+                hasExtendedTimestamp = ReadUInt24(_header + basicHeaderLength) == 0xffffff;
+            } else {
+                // type 3 headers have extended timestamps if the previous header on the chunk stream did
+                auto it = _chunkStreams.find(BasicHeaderChunkStreamId(_header));
+                hasExtendedTimestamp = it != _chunkStreams.end() && it->second.hasExtendedTimestamp;
+            }
+            if (hasExtendedTimestamp) {
+                _headerNeeded += 4;
+                continue;
+            }
+        }
+
+        _headerLength = 0;
+        _headerNeeded = 1;
+        return _beginChunk();
+    }
+
+    return true;
+}
+
+bool RTMPChunkStream::_beginChunk() {
+    auto fmt = _header[0] >> 6;
+    auto basicHeaderLength = BasicHeaderLength(_header[0]);
+    auto messageHeader = _header + basicHeaderLength;
+
+    _chunkStreamId = BasicHeaderChunkStreamId(_header);
+    auto& cs = _chunkStreams[_chunkStreamId];
+
+    auto isNewMessage = !cs.body;
+
+    if (fmt < 3) {
+        if (!isNewMessage) {
+            _logger.with("chunk_stream_id", _chunkStreamId).warn("discarding incomplete rtmp message");
+            cs.body.reset();
+            isNewMessage = true;
+        }
+
+        auto timestampField = ReadUInt24(messageHeader);
+        cs.hasExtendedTimestamp = timestampField == 0xffffff;
+        if (cs.hasExtendedTimestamp) {
+            timestampField = ReadUInt32(messageHeader + MessageHeaderSizes[fmt]);
+        }
+        cs.timestampField = timestampField;
+
+        if (fmt < 2) {
+            cs.length = ReadUInt24(messageHeader + 3);
+            cs.type = messageHeader[6];
+        }
+
+        if (fmt == 0) {
+            cs.streamId = messageHeader[7] | (messageHeader[8] << 8) | (messageHeader[9] << 16) | (static_cast<uint32_t>(messageHeader[10]) << 24);
+            cs.timestamp = timestampField;
+        } else {
+            cs.timestamp += timestampField;
+        }
+    } else if (isNewMessage) {
+        // a type 3 header that starts a message repeats the previous timestamp field
+        cs.timestamp += cs.timestampField;
+    }
+
+    if (isNewMessage) {
+        if (cs.length > MaxMessageSize) {
+            _logger.with("length", cs.length).error("rtmp message too large");
+            return false;
+        }
+        cs.body = _pool->acquire(cs.length);
+        cs.body->resize(cs.length);
+        cs.received = 0;
+    }
+
+    _chunkStream = &cs;
+    _chunkRemaining = std::min<size_t>(_inChunkSize, cs.length - cs.received);
+    _state = State::Payload;
+    return _commitPayload(0);
+}
+
+bool RTMPChunkStream::_commitPayload(size_t len) {
+    _chunkStream->received += len;
+    _chunkRemaining -= len;
+
+    if (_chunkRemaining > 0) {
+        return true;
+    }
+
+    _state = State::Header;
+    return _chunkStream->received < _chunkStream->length || _completeMessage();
+}
+
+bool RTMPChunkStream::_completeMessage() {
+    auto& cs = *_chunkStream;
+    _chunkStream = nullptr;
+
+    RTMPMessage message;
+    message.type = cs.type;
+    message.timestamp = cs.timestamp;
+    message.streamId = cs.streamId;
+    message.chunkStreamId = _chunkStreamId;
+    message.body = std::move(cs.body);
+    cs.body.reset();
+
+    switch (message.type) {
+    case RTMPMessageType::SetChunkSize:
+    case RTMPMessageType::Abort:
+    case RTMPMessageType::Acknowledgement:
+    case RTMPMessageType::WindowAcknowledgementSize:
+    case RTMPMessageType::SetPeerBandwidth:
+        return _handleControlMessage(message);
+    default:
+        return _handler(message);
+    }
+}
+
+bool RTMPChunkStream::_handleControlMessage(const RTMPMessage& message) {
+    if (message.size() < 4) {
+        _logger.with("type", static_cast<int>(message.type)).error("invalid rtmp protocol control message");
+        return false;
+    }
+
+    auto value = ReadUInt32(message.data());
+
+    switch (message.type) {
+    case RTMPMessageType::SetChunkSize:
+        value &= 0x7fffffff;
+        if (value == 0) {
+            _logger.error("invalid rtmp chunk size");
+            return false;
+        }
+        _inChunkSize = value;
+        break;
+    case RTMPMessageType::Abort: {
+        auto it = _chunkStreams.find(value);
+        if (it != _chunkStreams.end()) {
+            it->second.body.reset();
+        }
+        break;
+    }
+    case RTMPMessageType::WindowAcknowledgementSize:
+        if (value > 0) {
+            _windowAcknowledgementSize = value;
+        }
+        break;
+    default:
+        // acknowledgements and bandwidth limits don't affect us since we send so little
+        break;
+    }
+
+    return true;
+}
+
+bool RTMPChunkStream::_didReceive(size_t len) {
+    _bytesReceived += len;
+
+    // like librtmp, acknowledge every tenth of the window
+    if (!isHandshakeComplete() || _bytesReceived - _bytesAcknowledged < _windowAcknowledgementSize / 10) {
+        return true;
+    }
+    _bytesAcknowledged = _bytesReceived;
+
+    auto sequenceNumber = static_cast<uint32_t>(_bytesReceived);
+    uint8_t body[4] = {
+        static_cast<uint8_t>(sequenceNumber >> 24),
+        static_cast<uint8_t>(sequenceNumber >> 16),
+        static_cast<uint8_t>(sequenceNumber >> 8),
+        static_cast<uint8_t>(sequenceNumber),
+    };
+    if (!sendMessage(2, RTMPMessageType::Acknowledgement, 0, 0, body, sizeof(body))) {
+        _logger.error("unable to send rtmp acknowledgement");
+        return false;
+    }
+    return true;
+}
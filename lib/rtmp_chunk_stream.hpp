@@ -0,0 +1,151 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <random>
+#include <unordered_map>
+#include <vector>
+
+#include "buffer_pool.hpp"
+#include "logger.hpp"
+
+namespace RTMPMessageType {
+    enum : uint8_t {
+        SetChunkSize = 1,
+        Abort = 2,
+        Acknowledgement = 3,
+        UserControl = 4,
+        WindowAcknowledgementSize = 5,
+        SetPeerBandwidth = 6,
+        Audio = 8,
+        Video = 9,
+        DataAMF3 = 15,
+        SharedObjectAMF3 = 16,
+        CommandAMF3 = 17,
+        DataAMF0 = 18,
+        SharedObjectAMF0 = 19,
+        CommandAMF0 = 20,
+        Aggregate = 22,
+    };
+}
+
+struct RTMPMessage {
+    uint8_t type = 0;
+    uint32_t timestamp = 0;
+    uint32_t streamId = 0;
+    uint32_t chunkStreamId = 0;
+
+    // The message body. This is a pooled buffer, and handlers may retain it.
+    std::shared_ptr<BufferPool::Buffer> body;
+
+    const uint8_t* data() const { return body->data(); }
+    size_t size() const { return body->size(); }
+};
+
+// RTMPChunkStream implements the server side of an RTMP connection's transport: the plain handshake
+// and the chunk stream in both directions. Messages are reassembled directly into pooled buffers,
+// and protocol control messages (chunk sizes, aborts, and acknowledgements) are handled internally.
+// Everything else is passed to the message handler.
+//
+// This isn't thread-safe.
+class RTMPChunkStream {
+public:
+    // WriteFunction should write all of the given bytes to the peer, returning false on failure.
+    using WriteFunction = std::function<bool(const void* data, size_t len)>;
+
+    // MessageHandler is invoked for each complete message. If it returns false, the stream fails.
+    using MessageHandler = std::function<bool(const RTMPMessage& message)>;
+
+    static constexpr size_t HandshakeSize = 1536;
+    static constexpr uint32_t DefaultChunkSize = 128;
+    static constexpr uint32_t DefaultWindowAcknowledgementSize = 2500000;
+    static constexpr uint32_t MaxMessageSize = 16 * 1024 * 1024;
+
+    RTMPChunkStream(Logger logger, WriteFunction write, MessageHandler handler, std::shared_ptr<BufferPool> pool = BufferPool::Default());
+
+    // consume processes bytes received from the peer. If this returns false, the connection should be
+    // closed.
+    bool consume(const void* data, size_t len);
+
+    // readFrom reads whatever is available from the given non-blocking descriptor and consumes it.
+    // When a large part of a chunk's payload is still outstanding, it's read directly into the
+    // message's buffer. If this returns false, the connection should be closed. That may simply be
+    // because the peer closed it, in which case isClosed will be true.
+    bool readFrom(int fd);
+
+    // Returns true if the peer has closed the connection.
+    bool isClosed() const { return _isClosed; }
+
+    bool isHandshakeComplete() const { return _state != State::HandshakeC0C1 && _state != State::HandshakeC2; }
+
+    // Returns the total number of bytes received from the peer, including the handshake.
+    uint64_t bytesReceived() const { return _bytesReceived; }
+
+    // sendMessage chunks a message and writes it to the peer.
+    bool sendMessage(uint32_t chunkStreamId, uint8_t type, uint32_t streamId, uint32_t timestamp, const void* body, size_t len);
+
+    // setOutgoingChunkSize informs the peer of a new chunk size and uses it for subsequent messages.
+    bool setOutgoingChunkSize(uint32_t size);
+
+private:
+    const Logger _logger;
+    const WriteFunction _write;
+    const MessageHandler _handler;
+    const std::shared_ptr<BufferPool> _pool;
+
+    enum class State {
+        HandshakeC0C1,
+        HandshakeC2,
+        Header,
+        Payload,
+    };
+    State _state = State::HandshakeC0C1;
+    bool _isClosed = false;
+
+    std::vector<uint8_t> _handshake;
+    size_t _handshakeRemaining = 1 + HandshakeSize;
+
+    // The header of the chunk currently being received. This is at most 3 bytes of basic header, 11
+    // bytes of message header, and 4 bytes of extended timestamp.
+    uint8_t _header[18];
+    size_t _headerLength = 0;
+    size_t _headerNeeded = 1;
+
+    struct ChunkStreamState {
+        uint32_t timestamp = 0;
+        // For type 0 headers this is the absolute timestamp, otherwise it's the timestamp delta.
+        uint32_t timestampField = 0;
+        bool hasExtendedTimestamp = false;
+        uint32_t length = 0;
+        uint8_t type = 0;
+        uint32_t streamId = 0;
+
+        // The message currently being reassembled, if any.
+        std::shared_ptr<BufferPool::Buffer> body;
+        size_t received = 0;
+    };
+    std::unordered_map<uint32_t, ChunkStreamState> _chunkStreams;
+    uint32_t _chunkStreamId = 0;
+    ChunkStreamState* _chunkStream = nullptr;
+    size_t _chunkRemaining = 0;
+
+    uint32_t _inChunkSize = DefaultChunkSize;
+    uint32_t _outChunkSize = DefaultChunkSize;
+
+    uint64_t _bytesReceived = 0;
+    uint64_t _bytesAcknowledged = 0;
+    uint32_t _windowAcknowledgementSize = DefaultWindowAcknowledgementSize;
+
+    std::vector<uint8_t> _readBuffer;
+    std::vector<uint8_t> _writeBuffer;
+    std::minstd_rand _random;
+
+    bool _consumeHandshake(const uint8_t* data, size_t len, size_t* consumed);
+    bool _consumeHeader(const uint8_t* data, size_t len, size_t* consumed);
+    bool _beginChunk();
+    bool _commitPayload(size_t len);
+    bool _completeMessage();
+    bool _handleControlMessage(const RTMPMessage& message);
+    bool _didReceive(size_t len);
+};
@@ -0,0 +1,212 @@
+#include <gtest/gtest.h>
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "logger_test.hpp"
+#include "rtmp_chunk_stream.hpp"
+
+namespace {
+
+struct TestPeer {
+    explicit TestPeer(Logger logger) : stream{logger, [this](const void* data, size_t len) {
+        auto p = reinterpret_cast<const uint8_t*>(data);
+        written.insert(written.end(), p, p + len);
+        return true;
+    }, [this](const RTMPMessage& message) {
+        messages.emplace_back(message);
+        return true;
+    }} {}
+
+    std::vector<uint8_t> written;
+    std::vector<RTMPMessage> messages;
+    RTMPChunkStream stream;
+};
+
+std::vector<uint8_t> ClientHandshake() {
+    std::vector<uint8_t> ret(1 + 2 * RTMPChunkStream::HandshakeSize);
+    ret[0] = 3;
+    for (size_t i = 1; i < ret.size(); ++i) {
+        ret[i] = static_cast<uint8_t>(i * 7);
+    }
+    return ret;
+}
+
+std::vector<uint8_t> Body(size_t len, uint8_t seed) {
+    std::vector<uint8_t> ret(len);
+    for (size_t i = 0; i < len; ++i) {
+        ret[i] = static_cast<uint8_t>(seed + i);
+    }
+    return ret;
+}
+
+void CompleteHandshake(TestPeer* peer) {
+    auto handshake = ClientHandshake();
+    ASSERT_TRUE(peer->stream.consume(handshake.data(), handshake.size()));
+    ASSERT_TRUE(peer->stream.isHandshakeComplete());
+    peer->written.clear();
+}
+
+} // anonymous namespace
+
+TEST(RTMPChunkStream, handshake) {
+    TestLogDestination logDestination;
+    TestPeer peer{&logDestination};
+
+    auto handshake = ClientHandshake();
+    ASSERT_TRUE(peer.stream.consume(handshake.data(), 1 + RTMPChunkStream::HandshakeSize));
+    EXPECT_FALSE(peer.stream.isHandshakeComplete());
+
+    ASSERT_EQ(peer.written.size(), 1 + 2 * RTMPChunkStream::HandshakeSize);
+    EXPECT_EQ(peer.written[0], 3);
+    EXPECT_TRUE(std::equal(handshake.begin() + 1, handshake.begin() + 1 + RTMPChunkStream::HandshakeSize, peer.written.begin() + 1 + RTMPChunkStream::HandshakeSize));
+
+    ASSERT_TRUE(peer.stream.consume(handshake.data() + 1 + RTMPChunkStream::HandshakeSize, RTMPChunkStream::HandshakeSize));
+    EXPECT_TRUE(peer.stream.isHandshakeComplete());
+}
+
+TEST(RTMPChunkStream, unsupportedVersion) {
+    TestPeer peer{Logger::Void};
+
+    auto handshake = ClientHandshake();
+    handshake[0] = 6;
+    EXPECT_FALSE(peer.stream.consume(handshake.data(), handshake.size()));
+}
+
+TEST(RTMPChunkStream, messages) {
+    TestLogDestination logDestination;
+    TestPeer client{&logDestination}, server{&logDestination};
+    CompleteHandshake(&server);
+
+    struct Message {
+        uint32_t chunkStreamId;
+        uint8_t type;
+        uint32_t streamId;
+        uint32_t timestamp;
+        std::vector<uint8_t> body;
+    };
+    std::vector<Message> messages{
+        {3, RTMPMessageType::CommandAMF0, 0, 0, Body(10, 1)},
+        {4, RTMPMessageType::Video, 1, 33, Body(1000, 2)},
+        {5, RTMPMessageType::Audio, 1, 40, Body(128, 3)},
+        {70, RTMPMessageType::Video, 1, 0x1000000, Body(300, 4)},
+        {400, RTMPMessageType::Audio, 1, 0x1000010, Body(0, 5)},
+    };
+    for (auto& message : messages) {
+        ASSERT_TRUE(client.stream.sendMessage(message.chunkStreamId, message.type, message.streamId, message.timestamp, message.body.data(), message.body.size()));
+    }
+
+    // feed the stream a byte at a time to exercise every partial state
+    for (auto b : client.written) {
+        ASSERT_TRUE(server.stream.consume(&b, 1));
+    }
+
+    ASSERT_EQ(server.messages.size(), messages.size());
+    for (size_t i = 0; i < messages.size(); ++i) {
+        auto& expected = messages[i];
+        auto& actual = server.messages[i];
+        EXPECT_EQ(expected.chunkStreamId, actual.chunkStreamId);
+        EXPECT_EQ(expected.type, actual.type);
+        EXPECT_EQ(expected.streamId, actual.streamId);
+        EXPECT_EQ(expected.timestamp, actual.timestamp);
+        EXPECT_EQ(expected.body, std::vector<uint8_t>(actual.data(), actual.data() + actual.size()));
+    }
+}
+
+TEST(RTMPChunkStream, headerCompression) {
+    TestLogDestination logDestination;
+    TestPeer peer{&logDestination};
+    CompleteHandshake(&peer);
+
+    std::vector<uint8_t> data{
+        // type 0: timestamp 1000, length 3, video, stream 1
+        0x04, 0x00, 0x03, 0xe8, 0x00, 0x00, 0x03, 0x09, 0x01, 0x00, 0x00, 0x00, 'a', 'b', 'c',
+        // type 2: timestamp delta 20
+        0x84, 0x00, 0x00, 0x14, 'd', 'e', 'f',
+        // type 3: repeats the delta
+        0xc4, 'g', 'h', 'i',
+        // type 1: timestamp delta 10, length 2, audio
+        0x44, 0x00, 0x00, 0x0a, 0x00, 0x00, 0x02, 0x08, 'j', 'k',
+    };
+    ASSERT_TRUE(peer.stream.consume(data.data(), data.size()));
+
+    ASSERT_EQ(peer.messages.size(), 4);
+    EXPECT_EQ(peer.messages[0].timestamp, 1000);
+    EXPECT_EQ(peer.messages[1].timestamp, 1020);
+    EXPECT_EQ(peer.messages[2].timestamp, 1040);
+    EXPECT_EQ(peer.messages[3].timestamp, 1050);
+    EXPECT_EQ(peer.messages[3].type, RTMPMessageType::Audio);
+    EXPECT_EQ(peer.messages[3].streamId, 1);
+    EXPECT_EQ(std::string(reinterpret_cast<const char*>(peer.messages[2].data()), peer.messages[2].size()), "ghi");
+}
+
+TEST(RTMPChunkStream, chunkSize) {
+    TestLogDestination logDestination;
+    TestPeer client{&logDestination}, server{&logDestination};
+    CompleteHandshake(&server);
+
+    auto body = Body(10000, 6);
+    ASSERT_TRUE(client.stream.setOutgoingChunkSize(4096));
+    ASSERT_TRUE(client.stream.sendMessage(6, RTMPMessageType::Video, 1, 0, body.data(), body.size()));
+
+    // a type 0 header, two type 3 headers, and the set chunk size message
+    EXPECT_EQ(client.written.size(), body.size() + 12 + 2 + 16);
+
+    ASSERT_TRUE(server.stream.consume(client.written.data(), client.written.size()));
+    ASSERT_EQ(server.messages.size(), 1);
+    EXPECT_EQ(body, std::vector<uint8_t>(server.messages[0].data(), server.messages[0].data() + server.messages[0].size()));
+}
+
+TEST(RTMPChunkStream, acknowledgement) {
+    TestLogDestination logDestination;
+    TestPeer client{&logDestination}, server{&logDestination};
+    CompleteHandshake(&server);
+
+    uint8_t windowSize[4] = {0x00, 0x00, 0x03, 0xe8};
+    ASSERT_TRUE(client.stream.sendMessage(2, RTMPMessageType::WindowAcknowledgementSize, 0, 0, windowSize, sizeof(windowSize)));
+    auto body = Body(200, 7);
+    ASSERT_TRUE(client.stream.sendMessage(4, RTMPMessageType::Audio, 1, 0, body.data(), body.size()));
+
+    ASSERT_TRUE(server.stream.consume(client.written.data(), client.written.size()));
+    ASSERT_EQ(server.messages.size(), 1);
+
+    ASSERT_EQ(server.written.size(), 16);
+    EXPECT_EQ(server.written[0], 0x02);
+    EXPECT_EQ(server.written[7], RTMPMessageType::Acknowledgement);
+    auto sequenceNumber = (server.written[12] << 24) | (server.written[13] << 16) | (server.written[14] << 8) | server.written[15];
+    EXPECT_EQ(sequenceNumber, server.stream.bytesReceived());
+}
+
+TEST(RTMPChunkStream, readFrom) {
+    TestLogDestination logDestination;
+    TestPeer client{&logDestination}, server{&logDestination};
+
+    int fds[2];
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+
+    auto handshake = ClientHandshake();
+    ASSERT_EQ(write(fds[1], handshake.data(), handshake.size()), handshake.size());
+
+    auto body = Body(50000, 8);
+    ASSERT_TRUE(client.stream.setOutgoingChunkSize(8192));
+    ASSERT_TRUE(client.stream.sendMessage(6, RTMPMessageType::Video, 1, 0, body.data(), body.size()));
+
+    // write the message in pieces so that some payload is read directly into the message buffer
+    size_t offset = 0;
+    while (offset < client.written.size()) {
+        auto n = std::min<size_t>(client.written.size() - offset, 3000);
+        ASSERT_EQ(write(fds[1], client.written.data() + offset, n), n);
+        offset += n;
+        while (server.stream.bytesReceived() < handshake.size() + offset) {
+            ASSERT_TRUE(server.stream.readFrom(fds[0]));
+        }
+    }
+    close(fds[1]);
+
+    ASSERT_EQ(server.messages.size(), 1);
+    EXPECT_EQ(body, std::vector<uint8_t>(server.messages[0].data(), server.messages[0].data() + server.messages[0].size()));
+
+    EXPECT_FALSE(server.stream.readFrom(fds[0]));
+    EXPECT_TRUE(server.stream.isClosed());
+    close(fds[0]);
+}
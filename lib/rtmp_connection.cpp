@@ -1,5 +1,10 @@
 #include "rtmp_connection.hpp"
 
+#include <algorithm>
+
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
 #include <unistd.h>
 
 #include "librtmp/log.h"
@@ -79,71 +84,192 @@ struct RTMPLogger {
     }
 } _rtmpLogger; // NOLINT(cert-err58-cpp)
 
-void RTMPConnection::run(int fd, asio::ip::tcp::endpoint remote) {
-    _connectionId = GenerateUUID();
+RTMPConnection::RTMPConnection(Logger logger, RTMPConnectionDelegate* delegate) : _logger{std::move(logger)}, _delegate{delegate} {
+    _cancelEventFD = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (_cancelEventFD == -1) {
+        _logger.error("unable to create cancellation eventfd (errno = {})", errno);
+    }
+}
 
-    if (!_waitUntilReadable(fd)) {
-        // probably just a health check
-        close(fd);
-        return;
+RTMPConnection::~RTMPConnection() {
+    if (_cancelEventFD != -1) {
+        close(_cancelEventFD);
     }
+}
+
+bool RTMPConnection::begin(int fd, asio::ip::tcp::endpoint remote, EventLoop* loop) {
+    _fd = fd;
+    _connectionId = GenerateUUID();
 
     _logger = _logger.with("connection_id", _connectionId);
     _logger.with("remote", remote).info("handled rtmp connection");
 
-    RTMP* rtmp = RTMP_Alloc();
-    RTMP_Init(rtmp);
-    rtmp->m_sb.sb_socket = fd;
-    std::function<int()> interruptCallback = [this, fd]() {
-        return _waitUntilReadable(fd) ? 0 : -1;
-    };
-    rtmp->m_sb.sb_interrupt_callback = [](void* f){return (*reinterpret_cast<std::function<int()>*>(f))(); };
-    rtmp->m_sb.sb_context = &interruptCallback;
+    {
+        std::lock_guard<std::mutex> l{_loopMutex};
+        _loop = loop;
+    }
+
+    _chunkStream = std::make_unique<RTMPChunkStream>(_logger, [this](const void* data, size_t len) {
+        return _write(data, len);
+    }, [this](const RTMPMessage& message) {
+        return _serveMessage(message);
+    });
+    return true;
+}
 
-    _serveRTMP(rtmp);
+bool RTMPConnection::handleReadable() {
+    return _chunkStream->readFrom(_fd);
+}
 
+void RTMPConnection::end() {
     _logger.info("closing connection");
 
-    RTMP_Close(rtmp);
-    RTMP_Free(rtmp);
+    {
+        std::lock_guard<std::mutex> l{_loopMutex};
+        _loop = nullptr;
+    }
+
+    _chunkStream.reset();
+    _deferredMessages.clear();
+    if (_fd != -1) {
+        close(_fd);
+        _fd = -1;
+    }
+
+    if (!_mayBlock && _avHandler) {
+        _delegate->runBlocking([handler = std::move(_avHandler)]() mutable {
+            handler.reset();
+        });
+    }
 
     _logger.info("connection closed");
 }
 
+void RTMPConnection::run(int fd, asio::ip::tcp::endpoint remote) {
+    _mayBlock = true;
+
+    if (!_waitUntilReadable(fd)) {
+        // probably just a health check
+        close(fd);
+        return;
+    }
+
+    if (begin(fd, remote, nullptr)) {
+        while (handleReadable() && _waitUntilReadable(fd)) {}
+    }
+    end();
+}
+
 void RTMPConnection::cancel() {
     _logger.info("canceling rtmp connection");
     _shouldReturn = true;
+
+    if (_cancelEventFD != -1) {
+        uint64_t value = 1;
+        if (write(_cancelEventFD, &value, sizeof(value)) == -1 && errno != EAGAIN) {
+            _logger.error("unable to signal cancellation eventfd (errno = {})", errno);
+        }
+    }
 }
 
-void RTMPConnection::_serveRTMP(RTMP* rtmp) {
-    if (!RTMP_Serve(rtmp)) {
-        _logger.error("rtmp handshake failed");
-        return;
+bool RTMPConnection::_write(const void* data, size_t len) {
+    auto p = reinterpret_cast<const char*>(data);
+    while (len > 0) {
+        auto n = send(_fd, p, len, MSG_NOSIGNAL | (_mayBlock ? 0 : MSG_DONTWAIT));
+        if (n >= 0) {
+            p += n;
+            len -= n;
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            if (!_mayBlock) {
+                // we only ever send handshakes and small command responses, so a full send buffer
+                // means the client has stopped reading. waiting for it would stall every other
+                // connection on the worker
+                _logger.error("rtmp connection send buffer is full");
+                return false;
+            }
+            pollfd fds{};
+            fds.fd = _fd;
+            fds.events = POLLOUT;
+            if (poll(&fds, 1, 10000) == 0) {
+                _logger.error("timed out writing to rtmp connection");
+                return false;
+            }
+        } else if (errno != EINTR) {
+            _logger.error("rtmp write error (errno = {})", errno);
+            return false;
+        }
     }
+    return true;
+}
 
-    RTMPPacket packet{0};
+void RTMPConnection::_authenticate(double txn) {
+    // authentication may need to make requests to the platform, which would stall every other
+    // connection on the worker
+    _isAuthenticating = true;
+    _delegate->runBlocking([this, self = shared_from_this(), txn] {
+        {
+            std::lock_guard<std::mutex> l{_loopMutex};
+            if (!_loop) {
+                return;
+            }
+        }
+
+        auto handler = _delegate->authenticate(_connectionId);
 
-    while (!_shouldReturn && RTMP_IsConnected(rtmp) && RTMP_ReadPacket(rtmp, &packet)) {
-        if (!RTMPPacket_IsReady(&packet)) {
-            continue;
+        // if the connection ended in the meantime, the handler is released here after unlocking
+        std::lock_guard<std::mutex> l{_loopMutex};
+        if (_loop) {
+            _loop->post([this, self, txn, handler] {
+                _didAuthenticate(txn, handler);
+            });
         }
-        if (!_servePacket(rtmp, &packet)) {
-            break;
+    });
+}
+
+void RTMPConnection::_didAuthenticate(double txn, std::shared_ptr<EncodedAVHandler> handler) {
+    _isAuthenticating = false;
+
+    if (!_chunkStream) {
+        // the connection ended after the result was posted
+        if (handler) {
+            _delegate->runBlocking([handler = std::move(handler)]() mutable {
+                handler.reset();
+            });
         }
-        RTMPPacket_Free(&packet);
+        return;
+    }
+
+    _avHandler = std::move(handler);
+
+    auto deferred = std::move(_deferredMessages);
+    _deferredMessages.clear();
+
+    auto ok = false;
+    if (!_avHandler) {
+        _logger.info("authentication failed");
+    } else if (_sendConnectResult(txn)) {
+        ok = std::all_of(deferred.begin(), deferred.end(), [this](const RTMPMessage& message) {
+            return _serveMessage(message);
+        });
     }
 
-    RTMPPacket_Free(&packet);
+    if (!ok) {
+        // this wakes the worker up to close the connection the usual way
+        shutdown(_fd, SHUT_RDWR);
+    }
 }
 
-bool RTMPConnection::_serveInvoke(RTMP* rtmp, RTMPPacket* packet, const char* body, size_t len) {
+bool RTMPConnection::_serveInvoke(const RTMPMessage& message) {
+    auto body = reinterpret_cast<const char*>(message.data());
+    auto len = message.size();
+
     if (len < 1 || body[0] != 2) {
         _logger.error("expected 0x02 lead byte in invoke packet");
         return false;
     }
 
     AMFObject obj;
-    if (AMF_Decode(&obj, body, len, false) < 0) {
+    if (AMF_Decode(&obj, body, static_cast<int>(len), false) < 0) {
         _logger.error("unable to decode invoke packet");
         return false;
     }
@@ -176,19 +302,24 @@ bool RTMPConnection::_serveInvoke(RTMP* rtmp, RTMPPacket* packet, const char* bo
             }
 
             if (AVMATCH(&pname, &av_objectEncoding)) {
-                rtmp->m_fEncoding = number;
+                _objectEncoding = number;
             }
         }
 
+        if (!_mayBlock) {
+            _authenticate(txn);
+            return true;
+        }
+
         _avHandler = _delegate->authenticate(_connectionId);
         if (!_avHandler) {
             _logger.info("authentication failed");
             return false;
         }
-        return _sendConnectResult(rtmp, txn);
+        return _sendConnectResult(txn);
     }
     if (AVMATCH(&method, &av_createStream)) {
-        return _sendResultNumber(rtmp, txn, _nextStreamId++);
+        return _sendResultNumber(txn, _nextStreamId++);
     }
     if (AVMATCH(&method, &av_releaseStream)) {
         return true;
@@ -196,36 +327,46 @@ bool RTMPConnection::_serveInvoke(RTMP* rtmp, RTMPPacket* packet, const char* bo
     if (AVMATCH(&method, &av_FCPublish)) {
         AVal name{};
         AMFProp_GetString(AMF_GetProp(&obj, nullptr, 3), &name);
-        return _sendOnFCPublish(rtmp, packet->m_nInfoField2, &av_NetStream_Publish_Start, &name);
+        return _sendOnFCPublish(message.streamId, &av_NetStream_Publish_Start, &name);
     }
     if (AVMATCH(&method, &av_publish)) {
         AVal name, type;
         AMFProp_GetString(AMF_GetProp(&obj, nullptr, 3), &name);
         AMFProp_GetString(AMF_GetProp(&obj, nullptr, 4), &type);
         _logger.with("name", name, "type", type).info("handled publish");
-        return _sendOnStatus(rtmp, packet->m_nInfoField2, &av_NetStream_Publish_Start, &av_started_publishing);
+        return _sendOnStatus(message.streamId, &av_NetStream_Publish_Start, &av_started_publishing);
     }
     _logger.warn("unknown invoke method: {}", method);
 
     return true;
 }
 
-bool RTMPConnection::_servePacket(RTMP* rtmp, RTMPPacket* packet) {
-    switch (packet->m_packetType) {
-    case RTMP_PACKET_TYPE_CHUNK_SIZE:
-        if (packet->m_nBodySize >= 4) {
-            rtmp->m_inChunkSize = AMF_DecodeInt32(packet->m_body);
+bool RTMPConnection::_serveMessage(const RTMPMessage& message) {
+    // bodies are handed to the handlers as shared packets, so they're never copied unless a handler
+    // needs something other than the pooled buffer they arrived in
+    auto body = reinterpret_cast<const char*>(message.data());
+    auto bodySize = message.size();
+
+    if (_isAuthenticating) {
+        // well-behaved clients wait for the connect result, so this shouldn't grow much
+        if (_deferredMessages.size() >= MaxDeferredMessages) {
+            _logger.error("too many messages received during authentication");
+            return false;
         }
+        _deferredMessages.emplace_back(message);
         return true;
-    case RTMP_PACKET_TYPE_INVOKE:
-        return _serveInvoke(rtmp, packet, packet->m_body, packet->m_nBodySize);
-    case RTMP_PACKET_TYPE_AUDIO:
-        if (!_avHandler || packet->m_nBodySize < 2 || static_cast<uint8_t>(packet->m_body[0]) != 0xaf) {
+    }
+
+    switch (message.type) {
+    case RTMPMessageType::CommandAMF0:
+        return _serveInvoke(message);
+    case RTMPMessageType::Audio:
+        if (!_avHandler || bodySize < 2 || static_cast<uint8_t>(body[0]) != 0xaf) {
             _logger.error("invalid audio packet");
             return false;
-        } else if (packet->m_body[1] == 0) {
+        } else if (body[1] == 0) {
             MPEG4AudioSpecificConfig config{};
-            if (!config.decode(packet->m_body + 2, packet->m_nBodySize - 2)) {
+            if (!config.decode(body + 2, bodySize - 2)) {
                 _logger.error("unable to decode audio config");
                 return false;
             }
@@ -234,22 +375,22 @@ bool RTMPConnection::_servePacket(RTMP* rtmp, RTMPPacket* packet) {
                 "frequency", config.frequency,
                 "channel_configuration", config.channelConfiguration
             ).info("handled audio config");
-            _avHandler->handleEncodedAudioConfig(packet->m_body + 2, packet->m_nBodySize - 2);
-        } else if (packet->m_body[1] == 1) {
-            auto pts = std::chrono::milliseconds{packet->m_nTimeStamp};
-            _avHandler->handleEncodedAudio(pts, packet->m_body + 2, packet->m_nBodySize - 2);
+            _avHandler->handleEncodedAudioConfigPacket(EncodedPacket{message.body, 2, bodySize - 2});
+        } else if (body[1] == 1) {
+            auto pts = std::chrono::milliseconds{message.timestamp};
+            _avHandler->handleEncodedAudioPacket(pts, EncodedPacket{message.body, 2, bodySize - 2});
         }
         return true;
-    case RTMP_PACKET_TYPE_VIDEO: {
-        if (!_avHandler || packet->m_nBodySize < 5 || (packet->m_body[0] & 0x0f) != 0x07) {
+    case RTMPMessageType::Video: {
+        if (!_avHandler || bodySize < 5 || (body[0] & 0x0f) != 0x07) {
             _logger.error("invalid video packet");
             return false;
         }
-        auto ctPtr = reinterpret_cast<const uint8_t*>(packet->m_body + 2);
+        auto ctPtr = reinterpret_cast<const uint8_t*>(body + 2);
         auto compositionTimeOffset = std::chrono::milliseconds{(static_cast<unsigned int>(ctPtr[0]) << 16) | (static_cast<unsigned int>(ctPtr[1]) << 8) | ctPtr[2]};
-        if (packet->m_body[1] == 0) {
+        if (body[1] == 0) {
             AVCDecoderConfigurationRecord config;
-            if (!config.decode(packet->m_body + 5, packet->m_nBodySize - 5)) {
+            if (!config.decode(body + 5, bodySize - 5)) {
                 _logger.error("unable to decode video config");
                 return false;
             }
@@ -258,36 +399,43 @@ bool RTMPConnection::_servePacket(RTMP* rtmp, RTMPPacket* packet) {
                 "level", config.avcLevelIndication,
                 "length_size", config.lengthSizeMinusOne + 1
             ).info("handled video config");
-            _avHandler->handleEncodedVideoConfig(packet->m_body + 5, packet->m_nBodySize - 5);
-        } else if (packet->m_body[1] == 1) {
-            auto dts = std::chrono::milliseconds{packet->m_nTimeStamp};
+            _videoNALULengthSize = config.lengthSizeMinusOne + 1;
+            _avHandler->handleEncodedVideoConfigPacket(EncodedPacket{message.body, 5, bodySize - 5});
+        } else if (body[1] == 1) {
+            auto dts = std::chrono::milliseconds{message.timestamp};
             auto pts = dts + compositionTimeOffset;
-            _avHandler->handleEncodedVideo(pts, dts, packet->m_body + 5, packet->m_nBodySize - 5);
+            EncodedPacket packet{message.body, 5, bodySize - 5};
+            if (_videoNALULengthSize) {
+                auto descriptor = std::make_shared<FrameDescriptor>();
+                if (descriptor->decode(packet.data(), packet.size(), _videoNALULengthSize)) {
+                    packet.setFrameDescriptor(std::move(descriptor));
+                }
+            }
+            _avHandler->handleEncodedVideoPacket(pts, dts, packet);
         }
         return true;
     }
     default:
-        _logger.warn("handled unknown rtmp packet type {}", packet->m_packetType);
+        _logger.warn("handled unknown rtmp message type {}", static_cast<int>(message.type));
     }
     return true;
 }
 
-bool RTMPConnection::_sendConnectResult(RTMP* rtmp, double txn) {
-    RTMPPacket packet;
+bool RTMPConnection::_sendCommand(uint32_t streamId, const char* body, const char* end) {
+    if (!end) {
+        _logger.error("unable to encode rtmp command");
+        return false;
+    }
+    return _chunkStream->sendMessage(3, RTMPMessageType::CommandAMF0, streamId, 0, body, end - body);
+}
+
+bool RTMPConnection::_sendConnectResult(double txn) {
     char pbuf[384], *pend = pbuf+sizeof(pbuf);
     AMFObject obj;
     AMFObjectProperty p, op;
     AVal av;
 
-    packet.m_nChannel = 0x03;
-    packet.m_headerType = RTMP_PACKET_SIZE_MEDIUM;
-    packet.m_packetType = RTMP_PACKET_TYPE_INVOKE;
-    packet.m_nTimeStamp = 0;
-    packet.m_nInfoField2 = 0;
-    packet.m_hasAbsTimestamp = 0;
-    packet.m_body = pbuf + RTMP_MAX_HEADER_SIZE;
-
-    char *enc = packet.m_body;
+    char *enc = pbuf;
     enc = AMF_EncodeString(enc, pend, &av__result);
     enc = AMF_EncodeNumber(enc, pend, txn);
     *enc++ = AMF_OBJECT;
@@ -308,7 +456,7 @@ bool RTMPConnection::_sendConnectResult(RTMP* rtmp, double txn) {
     enc = AMF_EncodeNamedString(enc, pend, &av_code, &av);
     STR2AVAL(av, "Connection succeeded.");
     enc = AMF_EncodeNamedString(enc, pend, &av_description, &av);
-    enc = AMF_EncodeNamedNumber(enc, pend, &av_objectEncoding, rtmp->m_fEncoding);
+    enc = AMF_EncodeNamedNumber(enc, pend, &av_objectEncoding, _objectEncoding);
     STR2AVAL(p.p_name, "version");
     STR2AVAL(p.p_vu.p_aval, "3,5,1,525");
     p.p_type = AMF_STRING;
@@ -322,47 +470,25 @@ bool RTMPConnection::_sendConnectResult(RTMP* rtmp, double txn) {
     *enc++ = 0;
     *enc++ = AMF_OBJECT_END;
 
-    packet.m_nBodySize = enc - packet.m_body;
-
-    return RTMP_SendPacket(rtmp, &packet, false);
+    return _sendCommand(0, pbuf, enc);
 }
 
-bool RTMPConnection::_sendResultNumber(RTMP* rtmp, double txn, double n) {
-    RTMPPacket packet;
+bool RTMPConnection::_sendResultNumber(double txn, double n) {
     char pbuf[256], *pend = pbuf+sizeof(pbuf);
 
-    packet.m_nChannel = 0x03;
-    packet.m_headerType = RTMP_PACKET_SIZE_MEDIUM;
-    packet.m_packetType = RTMP_PACKET_TYPE_INVOKE;
-    packet.m_nTimeStamp = 0;
-    packet.m_nInfoField2 = 0;
-    packet.m_hasAbsTimestamp = 0;
-    packet.m_body = pbuf + RTMP_MAX_HEADER_SIZE;
-
-    char *enc = packet.m_body;
+    char *enc = pbuf;
     enc = AMF_EncodeString(enc, pend, &av__result);
     enc = AMF_EncodeNumber(enc, pend, txn);
     *enc++ = AMF_NULL;
     enc = AMF_EncodeNumber(enc, pend, n);
 
-    packet.m_nBodySize = enc - packet.m_body;
-
-    return RTMP_SendPacket(rtmp, &packet, false);
+    return _sendCommand(0, pbuf, enc);
 }
 
-bool RTMPConnection::_sendOnFCPublish(RTMP* rtmp, uint32_t streamId, const AVal* code, const AVal* description) {
-    RTMPPacket packet;
+bool RTMPConnection::_sendOnFCPublish(uint32_t streamId, const AVal* code, const AVal* description) {
     char pbuf[512], *pend = pbuf+sizeof(pbuf);
 
-    packet.m_nChannel = 0x03;
-    packet.m_headerType = RTMP_PACKET_SIZE_LARGE;
-    packet.m_packetType = RTMP_PACKET_TYPE_INVOKE;
-    packet.m_nTimeStamp = 0;
-    packet.m_nInfoField2 = streamId;
-    packet.m_hasAbsTimestamp = 0;
-    packet.m_body = pbuf + RTMP_MAX_HEADER_SIZE;
-
-    char *enc = packet.m_body;
+    char *enc = pbuf;
     enc = AMF_EncodeString(enc, pend, &av_onFCPublish);
     enc = AMF_EncodeNumber(enc, pend, 0);
     *enc++ = AMF_NULL;
@@ -376,23 +502,13 @@ bool RTMPConnection::_sendOnFCPublish(RTMP* rtmp, uint32_t streamId, const AVal*
     *enc++ = 0;
     *enc++ = AMF_OBJECT_END;
 
-    packet.m_nBodySize = enc - packet.m_body;
-    return RTMP_SendPacket(rtmp, &packet, false);
+    return _sendCommand(streamId, pbuf, enc);
 }
 
-bool RTMPConnection::_sendOnStatus(RTMP* rtmp, uint32_t streamId, const AVal* code, const AVal* description) {
-    RTMPPacket packet;
+bool RTMPConnection::_sendOnStatus(uint32_t streamId, const AVal* code, const AVal* description) {
     char pbuf[512], *pend = pbuf+sizeof(pbuf);
 
-    packet.m_nChannel = 0x03;
-    packet.m_headerType = RTMP_PACKET_SIZE_LARGE;
-    packet.m_packetType = RTMP_PACKET_TYPE_INVOKE;
-    packet.m_nTimeStamp = 0;
-    packet.m_nInfoField2 = streamId;
-    packet.m_hasAbsTimestamp = 0;
-    packet.m_body = pbuf + RTMP_MAX_HEADER_SIZE;
-
-    char *enc = packet.m_body;
+    char *enc = pbuf;
     enc = AMF_EncodeString(enc, pend, &av_onStatus);
     enc = AMF_EncodeNumber(enc, pend, 0);
     *enc++ = AMF_NULL;
@@ -407,19 +523,24 @@ bool RTMPConnection::_sendOnStatus(RTMP* rtmp, uint32_t streamId, const AVal* co
     *enc++ = 0;
     *enc++ = AMF_OBJECT_END;
 
-    packet.m_nBodySize = enc - packet.m_body;
-    return RTMP_SendPacket(rtmp, &packet, false);
+    return _sendCommand(streamId, pbuf, enc);
 }
 
 bool RTMPConnection::_waitUntilReadable(int fd) {
     while (!_shouldReturn) {
-        fd_set rfds;
-        FD_ZERO(&rfds);
-        FD_SET(fd, &rfds);
-
-        struct timeval timeout{0};
-        timeout.tv_sec = 1;
-        if (select(fd + 1, &rfds, nullptr, nullptr, &timeout) > 0) {
+        pollfd fds[2]{};
+        fds[0].fd = fd;
+        fds[0].events = POLLIN;
+        fds[1].fd = _cancelEventFD;
+        fds[1].events = POLLIN;
+
+        // without an eventfd, fall back to polling so that cancellation is still noticed
+        auto n = poll(fds, _cancelEventFD == -1 ? 1 : 2, _cancelEventFD == -1 ? 1000 : -1);
+        if (n < 0 && errno != EINTR) {
+            _logger.error("poll error (errno = {})", errno);
+            return false;
+        }
+        if (n > 0 && fds[0].revents) {
             return true;
         }
     }
@@ -1,23 +1,45 @@
 #pragma once
 
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
 #include <asio.hpp>
 
-#include "librtmp/rtmp.h"
+#include "librtmp/amf.h"
 
 #include "encoded_av_handler.hpp"
+#include "event_loop.hpp"
 #include "logger.hpp"
+#include "rtmp_chunk_stream.hpp"
 
 struct RTMPConnectionDelegate {
     virtual ~RTMPConnectionDelegate() {}
 
     virtual std::shared_ptr<EncodedAVHandler> authenticate(const std::string& connectionId) = 0;
+
+    // runBlocking invokes f on a thread that may block. Event-driven connections share their
+    // worker, so they use it for anything that might block, such as releasing their handlers, whose
+    // destructors may wait for their streams to finish up.
+    virtual void runBlocking(std::function<void()> f) = 0;
 };
 
-class RTMPConnection {
+// RTMPConnection serves a publishing RTMP client. It implements both of TCPServer's connection
+// interfaces. When event-driven, connections authenticate via their delegate's runBlocking, and any
+// messages that arrive in the meantime are held until authentication completes.
+class RTMPConnection : public std::enable_shared_from_this<RTMPConnection> {
 public:
-    RTMPConnection(Logger logger, RTMPConnectionDelegate* delegate) : _logger{logger}, _delegate{delegate} {}
+    RTMPConnection(Logger logger, RTMPConnectionDelegate* delegate);
+    ~RTMPConnection();
+
+    bool begin(int fd, asio::ip::tcp::endpoint remote, EventLoop* loop);
+    bool handleReadable();
+    void end();
 
     void run(int fd, asio::ip::tcp::endpoint remote);
+
+    // cancel causes run to return. Blocked reads are woken immediately.
     void cancel();
 
 private:
@@ -26,18 +48,42 @@ private:
     std::string _connectionId;
 
     std::atomic<bool> _shouldReturn{false};
+    int _cancelEventFD = -1;
+
+    int _fd = -1;
+
+    // Only connections with their own thread may block. Event-driven connections share a worker.
+    bool _mayBlock = false;
+    std::unique_ptr<RTMPChunkStream> _chunkStream;
+    double _objectEncoding = 0.0;
 
     uint32_t _nextStreamId{1};
     std::shared_ptr<EncodedAVHandler> _avHandler;
 
-    void _serveRTMP(RTMP* rtmp);
-    bool _serveInvoke(RTMP* rtmp, RTMPPacket* packet, const char* body, size_t len);
-    bool _servePacket(RTMP* rtmp, RTMPPacket* packet);
+    // the loop that authentication results are posted to. this is cleared by end
+    std::mutex _loopMutex;
+    EventLoop* _loop = nullptr;
+
+    static constexpr size_t MaxDeferredMessages = 64;
+    bool _isAuthenticating = false;
+    std::vector<RTMPMessage> _deferredMessages;
+
+    // taken from the most recent video config, so that frames can be described as they arrive
+    size_t _videoNALULengthSize = 0;
+
+    bool _write(const void* data, size_t len);
+
+    void _authenticate(double txn);
+    void _didAuthenticate(double txn, std::shared_ptr<EncodedAVHandler> handler);
+
+    bool _serveInvoke(const RTMPMessage& message);
+    bool _serveMessage(const RTMPMessage& message);
 
-    bool _sendConnectResult(RTMP* rtmp, double txn);
-    bool _sendResultNumber(RTMP* rtmp, double txn, double n);
-    bool _sendOnFCPublish(RTMP* rtmp, uint32_t streamId, const AVal* code, const AVal* description);
-    bool _sendOnStatus(RTMP* rtmp, uint32_t streamId, const AVal* code, const AVal* description);
+    bool _sendCommand(uint32_t streamId, const char* body, const char* end);
+    bool _sendConnectResult(double txn);
+    bool _sendResultNumber(double txn, double n);
+    bool _sendOnFCPublish(uint32_t streamId, const AVal* code, const AVal* description);
+    bool _sendOnStatus(uint32_t streamId, const AVal* code, const AVal* description);
 
     bool _waitUntilReadable(int fd);
 };
@@ -0,0 +1,186 @@
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <thread>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "logger_test.hpp"
+#include "rtmp_connection.hpp"
+#include "tcp_server.hpp"
+#include "thread_pool.hpp"
+
+namespace {
+
+struct TestHandler : EncodedAVHandler {};
+
+// TestDelegate's authentication blocks until allowed to finish.
+struct TestDelegate : RTMPConnectionDelegate {
+    std::shared_ptr<EncodedAVHandler> authenticate(const std::string& connectionId) override {
+        ++authenticationCount;
+        std::unique_lock<std::mutex> l{mutex};
+        cv.wait(l, [this] { return isFinished; });
+        return shouldSucceed ? std::make_shared<TestHandler>() : nullptr;
+    }
+
+    void runBlocking(std::function<void()> f) override {
+        pool.post(std::move(f));
+    }
+
+    void finishAuthentication() {
+        std::lock_guard<std::mutex> l{mutex};
+        isFinished = true;
+        cv.notify_all();
+    }
+
+    std::atomic<int> authenticationCount{0};
+    bool shouldSucceed = true;
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool isFinished = false;
+
+    ThreadPool pool{2};
+};
+
+using TestServer = TCPServer<RTMPConnection, RTMPConnectionDelegate*>;
+
+bool StartServer(TestServer* server, int port) {
+    TestServer::Options options;
+    options.workerCount = 1;
+    return server->start(asio::ip::address_v4::loopback(), port, options);
+}
+
+int Connect(int port) {
+    asio::io_service service;
+    asio::ip::tcp::socket s{service};
+    s.connect(asio::ip::tcp::endpoint(asio::ip::address_v4::loopback(), port));
+    return s.release();
+}
+
+// Read returns everything received until the peer goes quiet for timeout. If the peer closes the
+// connection, "<eof>" is appended.
+std::string Read(int fd, std::chrono::milliseconds timeout) {
+    std::string ret;
+    char buf[4096];
+    while (true) {
+        pollfd fds{};
+        fds.fd = fd;
+        fds.events = POLLIN;
+        if (poll(&fds, 1, timeout.count()) <= 0) {
+            return ret;
+        }
+        auto n = recv(fd, buf, sizeof(buf), 0);
+        if (n <= 0) {
+            return ret + "<eof>";
+        }
+        ret.append(buf, n);
+    }
+}
+
+bool Handshake(int fd) {
+    std::vector<char> c0c1(1 + RTMPChunkStream::HandshakeSize);
+    c0c1[0] = 3;
+    if (send(fd, c0c1.data(), c0c1.size(), 0) != static_cast<ssize_t>(c0c1.size())) {
+        return false;
+    }
+    auto s0s1s2 = Read(fd, std::chrono::milliseconds(500));
+    if (s0s1s2.size() != 1 + 2 * RTMPChunkStream::HandshakeSize) {
+        return false;
+    }
+    return send(fd, s0s1s2.data() + 1, RTMPChunkStream::HandshakeSize, 0) == static_cast<ssize_t>(RTMPChunkStream::HandshakeSize);
+}
+
+void SendCommand(int fd, const char* name, double txn) {
+    char body[128], *end = body + sizeof(body);
+    AVal method{const_cast<char*>(name), static_cast<int>(strlen(name))};
+    auto enc = AMF_EncodeString(body, end, &method);
+    enc = AMF_EncodeNumber(enc, end, txn);
+    *enc++ = AMF_OBJECT;
+    *enc++ = 0;
+    *enc++ = 0;
+    *enc++ = AMF_OBJECT_END;
+    auto len = enc - body;
+
+    // a type 0 chunk on chunk stream 3
+    std::vector<char> chunk{3, 0, 0, 0, 0, 0, static_cast<char>(len), RTMPMessageType::CommandAMF0, 0, 0, 0, 0};
+    chunk.insert(chunk.end(), body, enc);
+    ASSERT_EQ(send(fd, chunk.data(), chunk.size(), 0), static_cast<ssize_t>(chunk.size()));
+}
+
+} // anonymous namespace
+
+TEST(RTMPConnection, eventDrivenAuthentication) {
+    TestLogDestination logDestination;
+    TestDelegate delegate;
+    TestServer server{&logDestination, &delegate};
+    ASSERT_TRUE(StartServer(&server, 6510));
+
+    auto a = Connect(6510);
+    ASSERT_TRUE(Handshake(a));
+    SendCommand(a, "connect", 1);
+    SendCommand(a, "createStream", 2);
+    while (delegate.authenticationCount == 0) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    // the worker is shared, so it should keep serving other connections in the meantime
+    auto b = Connect(6510);
+    EXPECT_TRUE(Handshake(b));
+    EXPECT_EQ(Read(a, std::chrono::milliseconds(100)), "");
+
+    // createStream should be answered after connect
+    delegate.finishAuthentication();
+    auto response = Read(a, std::chrono::milliseconds(500));
+    auto connectResult = response.find("_result");
+    ASSERT_NE(connectResult, std::string::npos);
+    EXPECT_NE(response.find("FMS/3,5,1,525", connectResult), std::string::npos);
+    EXPECT_NE(response.find("_result", connectResult + 1), std::string::npos);
+    EXPECT_EQ(response.find("<eof>"), std::string::npos);
+
+    close(a);
+    close(b);
+    server.stop();
+}
+
+TEST(RTMPConnection, eventDrivenAuthenticationFailure) {
+    TestLogDestination logDestination;
+    TestDelegate delegate;
+    delegate.shouldSucceed = false;
+    delegate.finishAuthentication();
+    TestServer server{&logDestination, &delegate};
+    ASSERT_TRUE(StartServer(&server, 6511));
+
+    auto fd = Connect(6511);
+    ASSERT_TRUE(Handshake(fd));
+    SendCommand(fd, "connect", 1);
+    EXPECT_EQ(Read(fd, std::chrono::seconds(1)), "<eof>");
+
+    close(fd);
+    server.stop();
+}
+
+TEST(RTMPConnection, closedDuringAuthentication) {
+    TestLogDestination logDestination;
+    TestDelegate delegate;
+    {
+        TestServer server{&logDestination, &delegate};
+        ASSERT_TRUE(StartServer(&server, 6512));
+
+        auto fd = Connect(6512);
+        ASSERT_TRUE(Handshake(fd));
+        SendCommand(fd, "connect", 1);
+        while (delegate.authenticationCount == 0) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        close(fd);
+    }
+
+    // the server and its workers are gone, so the result has nowhere to go
+    delegate.finishAuthentication();
+}
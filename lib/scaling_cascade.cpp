@@ -0,0 +1,187 @@
+#include "scaling_cascade.hpp"
+
+#include <algorithm>
+
+extern "C" {
+    #include <libavutil/imgutils.h>
+}
+
+namespace {
+
+constexpr int ImageAlignment = 32;
+
+} // anonymous namespace
+
+ScalingCascade::~ScalingCascade() {
+    drain();
+    _reset();
+}
+
+void ScalingCascade::addHandler(VideoHandler* handler, int width, int height) {
+    for (auto& rung : _rungs) {
+        if (rung->width == width && rung->height == height) {
+            rung->splitter->addHandler(handler);
+            return;
+        }
+    }
+
+    ConcurrentVideoSplitter::Configuration splitterConfiguration;
+    splitterConfiguration.pool = _configuration.pool;
+    splitterConfiguration.maxLag = _configuration.maxLag;
+
+    auto rung = std::make_unique<Rung>();
+    rung->width = width;
+    rung->height = height;
+    rung->splitter = std::make_unique<ConcurrentVideoSplitter>(_logger, splitterConfiguration);
+    rung->splitter->addHandler(handler);
+    _rungs.emplace_back(std::move(rung));
+
+    std::stable_sort(_rungs.begin(), _rungs.end(), [](const std::unique_ptr<Rung>& a, const std::unique_ptr<Rung>& b) {
+        return static_cast<int64_t>(a->width) * a->height > static_cast<int64_t>(b->width) * b->height;
+    });
+
+    // the cascade needs to be worked out again
+    _reset();
+}
+
+void ScalingCascade::handleVideo(std::chrono::microseconds pts, const AVFrame* frame) {
+    auto pixelFormat = static_cast<AVPixelFormat>(frame->format);
+    if (frame->width != _inputWidth || frame->height != _inputHeight || pixelFormat != _inputPixelFormat) {
+        // everything still using the old scaling contexts needs to be done first
+        drain();
+        if (!_configure(frame->width, frame->height, pixelFormat)) {
+            _reset();
+            return;
+        }
+    }
+
+    for (auto& rung : _rungs) {
+        if (!rung->isScaled) {
+            rung->splitter->handleVideo(pts, frame);
+            continue;
+        }
+
+        auto source = rung->parent ? rung->parent->frame : frame;
+        if (!source) {
+            // the parent's frame couldn't be allocated, so this rung misses the frame too
+            _logger.with("width", rung->width, "height", rung->height).error("skipping frame without a parent frame to scale from");
+            continue;
+        }
+
+        rung->frame = av_frame_alloc();
+        if (!rung->frame) {
+            _logger.error("unable to allocate frame");
+            continue;
+        }
+        rung->frame->format = pixelFormat;
+        rung->frame->width = rung->width;
+        rung->frame->height = rung->height;
+        // frames return to the pool once every handler is done with them
+        rung->frame->buf[0] = av_buffer_pool_get(rung->bufferPool);
+        if (!rung->frame->buf[0] || av_image_fill_arrays(rung->frame->data, rung->frame->linesize, rung->frame->buf[0]->data, pixelFormat, rung->width, rung->height, ImageAlignment) < 0) {
+            _logger.error("unable to allocate frame buffer");
+            av_frame_free(&rung->frame);
+            continue;
+        }
+        av_frame_copy_props(rung->frame, frame);
+
+        if (rung->yuvScaler) {
+            rung->yuvScaler->scale(source, rung->frame);
+        } else {
+            sws_scale(rung->scalingContext, source->data, source->linesize, 0, source->height, rung->frame->data, rung->frame->linesize);
+        }
+        rung->splitter->handleVideo(pts, rung->frame);
+    }
+
+    for (auto& rung : _rungs) {
+        if (rung->frame) {
+            av_frame_free(&rung->frame);
+        }
+    }
+}
+
+void ScalingCascade::drain() {
+    for (auto& rung : _rungs) {
+        rung->splitter->drain();
+    }
+}
+
+bool ScalingCascade::_configure(int width, int height, AVPixelFormat pixelFormat) {
+    _reset();
+
+    for (size_t i = 0; i < _rungs.size(); ++i) {
+        auto& rung = _rungs[i];
+        if (rung->width == width && rung->height == height) {
+            continue;
+        }
+
+        // find the smallest downscaled rung that's still at least as large as this one
+        rung->depth = 1;
+        for (size_t j = i; j-- > 0;) {
+            auto candidate = _rungs[j].get();
+            if (!candidate->isScaled || candidate->width > width || candidate->height > height) {
+                // upscaled rungs would only add blur, and source-sized rungs are the source
+                continue;
+            }
+            if (candidate->width >= rung->width && candidate->height >= rung->height && candidate->depth < _configuration.maxDepth) {
+                rung->parent = candidate;
+                rung->depth = candidate->depth + 1;
+                break;
+            }
+        }
+
+        auto sourceWidth = rung->parent ? rung->parent->width : width;
+        auto sourceHeight = rung->parent ? rung->parent->height : height;
+        rung->isScaled = true;
+        if (_configuration.useYUVScaler && YUVScaler::IsFormatSupported(pixelFormat)) {
+            auto filter = _configuration.scalingFlags == SWS_AREA ? YUVScaler::Filter::Area : YUVScaler::Filter::Bilinear;
+            rung->yuvScaler = std::make_unique<YUVScaler>();
+            if (!rung->yuvScaler->configure(sourceWidth, sourceHeight, rung->width, rung->height, pixelFormat, filter)) {
+                // the resolutions are too small for its filters, but libswscale can still do it
+                rung->yuvScaler.reset();
+            }
+        }
+        if (!rung->yuvScaler) {
+            rung->scalingContext = sws_getContext(
+                sourceWidth, sourceHeight, pixelFormat,
+                rung->width, rung->height, pixelFormat,
+                _configuration.scalingFlags, nullptr, nullptr, nullptr
+            );
+            if (!rung->scalingContext) {
+                _logger.with("width", rung->width, "height", rung->height).error("unable to create scaling context");
+                return false;
+            }
+        }
+
+        auto size = av_image_get_buffer_size(pixelFormat, rung->width, rung->height, ImageAlignment);
+        if (size < 0 || !(rung->bufferPool = av_buffer_pool_init(size, nullptr))) {
+            _logger.with("width", rung->width, "height", rung->height).error("unable to create frame buffer pool");
+            return false;
+        }
+    }
+
+    _inputWidth = width;
+    _inputHeight = height;
+    _inputPixelFormat = pixelFormat;
+    return true;
+}
+
+void ScalingCascade::_reset() {
+    for (auto& rung : _rungs) {
+        rung->parent = nullptr;
+        rung->depth = 0;
+        rung->isScaled = false;
+        rung->yuvScaler.reset();
+        if (rung->scalingContext) {
+            sws_freeContext(rung->scalingContext);
+            rung->scalingContext = nullptr;
+        }
+        if (rung->bufferPool) {
+            // buffers still referenced by handlers keep the pool's memory alive until they're freed
+            av_buffer_pool_uninit(&rung->bufferPool);
+        }
+    }
+    _inputWidth = 0;
+    _inputHeight = 0;
+    _inputPixelFormat = AV_PIX_FMT_NONE;
+}
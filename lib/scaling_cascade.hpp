@@ -0,0 +1,94 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+
+extern "C" {
+    #include <libavutil/buffer.h>
+    #include <libswscale/swscale.h>
+}
+
+#include "av_handler.hpp"
+#include "concurrent_video_splitter.hpp"
+#include "logger.hpp"
+#include "thread_pool.hpp"
+#include "yuv_scaler.hpp"
+
+// ScalingCascade scales video to each of its handlers' resolutions, scaling to each distinct
+// resolution once per frame. Smaller resolutions are derived from the nearest larger one that has
+// already been scaled instead of from the source, as long as no frame is rescaled more than
+// Configuration::maxDepth times on its way to a handler. Handlers with the same resolution get
+// references to the same frame, and handlers with the source's resolution get the source frame.
+//
+// Scaling happens on the caller's thread. Each resolution's handlers are then invoked through a
+// ConcurrentVideoSplitter, so with a pool, the handlers for different resolutions run concurrently
+// with each other and with the scaling of the next frame.
+class ScalingCascade : public VideoHandler {
+public:
+    struct Configuration {
+        // See ConcurrentVideoSplitter::Configuration.
+        ThreadPool* pool = nullptr;
+        size_t maxLag = 0;
+
+        // The maximum number of times a frame may be rescaled on its way to a handler. If 1,
+        // everything is scaled directly from the source.
+        int maxDepth = 2;
+
+        // The flags for sws_getContext, which select the scaling algorithm.
+        int scalingFlags = SWS_BILINEAR;
+
+        // If true, yuv420p and nv12 video is scaled with YUVScaler instead of libswscale. Its area
+        // filter is used if scalingFlags is SWS_AREA, and its bilinear filter otherwise.
+        bool useYUVScaler = false;
+    };
+
+    ScalingCascade(Logger logger, Configuration configuration)
+        : _logger{std::move(logger)}, _configuration{configuration} {}
+    ScalingCascade(const ScalingCascade& other) = delete;
+    ScalingCascade& operator=(const ScalingCascade& other) = delete;
+
+    // Waits for all handlers to finish.
+    virtual ~ScalingCascade();
+
+    // addHandler adds a handler that wants video at the given resolution. It is not safe to call
+    // this while other threads may be invoking the handle methods.
+    void addHandler(VideoHandler* handler, int width, int height);
+
+    virtual void handleVideo(std::chrono::microseconds pts, const AVFrame* frame) override;
+
+    // drain blocks until every handler has handled every frame. See ConcurrentVideoSplitter::drain.
+    void drain();
+
+private:
+    const Logger _logger;
+    const Configuration _configuration;
+
+    struct Rung {
+        int width = 0;
+        int height = 0;
+        std::unique_ptr<ConcurrentVideoSplitter> splitter;
+
+        // The rest is set up for each input format. If parent is null, the rung is scaled from the
+        // source. If isScaled is false, the rung has the source's resolution. Scaled rungs have
+        // either a scaling context or a configured yuvScaler.
+        Rung* parent = nullptr;
+        int depth = 0;
+        bool isScaled = false;
+        SwsContext* scalingContext = nullptr;
+        std::unique_ptr<YUVScaler> yuvScaler;
+        AVBufferPool* bufferPool = nullptr;
+
+        // The rung's frame for the current input frame.
+        AVFrame* frame = nullptr;
+    };
+
+    // Sorted from largest to smallest.
+    std::vector<std::unique_ptr<Rung>> _rungs;
+
+    int _inputWidth = 0;
+    int _inputHeight = 0;
+    AVPixelFormat _inputPixelFormat = AV_PIX_FMT_NONE;
+
+    bool _configure(int width, int height, AVPixelFormat pixelFormat);
+    void _reset();
+};
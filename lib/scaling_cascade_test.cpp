@@ -0,0 +1,158 @@
+#include <gtest/gtest.h>
+
+#include <cstring>
+#include <mutex>
+
+#include "logger_test.hpp"
+#include "scaling_cascade.hpp"
+
+namespace {
+
+struct TestVideoHandler : VideoHandler {
+    std::mutex mutex;
+    std::vector<AVFrame*> frames;
+
+    virtual ~TestVideoHandler() {
+        for (auto& frame : frames) {
+            av_frame_free(&frame);
+        }
+    }
+
+    virtual void handleVideo(std::chrono::microseconds pts, const AVFrame* frame) override {
+        std::lock_guard<std::mutex> l{mutex};
+        frames.emplace_back(av_frame_clone(frame));
+    }
+};
+
+AVFrame* SolidFrame(int width, int height, uint8_t y, uint8_t u, uint8_t v) {
+    auto frame = av_frame_alloc();
+    frame->format = AV_PIX_FMT_YUV420P;
+    frame->width = width;
+    frame->height = height;
+    av_frame_get_buffer(frame, 32);
+    for (int row = 0; row < height; ++row) {
+        memset(frame->data[0] + row * frame->linesize[0], y, width);
+    }
+    for (int row = 0; row < height / 2; ++row) {
+        memset(frame->data[1] + row * frame->linesize[1], u, width / 2);
+        memset(frame->data[2] + row * frame->linesize[2], v, width / 2);
+    }
+    return frame;
+}
+
+} // anonymous namespace
+
+TEST(ScalingCascade, ladder) {
+    TestLogDestination logDestination;
+    ThreadPool pool{4};
+
+    TestVideoHandler source, hd[2], sd, tiny;
+    {
+        ScalingCascade::Configuration configuration;
+        configuration.pool = &pool;
+        configuration.maxLag = 1;
+        ScalingCascade cascade{&logDestination, configuration};
+        cascade.addHandler(&tiny, 320, 180);
+        cascade.addHandler(&hd[0], 1280, 720);
+        cascade.addHandler(&sd, 640, 360);
+        cascade.addHandler(&hd[1], 1280, 720);
+        cascade.addHandler(&source, 1920, 1080);
+
+        for (int i = 0; i < 3; ++i) {
+            auto frame = SolidFrame(1920, 1080, 100 + i, 50, 200);
+            cascade.handleVideo(std::chrono::microseconds(i), frame);
+            av_frame_free(&frame);
+        }
+        cascade.drain();
+    }
+
+    struct Expectation {
+        TestVideoHandler* handler;
+        int width;
+        int height;
+    } expectations[] = {
+        {&source, 1920, 1080},
+        {&hd[0], 1280, 720},
+        {&hd[1], 1280, 720},
+        {&sd, 640, 360},
+        {&tiny, 320, 180},
+    };
+
+    for (auto& expectation : expectations) {
+        auto& frames = expectation.handler->frames;
+        ASSERT_EQ(3, frames.size());
+        for (size_t i = 0; i < frames.size(); ++i) {
+            auto frame = frames[i];
+            EXPECT_EQ(expectation.width, frame->width);
+            EXPECT_EQ(expectation.height, frame->height);
+            EXPECT_EQ(AV_PIX_FMT_YUV420P, frame->format);
+
+            // solid colors should survive any number of rescales
+            EXPECT_EQ(100 + i, frame->data[0][0]);
+            EXPECT_EQ(100 + i, frame->data[0][(frame->height - 1) * frame->linesize[0] + frame->width - 1]);
+            EXPECT_EQ(50, frame->data[1][0]);
+            EXPECT_EQ(200, frame->data[2][0]);
+        }
+    }
+
+    // handlers with the same resolution share frames
+    for (size_t i = 0; i < 3; ++i) {
+        EXPECT_EQ(hd[0].frames[i]->data[0], hd[1].frames[i]->data[0]);
+    }
+}
+
+TEST(ScalingCascade, resolutionChange) {
+    TestLogDestination logDestination;
+
+    TestVideoHandler handler;
+    {
+        ScalingCascade cascade{&logDestination, ScalingCascade::Configuration{}};
+        cascade.addHandler(&handler, 640, 360);
+
+        auto frame = SolidFrame(1280, 720, 10, 20, 30);
+        cascade.handleVideo(std::chrono::microseconds(0), frame);
+        av_frame_free(&frame);
+
+        frame = SolidFrame(640, 360, 40, 50, 60);
+        cascade.handleVideo(std::chrono::microseconds(1), frame);
+        av_frame_free(&frame);
+
+        frame = SolidFrame(1920, 1080, 70, 80, 90);
+        cascade.handleVideo(std::chrono::microseconds(2), frame);
+        av_frame_free(&frame);
+    }
+
+    ASSERT_EQ(3, handler.frames.size());
+    uint8_t expectedY[] = {10, 40, 70};
+    for (size_t i = 0; i < 3; ++i) {
+        EXPECT_EQ(640, handler.frames[i]->width);
+        EXPECT_EQ(360, handler.frames[i]->height);
+        EXPECT_EQ(expectedY[i], handler.frames[i]->data[0][0]);
+    }
+}
+
+TEST(ScalingCascade, yuvScaler) {
+    TestLogDestination logDestination;
+
+    TestVideoHandler hd, sd;
+    {
+        ScalingCascade::Configuration configuration;
+        configuration.useYUVScaler = true;
+        ScalingCascade cascade{&logDestination, configuration};
+        cascade.addHandler(&hd, 1280, 720);
+        cascade.addHandler(&sd, 640, 360);
+
+        auto frame = SolidFrame(1920, 1080, 100, 50, 200);
+        cascade.handleVideo(std::chrono::microseconds(0), frame);
+        av_frame_free(&frame);
+    }
+
+    for (auto handler : {&hd, &sd}) {
+        ASSERT_EQ(1, handler->frames.size());
+        auto frame = handler->frames[0];
+        EXPECT_EQ(handler == &hd ? 1280 : 640, frame->width);
+        EXPECT_EQ(100, frame->data[0][(frame->height - 1) * frame->linesize[0] + frame->width - 1]);
+        EXPECT_EQ(50, frame->data[1][0]);
+        EXPECT_EQ(200, frame->data[2][0]);
+    }
+}
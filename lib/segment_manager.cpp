@@ -2,6 +2,30 @@
 
 #include "utility.hpp"
 
+SegmentManager::SegmentManager(Logger logger, Configuration configuration)
+    : _logger{std::move(logger)}, _configuration{std::move(configuration)}, _streamId{std::make_shared<StreamId>(_configuration.streamId)}
+{
+    if (!_configuration.playlistPath.empty()) {
+        for (auto fs : _configuration.storage) {
+            _playlists.emplace_back(std::make_shared<Playlist>(_logger, fs, _configuration.playlistPath, _configuration.playlist));
+        }
+    }
+}
+
+SegmentManager::~SegmentManager() {
+    if (_playlists.empty()) {
+        return;
+    }
+    // joining the segments' threads makes sure nothing is added after the playlists end
+    _segments.clear();
+    _initSegment.reset();
+    for (auto& playlist : _playlists) {
+        playlist->update([](HLSMediaPlaylist* playlist) {
+            playlist->end();
+        });
+    }
+}
+
 std::shared_ptr<SegmentStorage::Segment> SegmentManager::createSegment(const std::string& extension) {
     auto segmentId = GenerateUUID();
     auto path = segmentId + "." + extension;
@@ -9,8 +33,73 @@ std::shared_ptr<SegmentStorage::Segment> SegmentManager::createSegment(const std
     std::lock_guard<std::mutex> l{_mutex};
 
     _logger.with("path", path, "segment_number", _nextSegmentNumber).info("creating segment");
-    auto segment = std::make_shared<Segment>(_logger, _configuration, path, _nextSegmentNumber++);
+    auto segment = std::make_shared<Segment>(_logger, _configuration, path, _nextSegmentNumber++, -1, _initSegment, _playlists, _streamId);
+    _retainSegment(segment);
+    return segment;
+}
+
+std::shared_ptr<SegmentStorage::Segment> SegmentManager::createInitSegment(const std::string& extension) {
+    auto segmentId = GenerateUUID();
+    auto path = segmentId + "." + extension;
+
+    std::lock_guard<std::mutex> l{_mutex};
+
+    _logger.with("path", path).info("creating init segment");
+    _initSegment = std::make_shared<Segment>(_logger, _configuration, path, -1);
+    _retainSegment(_initSegment);
+    return _initSegment;
+}
 
+std::shared_ptr<SegmentStorage::Segment> SegmentManager::createPart(SegmentStorage::Segment* segment, int partNumber, const std::string& extension) {
+    auto parent = static_cast<Segment*>(segment);
+    auto& segmentPath = parent->path();
+    auto path = segmentPath.substr(0, segmentPath.rfind('.')) + ".part" + std::to_string(partNumber) + "." + extension;
+
+    std::lock_guard<std::mutex> l{_mutex};
+
+    auto part = std::make_shared<Segment>(_logger, _configuration, path, parent->number(), partNumber, parent->initSegment(), _playlists);
+    part->metadata = parent->metadata;
+    _retainSegment(part);
+    return part;
+}
+
+SegmentManager::Playlist::Playlist(Logger logger, FileStorage* storage, std::string path, HLSMediaPlaylist::Configuration configuration)
+    : _logger{logger.with("playlist_url", storage->downloadURL(path))}, _storage{storage}, _path{std::move(path)}, _playlist{std::move(configuration)} {}
+
+std::string SegmentManager::Playlist::uriForPath(const std::string& path) const {
+    std::string ret;
+    for (auto c : _path) {
+        if (c == '/') {
+            ret += "../";
+        }
+    }
+    return ret + path;
+}
+
+void SegmentManager::Playlist::update(const std::function<void(HLSMediaPlaylist*)>& f) {
+    // the playlist is written while the lock is held so that older versions can't clobber newer ones
+    std::lock_guard<std::mutex> l{_mutex};
+
+    f(&_playlist);
+    auto rendered = _playlist.render();
+    if (rendered == _rendered) {
+        return;
+    }
+
+    auto file = _storage->createFile(_path);
+    if (!file) {
+        _logger.error("unable to create playlist file");
+        return;
+    }
+    auto ok = file->write(rendered.data(), rendered.size());
+    if (!file->close() || !ok) {
+        _logger.error("error writing playlist");
+        return;
+    }
+    _rendered = std::move(rendered);
+}
+
+void SegmentManager::_retainSegment(std::shared_ptr<Segment> segment) {
     for (size_t i = 0; i < _segments.size();) {
         if (_segments[i]->isComplete()) {
             _segments[i] = _segments.back();
@@ -19,40 +108,161 @@ std::shared_ptr<SegmentStorage::Segment> SegmentManager::createSegment(const std
             ++i;
         }
     }
-    _segments.emplace_back(segment);
+    _segments.emplace_back(std::move(segment));
+}
 
-    return segment;
+std::string SegmentManager::streamId() const {
+    return _streamId->get();
 }
 
-SegmentManager::Segment::Segment(const Logger& logger, const SegmentManager::Configuration& configuration, const std::string& path, int64_t segmentNumber) {
-    for (auto fs : configuration.storage) {
+void SegmentManager::setStreamId(std::string streamId) {
+    _streamId->set(std::move(streamId));
+}
+
+bool SegmentManager::expectStreamId() {
+    return _streamId->expect();
+}
+
+std::string SegmentManager::StreamId::get() const {
+    std::lock_guard<std::mutex> l{_mutex};
+    return _value;
+}
+
+std::string SegmentManager::StreamId::wait() const {
+    std::unique_lock<std::mutex> l{_mutex};
+    _cv.wait(l, [this] { return !_isExpected; });
+    return _value;
+}
+
+bool SegmentManager::StreamId::expect() {
+    std::lock_guard<std::mutex> l{_mutex};
+    if (_isExpected || !_value.empty()) {
+        return false;
+    }
+    _isExpected = true;
+    return true;
+}
+
+void SegmentManager::StreamId::set(std::string value) {
+    {
+        std::lock_guard<std::mutex> l{_mutex};
+        _value = std::move(value);
+        _isExpected = false;
+    }
+    _cv.notify_all();
+}
+
+SegmentManager::Segment::Segment(const Logger& logger, const SegmentManager::Configuration& configuration, const std::string& path, int64_t segmentNumber, int partNumber, const std::shared_ptr<Segment>& initSegment, const std::vector<std::shared_ptr<Playlist>>& playlists, std::shared_ptr<StreamId> streamId)
+    : _path{path}, _number{segmentNumber}, _initSegment{initSegment}
+{
+    for (size_t i = 0; i < configuration.storage.size(); ++i) {
+        auto fs = configuration.storage[i];
         auto url = fs->downloadURL(path);
+
+        std::shared_ptr<AsyncFile> initFile;
+        std::string initURL;
+        std::string initPath;
+        if (initSegment) {
+            initFile = initSegment->_replicas[i].file;
+            initURL = initSegment->_replicas[i].url;
+            initPath = initSegment->_path;
+        }
+
+        std::shared_ptr<Playlist> playlist;
+        if (segmentNumber >= 0 && i < playlists.size()) {
+            playlist = playlists[i];
+        }
+
         Replica replica;
         replica.file = std::make_shared<AsyncFile>(fs, path);
+        replica.url = url;
         replica.thread = std::thread([
                 this,
                 file = replica.file,
+                path,
                 url,
+                initFile,
+                initURL,
+                initPath,
                 segmentNumber,
+                partNumber,
+                playlist,
                 logger = logger.with("url", url),
-                configuration
+                configuration,
+                streamId
         ]{
             PlatformAPI::AVStreamSegmentReplica replica;
             replica.time = std::chrono::system_clock::now();
 
+            // failed segments are skipped so that the playlist can move on past them
+            auto skip = [&] {
+                if (playlist && partNumber < 0) {
+                    playlist->update([&](HLSMediaPlaylist* playlist) {
+                        playlist->skipSegment(segmentNumber);
+                    });
+                }
+            };
+
             file->wait();
             if (!file->isHealthy()) {
                 logger.error("error writing segment replica");
+                skip();
+                return;
+            }
+
+            if (segmentNumber < 0) {
+                // init segments aren't listed or registered
                 return;
             }
 
-            if (configuration.platformAPI) {
-                replica.streamId = configuration.streamId;
+            if (initFile) {
+                initFile->wait();
+                if (!initFile->isHealthy()) {
+                    logger.with("init_url", initURL).error("init segment replica failed; not registering segment replica");
+                    skip();
+                    return;
+                }
+            }
+
+            if (partNumber >= 0) {
+                // parts are only listed in the playlists
+                if (playlist) {
+                    HLSMediaPlaylist::Part part;
+                    part.uri = playlist->uriForPath(path);
+                    part.duration = _duration;
+                    part.isIndependent = isIndependent;
+                    part.discontinuity = metadata.discontinuity;
+                    part.initSegmentURI = initPath.empty() ? "" : playlist->uriForPath(initPath);
+                    playlist->update([&](HLSMediaPlaylist* playlist) {
+                        playlist->addPart(segmentNumber, partNumber, std::move(part));
+                    });
+                }
+                return;
+            }
+
+            if (configuration.latencyTracer) {
+                configuration.latencyTracer->stamp(LatencyTracer::Stage::Upload, maxVideoPTS);
+            }
+
+            if (playlist) {
+                HLSMediaPlaylist::Segment segment;
+                segment.uri = playlist->uriForPath(path);
+                segment.duration = _duration;
+                segment.discontinuity = metadata.discontinuity;
+                segment.initSegmentURI = initPath.empty() ? "" : playlist->uriForPath(initPath);
+                playlist->update([&](HLSMediaPlaylist* playlist) {
+                    playlist->addSegment(segmentNumber, std::move(segment));
+                });
+            }
+
+            if (configuration.platformAPI && streamId) {
+                replica.streamId = streamId->wait();
                 replica.segmentNumber = segmentNumber;
                 replica.url = url;
                 replica.gameId = configuration.gameId;
                 replica.duration = std::chrono::duration_cast<decltype(replica.duration)>(_duration);
                 replica.discontinuity = metadata.discontinuity;
+                replica.initSegmentURL = initURL;
 
                 auto result = configuration.platformAPI->createAVStreamSegmentReplica(replica);
                 if (!result.requestError.empty()) {
@@ -62,6 +272,9 @@ SegmentManager::Segment::Segment(const Logger& logger, const SegmentManager::Con
                         logger.error("createAVStreamSegmentReplica error: {}", err.message);
                     }
                 } else {
+                    if (configuration.latencyTracer) {
+                        configuration.latencyTracer->stamp(LatencyTracer::Stage::Registration, maxVideoPTS);
+                    }
                     auto replicaId = result.data.id;
                     logger.with("av_stream_segment_replica_id", replicaId).info("created platform AVStreamSegmentReplica");
                 }
@@ -78,10 +291,10 @@ SegmentManager::Segment::~Segment() {
 }
 
 bool SegmentManager::Segment::write(const void* data, size_t len) {
-    auto begin = reinterpret_cast<const uint8_t*>(data);
-    auto sharedData = std::make_shared<std::vector<uint8_t>>(begin, begin + len);
+    // one pooled copy is shared by all of the replicas
+    auto packet = EncodedPacket::Copy(data, len);
     for (auto& r : _replicas) {
-        r.file->write(sharedData);
+        r.file->write(packet);
     }
     return true;
 }
@@ -1,15 +1,22 @@
 #pragma once
 
+#include <condition_variable>
+#include <functional>
+#include <memory>
 #include <mutex>
 #include <vector>
 
 #include "file_storage.hpp"
+#include "hls_playlist.hpp"
+#include "latency_tracer.hpp"
 #include "platform_api.hpp"
 #include "segment_storage.hpp"
 
 // SegmentManager asynchronously uploads segments for a stream to multiple file storages.
 //
-// It can also post to the platform API as segment replicas complete.
+// It can also keep an HLS media playlist of the segments in each file storage and post to the
+// platform API as segment replicas complete. Playlists are updated first, so a segment becomes
+// playable as soon as it's uploaded, without waiting on the platform API.
 class SegmentManager : public SegmentStorage {
 public:
     struct Configuration {
@@ -17,24 +24,102 @@ public:
         PlatformAPI* platformAPI = nullptr;
         std::string streamId;
         std::string gameId;
+
+        // If set, segments' newest frames are stamped with LatencyTracer::Stage::Upload and
+        // LatencyTracer::Stage::Registration as their replicas complete.
+        LatencyTracer* latencyTracer = nullptr;
+
+        // If non-empty, a media playlist is kept at this path in each file storage and rewritten as
+        // segments and parts complete. Its URIs are relative to it.
+        std::string playlistPath;
+        HLSMediaPlaylist::Configuration playlist;
     };
 
-    explicit SegmentManager(Logger logger, Configuration configuration) : _logger{std::move(logger)}, _configuration{std::move(configuration)} {}
-    virtual ~SegmentManager() {}
+    explicit SegmentManager(Logger logger, Configuration configuration);
+
+    // If there are playlists, this waits for the remaining segments and ends them.
+    virtual ~SegmentManager();
 
     virtual std::shared_ptr<SegmentStorage::Segment> createSegment(const std::string& extension) override;
+    virtual std::shared_ptr<SegmentStorage::Segment> createInitSegment(const std::string& extension) override;
+
+    // Parts are uploaded next to their segment as "<segment id>.part<number>.<extension>". They
+    // aren't registered with the platform API.
+    virtual std::shared_ptr<SegmentStorage::Segment> createPart(SegmentStorage::Segment* segment, int partNumber, const std::string& extension) override;
 
-    const Configuration& configuration() const { return _configuration; }
+    // streamId returns the platform AVStream id that segment replicas are posted for.
+    std::string streamId() const;
+
+    // setStreamId sets the platform AVStream id that segments are posted for, including the ones
+    // that have been created but not posted yet. This is used when the stream can't be registered
+    // until its first video config has been seen.
+    void setStreamId(std::string streamId);
+
+    // expectStreamId indicates that setStreamId is about to be invoked, possibly from another
+    // thread. Segments that complete in the meantime wait for it before they're posted. It returns
+    // false without doing anything if the stream id is already set or expected.
+    bool expectStreamId();
 
 private:
     const Logger _logger;
-    std::mutex _mutex;
-    const Configuration _configuration;
+    mutable std::mutex _mutex;
+    Configuration _configuration;
     int64_t _nextSegmentNumber = 0;
 
+    // StreamId is shared with segments, which look it up once they complete.
+    class StreamId {
+    public:
+        explicit StreamId(std::string value) : _value{std::move(value)} {}
+
+        std::string get() const;
+
+        // wait returns the stream id once it's no longer expected.
+        std::string wait() const;
+
+        bool expect();
+        void set(std::string value);
+
+    private:
+        mutable std::mutex _mutex;
+        mutable std::condition_variable _cv;
+        std::string _value;
+        bool _isExpected = false;
+    };
+
+    const std::shared_ptr<StreamId> _streamId;
+
+    // Playlist keeps a file storage's media playlist, rewriting it whenever it changes.
+    class Playlist {
+    public:
+        Playlist(Logger logger, FileStorage* storage, std::string path, HLSMediaPlaylist::Configuration configuration);
+
+        // uriForPath returns the URI of the file at the given storage path, relative to the playlist.
+        std::string uriForPath(const std::string& path) const;
+
+        // update invokes f with the playlist and writes it out if it changed.
+        void update(const std::function<void(HLSMediaPlaylist*)>& f);
+
+    private:
+        const Logger _logger;
+        FileStorage* const _storage;
+        const std::string _path;
+        std::mutex _mutex;
+        HLSMediaPlaylist _playlist;
+        std::string _rendered;
+    };
+
+    // One per file storage, if there are playlists.
+    std::vector<std::shared_ptr<Playlist>> _playlists;
+
     class Segment : public SegmentStorage::Segment {
     public:
-        Segment(const Logger& logger, const Configuration& configuration, const std::string& path, int64_t segmentNumber);
+        // If initSegment is given, replicas aren't listed or registered until the init segment's
+        // corresponding replicas are complete, and they're registered with its URL. If
+        // segmentNumber is negative, the segment is an init segment and its replicas aren't listed
+        // or registered at all. If partNumber is non-negative, the segment is a part of segment
+        // segmentNumber, and its replicas are only listed in the playlists. Replicas are posted for
+        // streamId, which is only needed for segments.
+        Segment(const Logger& logger, const Configuration& configuration, const std::string& path, int64_t segmentNumber, int partNumber = -1, const std::shared_ptr<Segment>& initSegment = nullptr, const std::vector<std::shared_ptr<Playlist>>& playlists = {}, std::shared_ptr<StreamId> streamId = nullptr);
         virtual ~Segment();
 
         virtual bool write(const void* data, size_t len) override;
@@ -43,12 +128,20 @@ private:
         // Returns true if all files have been fully written and closed.
         bool isComplete() const;
 
+        const std::string& path() const { return _path; }
+        int64_t number() const { return _number; }
+        const std::shared_ptr<Segment>& initSegment() const { return _initSegment; }
+
     private:
         struct Replica {
             std::shared_ptr<AsyncFile> file;
+            std::string url;
             std::thread thread;
         };
 
+        const std::string _path;
+        const int64_t _number;
+        const std::shared_ptr<Segment> _initSegment;
         std::vector<Replica> _replicas;
         std::chrono::microseconds _duration{};
     };
@@ -56,4 +149,9 @@ private:
     // Segments that haven't fully completed need to be kept alive so users aren't blocked when they
     // drop their references.
     std::vector<std::shared_ptr<Segment>> _segments;
+
+    // The most recent init segment, which segments created from now on depend on.
+    std::shared_ptr<Segment> _initSegment;
+
+    void _retainSegment(std::shared_ptr<Segment> segment);
 };
@@ -0,0 +1,133 @@
+#include "segment_parallel_encoder.hpp"
+
+#include <algorithm>
+
+SegmentParallelEncoder::SegmentParallelEncoder(Logger logger, EncodedAVHandler* handler, const EncoderFactory& factory, Configuration configuration, std::function<void()> segmentCallback)
+    : _logger{std::move(logger)}, _handler{handler}, _configuration{configuration}, _segmentCallback{std::move(segmentCallback)}
+{
+    AsyncStage::Configuration asyncConfiguration;
+    // each frame takes one call, and each segment takes two more
+    asyncConfiguration.capacity = _configuration.queueCapacity + 2;
+
+    for (size_t i = 0; i < std::max<size_t>(_configuration.instances, 1); ++i) {
+        auto instance = std::make_unique<Instance>();
+        instance->encoder = factory(&instance->collector);
+        instance->async = std::make_unique<AsyncVideoHandler>(_logger.with("encoder_instance", i), instance->encoder.get(), asyncConfiguration);
+        _instances.emplace_back(std::move(instance));
+    }
+
+    std::lock_guard<std::mutex> l{_mutex};
+    _beginSegment();
+}
+
+SegmentParallelEncoder::~SegmentParallelEncoder() {
+    {
+        std::lock_guard<std::mutex> l{_mutex};
+        _endSegment();
+    }
+    // the async handlers finish everything they have queued as they're destroyed
+    _instances.clear();
+}
+
+void SegmentParallelEncoder::handleVideo(std::chrono::microseconds pts, const AVFrame* frame) {
+    std::lock_guard<std::mutex> l{_mutex};
+    _instance->async->handleVideo(pts, frame);
+}
+
+void SegmentParallelEncoder::handleEncodedAudioConfig(const void* data, size_t len) {
+    std::lock_guard<std::mutex> l{_mutex};
+    _audioConfig = EncodedPacket::Copy(data, len);
+    _segment->audioConfig = _audioConfig;
+}
+
+void SegmentParallelEncoder::handleEncodedAudio(std::chrono::microseconds pts, const void* data, size_t len) {
+    std::lock_guard<std::mutex> l{_mutex};
+    _segment->audio.push_back({pts, pts, EncodedPacket::Copy(data, len)});
+}
+
+void SegmentParallelEncoder::flush() {
+    std::lock_guard<std::mutex> l{_mutex};
+    _endSegment();
+    _beginSegment();
+}
+
+void SegmentParallelEncoder::_beginSegment() {
+    _segment = std::make_shared<Segment>();
+    _segment->audioConfig = _audioConfig;
+    {
+        std::lock_guard<std::mutex> l{_deliveryMutex};
+        _segments.emplace_back(_segment);
+    }
+
+    _instance = _instances[_nextInstance].get();
+    _nextInstance = (_nextInstance + 1) % _instances.size();
+
+    auto collector = &_instance->collector;
+    _instance->async->post([collector, segment = _segment] {
+        collector->segment = segment;
+        segment->videoConfig = collector->videoConfig;
+    });
+}
+
+void SegmentParallelEncoder::_endSegment() {
+    auto instance = _instance;
+    _instance->async->post([this, instance, segment = _segment] {
+        // the encoder drains and closes, so the instance's next segment begins with an idr
+        instance->encoder->flush();
+        instance->collector.segment = nullptr;
+        {
+            std::lock_guard<std::mutex> l{_deliveryMutex};
+            segment->isComplete = true;
+        }
+        _deliver();
+    });
+    _segment = nullptr;
+    _instance = nullptr;
+}
+
+void SegmentParallelEncoder::_deliver() {
+    std::lock_guard<std::mutex> l{_deliveryMutex};
+
+    while (!_segments.empty() && _segments.front()->isComplete) {
+        auto segment = std::move(_segments.front());
+        _segments.pop_front();
+
+        // without video, there's no idr to begin a new segment with, so the audio is handed off
+        // without one and carries on the previous segment
+        auto hasVideo = !segment->video.empty();
+        if (hasVideo && _segmentCallback) {
+            _segmentCallback();
+        }
+        if (!segment->audioConfig.empty()) {
+            _handler->handleEncodedAudioConfigPacket(segment->audioConfig);
+        }
+        if (!segment->videoConfig.empty()) {
+            _handler->handleEncodedVideoConfigPacket(segment->videoConfig);
+        }
+
+        // the audio and video are interleaved the way they would have been without the delay
+        auto audio = segment->audio.begin();
+        for (auto& video : segment->video) {
+            for (; audio != segment->audio.end() && audio->pts < video.dts; ++audio) {
+                _handler->handleEncodedAudioPacket(audio->pts, audio->packet);
+            }
+            _handler->handleEncodedVideoPacket(video.pts, video.dts, video.packet);
+        }
+        for (; audio != segment->audio.end(); ++audio) {
+            _handler->handleEncodedAudioPacket(audio->pts, audio->packet);
+        }
+    }
+}
+
+void SegmentParallelEncoder::Collector::handleEncodedVideoConfig(const void* data, size_t len) {
+    videoConfig = EncodedPacket::Copy(data, len);
+    if (segment) {
+        segment->videoConfig = videoConfig;
+    }
+}
+
+void SegmentParallelEncoder::Collector::handleEncodedVideo(std::chrono::microseconds pts, std::chrono::microseconds dts, const void* data, size_t len) {
+    if (segment) {
+        segment->video.push_back({pts, dts, EncodedPacket::Copy(data, len)});
+    }
+}
@@ -0,0 +1,123 @@
+#pragma once
+
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "async_handler.hpp"
+#include "av_handler.hpp"
+#include "encoded_av_handler.hpp"
+#include "logger.hpp"
+#include "video_encoder.hpp"
+
+// SegmentParallelEncoder encodes consecutive segments on a round-robin pool of encoder instances,
+// so a rendition whose encoder can't keep up with realtime on its own can still be encoded live.
+// Each segment is encoded start to finish by one instance on that instance's own thread, beginning
+// with an IDR, and the encoded segments are handed off in order.
+//
+// Audio is held back along with its segment's video so that it's still packaged with it. The
+// handler therefore receives everything a segment or more late: roughly the time it takes one
+// instance to encode a segment. If a segment ends up without any video, its audio is still handed
+// off in order, but without invoking the segment callback.
+//
+// Video, audio, and flush may come from different threads. If the current instance has too many
+// frames queued, all of them block until it catches up.
+class SegmentParallelEncoder : public VideoHandler, public EncodedAudioHandler {
+public:
+    struct Configuration {
+        // The number of encoder instances, which is the number of segments that can be encoded at
+        // once.
+        size_t instances = 2;
+
+        // The number of frames that can be queued for each instance before handleVideo blocks.
+        // Each queued frame holds on to its buffer, so this bounds the memory used.
+        size_t queueCapacity = 512;
+    };
+
+    // EncoderFactory creates an encoder instance that outputs to the given handler. The encoders
+    // must drain and close on flush, so VideoEncoderConfiguration::forceIDROnFlush must be false.
+    using EncoderFactory = std::function<std::unique_ptr<VideoEncoder>(EncodedVideoHandler* handler)>;
+
+    // segmentCallback is invoked before each segment's output is handed to handler. It may want
+    // to, for example, invoke a Packager's beginNewSegment method.
+    SegmentParallelEncoder(Logger logger, EncodedAVHandler* handler, const EncoderFactory& factory, Configuration configuration, std::function<void()> segmentCallback = {});
+    SegmentParallelEncoder(const SegmentParallelEncoder& other) = delete;
+    SegmentParallelEncoder& operator=(const SegmentParallelEncoder& other) = delete;
+
+    // Everything still being encoded is finished and handed off before the destructor returns.
+    virtual ~SegmentParallelEncoder();
+
+    virtual void handleVideo(std::chrono::microseconds pts, const AVFrame* frame) override;
+
+    virtual void handleEncodedAudioConfig(const void* data, size_t len) override;
+    virtual void handleEncodedAudio(std::chrono::microseconds pts, const void* data, size_t len) override;
+
+    // flush ends the current segment. Its instance finishes encoding it in the background, and the
+    // next segment goes to the next instance.
+    void flush();
+
+private:
+    const Logger _logger;
+    EncodedAVHandler* const _handler;
+    const Configuration _configuration;
+    std::function<void()> _segmentCallback;
+
+    struct Packet {
+        std::chrono::microseconds pts;
+        std::chrono::microseconds dts;
+        EncodedPacket packet;
+    };
+
+    struct Segment {
+        EncodedPacket audioConfig;
+        EncodedPacket videoConfig;
+        std::vector<Packet> audio;
+        std::vector<Packet> video;
+        bool isComplete = false;
+    };
+
+    // Collector gathers an instance's output into whichever segment it's encoding. It's only
+    // used from the instance's thread.
+    struct Collector : EncodedVideoHandler {
+        virtual ~Collector() {}
+
+        virtual void handleEncodedVideoConfig(const void* data, size_t len) override;
+        virtual void handleEncodedVideo(std::chrono::microseconds pts, std::chrono::microseconds dts, const void* data, size_t len) override;
+
+        // The instance's most recent config. Encoders only output it when they're opened, so it's
+        // given to every segment the instance encodes.
+        EncodedPacket videoConfig;
+        std::shared_ptr<Segment> segment;
+    };
+
+    struct Instance {
+        Collector collector;
+        std::unique_ptr<VideoEncoder> encoder;
+        // This is destroyed first, so the encoder outlives anything it still has queued.
+        std::unique_ptr<AsyncVideoHandler> async;
+    };
+
+    std::vector<std::unique_ptr<Instance>> _instances;
+
+    // Guards everything about the segment currently being fed.
+    std::mutex _mutex;
+    EncodedPacket _audioConfig;
+    std::shared_ptr<Segment> _segment;
+    size_t _nextInstance = 0;
+    Instance* _instance = nullptr;
+
+    // Segments that haven't been handed off yet, in order.
+    std::mutex _deliveryMutex;
+    std::deque<std::shared_ptr<Segment>> _segments;
+
+    // _beginSegment assigns a new segment to the next instance. _mutex must be held.
+    void _beginSegment();
+
+    // _endSegment has the current segment's instance finish it. _mutex must be held.
+    void _endSegment();
+
+    // _deliver hands off every complete segment at the front of the queue.
+    void _deliver();
+};
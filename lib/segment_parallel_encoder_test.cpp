@@ -0,0 +1,162 @@
+#include <gtest/gtest.h>
+
+#include <cstring>
+#include <vector>
+
+#include "frame_descriptor.hpp"
+#include "logger_test.hpp"
+#include "mpeg4.hpp"
+#include "segment_parallel_encoder.hpp"
+
+namespace {
+
+struct RecordingHandler : EncodedAVHandler {
+    virtual ~RecordingHandler() {}
+
+    virtual void handleEncodedAudio(std::chrono::microseconds pts, const void* data, size_t len) override {
+        events.emplace_back('a');
+        audioPTS.emplace_back(pts);
+    }
+
+    virtual void handleEncodedVideoConfig(const void* data, size_t len) override {
+        config = std::make_unique<AVCDecoderConfigurationRecord>();
+        ASSERT_TRUE(config->decode(data, len));
+    }
+
+    virtual void handleEncodedVideo(std::chrono::microseconds pts, std::chrono::microseconds dts, const void* data, size_t len) override {
+        ASSERT_TRUE(config);
+        FrameDescriptor descriptor;
+        ASSERT_TRUE(descriptor.decode(data, len, config->lengthSizeMinusOne + 1));
+        events.emplace_back(descriptor.isKeyframe ? 'K' : 'v');
+        videoPTS.emplace_back(pts);
+    }
+
+    std::unique_ptr<AVCDecoderConfigurationRecord> config;
+    std::vector<char> events;
+    std::vector<std::chrono::microseconds> audioPTS;
+    std::vector<std::chrono::microseconds> videoPTS;
+};
+
+} // anonymous namespace
+
+TEST(SegmentParallelEncoder, encoding) {
+    TestLogDestination logDestination;
+
+    RecordingHandler handler;
+    size_t segmentCount = 0;
+    {
+        VideoEncoderConfiguration encoderConfiguration;
+        encoderConfiguration.codec = VideoCodec::x264;
+        encoderConfiguration.width = 64;
+        encoderConfiguration.height = 64;
+        encoderConfiguration.x264.h264Preset = "ultrafast";
+
+        SegmentParallelEncoder::Configuration configuration;
+        configuration.instances = 2;
+        SegmentParallelEncoder encoder{&logDestination, &handler, [&](EncodedVideoHandler* output) {
+            return std::make_unique<H264VideoEncoder>(&logDestination, output, encoderConfiguration);
+        }, configuration, [&] {
+            // each segment's output is handed off in its entirety
+            EXPECT_TRUE(handler.events.empty() || handler.events.size() == segmentCount * 40);
+            ++segmentCount;
+        }};
+
+        auto frame = av_frame_alloc();
+        frame->format = AV_PIX_FMT_YUV420P;
+        frame->width = 64;
+        frame->height = 64;
+        ASSERT_GE(av_frame_get_buffer(frame, 32), 0);
+
+        const uint8_t audio[] = {0x21, 0x00};
+        for (int i = 0; i < 150; ++i) {
+            if (i > 0 && i % 30 == 0) {
+                encoder.flush();
+            }
+            for (int p = 0; p < 3; ++p) {
+                memset(frame->data[p], i, frame->linesize[p] * (p ? 32 : 64));
+            }
+            encoder.handleVideo(std::chrono::milliseconds(i * 33), frame);
+            if (i % 3 == 0) {
+                encoder.handleEncodedAudio(std::chrono::milliseconds(i * 33), audio, sizeof(audio));
+            }
+        }
+        av_frame_free(&frame);
+    }
+
+    EXPECT_EQ(5, segmentCount);
+    ASSERT_EQ(150, handler.videoPTS.size());
+    ASSERT_EQ(50, handler.audioPTS.size());
+    for (size_t i = 1; i < handler.audioPTS.size(); ++i) {
+        EXPECT_LT(handler.audioPTS[i - 1], handler.audioPTS[i]);
+    }
+
+    // every segment begins with an idr, no matter which instance encoded it
+    for (size_t i = 0; i < handler.events.size(); ++i) {
+        auto isSegmentStart = i % 40 == 0;
+        EXPECT_EQ(isSegmentStart, handler.events[i] == 'K') << i;
+    }
+
+    // segments are handed off in order
+    for (size_t segment = 1; segment < 5; ++segment) {
+        EXPECT_LT(handler.videoPTS[segment * 30 - 1], handler.videoPTS[segment * 30]);
+    }
+}
+
+TEST(SegmentParallelEncoder, segmentWithoutVideo) {
+    TestLogDestination logDestination;
+
+    RecordingHandler handler;
+    std::vector<size_t> segmentStarts;
+    {
+        VideoEncoderConfiguration encoderConfiguration;
+        encoderConfiguration.codec = VideoCodec::x264;
+        encoderConfiguration.width = 64;
+        encoderConfiguration.height = 64;
+        encoderConfiguration.x264.h264Preset = "ultrafast";
+
+        SegmentParallelEncoder::Configuration configuration;
+        configuration.instances = 2;
+        SegmentParallelEncoder encoder{&logDestination, &handler, [&](EncodedVideoHandler* output) {
+            return std::make_unique<H264VideoEncoder>(&logDestination, output, encoderConfiguration);
+        }, configuration, [&] {
+            segmentStarts.emplace_back(handler.events.size());
+        }};
+
+        auto frame = av_frame_alloc();
+        frame->format = AV_PIX_FMT_YUV420P;
+        frame->width = 64;
+        frame->height = 64;
+        ASSERT_GE(av_frame_get_buffer(frame, 32), 0);
+
+        // the second segment only gets audio
+        const uint8_t audio[] = {0x21, 0x00};
+        for (int i = 0; i < 90; ++i) {
+            if (i > 0 && i % 30 == 0) {
+                encoder.flush();
+            }
+            if (i < 30 || i >= 60) {
+                for (int p = 0; p < 3; ++p) {
+                    memset(frame->data[p], i, frame->linesize[p] * (p ? 32 : 64));
+                }
+                encoder.handleVideo(std::chrono::milliseconds(i * 33), frame);
+            }
+            if (i % 3 == 0) {
+                encoder.handleEncodedAudio(std::chrono::milliseconds(i * 33), audio, sizeof(audio));
+            }
+        }
+        av_frame_free(&frame);
+    }
+
+    ASSERT_EQ(60, handler.videoPTS.size());
+    ASSERT_EQ(30, handler.audioPTS.size());
+    for (size_t i = 1; i < handler.audioPTS.size(); ++i) {
+        EXPECT_LT(handler.audioPTS[i - 1], handler.audioPTS[i]);
+    }
+
+    // the audio without video is handed off between its neighbors, but doesn't begin a segment
+    EXPECT_EQ(std::vector<size_t>({0, 50}), segmentStarts);
+    for (size_t i = 40; i < 50; ++i) {
+        EXPECT_EQ('a', handler.events[i]) << i;
+    }
+    EXPECT_EQ('K', handler.events[50]);
+}
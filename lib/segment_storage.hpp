@@ -1,5 +1,6 @@
 #pragma once
 
+#include <chrono>
 #include <memory>
 #include <string>
 
@@ -17,9 +18,26 @@ struct SegmentStorage {
         virtual bool close(std::chrono::microseconds duration) = 0;
 
         SegmentReplicaMetaData metadata;
+
+        // The pts of the newest video frame in the segment, if known. This relates the segment
+        // back to the frames in it for latency tracing.
+        std::chrono::microseconds maxVideoPTS = std::chrono::microseconds::min();
+
+        // For parts, whether the part begins with a random access point.
+        bool isIndependent = false;
     };
 
 
     // createSegment creates a segment with the given extension (such as "ts").
     virtual std::shared_ptr<Segment> createSegment(const std::string& extension) = 0;
+
+    // createInitSegment creates an init segment (such as "mp4") that the segments created after it
+    // depend on. Init segments aren't numbered or registered like other segments.
+    virtual std::shared_ptr<Segment> createInitSegment(const std::string& extension) { return createSegment(extension); }
+
+    // createPart creates a part of the given segment, such as an LL-HLS part. Parts hold consecutive
+    // ranges of their segment's data and are written while the segment is still open, so clients
+    // can get at it before the segment completes. They're numbered from zero within their segment.
+    // This returns nullptr if the storage doesn't support parts.
+    virtual std::shared_ptr<Segment> createPart(Segment* segment, int partNumber, const std::string& extension) { return nullptr; }
 };
@@ -1,76 +1,169 @@
 #include "segmenter.hpp"
 
-#include <h26x/h264.hpp>
+#include <algorithm>
+
+void KeyframeIntervalEstimator::addKeyframe(std::chrono::microseconds pts) {
+    auto last = _lastKeyframePTS;
+    _lastKeyframePTS = pts;
+    if (last == std::chrono::microseconds::min() || pts <= last) {
+        return;
+    }
+
+    // a moving average keeps the odd scene cut from throwing the estimate off too much
+    auto interval = pts - last;
+    if (_estimate.count() == 0) {
+        _estimate = interval;
+    } else {
+        _estimate += (interval - _estimate) / 4;
+    }
+}
+
+Segmenter::Stats Segmenter::stats() {
+    std::lock_guard<std::mutex> l{_mutex};
+    auto stats = _stats;
+    stats.keyframeInterval = _keyframeInterval.estimate();
+    return stats;
+}
+
+void Segmenter::handleEncodedVideoDiscontinuity() {
+    {
+        std::lock_guard<std::mutex> l{_mutex};
+        _keyframeInterval.reset();
+    }
+    _handler->handleEncodedVideoDiscontinuity();
+}
 
 void Segmenter::handleEncodedAudioConfig(const void* data, size_t len) {
+    handleEncodedAudioConfigPacket(EncodedPacket::Borrow(data, len));
+}
+
+void Segmenter::handleEncodedAudio(std::chrono::microseconds pts, const void* data, size_t len) {
+    handleEncodedAudioPacket(pts, EncodedPacket::Borrow(data, len));
+}
+
+void Segmenter::handleEncodedVideoConfig(const void* data, size_t len) {
+    handleEncodedVideoConfigPacket(EncodedPacket::Borrow(data, len));
+}
+
+void Segmenter::handleEncodedVideo(std::chrono::microseconds pts, std::chrono::microseconds dts, const void* data, size_t len) {
+    handleEncodedVideoPacket(pts, dts, EncodedPacket::Borrow(data, len));
+}
+
+void Segmenter::handleEncodedAudioConfigPacket(const EncodedPacket& packet) {
     std::lock_guard<std::mutex> l{_mutex};
 
-    _audioConfig.clear();
-    _audioConfig.insert(_audioConfig.end(), reinterpret_cast<const uint8_t*>(data), reinterpret_cast<const uint8_t*>(data) + len);
+    _audioConfig = packet.retained();
 
     if (_didStartFirstSegment) {
-        _handler->handleEncodedAudioConfig(data, len);
+        _handler->handleEncodedAudioConfigPacket(packet);
     }
 }
 
-void Segmenter::handleEncodedAudio(std::chrono::microseconds pts, const void* data, size_t len) {
+void Segmenter::handleEncodedAudioPacket(std::chrono::microseconds pts, const EncodedPacket& packet) {
     std::lock_guard<std::mutex> l{_mutex};
 
     if (_didStartFirstSegment) {
-        _handler->handleEncodedAudio(pts, data, len);
+        _handler->handleEncodedAudioPacket(pts, packet);
     }
 }
 
-void Segmenter::handleEncodedVideoConfig(const void* data, size_t len) {
+void Segmenter::handleEncodedVideoConfigPacket(const EncodedPacket& packet) {
     std::lock_guard<std::mutex> l{_mutex};
 
-    _videoConfig.clear();
-    _videoConfig.insert(_videoConfig.end(), reinterpret_cast<const uint8_t*>(data), reinterpret_cast<const uint8_t*>(data) + len);
+    _videoConfig = packet.retained();
 
     auto config = std::make_unique<AVCDecoderConfigurationRecord>();
-    if (!config->decode(data, len)) {
+    if (!config->decode(packet.data(), packet.size())) {
         _logger.error("unable to decode video config");
     } else {
         _videoConfigRecord = std::move(config);
     }
 
     if (_didStartFirstSegment) {
-        _handler->handleEncodedVideoConfig(data, len);
+        _handler->handleEncodedVideoConfigPacket(packet);
     }
 }
 
-void Segmenter::handleEncodedVideo(std::chrono::microseconds pts, std::chrono::microseconds dts, const void* data, size_t len) {
+void Segmenter::handleEncodedVideoPacket(std::chrono::microseconds pts, std::chrono::microseconds dts, const EncodedPacket& packet) {
     std::lock_guard<std::mutex> l{_mutex};
 
     if (!_videoConfigRecord) {
         return;
     }
 
-    auto isIDR = false;
-    if (!h264::IterateAVCC(data, len, _videoConfigRecord->lengthSizeMinusOne + 1, [&](const void* data, size_t len) {
-        if (len < 1) {
-            return;
-        }
-        auto naluType = *reinterpret_cast<const uint8_t*>(data) & 0x1f;
-        isIDR |= (naluType == h264::NALUnitType::IDRSlice);
-    })) {
+    if (_latencyTracer) {
+        _latencyTracer->stamp(LatencyTracer::Stage::Segmenter, pts);
+    }
+
+    FrameDescriptor storage;
+    auto descriptor = DescribeFrame(packet, _videoConfigRecord->lengthSizeMinusOne + 1, &storage);
+    if (!descriptor) {
         _logger.error("unable to iterate avcc");
         return;
     }
+    auto isRandomAccessPoint = descriptor->isKeyframe || (_segmentsAtRecoveryPoints && descriptor->isRecoveryPoint);
+
+    if (isRandomAccessPoint) {
+        _keyframeInterval.addKeyframe(pts);
+    }
 
-    if (isIDR && _currentSegmentPTS + std::chrono::seconds(5) < pts) {
+    if (isRandomAccessPoint && _isBoundary(pts)) {
+        if (_didStartFirstSegment && pts > _currentSegmentPTS) {
+            auto duration = pts - _currentSegmentPTS;
+            _stats.lastSegmentDuration = duration;
+            _stats.minSegmentDuration = _stats.segments ? std::min(_stats.minSegmentDuration, duration) : duration;
+            _stats.maxSegmentDuration = std::max(_stats.maxSegmentDuration, duration);
+            _stats.totalSegmentDuration += duration;
+            ++_stats.segments;
+            _logger.with(
+                "segment_duration_ms", std::chrono::duration_cast<std::chrono::milliseconds>(duration).count(),
+                "target_segment_duration_ms", std::chrono::duration_cast<std::chrono::milliseconds>(_targetSegmentDuration).count(),
+                "keyframe_interval_ms", std::chrono::duration_cast<std::chrono::milliseconds>(_keyframeInterval.estimate()).count()
+            ).info("segment boundary");
+            if (_maxSegmentDuration.count() > 0 && duration > _maxSegmentDuration) {
+                _logger.with(
+                    "segment_duration_ms", std::chrono::duration_cast<std::chrono::milliseconds>(duration).count(),
+                    "max_segment_duration_ms", std::chrono::duration_cast<std::chrono::milliseconds>(_maxSegmentDuration).count()
+                ).warn("source random access points are too far apart for the max segment duration");
+            }
+        }
         _didStartFirstSegment = true;
         _currentSegmentPTS = pts;
         if (_boundaryCallback) {
             _boundaryCallback();
         }
         if (!_audioConfig.empty()) {
-            _handler->handleEncodedAudioConfig(_audioConfig.data(), _audioConfig.size());
+            _handler->handleEncodedAudioConfigPacket(_audioConfig);
         }
-        _handler->handleEncodedVideoConfig(_videoConfig.data(), _videoConfig.size());
+        _handler->handleEncodedVideoConfigPacket(_videoConfig);
     }
 
     if (_didStartFirstSegment) {
-        _handler->handleEncodedVideo(pts, dts, data, len);
+        _handler->handleEncodedVideoPacket(pts, dts, packet);
+    }
+}
+
+bool Segmenter::_isBoundary(std::chrono::microseconds pts) const {
+    if (_currentSegmentPTS == std::chrono::microseconds::min()) {
+        return true;
+    }
+
+    auto elapsed = pts - _currentSegmentPTS;
+    if (elapsed >= _targetSegmentDuration) {
+        return true;
+    }
+
+    // end the segment early if the next random access point is expected to be further past the
+    // target than this one is short of it. segments are never ended early by more than half the
+    // target though, so an unexpected keyframe can't make for a tiny segment
+    auto interval = _keyframeInterval.estimate();
+    if (interval.count() <= 0 || elapsed < _targetSegmentDuration / 2) {
+        return false;
+    }
+
+    // waiting for the next random access point would take the segment past the max
+    if (_maxSegmentDuration.count() > 0 && elapsed + interval > _maxSegmentDuration) {
+        return true;
     }
+    return _targetSegmentDuration - elapsed <= elapsed + interval - _targetSegmentDuration;
 }
@@ -1,17 +1,53 @@
 #pragma once
 
+#include <chrono>
 #include <functional>
 #include <memory>
 #include <mutex>
-#include <vector>
 
 #include "encoded_av_handler.hpp"
+#include "latency_tracer.hpp"
 #include "logger.hpp"
 #include "mpeg4.hpp"
 
+// KeyframeIntervalEstimator learns a source's keyframe cadence from the intervals between its
+// random access points.
+class KeyframeIntervalEstimator {
+public:
+    // addKeyframe should be invoked with the pts of each random access point.
+    void addKeyframe(std::chrono::microseconds pts);
+
+    // reset forgets the previous keyframe, such as after a discontinuity. The estimate is kept.
+    void reset() { _lastKeyframePTS = std::chrono::microseconds::min(); }
+
+    // estimate returns the estimated interval, or zero if there isn't one yet.
+    std::chrono::microseconds estimate() const { return _estimate; }
+
+private:
+    std::chrono::microseconds _lastKeyframePTS = std::chrono::microseconds::min();
+    std::chrono::microseconds _estimate{0};
+};
+
 // Segmenter is responsible for determining segment boundaries.
+//
+// Boundaries are placed at the random access point closest to the target duration rather than the
+// first one after it. Since the segmenter can't see ahead, it uses the estimated keyframe interval to
+// guess where the next random access point will be, and ends the segment early if that's further
+// from the target. It also ends the segment early if the next random access point is expected to be
+// past the max segment duration.
 class Segmenter : public EncodedAVHandler {
 public:
+    static constexpr std::chrono::microseconds DefaultTargetSegmentDuration = std::chrono::seconds(5);
+
+    struct Stats {
+        size_t segments = 0;
+        std::chrono::microseconds lastSegmentDuration{0};
+        std::chrono::microseconds minSegmentDuration{0};
+        std::chrono::microseconds maxSegmentDuration{0};
+        std::chrono::microseconds totalSegmentDuration{0};
+        std::chrono::microseconds keyframeInterval{0};
+    };
+
     // Audio and video is synchronously forwarded to the given handler, and boundaryCallback is
     // invoked whenever a segment boundary should be made. boundaryCallback may want to, for
     // example, flush coders and invoke a Packager instance's beginNewSegment method.
@@ -19,25 +55,58 @@ public:
         : _logger{std::move(logger)}, _handler{handler}, _boundaryCallback{std::move(boundaryCallback)} {}
     virtual ~Segmenter() {}
 
+    // If set, video frames are stamped with LatencyTracer::Stage::Segmenter as they arrive.
+    void setLatencyTracer(LatencyTracer* tracer) { _latencyTracer = tracer; }
+
+    // If set, segments can begin at recovery points as well as at IDRs. This is for video encoded
+    // with periodic intra refresh.
+    void setSegmentsAtRecoveryPoints(bool segmentsAtRecoveryPoints) { _segmentsAtRecoveryPoints = segmentsAtRecoveryPoints; }
+
+    void setTargetSegmentDuration(std::chrono::microseconds duration) { _targetSegmentDuration = duration; }
+
+    // If non-zero, segments are kept to this duration as far as the source's random access points
+    // allow. Playlists can then advertise it as the target duration. Segments that exceed it anyway
+    // are logged.
+    void setMaxSegmentDuration(std::chrono::microseconds duration) { _maxSegmentDuration = duration; }
+
+    // stats returns the durations of the segments so far, which are also logged at each boundary.
+    // The durations are measured between boundaries, so the segment in progress isn't included.
+    // It must not be invoked from the boundary callback.
+    Stats stats();
+
     virtual void handleEncodedAudioConfig(const void* data, size_t len) override;
     virtual void handleEncodedAudio(std::chrono::microseconds pts, const void* data, size_t len) override;
     virtual void handleEncodedVideoConfig(const void* data, size_t len) override;
     virtual void handleEncodedVideo(std::chrono::microseconds pts, std::chrono::microseconds dts, const void* data, size_t len) override;
 
-    virtual void handleEncodedVideoDiscontinuity() override {
-        _handler->handleEncodedVideoDiscontinuity();
-    }
+    virtual void handleEncodedVideoDiscontinuity() override;
+
+    virtual void handleEncodedAudioConfigPacket(const EncodedPacket& packet) override;
+    virtual void handleEncodedAudioPacket(std::chrono::microseconds pts, const EncodedPacket& packet) override;
+    virtual void handleEncodedVideoConfigPacket(const EncodedPacket& packet) override;
+    virtual void handleEncodedVideoPacket(std::chrono::microseconds pts, std::chrono::microseconds dts, const EncodedPacket& packet) override;
 
 private:
     const Logger _logger;
     EncodedAVHandler* const _handler;
     std::function<void()> _boundaryCallback;
+    LatencyTracer* _latencyTracer = nullptr;
+    bool _segmentsAtRecoveryPoints = false;
+    std::chrono::microseconds _targetSegmentDuration = DefaultTargetSegmentDuration;
+    std::chrono::microseconds _maxSegmentDuration{0};
     std::mutex _mutex;
 
     bool _didStartFirstSegment = false;
     std::chrono::microseconds _currentSegmentPTS{std::chrono::microseconds::min()};
 
-    std::vector<uint8_t> _audioConfig;
-    std::vector<uint8_t> _videoConfig;
+    KeyframeIntervalEstimator _keyframeInterval;
+    Stats _stats;
+
+    // _isBoundary returns true if a segment should begin at the random access point with the
+    // given pts.
+    bool _isBoundary(std::chrono::microseconds pts) const;
+
+    EncodedPacket _audioConfig;
+    EncodedPacket _videoConfig;
     std::unique_ptr<AVCDecoderConfigurationRecord> _videoConfigRecord;
 };
@@ -0,0 +1,133 @@
+#include <gtest/gtest.h>
+
+#include <vector>
+
+#include "encoded_av_handler_test.hpp"
+#include "logger_test.hpp"
+#include "segmenter.hpp"
+
+namespace {
+
+// SegmentBoundaries feeds the segmenter a 30 fps video stream with keyframes at the given frames,
+// and returns the pts at which it made boundaries.
+std::vector<std::chrono::milliseconds> SegmentBoundaries(std::chrono::milliseconds targetDuration, const std::vector<int>& keyframeFrames, int frames, std::chrono::milliseconds maxDuration = {}) {
+    TestLogDestination logDestination;
+    TestEncodedAVHandler handler;
+
+    std::vector<std::chrono::milliseconds> boundaries;
+    std::chrono::microseconds pts{0};
+    Segmenter segmenter{&logDestination, &handler, [&] {
+        boundaries.emplace_back(std::chrono::duration_cast<std::chrono::milliseconds>(pts));
+    }};
+    segmenter.setTargetSegmentDuration(targetDuration);
+    segmenter.setMaxSegmentDuration(maxDuration);
+
+    AVCDecoderConfigurationRecord config;
+    config.sequenceParameterSets.push_back({0x67, 0x64, 0x00, 0x1f});
+    config.pictureParameterSets.push_back({0x68, 0xeb});
+    auto encodedConfig = config.encode();
+    segmenter.handleEncodedVideoConfig(encodedConfig.data(), encodedConfig.size());
+
+    const uint8_t keyframe[] = {0x00, 0x00, 0x00, 0x02, 0x65, 0x88};
+    const uint8_t frame[] = {0x00, 0x00, 0x00, 0x02, 0x41, 0x9a};
+    size_t nextKeyframe = 0;
+    for (int i = 0; i < frames; ++i) {
+        pts = std::chrono::microseconds(i * 100000 / 3);
+        if (nextKeyframe < keyframeFrames.size() && keyframeFrames[nextKeyframe] == i) {
+            ++nextKeyframe;
+            segmenter.handleEncodedVideo(pts, pts, keyframe, sizeof(keyframe));
+        } else {
+            segmenter.handleEncodedVideo(pts, pts, frame, sizeof(frame));
+        }
+    }
+
+    auto stats = segmenter.stats();
+    EXPECT_EQ(boundaries.size() - 1, stats.segments);
+    return boundaries;
+}
+
+} // anonymous namespace
+
+TEST(KeyframeIntervalEstimator, estimate) {
+    KeyframeIntervalEstimator estimator;
+    EXPECT_EQ(0, estimator.estimate().count());
+
+    estimator.addKeyframe(std::chrono::seconds(2));
+    EXPECT_EQ(0, estimator.estimate().count());
+
+    for (int i = 2; i < 10; ++i) {
+        estimator.addKeyframe(std::chrono::seconds(i * 2));
+    }
+    EXPECT_EQ(2000000, estimator.estimate().count());
+
+    // a scene cut shouldn't throw it off much
+    estimator.addKeyframe(std::chrono::milliseconds(18500));
+    estimator.addKeyframe(std::chrono::seconds(20));
+    EXPECT_NEAR(2000000, estimator.estimate().count(), 500000);
+
+    estimator.reset();
+    estimator.addKeyframe(std::chrono::seconds(100));
+    EXPECT_NEAR(2000000, estimator.estimate().count(), 500000);
+}
+
+TEST(Segmenter, closestBoundary) {
+    // with a keyframe every 4 seconds, waiting for the first one past 5 seconds would make 8 second
+    // segments
+    auto boundaries = SegmentBoundaries(std::chrono::seconds(5), {0, 120, 240, 360, 480}, 600);
+    EXPECT_EQ((std::vector<std::chrono::milliseconds>{
+        std::chrono::seconds(0),
+        std::chrono::seconds(4),
+        std::chrono::seconds(8),
+        std::chrono::seconds(12),
+        std::chrono::seconds(16),
+    }), boundaries);
+
+    // with a keyframe every 2 seconds, 4 and 6 are equally close to 5
+    boundaries = SegmentBoundaries(std::chrono::seconds(5), {0, 60, 120, 180, 240, 300, 360}, 400);
+    EXPECT_EQ((std::vector<std::chrono::milliseconds>{
+        std::chrono::seconds(0),
+        std::chrono::seconds(4),
+        std::chrono::seconds(8),
+        std::chrono::seconds(12),
+    }), boundaries);
+
+    // a scene cut shortly after a boundary shouldn't make a tiny segment
+    boundaries = SegmentBoundaries(std::chrono::seconds(2), {0, 180, 186, 360}, 400);
+    EXPECT_EQ((std::vector<std::chrono::milliseconds>{
+        std::chrono::seconds(0),
+        std::chrono::seconds(6),
+        std::chrono::seconds(12),
+    }), boundaries);
+}
+
+TEST(Segmenter, targetDuration) {
+    std::vector<int> keyframes;
+    for (int i = 0; i < 600; i += 30) {
+        keyframes.emplace_back(i);
+    }
+    auto boundaries = SegmentBoundaries(std::chrono::seconds(2), keyframes, 600);
+    ASSERT_EQ(10, boundaries.size());
+    for (size_t i = 0; i < boundaries.size(); ++i) {
+        EXPECT_EQ(std::chrono::seconds(i * 2), boundaries[i]);
+    }
+}
+
+TEST(Segmenter, maxDuration) {
+    // with a keyframe every 3 seconds, 6 is closer to 5 than 3 is, but it's past the max
+    std::vector<int> keyframes{0, 90, 180, 270, 360};
+    auto boundaries = SegmentBoundaries(std::chrono::seconds(5), keyframes, 400);
+    EXPECT_EQ((std::vector<std::chrono::milliseconds>{
+        std::chrono::seconds(0),
+        std::chrono::seconds(6),
+        std::chrono::seconds(12),
+    }), boundaries);
+
+    boundaries = SegmentBoundaries(std::chrono::seconds(5), keyframes, 400, std::chrono::milliseconds(5500));
+    EXPECT_EQ((std::vector<std::chrono::milliseconds>{
+        std::chrono::seconds(0),
+        std::chrono::seconds(3),
+        std::chrono::seconds(6),
+        std::chrono::seconds(9),
+        std::chrono::seconds(12),
+    }), boundaries);
+}
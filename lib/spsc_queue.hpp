@@ -0,0 +1,86 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <utility>
+
+// SPSCQueue is a fixed-capacity, lock-free ring buffer for exactly one producer thread and exactly
+// one consumer thread. The capacity is rounded up to a power of two.
+//
+// Each side keeps a cached copy of the other side's index so that the shared indices are only
+// touched when the queue looks full or empty, and the two sides' state lives on separate cache
+// lines.
+template <typename T>
+class SPSCQueue {
+public:
+    explicit SPSCQueue(size_t capacity) : _mask{_roundUp(capacity) - 1}, _slots{new T[_mask + 1]} {}
+    SPSCQueue(const SPSCQueue& other) = delete;
+    SPSCQueue& operator=(const SPSCQueue& other) = delete;
+
+    size_t capacity() const { return _mask + 1; }
+
+    // tryPush moves value into the queue. If the queue is full, it returns false and value is left
+    // untouched. This may only be invoked by the producer.
+    bool tryPush(T&& value) {
+        auto tail = _tail.load(std::memory_order_relaxed);
+        if (tail - _cachedHead > _mask) {
+            _cachedHead = _head.load(std::memory_order_acquire);
+            if (tail - _cachedHead > _mask) {
+                return false;
+            }
+        }
+        _slots[tail & _mask] = std::move(value);
+        _tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // tryPop moves the oldest value out of the queue. If the queue is empty, it returns false. This
+    // may only be invoked by the consumer.
+    bool tryPop(T* value) {
+        auto head = _head.load(std::memory_order_relaxed);
+        if (head == _cachedTail) {
+            _cachedTail = _tail.load(std::memory_order_acquire);
+            if (head == _cachedTail) {
+                return false;
+            }
+        }
+        auto& slot = _slots[head & _mask];
+        *value = std::move(slot);
+        // don't let the slot hold on to anything the value owned
+        slot = T{};
+        _head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    // size returns the number of queued values. If invoked by a thread other than the producer or
+    // consumer, the result is only a snapshot.
+    size_t size() const {
+        auto head = _head.load(std::memory_order_acquire);
+        return _tail.load(std::memory_order_acquire) - head;
+    }
+
+    bool empty() const { return size() == 0; }
+
+private:
+    static constexpr size_t CacheLineSize = 64;
+
+    static size_t _roundUp(size_t n) {
+        size_t ret = 1;
+        while (ret < n) {
+            ret <<= 1;
+        }
+        return ret;
+    }
+
+    const size_t _mask;
+    const std::unique_ptr<T[]> _slots;
+
+    // consumer state
+    alignas(CacheLineSize) std::atomic<size_t> _head{0};
+    size_t _cachedTail = 0;
+
+    // producer state
+    alignas(CacheLineSize) std::atomic<size_t> _tail{0};
+    size_t _cachedHead = 0;
+};
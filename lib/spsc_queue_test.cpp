@@ -0,0 +1,70 @@
+#include <gtest/gtest.h>
+
+#include <memory>
+#include <thread>
+
+#include "spsc_queue.hpp"
+
+TEST(SPSCQueue, pushAndPop) {
+    SPSCQueue<int> queue{3};
+    EXPECT_EQ(4, queue.capacity());
+    EXPECT_TRUE(queue.empty());
+
+    for (int i = 0; i < 4; ++i) {
+        int value = i;
+        EXPECT_TRUE(queue.tryPush(std::move(value)));
+    }
+    int value = 4;
+    EXPECT_FALSE(queue.tryPush(std::move(value)));
+    EXPECT_EQ(4, queue.size());
+
+    for (int i = 0; i < 4; ++i) {
+        ASSERT_TRUE(queue.tryPop(&value));
+        EXPECT_EQ(i, value);
+    }
+    EXPECT_FALSE(queue.tryPop(&value));
+    EXPECT_TRUE(queue.empty());
+}
+
+TEST(SPSCQueue, releasesPoppedValues) {
+    SPSCQueue<std::shared_ptr<int>> queue{2};
+    auto value = std::make_shared<int>(1);
+    auto copy = value;
+    ASSERT_TRUE(queue.tryPush(std::move(copy)));
+    EXPECT_EQ(2, value.use_count());
+
+    std::shared_ptr<int> popped;
+    ASSERT_TRUE(queue.tryPop(&popped));
+    popped.reset();
+    EXPECT_EQ(1, value.use_count());
+}
+
+TEST(SPSCQueue, threads) {
+    constexpr size_t kCount = 1000000;
+    SPSCQueue<size_t> queue{64};
+
+    std::thread producer([&] {
+        for (size_t i = 0; i < kCount;) {
+            size_t value = i;
+            if (queue.tryPush(std::move(value))) {
+                ++i;
+            } else {
+                std::this_thread::yield();
+            }
+        }
+    });
+
+    size_t expected = 0;
+    while (expected < kCount) {
+        size_t value;
+        if (queue.tryPop(&value)) {
+            ASSERT_EQ(expected, value);
+            ++expected;
+        } else {
+            std::this_thread::yield();
+        }
+    }
+
+    producer.join();
+    EXPECT_TRUE(queue.empty());
+}
@@ -1,20 +1,73 @@
 #pragma once
 
+#include <algorithm>
 #include <condition_variable>
 #include <memory>
 #include <mutex>
 #include <thread>
+#include <type_traits>
 #include <unordered_map>
 #include <utility>
 #include <functional>
 
 #include <asio.hpp>
 
+#include "event_loop.hpp"
 #include "logger.hpp"
+#include "utility.hpp"
+
+struct TCPServerOptions {
+    // The number of worker threads to multiplex event-driven connections onto. If zero, one worker
+    // is started per core. This has no effect for thread-per-connection classes.
+    size_t workerCount = 0;
+
+    // If true, connection classes that implement both interfaces are given a thread per connection
+    // instead of being multiplexed onto workers.
+    bool threadPerConnection = false;
+
+    // The number of acceptors to open. If greater than one, each acceptor is opened with
+    // SO_REUSEPORT so that the kernel balances new connections between them, and each acceptor's
+    // thread is pinned to its own cpu. Multiplexed connections accepted by acceptor i are assigned
+    // to workers i, i + acceptorCount, i + 2 * acceptorCount, etc. Worker j is pinned to cpu j (modulo
+    // the number of cpus), so the workers are spread across every core and each acceptor shares its
+    // cpu with its first worker.
+    size_t acceptorCount = 1;
+};
+
+// IsEventDrivenConnection is true for connection classes that implement the event-driven interface
+// described below.
+template <typename T, typename = void>
+struct IsEventDrivenConnection : std::false_type {};
+
+template <typename T>
+struct IsEventDrivenConnection<T, std::void_t<decltype(std::declval<T&>().handleReadable())>> : std::true_type {};
 
-// ConnectionClass should be a class with a run(int, asio::ip::tcp::endpoint) method, to be invoked
-// from a new thread, and a cancel() method to cause the run() invocation to return early. The Args
-// parameter represents the types of the arguments to be passed to new ConnectionClass instances.
+// IsThreadPerConnection is true for connection classes that implement the thread-per-connection
+// interface described below.
+template <typename T, typename = void>
+struct IsThreadPerConnection : std::false_type {};
+
+template <typename T>
+struct IsThreadPerConnection<T, std::void_t<decltype(std::declval<T&>().cancel())>> : std::true_type {};
+
+// ConnectionClass can implement one of two interfaces:
+//
+// Event-driven connection classes have begin(int, asio::ip::tcp::endpoint, EventLoop*),
+// handleReadable(), and end() methods. Their connections are multiplexed onto a fixed pool of worker
+// threads. begin is invoked once the connection is assigned to a worker, and handleReadable is
+// invoked each time the socket becomes readable. Either may return false to close the connection.
+// end is invoked exactly once when the connection is closed, and should close the descriptor. All
+// three are invoked from the connection's worker thread and must not block for long. Anything that
+// might block should be done on another thread, with its result posted back to the EventLoop given
+// to begin. Once end has been invoked, nothing should be posted to it anymore.
+//
+// Otherwise, ConnectionClass should be a class with a run(int, asio::ip::tcp::endpoint) method, to
+// be invoked from a new thread, and a cancel() method to cause the run() invocation to return
+// early. This thread-per-connection mode is kept for compatibility. Classes may implement both, in
+// which case the mode is chosen via TCPServerOptions.
+//
+// The Args parameter represents the types of the arguments to be passed to new ConnectionClass
+// instances.
 //
 // This class is based on the TCPAcceptor class in bittorrent/scraps:
 // https://github.com/bittorrent/scraps
@@ -23,44 +76,85 @@ class TCPServer {
 public:
     // Any arguments passed to the constructor will be copied and passed to each connection class
     // constructor (including the logger).
-    TCPServer(Logger logger, const Args&... args) : _logger{logger}, _args(args...), _acceptor(_service) {}
+    TCPServer(Logger logger, const Args&... args) : _logger{logger}, _args(args...) {}
     TCPServer(const TCPServer& other) = delete;
     TCPServer& operator=(const TCPServer& other) = delete;
     ~TCPServer() { _stop(); }
 
+    using Options = TCPServerOptions;
+
     // Starts the server on the specified address and port.
-    bool start(asio::ip::address address, uint16_t port) {
+    bool start(asio::ip::address address, uint16_t port, Options options = {}) {
         std::unique_lock<std::mutex> lock(_startStopMutex);
         _stop();
-        _service.reset();
         _isCancelled = false;
 
-        try {
-            _acceptor.open(address.is_v6() ? asio::ip::tcp::v6() : asio::ip::tcp::v4());
-            _acceptor.set_option(asio::ip::tcp::acceptor::reuse_address(true));
-            _acceptor.bind(asio::ip::tcp::endpoint(address, port));
-            _acceptor.listen();
-        } catch (std::exception& e) {
-            _logger.error("exception opening tcp server acceptor: {}", e.what());
-            return false;
+        auto acceptorCount = std::max<size_t>(options.acceptorCount, 1);
+        auto cpuCount = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+        auto isSharded = acceptorCount > 1;
+
+        if constexpr (IsEventDrivenConnection<ConnectionClass>::value) {
+            _isMultiplexed = !IsThreadPerConnection<ConnectionClass>::value || !options.threadPerConnection;
         }
 
-        _work = std::make_unique<asio::io_service::work>(_service);
+        if (_isMultiplexed) {
+            // every acceptor needs at least one worker
+            auto workerCount = std::max(options.workerCount ? options.workerCount : cpuCount, acceptorCount);
+            for (size_t i = 0; i < workerCount; ++i) {
+                auto worker = std::make_unique<EventLoop>(_logger.with("worker", i));
+                if (!worker->start(isSharded ? static_cast<int>(i % cpuCount) : -1)) {
+                    _logger.error("unable to start tcp server worker");
+                    _stop();
+                    return false;
+                }
+                _workers.emplace_back(std::move(worker));
+            }
+            _logger.with("workers", workerCount).info("started tcp server workers");
+        }
 
-        _serviceThread = std::thread([&] {
-            _logger.info("starting tcp server worker thread");
-            while (!_isCancelled) {
-                try {
-                    _service.run();
-                    break;
-                } catch (std::exception& e) {
-                    _logger.error("exception in tcp server worker thread: {}", e.what());
-                } catch (...) {
-                    _logger.error("unknown exception in tcp server worker thread");
+        for (size_t i = 0; i < acceptorCount; ++i) {
+            auto acceptor = std::make_unique<Acceptor>(i);
+            try {
+                acceptor->acceptor.open(address.is_v6() ? asio::ip::tcp::v6() : asio::ip::tcp::v4());
+                acceptor->acceptor.set_option(asio::ip::tcp::acceptor::reuse_address(true));
+                if (isSharded) {
+                    acceptor->acceptor.set_option(ReusePort(true));
                 }
+                acceptor->acceptor.bind(asio::ip::tcp::endpoint(address, port));
+                acceptor->acceptor.listen();
+            } catch (std::exception& e) {
+                _logger.error("exception opening tcp server acceptor: {}", e.what());
+                _stop();
+                return false;
             }
-            _logger.info("exiting tcp server worker thread");
-        });
+            _acceptors.emplace_back(std::move(acceptor));
+        }
+
+        for (auto& acceptor : _acceptors) {
+            acceptor->work = std::make_unique<asio::io_service::work>(acceptor->service);
+
+            acceptor->thread = std::thread([this, acceptor = acceptor.get()] {
+                _logger.info("starting tcp server worker thread");
+                while (!_isCancelled) {
+                    try {
+                        acceptor->service.run();
+                        break;
+                    } catch (std::exception& e) {
+                        _logger.error("exception in tcp server worker thread: {}", e.what());
+                    } catch (...) {
+                        _logger.error("unknown exception in tcp server worker thread");
+                    }
+                }
+                _logger.info("exiting tcp server worker thread");
+            });
+
+            if (isSharded && !SetThreadAffinity(acceptor->thread, static_cast<int>(acceptor->index % cpuCount))) {
+                _logger.with("acceptor", acceptor->index).warn("unable to set tcp server acceptor thread affinity");
+            }
+        }
+        if (isSharded) {
+            _logger.with("acceptors", acceptorCount).info("started sharded tcp server acceptors");
+        }
 
         _connectionCleaner = std::thread([&] {
             while (!_isCancelled) {
@@ -77,8 +171,10 @@ public:
             }
         });
 
-        auto socket = std::make_shared<asio::ip::tcp::socket>(_service);
-        _acceptor.async_accept(*socket, std::bind(ArgsHelper<sizeof...(Args)>::AcceptHandler(), this, socket, std::placeholders::_1));
+        for (auto& acceptor : _acceptors) {
+            auto socket = std::make_shared<asio::ip::tcp::socket>(acceptor->service);
+            acceptor->acceptor.async_accept(*socket, std::bind(ArgsHelper<sizeof...(Args)>::AcceptHandler(), this, acceptor.get(), socket, std::placeholders::_1));
+        }
 
         return true;
     }
@@ -114,17 +210,32 @@ private:
     Logger _logger;
     std::tuple<Args...> _args;
 
-    asio::io_service _service;
-    std::unique_ptr<asio::io_service::work> _work;
-    std::thread _serviceThread;
+    using ReusePort = asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>;
+
+    struct Acceptor {
+        explicit Acceptor(size_t index) : index{index}, acceptor{service} {}
+
+        const size_t index;
+        asio::io_service service;
+        std::unique_ptr<asio::io_service::work> work;
+        asio::ip::tcp::acceptor acceptor;
+        std::thread thread;
+        size_t nextWorker = 0;
+    };
+    std::vector<std::unique_ptr<Acceptor>> _acceptors;
 
-    asio::ip::tcp::acceptor _acceptor;
+    bool _isMultiplexed = false;
+    std::vector<std::unique_ptr<EventLoop>> _workers;
 
     struct Connection {
         ~Connection() {
-            auto connection = connectionClass.lock();
-            if (connection) {
-                connection->cancel();
+            if constexpr (IsThreadPerConnection<ConnectionClass>::value) {
+                if (connectionThread.joinable()) {
+                    auto connection = connectionClass.lock();
+                    if (connection) {
+                        connection->cancel();
+                    }
+                }
             }
 
             if (connectionThread.joinable()) {
@@ -144,7 +255,7 @@ private:
 
     template <int... S>
     struct ArgsHelper<0, S...> {
-        typedef void (TCPServer::*AcceptHandlerPointer)(std::shared_ptr<asio::ip::tcp::socket>, const asio::error_code&);
+        typedef void (TCPServer::*AcceptHandlerPointer)(Acceptor*, std::shared_ptr<asio::ip::tcp::socket>, const asio::error_code&);
         static constexpr AcceptHandlerPointer AcceptHandler() { return &TCPServer::_acceptHandler<S...>; }
     };
 
@@ -152,32 +263,43 @@ private:
         _isCancelled = true;
         _cv.notify_one();
 
-        try {
-            _acceptor.close();
-        } catch (...) {}
+        for (auto& acceptor : _acceptors) {
+            try {
+                acceptor->acceptor.close();
+            } catch (...) {}
 
-        _work.reset();
+            acceptor->work.reset();
+        }
 
-        if (_serviceThread.joinable()) {
-            _serviceThread.join();
+        for (auto& acceptor : _acceptors) {
+            if (acceptor->thread.joinable()) {
+                acceptor->thread.join();
+            }
         }
+        _acceptors.clear();
 
         if (_connectionCleaner.joinable()) {
             _cv.notify_one();
             _connectionCleaner.join();
         }
 
+        // stopping the workers ends all of their connections
+        for (auto& worker : _workers) {
+            worker->stop();
+        }
+        _workers.clear();
+
         _connections.clear();
         _completeConnections.clear();
     }
 
     template <int... ArgIndices>
-    void _acceptHandler(std::shared_ptr<asio::ip::tcp::socket> socket, const asio::error_code& error) {
+    void _acceptHandler(Acceptor* acceptor, std::shared_ptr<asio::ip::tcp::socket> socket, const asio::error_code& error) {
         if (_isCancelled || error == asio::error::operation_aborted) {
             return;
         }
-        auto nextSocket = std::make_shared<asio::ip::tcp::socket>(_service);
-        _acceptor.async_accept(*nextSocket, std::bind(&TCPServer::_acceptHandler<ArgIndices...>, this, nextSocket, std::placeholders::_1));
+        auto nextSocket = std::make_shared<asio::ip::tcp::socket>(acceptor->service);
+        acceptor->acceptor.async_accept(*nextSocket, std::bind(&TCPServer::_acceptHandler<ArgIndices...>, this, acceptor, nextSocket, std::placeholders::_1));
 
         if (error) {
             _logger.error("accept error: {}", error.message().c_str());
@@ -198,16 +320,51 @@ private:
         auto connection = std::make_shared<Connection>();
         auto connectionClass = std::make_shared<ConnectionClass>(_logger, std::get<ArgIndices>(_args)...);
         connection->connectionClass = connectionClass;
-        connection->connectionThread = std::thread([this, connectionClass, fd, remote]() {
-            connectionClass->run(fd, remote);
+
+        auto complete = [this, connectionClass = connectionClass.get()] {
             {
                 std::lock_guard<std::mutex> lock{_mutex};
-                _completeConnections.emplace_back(connectionClass.get());
+                _completeConnections.emplace_back(connectionClass);
             }
             _cv.notify_one();
-        });
+        };
+
+        if constexpr (IsEventDrivenConnection<ConnectionClass>::value) {
+            if (_isMultiplexed) {
+                _multiplexConnection(acceptor, connectionClass, fd, remote, complete);
+            }
+        }
+        if constexpr (IsThreadPerConnection<ConnectionClass>::value) {
+            if (!_isMultiplexed) {
+                connection->connectionThread = std::thread([connectionClass, fd, remote, complete]() {
+                    connectionClass->run(fd, remote);
+                    complete();
+                });
+            }
+        }
 
         std::lock_guard<std::mutex> lock{_mutex};
         _connections.emplace(connectionClass.get(), connection);
     }
+
+    template <typename Complete>
+    void _multiplexConnection(Acceptor* acceptor, std::shared_ptr<ConnectionClass> connectionClass, int fd, asio::ip::tcp::endpoint remote, Complete complete) {
+        // each acceptor round-robins over its own share of the workers
+        auto acceptorCount = _acceptors.size();
+        auto workerCount = (_workers.size() - acceptor->index + acceptorCount - 1) / acceptorCount;
+        auto& worker = _workers[acceptor->index + acceptorCount * (acceptor->nextWorker++ % workerCount)];
+        worker->post([worker = worker.get(), connectionClass, fd, remote, complete] {
+            auto end = [connectionClass, complete] {
+                connectionClass->end();
+                complete();
+            };
+            if (!connectionClass->begin(fd, remote, worker)) {
+                end();
+                return;
+            }
+            worker->add(fd, [connectionClass] {
+                return connectionClass->handleReadable();
+            }, end);
+        });
+    }
 };
@@ -1,5 +1,11 @@
 #include <gtest/gtest.h>
 
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include <unistd.h>
+
 #include "logger_test.hpp"
 #include "tcp_server.hpp"
 
@@ -19,3 +25,154 @@ TEST(TCPServer, inUsePorts) {
     ASSERT_FALSE(c.start(asio::ip::address::from_string("127.0.0.1"), 6501));
     ASSERT_TRUE(c.start(asio::ip::address::from_string("127.0.0.1"), 6502));
 }
+
+struct TestEventDrivenConnection {
+    static std::atomic<int> beginCount;
+    static std::atomic<int> endCount;
+    static std::atomic<int> bytesRead;
+
+    TestEventDrivenConnection(Logger logger) {}
+
+    bool begin(int fd, asio::ip::tcp::endpoint remote, EventLoop* loop) {
+        _fd = fd;
+        ++beginCount;
+        return true;
+    }
+
+    bool handleReadable() {
+        char buf[64];
+        auto n = read(_fd, buf, sizeof(buf));
+        if (n <= 0) {
+            return false;
+        }
+        bytesRead += n;
+        return true;
+    }
+
+    void end() {
+        close(_fd);
+        ++endCount;
+    }
+
+    int _fd = -1;
+};
+
+std::atomic<int> TestEventDrivenConnection::beginCount{0};
+std::atomic<int> TestEventDrivenConnection::endCount{0};
+std::atomic<int> TestEventDrivenConnection::bytesRead{0};
+
+TEST(TCPServer, eventDrivenConnections) {
+    static_assert(IsEventDrivenConnection<TestEventDrivenConnection>::value);
+    static_assert(!IsEventDrivenConnection<TestConnection>::value);
+
+    TestLogDestination logDestination;
+    TCPServer<TestEventDrivenConnection> server(&logDestination);
+    TCPServer<TestEventDrivenConnection>::Options options;
+    options.workerCount = 2;
+    ASSERT_TRUE(server.start(asio::ip::address::from_string("127.0.0.1"), 6503, options));
+
+    constexpr int kConnections = 10;
+    {
+        asio::io_service service;
+        std::vector<std::unique_ptr<asio::ip::tcp::socket>> sockets;
+        for (int i = 0; i < kConnections; ++i) {
+            auto s = std::make_unique<asio::ip::tcp::socket>(service);
+            s->connect(asio::ip::tcp::endpoint(asio::ip::address::from_string("127.0.0.1"), 6503));
+            asio::write(*s, asio::buffer("hello", 5));
+            sockets.emplace_back(std::move(s));
+        }
+
+        for (int i = 0; i < 500 && TestEventDrivenConnection::bytesRead < kConnections * 5; ++i) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        EXPECT_EQ(kConnections, TestEventDrivenConnection::beginCount);
+        EXPECT_EQ(kConnections * 5, TestEventDrivenConnection::bytesRead);
+        EXPECT_EQ(0, TestEventDrivenConnection::endCount);
+
+        sockets[0]->close();
+        for (int i = 0; i < 500 && TestEventDrivenConnection::endCount < 1; ++i) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        EXPECT_EQ(1, TestEventDrivenConnection::endCount);
+    }
+
+    server.stop();
+    EXPECT_EQ(kConnections, TestEventDrivenConnection::endCount);
+}
+
+struct TestDualConnection : TestEventDrivenConnection {
+    static std::atomic<int> runCount;
+
+    using TestEventDrivenConnection::TestEventDrivenConnection;
+
+    void run(int fd, asio::ip::tcp::endpoint remote) {
+        ++runCount;
+        close(fd);
+    }
+
+    void cancel() {}
+};
+
+std::atomic<int> TestDualConnection::runCount{0};
+
+TEST(TCPServer, threadPerConnectionOption) {
+    static_assert(IsEventDrivenConnection<TestDualConnection>::value);
+    static_assert(IsThreadPerConnection<TestDualConnection>::value);
+
+    TestLogDestination logDestination;
+    TCPServer<TestDualConnection> server(&logDestination);
+    TCPServer<TestDualConnection>::Options options;
+    options.threadPerConnection = true;
+    ASSERT_TRUE(server.start(asio::ip::address::from_string("127.0.0.1"), 6504, options));
+
+    auto beginCount = TestEventDrivenConnection::beginCount.load();
+    {
+        asio::io_service service;
+        asio::ip::tcp::socket s(service);
+        s.connect(asio::ip::tcp::endpoint(asio::ip::address::from_string("127.0.0.1"), 6504));
+
+        for (int i = 0; i < 500 && TestDualConnection::runCount < 1; ++i) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+    }
+    server.stop();
+
+    EXPECT_EQ(1, TestDualConnection::runCount);
+    EXPECT_EQ(beginCount, TestEventDrivenConnection::beginCount);
+}
+
+TEST(TCPServer, shardedAcceptors) {
+    TestLogDestination logDestination;
+    TCPServer<TestEventDrivenConnection> server(&logDestination);
+    TCPServer<TestEventDrivenConnection>::Options options;
+    options.acceptorCount = 4;
+    options.workerCount = 4;
+    ASSERT_TRUE(server.start(asio::ip::address::from_string("127.0.0.1"), 6505, options));
+
+    // another server can't take the port since it isn't using SO_REUSEPORT
+    TCPServer<TestEventDrivenConnection> other(Logger::Void);
+    EXPECT_FALSE(other.start(asio::ip::address::from_string("127.0.0.1"), 6505));
+
+    auto beginCount = TestEventDrivenConnection::beginCount.load();
+    auto bytesRead = TestEventDrivenConnection::bytesRead.load();
+
+    constexpr int kConnections = 20;
+    {
+        asio::io_service service;
+        std::vector<std::unique_ptr<asio::ip::tcp::socket>> sockets;
+        for (int i = 0; i < kConnections; ++i) {
+            auto s = std::make_unique<asio::ip::tcp::socket>(service);
+            s->connect(asio::ip::tcp::endpoint(asio::ip::address::from_string("127.0.0.1"), 6505));
+            asio::write(*s, asio::buffer("hello", 5));
+            sockets.emplace_back(std::move(s));
+        }
+
+        for (int i = 0; i < 500 && TestEventDrivenConnection::bytesRead < bytesRead + kConnections * 5; ++i) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        EXPECT_EQ(beginCount + kConnections, TestEventDrivenConnection::beginCount);
+        EXPECT_EQ(bytesRead + kConnections * 5, TestEventDrivenConnection::bytesRead);
+    }
+
+    server.stop();
+}
@@ -0,0 +1,50 @@
+#include "thread_pool.hpp"
+
+#include <algorithm>
+
+ThreadPool::ThreadPool(size_t threadCount) {
+    if (threadCount == 0) {
+        threadCount = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+    for (size_t i = 0; i < threadCount; ++i) {
+        _threads.emplace_back([this] {
+            _run();
+        });
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> l{_mutex};
+        _isDestructing = true;
+    }
+    _cv.notify_all();
+    for (auto& thread : _threads) {
+        thread.join();
+    }
+}
+
+void ThreadPool::post(std::function<void()> f) {
+    {
+        std::lock_guard<std::mutex> l{_mutex};
+        _queue.emplace_back(std::move(f));
+    }
+    _cv.notify_one();
+}
+
+void ThreadPool::_run() {
+    std::unique_lock<std::mutex> l{_mutex};
+    while (true) {
+        _cv.wait(l, [this] {
+            return _isDestructing || !_queue.empty();
+        });
+        if (_queue.empty()) {
+            return;
+        }
+        auto f = std::move(_queue.front());
+        _queue.pop_front();
+        l.unlock();
+        f();
+        l.lock();
+    }
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// ThreadPool runs posted functions on a fixed set of threads. Functions are started in the order
+// they're posted, but with more than one thread they may run concurrently and finish in any order.
+class ThreadPool {
+public:
+    // If threadCount is zero, one thread per core is created.
+    explicit ThreadPool(size_t threadCount = 0);
+    ThreadPool(const ThreadPool& other) = delete;
+    ThreadPool& operator=(const ThreadPool& other) = delete;
+
+    // Everything already posted runs before the destructor returns.
+    ~ThreadPool();
+
+    // post schedules f to be invoked on one of the pool's threads. This may be called from any
+    // thread, including the pool's own.
+    void post(std::function<void()> f);
+
+    size_t threadCount() const { return _threads.size(); }
+
+private:
+    std::mutex _mutex;
+    std::condition_variable _cv;
+    std::deque<std::function<void()>> _queue;
+    bool _isDestructing = false;
+
+    std::vector<std::thread> _threads;
+
+    void _run();
+};
@@ -0,0 +1,39 @@
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <future>
+
+#include "thread_pool.hpp"
+
+TEST(ThreadPool, post) {
+    std::atomic<int> count{0};
+    {
+        ThreadPool pool{4};
+        EXPECT_EQ(4, pool.threadCount());
+        for (int i = 0; i < 100; ++i) {
+            pool.post([&] {
+                ++count;
+            });
+        }
+    }
+    EXPECT_EQ(100, count);
+}
+
+TEST(ThreadPool, concurrency) {
+    ThreadPool pool{2};
+
+    // each function waits for the other, so this only completes if they run concurrently
+    std::promise<void> a, b;
+    std::promise<void> done;
+    pool.post([&] {
+        a.set_value();
+        b.get_future().wait();
+    });
+    pool.post([&] {
+        b.set_value();
+        a.get_future().wait();
+        done.set_value();
+    });
+
+    EXPECT_EQ(std::future_status::ready, done.get_future().wait_for(std::chrono::seconds(5)));
+}
@@ -4,9 +4,18 @@
 
 #include <aws/core/utils/UUID.h>
 
+#include <pthread.h>
+
 std::string GenerateUUID() {
     InitAWS();
     std::string uuid{Aws::String(Aws::Utils::UUID::RandomUUID())};
     std::transform(uuid.begin(), uuid.end(), uuid.begin(), ::tolower);
     return uuid;
 }
+
+bool SetThreadAffinity(std::thread& thread, int cpu) {
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(cpu, &cpus);
+    return pthread_setaffinity_np(thread.native_handle(), sizeof(cpus), &cpus) == 0;
+}
@@ -4,6 +4,7 @@
 #include <cstdint>
 #include <functional>
 #include <string>
+#include <thread>
 #include <utility>
 #include <vector>
 
@@ -39,3 +40,6 @@ std::vector<uint8_t> HexToVector(const char(&hex)[N]) {
 }
 
 std::string GenerateUUID();
+
+// SetThreadAffinity pins the given thread to a single cpu.
+bool SetThreadAffinity(std::thread& thread, int cpu);
@@ -2,14 +2,24 @@
 
 #include "ffmpeg.hpp"
 
-#include <h26x/h264.hpp>
-
 VideoDecoder::~VideoDecoder() {
     _endDecoding();
 }
 
 void VideoDecoder::flush() {
-    _endDecoding();
+    if (!_configuration.reuseContext) {
+        _endDecoding();
+        return;
+    }
+
+    if (!_context) {
+        return;
+    }
+
+    _drain();
+    // this is needed to accept packets again after draining
+    avcodec_flush_buffers(_context);
+    _isAwaitingIDR = true;
 }
 
 void VideoDecoder::handleEncodedVideoConfig(const void* data, size_t len) {
@@ -24,34 +34,42 @@ void VideoDecoder::handleEncodedVideoConfig(const void* data, size_t len) {
         return;
     }
 
+    // the next idr will open a decoder for the new config
+    _endDecoding();
     _videoConfig = std::move(config);
 }
 
-// NOLINTNEXTLINE(misc-unused-parameters)
 void VideoDecoder::handleEncodedVideo(std::chrono::microseconds pts, std::chrono::microseconds dts, const void* data, size_t len) {
+    handleEncodedVideoPacket(pts, dts, EncodedPacket::Borrow(data, len));
+}
+
+// NOLINTNEXTLINE(misc-unused-parameters)
+void VideoDecoder::handleEncodedVideoPacket(std::chrono::microseconds pts, std::chrono::microseconds dts, const EncodedPacket& encodedPacket) {
     if (!_videoConfig) {
         return;
     }
 
     auto isFirstFrame = false;
 
-    if (!_context) {
-        auto isIDR = false;
-        if (!h264::IterateAVCC(data, len, _videoConfig->lengthSizeMinusOne + 1, [&](const void* data, size_t len) {
-            if (len < 1) {
-                return;
-            }
-            auto naluType = *reinterpret_cast<const uint8_t*>(data) & 0x1f;
-            isIDR |= (naluType == h264::NALUnitType::IDRSlice);
-        })) {
+    FrameDescriptor storage;
+    auto descriptor = encodedPacket.frameDescriptor();
+
+    if (!_context || _isAwaitingIDR) {
+        descriptor = DescribeFrame(encodedPacket, _videoConfig->lengthSizeMinusOne + 1, &storage);
+        if (!descriptor) {
             _logger.error("unable to iterate avcc");
             return;
         }
 
-        if (isIDR) {
+        if (!descriptor->isKeyframe && !(_configuration.startsAtRecoveryPoints && descriptor->isRecoveryPoint)) {
+            return;
+        }
+
+        if (!_context) {
             _beginDecoding();
-            isFirstFrame = true;
         }
+        _isAwaitingIDR = false;
+        isFirstFrame = true;
     }
 
     if (!_context) {
@@ -76,7 +94,7 @@ void VideoDecoder::handleEncodedVideo(std::chrono::microseconds pts, std::chrono
         }
     }
 
-    if (!h264::AVCCToAnnexB(&_inputBuffer, data, len, _videoConfig->lengthSizeMinusOne + 1)) {
+    if (!AppendAnnexB(&_inputBuffer, encodedPacket, _videoConfig->lengthSizeMinusOne + 1, descriptor)) {
         _logger.error("unable to convert avcc to annex-b");
         return;
     }
@@ -116,6 +134,9 @@ void VideoDecoder::_beginDecoding() {
     }
     RegisterFFmpegLogContext(_context, _logger);
 
+    _context->thread_count = _configuration.threadCount;
+    _context->thread_type = (_configuration.frameThreading ? FF_THREAD_FRAME : 0) | (_configuration.sliceThreading ? FF_THREAD_SLICE : 0);
+
     auto err = avcodec_open2(_context, codec, nullptr);
     if (err < 0) {
         _logger.error("unable to open codec: {}", FFmpegErrorString(err));
@@ -131,12 +152,10 @@ void VideoDecoder::_endDecoding() {
         return;
     }
 
-	auto err = avcodec_send_packet(_context, nullptr);
-	if (err < 0) {
-		_logger.error("error sending video flush packet to decoder: {}", FFmpegErrorString(err));
-	} else {
-        _handleDecodedFrames();
+    if (!_isAwaitingIDR) {
+        _drain();
     }
+    _isAwaitingIDR = false;
 
     avcodec_close(_context);
     av_free(_context);
@@ -144,6 +163,15 @@ void VideoDecoder::_endDecoding() {
     _context = nullptr;
 }
 
+void VideoDecoder::_drain() {
+	auto err = avcodec_send_packet(_context, nullptr);
+	if (err < 0) {
+		_logger.error("error sending video flush packet to decoder: {}", FFmpegErrorString(err));
+	} else {
+        _handleDecodedFrames();
+    }
+}
+
 void VideoDecoder::_handleDecodedFrames() {
     auto frame = av_frame_alloc();
     while (true) {
@@ -156,7 +184,11 @@ void VideoDecoder::_handleDecodedFrames() {
             break;
         }
 
-        _handler->handleVideo(std::chrono::microseconds{frame->reordered_opaque}, frame);
+        auto pts = std::chrono::microseconds{frame->reordered_opaque};
+        if (_latencyTracer) {
+            _latencyTracer->stamp(LatencyTracer::Stage::Decoder, pts);
+        }
+        _handler->handleVideo(pts, frame);
     }
 	av_frame_free(&frame);
 }
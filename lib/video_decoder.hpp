@@ -8,25 +8,53 @@ extern "C" {
 
 #include "av_handler.hpp"
 #include "encoded_av_handler.hpp"
+#include "latency_tracer.hpp"
 #include "logger.hpp"
 #include "mpeg4.hpp"
 
 // VideoDecoder takes incoming video and synchronously decodes it.
 class VideoDecoder : public EncodedVideoHandler {
 public:
-    VideoDecoder(Logger logger, VideoHandler* handler) : _logger{std::move(logger)}, _handler{handler} {}
+    struct Configuration {
+        // If true, flush keeps the decoder open so that it doesn't need to be torn down and
+        // initialized again for the next frame. It's only reopened when the video config changes.
+        bool reuseContext = false;
+
+        // The number of threads to decode with. If zero, FFmpeg picks one per core.
+        int threadCount = 1;
+
+        // The kinds of threading to use if threadCount isn't one. Frame threading scales the best,
+        // but delays output by a frame per thread. Slice threading only helps with video that has
+        // multiple slices per frame. Output order and timestamps are the same either way.
+        bool frameThreading = true;
+        bool sliceThreading = true;
+
+        // If true, decoding can begin at a recovery point as well as at an IDR. This is for video
+        // encoded with periodic intra refresh, which may not have IDRs after its first frame.
+        bool startsAtRecoveryPoints = false;
+    };
+
+    VideoDecoder(Logger logger, VideoHandler* handler) : VideoDecoder(std::move(logger), handler, Configuration{}) {}
+    VideoDecoder(Logger logger, VideoHandler* handler, Configuration configuration)
+        : _logger{std::move(logger)}, _handler{handler}, _configuration{configuration} {}
     virtual ~VideoDecoder();
 
     // flush outputs decoded video for the frames received so far. Note that if the next frame
     // received after this call is not an IDR, frames will be skipped.
     void flush();
 
+    // If set, frames are stamped with LatencyTracer::Stage::Decoder as they're decoded.
+    void setLatencyTracer(LatencyTracer* tracer) { _latencyTracer = tracer; }
+
     virtual void handleEncodedVideoConfig(const void* data, size_t len) override;
     virtual void handleEncodedVideo(std::chrono::microseconds pts, std::chrono::microseconds dts, const void* data, size_t len) override;
+    virtual void handleEncodedVideoPacket(std::chrono::microseconds pts, std::chrono::microseconds dts, const EncodedPacket& packet) override;
 
 private:
     const Logger _logger;
     VideoHandler* const _handler;
+    const Configuration _configuration;
+    LatencyTracer* _latencyTracer = nullptr;
 
     std::vector<uint8_t> _inputBuffer;
 
@@ -34,7 +62,11 @@ private:
 
     AVCodecContext* _context = nullptr;
 
+    // Set when the context has been flushed but kept open. Frames are skipped until the next IDR.
+    bool _isAwaitingIDR = false;
+
     void _beginDecoding();
     void _endDecoding();
+    void _drain();
     void _handleDecodedFrames();
 };
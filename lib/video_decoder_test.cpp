@@ -1,10 +1,12 @@
 #include <gtest/gtest.h>
 
 #include <unordered_set>
+#include <vector>
 
 #include "encoded_av_handler_test.hpp"
 #include "encoded_av_splitter.hpp"
 #include "logger_test.hpp"
+#include "segmenter.hpp"
 #include "video_decoder.hpp"
 
 TEST(VideoDecoder, decoding) {
@@ -43,3 +45,82 @@ TEST(VideoDecoder, decoding) {
 
     EXPECT_EQ(handler.encodedFrameCount, handler.frameCount);
 }
+
+TEST(VideoDecoder, reuseContext) {
+    struct Handler : EncodedAVHandler, VideoHandler {
+        virtual ~Handler() {}
+
+        virtual void handleEncodedVideo(std::chrono::microseconds pts, std::chrono::microseconds dts, const void* data, size_t len) override {
+            ++encodedFrameCount;
+        }
+
+        virtual void handleVideo(std::chrono::microseconds pts, const AVFrame* frame) override {
+            EXPECT_GE(pts, lastPTS);
+            lastPTS = pts;
+            ++frameCount;
+        }
+
+        size_t encodedFrameCount = 0;
+        size_t frameCount = 0;
+        std::chrono::microseconds lastPTS{-1};
+    } handler;
+
+    TestLogDestination logDestination;
+    VideoDecoder::Configuration configuration;
+    configuration.reuseContext = true;
+    VideoDecoder decoder{&logDestination, &handler, configuration};
+
+    EncodedAVSplitter avHandler;
+    avHandler.addHandler(&decoder);
+    avHandler.addHandler(static_cast<EncodedVideoHandler*>(&handler));
+
+    // flush at every segment boundary, like the ingest server does
+    size_t boundaries = 0;
+    Segmenter segmenter{&logDestination, &avHandler, [&] {
+        decoder.flush();
+        EXPECT_EQ(handler.encodedFrameCount, handler.frameCount);
+        ++boundaries;
+    }};
+    ExerciseEncodedAVHandler(&segmenter);
+    decoder.flush();
+
+    EXPECT_GT(boundaries, 1);
+    EXPECT_GT(handler.frameCount, 0);
+    EXPECT_EQ(handler.encodedFrameCount, handler.frameCount);
+}
+
+TEST(VideoDecoder, threading) {
+    struct Handler : VideoHandler {
+        virtual ~Handler() {}
+
+        virtual void handleVideo(std::chrono::microseconds pts, const AVFrame* frame) override {
+            timestamps.emplace_back(pts);
+        }
+
+        std::vector<std::chrono::microseconds> timestamps;
+    };
+
+    auto decode = [](VideoDecoder::Configuration configuration) {
+        Handler handler;
+        TestLogDestination logDestination;
+        VideoDecoder decoder{&logDestination, &handler, configuration};
+        EncodedAVSplitter avHandler;
+        avHandler.addHandler(&decoder);
+        ExerciseEncodedAVHandler(&avHandler);
+        decoder.flush();
+        return handler.timestamps;
+    };
+
+    auto expected = decode({});
+    ASSERT_FALSE(expected.empty());
+
+    VideoDecoder::Configuration frameThreading;
+    frameThreading.threadCount = 4;
+    frameThreading.sliceThreading = false;
+    EXPECT_EQ(expected, decode(frameThreading));
+
+    VideoDecoder::Configuration sliceThreading;
+    sliceThreading.threadCount = 4;
+    sliceThreading.frameThreading = false;
+    EXPECT_EQ(expected, decode(sliceThreading));
+}
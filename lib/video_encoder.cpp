@@ -1,15 +1,82 @@
 #include "lib/video_encoder.hpp"
 
+#include <algorithm>
+
 extern "C" {
     #include <libavutil/imgutils.h>
 }
 
 #include "ffmpeg.hpp"
 
+bool VideoEncoderThreading::Profile(const std::string& name, VideoEncoderThreading* threading) {
+    VideoEncoderThreading ret;
+    if (name == "throughput") {
+        ret.threads = 0;
+    } else if (name == "low-latency") {
+        ret.threads = 0;
+        ret.slicedThreads = true;
+        ret.zeroLatency = true;
+    } else if (name != "default") {
+        return false;
+    }
+    *threading = ret;
+    return true;
+}
+
 void VideoEncoder::flush() {
+    _framesSinceFlush = 0;
+    if (_configuration.x264.intraRefresh && _context) {
+        // the next refresh wave will begin the next segment
+        return;
+    }
+    if (_configuration.forceIDROnFlush && _context) {
+        _shouldForceIDR = true;
+        return;
+    }
     _endEncoding();
 }
 
+void VideoEncoder::setPresetSteps(int steps) {
+    if (steps != _presetSteps) {
+        _presetSteps = steps;
+        _shouldReopen = _context != nullptr;
+    }
+}
+
+void VideoEncoder::setFrameRateDivisor(int divisor) {
+    _frameRateDivisor = std::max(divisor, 1);
+}
+
+void VideoEncoder::setSuspended(bool isSuspended) {
+    if (isSuspended && !_isSuspended) {
+        _endEncoding();
+    }
+    _isSuspended = isSuspended;
+}
+
+bool VideoEncoder::_shouldDecimate(std::chrono::microseconds pts) {
+    if (_configuration.maxFrameRate <= 0.0) {
+        return false;
+    }
+    std::chrono::microseconds interval{static_cast<int64_t>(1000000.0 / _configuration.maxFrameRate)};
+
+    // a little slack keeps jittery timestamps (rtmp's are in milliseconds) from skipping a slot
+    auto isFirst = _framesSinceFlush == 0;
+    auto isBackwards = pts + 2 * interval < _nextFramePTS;
+    if (!isFirst && !isBackwards && pts + interval / 4 < _nextFramePTS) {
+        return true;
+    }
+
+    // slots are advanced from the last one rather than from pts so that the cadence stays even,
+    // unless the source skipped ahead
+    if (isFirst || isBackwards || pts >= _nextFramePTS + interval) {
+        _nextFramePTS = pts + interval;
+    } else {
+        _nextFramePTS += interval;
+    }
+    return false;
+}
+
 void VideoEncoder::_endEncoding() {
     if (!_context) {
         return;
@@ -40,8 +107,31 @@ void VideoEncoder::_endEncoding() {
 }
 
 void VideoEncoder::handleVideo(std::chrono::microseconds pts, const AVFrame* frame) {
+    if (_isSuspended || _shouldDecimate(pts) || _framesSinceFlush++ % _frameRateDivisor != 0) {
+        return;
+    }
+
+    auto pixelFormat = static_cast<AVPixelFormat>(frame->format);
+
+    if (_context && (frame->width != _inputWidth || frame->height != _inputHeight || pixelFormat != _inputPixelFormat)) {
+        _logger.with(
+            "width", frame->width,
+            "height", frame->height
+        ).info("input format changed. reopening encoder");
+        _endEncoding();
+    } else if (_shouldReopen) {
+        _logger.with("preset_steps", _presetSteps).info("preset changed. reopening encoder");
+        _endEncoding();
+    }
+    _shouldReopen = false;
+
     if (!_context) {
-        _beginEncoding(frame->width, frame->height, static_cast<AVPixelFormat>(frame->format));
+        _beginEncoding(frame->width, frame->height, pixelFormat);
+        _inputWidth = frame->width;
+        _inputHeight = frame->height;
+        _inputPixelFormat = pixelFormat;
+        // new encoders always begin with an idr
+        _shouldForceIDR = false;
     }
 
     if (!_context) {
@@ -57,7 +147,8 @@ void VideoEncoder::handleVideo(std::chrono::microseconds pts, const AVFrame* fra
     }
 
     frameCopy->pts = pts.count() / 1000000.0 / av_q2d(_context->time_base);
-    frameCopy->pict_type = AV_PICTURE_TYPE_NONE;
+    frameCopy->pict_type = _shouldForceIDR ? AV_PICTURE_TYPE_I : AV_PICTURE_TYPE_NONE;
+    _shouldForceIDR = false;
 
     auto err = avcodec_send_frame(_context, frameCopy);
     if (!_scalingContext) {
@@ -69,4 +160,15 @@ void VideoEncoder::handleVideo(std::chrono::microseconds pts, const AVFrame* fra
     }
 
     _handleEncodedPackets();
-}
\ No newline at end of file
+}
+
+std::string VideoEncoder::_joinParams(const std::vector<std::string>& params) {
+    std::string ret;
+    for (auto& param : params) {
+        if (!ret.empty()) {
+            ret += ':';
+        }
+        ret += param;
+    }
+    return ret;
+}
@@ -11,13 +11,54 @@ extern "C" {
 
 #include "av_handler.hpp"
 #include "encoded_av_handler.hpp"
+#include "latency_tracer.hpp"
 #include "logger.hpp"
 
 #include <h26x/h264.hpp>
 #include <h26x/h265.hpp>
 
 enum class VideoCodec {
-    null, x264, x265
+    null, x264, x265,
+
+    // copy isn't an encoder. It indicates that the source video should be passed through as-is.
+    copy,
+};
+
+// VideoEncoderThreading trades encoding latency against throughput. Counts of zero let the encoder
+// size them for the number of cores.
+struct VideoEncoderThreading {
+    // x264 only. It encodes this many frames at once, or splits each frame into this many slices
+    // if slicedThreads is set.
+    int threads = 1;
+
+    // x265 only. The number of threads in its pool.
+    int poolThreads = 0;
+
+    // x265 only. The number of frames encoded at once. Each one adds a frame of latency.
+    int frameThreads = 0;
+
+    // x264 only. Slice-based threading adds no latency, but costs some compression.
+    bool slicedThreads = false;
+
+    // x265 only. Wavefront parallel processing encodes rows of a frame concurrently.
+    bool wpp = true;
+
+    // The number of threads used for the lookahead.
+    int lookaheadThreads = 0;
+
+    // If true, the encoders are tuned with "zerolatency", which disables b-frames and the
+    // lookahead.
+    bool zeroLatency = false;
+
+    // Profile returns the settings for one of the named profiles:
+    //
+    // - "default" is the default configuration above. x264 encodes one frame at a time, and x265
+    //   picks its own thread counts.
+    // - "throughput" lets the encoders use every core, at the cost of several frames of latency.
+    // - "low-latency" uses every core without adding any latency, at the cost of some compression.
+    //
+    // It returns false if the name isn't recognized.
+    static bool Profile(const std::string& name, VideoEncoderThreading* threading);
 };
 
 // Unified encoder configuration; each codec uses only the fields relative to it
@@ -27,11 +68,30 @@ struct VideoEncoderConfiguration {
     int width = -1;
     int height = -1;
 
+    // If true, flush makes the next frame an IDR instead of draining and closing the encoder, and
+    // the encoder doesn't place IDRs on its own. The encoder is only reopened when the input's
+    // resolution or pixel format changes.
+    bool forceIDROnFlush = false;
+
+    // If non-zero, frames are dropped evenly by pts to keep the frame rate at or below this. The
+    // first frame after a flush is always encoded, so IDRs stay at segment boundaries.
+    double maxFrameRate = 0.0;
+
+    VideoEncoderThreading threading;
+
     struct  {
         int profileIDC = h264::ProfileIDC::High;
         int levelIDC = 31;
         std::string h264Preset = "fast";
 
+        // If true, the encoder never places IDRs after the first frame. Instead, it refreshes the
+        // picture with a wave of intra blocks every intraRefreshFrames frames, each starting with
+        // a recovery point. This spreads the cost of intra coding evenly across frames, which
+        // together with zerolatency tuning and a small vbv buffer keeps latency low. flush doesn't
+        // force anything in this mode, so packagers need to cut segments at recovery points.
+        bool intraRefresh = false;
+        int intraRefreshFrames = 60;
+
     } x264;
 
     struct {
@@ -51,12 +111,36 @@ public:
 
     virtual ~VideoEncoder() {};
     virtual void handleVideo(std::chrono::microseconds pts, const AVFrame* frame);
+
+    // flush outputs encoded video for the frames received so far, then starts over with an IDR.
+    // See VideoEncoderConfiguration::forceIDROnFlush for an alternative.
     void flush();
 
+    // If set, frames are stamped with LatencyTracer::Stage::Encoder as they're output.
+    void setLatencyTracer(LatencyTracer* tracer) { _latencyTracer = tracer; }
+
+    // The following shed work when encoders can't keep up (see OverloadController). Like flush,
+    // they must not be invoked concurrently with handleVideo.
+
+    // setPresetSteps makes the encoder use a preset this many steps faster than the configured one.
+    // If that changes anything, the encoder is reopened at the next frame. Only x264 has presets to
+    // step through.
+    void setPresetSteps(int steps);
+
+    // setFrameRateDivisor makes the encoder skip all but one out of every divisor frames. The first
+    // frame after a flush is always encoded.
+    void setFrameRateDivisor(int divisor);
+
+    // setSuspended stops or resumes encoding. Suspending drains and closes the encoder, so encoding
+    // resumes with an IDR.
+    void setSuspended(bool isSuspended);
+    bool isSuspended() const { return _isSuspended; }
+
 protected:
     const Logger _logger;
     EncodedVideoHandler* const _handler;
     const VideoEncoderConfiguration _configuration;
+    LatencyTracer* _latencyTracer = nullptr;
 
     std::vector<uint8_t> _outputBuffer;
 
@@ -64,9 +148,31 @@ protected:
     SwsContext* _scalingContext = nullptr;
     AVFrame* _scaledFrame = nullptr;
 
+    // The input format that the encoder was opened for.
+    int _inputWidth = 0;
+    int _inputHeight = 0;
+    AVPixelFormat _inputPixelFormat = AV_PIX_FMT_NONE;
+
+    bool _shouldForceIDR = false;
+
+    int _presetSteps = 0;
+    bool _shouldReopen = false;
+    int _frameRateDivisor = 1;
+    uint64_t _framesSinceFlush = 0;
+    bool _isSuspended = false;
+
+    // The pts at which the next frame should be encoded if maxFrameRate is set.
+    std::chrono::microseconds _nextFramePTS{0};
+
+    // _shouldDecimate returns true if the frame should be dropped to satisfy maxFrameRate.
+    bool _shouldDecimate(std::chrono::microseconds pts);
+
     virtual void _beginEncoding(int inputWidth, int inputHeight, AVPixelFormat inputPixelFormat) = 0;
     virtual void _endEncoding();
     virtual void _handleEncodedPackets() = 0;
+
+    // _joinParams joins "key=value" options into the form that x264-params and x265-params take.
+    static std::string _joinParams(const std::vector<std::string>& params);
 };
 
 // Encoding to h.264
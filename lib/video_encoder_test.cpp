@@ -1,9 +1,11 @@
 #include <gtest/gtest.h>
 
+#include <cstring>
 #include <string>
 
 #include "encoded_av_handler_test.hpp"
 #include "encoded_av_splitter.hpp"
+#include "frame_descriptor.hpp"
 #include "logger_test.hpp"
 #include "video_decoder.hpp"
 #include "video_encoder.hpp"
@@ -25,10 +27,24 @@ struct H264Handler : EncodedAVHandler {
         EXPECT_TRUE(h264::IterateAVCC(data, len, config->lengthSizeMinusOne + 1, [&](const void* data, size_t len) {
             EXPECT_GT(len, 0);
         }));
+        FrameDescriptor descriptor;
+        EXPECT_TRUE(descriptor.decode(data, len, config->lengthSizeMinusOne + 1));
+        if (descriptor.isKeyframe) {
+            ++keyframeCount;
+        }
+        if (descriptor.isRecoveryPoint) {
+            ++recoveryPointCount;
+        }
+        if (pts != dts) {
+            ++reorderedFrameCount;
+        }
     }
 
     std::unique_ptr<AVCDecoderConfigurationRecord> config;
     size_t frameCount = 0;
+    size_t keyframeCount = 0;
+    size_t recoveryPointCount = 0;
+    size_t reorderedFrameCount = 0;
 };
 
 struct H265Handler : EncodedAVHandler {
@@ -43,13 +59,23 @@ struct H265Handler : EncodedAVHandler {
     virtual void handleEncodedVideo(std::chrono::microseconds pts, std::chrono::microseconds dts, const void* data, size_t len) override {
         ASSERT_TRUE(config);
         ++frameCount;
+        bool isIDR = false;
         EXPECT_TRUE(h264::IterateAnnexB(data, len, [&](const void* data, size_t len) {
             EXPECT_GT(len, 0);
+            if (len > 0) {
+                auto type = (*reinterpret_cast<const uint8_t*>(data) >> 1) & 0x3f;
+                // IDR_W_RADL or IDR_N_LP
+                isIDR = isIDR || type == 19 || type == 20;
+            }
         }));
+        if (isIDR) {
+            ++keyframeCount;
+        }
     }
 
     std::unique_ptr<HEVCDecoderConfigurationRecord> config;
     size_t frameCount = 0;
+    size_t keyframeCount = 0;
 };
 
 TEST(VideoEncoder, encoding_h264) {
@@ -75,6 +101,53 @@ TEST(VideoEncoder, encoding_h264) {
     EXPECT_EQ(before.frameCount, after.frameCount);
 }
 
+TEST(VideoEncoder, threadingProfiles) {
+    VideoEncoderThreading threading;
+    EXPECT_TRUE(VideoEncoderThreading::Profile("default", &threading));
+    EXPECT_EQ(1, threading.threads);
+    // x265 picks its own thread counts
+    EXPECT_EQ(0, threading.poolThreads);
+    EXPECT_EQ(0, threading.frameThreads);
+    EXPECT_FALSE(threading.zeroLatency);
+
+    EXPECT_TRUE(VideoEncoderThreading::Profile("throughput", &threading));
+    EXPECT_EQ(0, threading.threads);
+    EXPECT_EQ(0, threading.frameThreads);
+
+    EXPECT_TRUE(VideoEncoderThreading::Profile("low-latency", &threading));
+    EXPECT_TRUE(threading.slicedThreads);
+    EXPECT_TRUE(threading.zeroLatency);
+
+    EXPECT_FALSE(VideoEncoderThreading::Profile("fast", &threading));
+    EXPECT_TRUE(threading.zeroLatency);
+}
+
+TEST(VideoEncoder, lowLatencyThreading) {
+    TestLogDestination logDestination;
+
+    H264Handler before, after;
+    ExerciseEncodedAVHandler(&before);
+    {
+        VideoEncoderConfiguration configuration;
+        configuration.width = 600;
+        configuration.height = 480;
+        configuration.x264.h264Preset = "veryfast";
+        ASSERT_TRUE(VideoEncoderThreading::Profile("low-latency", &configuration.threading));
+        configuration.threading.threads = 4;
+        H264VideoEncoder encoder{&logDestination, &after, configuration};
+        {
+            VideoDecoder decoder{&logDestination, &encoder};
+
+            EncodedAVSplitter avHandler;
+            avHandler.addHandler(&decoder);
+            ExerciseEncodedAVHandler(&avHandler);
+        }
+    }
+    EXPECT_EQ(before.frameCount, after.frameCount);
+    // zerolatency turns b-frames off
+    EXPECT_EQ(0, after.reorderedFrameCount);
+}
+
 TEST(VideoEncoder, encoding_h265) {
         TestLogDestination logDestination;
 
@@ -98,3 +171,178 @@ TEST(VideoEncoder, encoding_h265) {
         }
         EXPECT_EQ(before.frameCount, after.frameCount);
 }
+
+TEST(VideoEncoder, forceIDROnFlush) {
+    TestLogDestination logDestination;
+
+    H264Handler before, after;
+    ExerciseEncodedAVHandler(&before);
+
+    // flushes the encoder every so often, like the ingest server does at segment boundaries
+    struct Flusher : VideoHandler {
+        explicit Flusher(VideoEncoder* encoder) : encoder{encoder} {}
+        virtual ~Flusher() {}
+
+        virtual void handleVideo(std::chrono::microseconds pts, const AVFrame* frame) override {
+            if (frameCount > 0 && frameCount % 100 == 0) {
+                encoder->flush();
+                ++flushCount;
+            }
+            ++frameCount;
+            encoder->handleVideo(pts, frame);
+        }
+
+        VideoEncoder* encoder;
+        size_t frameCount = 0;
+        size_t flushCount = 0;
+    };
+
+    size_t flushCount = 0;
+    {
+        VideoEncoderConfiguration configuration;
+        configuration.width = 600;
+        configuration.height = 480;
+        configuration.x264.h264Preset = "veryfast";
+        configuration.forceIDROnFlush = true;
+        H264VideoEncoder encoder{&logDestination, &after, configuration};
+        Flusher flusher{&encoder};
+        {
+            VideoDecoder decoder{&logDestination, &flusher};
+
+            EncodedAVSplitter avHandler;
+            avHandler.addHandler(&decoder);
+            ExerciseEncodedAVHandler(&avHandler);
+        }
+        flushCount = flusher.flushCount;
+    }
+    EXPECT_GT(flushCount, 0);
+    EXPECT_EQ(before.frameCount, after.frameCount);
+
+    // one idr to start, then one per flush
+    EXPECT_EQ(flushCount + 1, after.keyframeCount);
+}
+
+TEST(VideoEncoder, forceIDROnFlush_h265) {
+    TestLogDestination logDestination;
+
+    struct Flusher : VideoHandler {
+        explicit Flusher(VideoEncoder* encoder) : encoder{encoder} {}
+        virtual ~Flusher() {}
+
+        virtual void handleVideo(std::chrono::microseconds pts, const AVFrame* frame) override {
+            // flush often enough that x265's automatic min-keyint would get in the way
+            if (frameCount > 0 && frameCount % 20 == 0) {
+                encoder->flush();
+                ++flushCount;
+            }
+            ++frameCount;
+            encoder->handleVideo(pts, frame);
+        }
+
+        VideoEncoder* encoder;
+        size_t frameCount = 0;
+        size_t flushCount = 0;
+    };
+
+    H265Handler after;
+    size_t flushCount = 0;
+    {
+        VideoEncoderConfiguration configuration;
+        configuration.width = 320;
+        configuration.height = 240;
+        configuration.codec = VideoCodec::x265;
+        configuration.forceIDROnFlush = true;
+        H265VideoEncoder encoder{&logDestination, &after, configuration};
+        Flusher flusher{&encoder};
+        {
+            VideoDecoder decoder{&logDestination, &flusher};
+
+            EncodedAVSplitter avHandler;
+            avHandler.addHandler(&decoder);
+            ExerciseEncodedAVHandler(&avHandler);
+        }
+        flushCount = flusher.flushCount;
+    }
+    EXPECT_GT(flushCount, 0);
+
+    // one idr to start, then one per flush
+    EXPECT_EQ(flushCount + 1, after.keyframeCount);
+}
+
+TEST(VideoEncoder, maxFrameRate) {
+    TestLogDestination logDestination;
+
+    H264Handler handler;
+    {
+        VideoEncoderConfiguration configuration;
+        configuration.width = 64;
+        configuration.height = 64;
+        configuration.x264.h264Preset = "ultrafast";
+        configuration.forceIDROnFlush = true;
+        configuration.maxFrameRate = 30;
+        H264VideoEncoder encoder{&logDestination, &handler, configuration};
+
+        auto frame = av_frame_alloc();
+        frame->format = AV_PIX_FMT_YUV420P;
+        frame->width = 64;
+        frame->height = 64;
+        ASSERT_GE(av_frame_get_buffer(frame, 32), 0);
+        for (int p = 0; p < 3; ++p) {
+            memset(frame->data[p], 128, frame->linesize[p] * (p ? 32 : 64));
+        }
+
+        // two seconds of 60 fps with rtmp's millisecond timestamps, with a segment boundary on an
+        // odd frame
+        for (int i = 0; i < 120; ++i) {
+            if (i == 61) {
+                encoder.flush();
+            }
+            encoder.handleVideo(std::chrono::milliseconds(i * 1000 / 60), frame);
+        }
+        av_frame_free(&frame);
+    }
+
+    // every other frame, plus the boundary frame
+    EXPECT_EQ(61, handler.frameCount);
+    EXPECT_EQ(2, handler.keyframeCount);
+}
+
+TEST(VideoEncoder, intraRefresh) {
+    TestLogDestination logDestination;
+
+    H264Handler handler;
+    {
+        VideoEncoderConfiguration configuration;
+        configuration.width = 64;
+        configuration.height = 64;
+        configuration.x264.h264Preset = "ultrafast";
+        configuration.forceIDROnFlush = true;
+        configuration.x264.intraRefresh = true;
+        configuration.x264.intraRefreshFrames = 30;
+        H264VideoEncoder encoder{&logDestination, &handler, configuration};
+
+        auto frame = av_frame_alloc();
+        frame->format = AV_PIX_FMT_YUV420P;
+        frame->width = 64;
+        frame->height = 64;
+        ASSERT_GE(av_frame_get_buffer(frame, 32), 0);
+        for (int p = 0; p < 3; ++p) {
+            memset(frame->data[p], 128, frame->linesize[p] * (p ? 32 : 64));
+        }
+
+        for (int i = 0; i < 120; ++i) {
+            if (i > 0 && i % 50 == 0) {
+                encoder.flush();
+            }
+            encoder.handleVideo(std::chrono::milliseconds(i * 1000 / 60), frame);
+        }
+        av_frame_free(&frame);
+    }
+
+    EXPECT_EQ(120, handler.frameCount);
+    EXPECT_EQ(0, handler.reorderedFrameCount);
+
+    // flushes don't force anything. there's an idr to start, then a recovery point for each wave
+    EXPECT_EQ(1, handler.keyframeCount);
+    EXPECT_GE(handler.recoveryPointCount, 3);
+}
@@ -1,5 +1,7 @@
 #include "lib/video_encoder.hpp"
 
+#include <algorithm>
+
 extern "C" {
     #include <libavutil/imgutils.h>
 }
@@ -11,6 +13,22 @@ extern "C" {
 #include <h26x/nal_unit.hpp>
 #include <h26x/seq_parameter_set.hpp>
 
+namespace {
+
+// FasterPreset returns the preset that's the given number of steps faster than preset.
+std::string FasterPreset(const std::string& preset, int steps) {
+    static const char* const presets[] = {"ultrafast", "superfast", "veryfast", "faster", "fast", "medium", "slow", "slower", "veryslow", "placebo"};
+    constexpr int count = sizeof(presets) / sizeof(*presets);
+    for (int i = 0; i < count; ++i) {
+        if (preset == presets[i]) {
+            return presets[std::max(i - steps, 0)];
+        }
+    }
+    return preset;
+}
+
+} // anonymous namespace
+
 H264VideoEncoder::~H264VideoEncoder(){
     _endEncoding();
 }
@@ -36,7 +54,7 @@ void H264VideoEncoder::_beginEncoding(int inputWidth, int inputHeight, AVPixelFo
     _context->width = _configuration.width;
     _context->height = _configuration.height;
     _context->pix_fmt = inputPixelFormat;
-    _context->max_b_frames = 1;
+    _context->max_b_frames = _configuration.x264.intraRefresh ? 0 : 1;
     _context->profile = _configuration.x264.profileIDC;
     _context->level = _configuration.x264.levelIDC;
 
@@ -46,10 +64,45 @@ void H264VideoEncoder::_beginEncoding(int inputWidth, int inputHeight, AVPixelFo
     // TODO: ??? parameterize the time base maybe?
     _context->time_base = AVRational{1, 120};
     _context->ticks_per_frame = 2;
+    if (_configuration.maxFrameRate > 0.0) {
+        // lets rate control budget bits for the frames that are actually encoded
+        _context->framerate = av_d2q(_configuration.maxFrameRate, 1001);
+    }
 
+    auto& threading = _configuration.threading;
+    _context->thread_count = threading.threads;
+    _context->thread_type = threading.slicedThreads ? FF_THREAD_SLICE : FF_THREAD_FRAME;
+
+    std::vector<std::string> params;
     AVDictionary* options = nullptr;
-    av_dict_set(&options, "preset", _configuration.x264.h264Preset.c_str(), 0);
-    av_dict_set(&options, "rc-lookahead", "5", 0);
+    auto preset = FasterPreset(_configuration.x264.h264Preset, _presetSteps);
+    av_dict_set(&options, "preset", preset.c_str(), 0);
+    if (threading.zeroLatency || _configuration.x264.intraRefresh) {
+        // this also turns the lookahead off, so it isn't overridden below
+        av_dict_set(&options, "tune", "zerolatency", 0);
+    } else {
+        av_dict_set(&options, "rc-lookahead", "5", 0);
+    }
+    if (threading.lookaheadThreads) {
+        params.emplace_back("lookahead-threads=" + std::to_string(threading.lookaheadThreads));
+    }
+    if (_configuration.x264.intraRefresh) {
+        av_dict_set(&options, "intra-refresh", "1", 0);
+        // keyint is the refresh period in this mode
+        params.emplace_back("keyint=" + std::to_string(_configuration.x264.intraRefreshFrames));
+        _context->rc_max_rate = _configuration.bitrate;
+        _context->rc_buffer_size = _configuration.bitrate / 4;
+    } else if (_configuration.forceIDROnFlush) {
+        // idrs only go where flush puts them. scene cuts still get i-frames, but never idrs since
+        // min-keyint is never reached
+        av_dict_set(&options, "forced-idr", "1", 0);
+        params.emplace_back("keyint=infinite");
+        params.emplace_back("min-keyint=" + std::to_string(1 << 30));
+    }
+    auto x264Params = _joinParams(params);
+    if (!x264Params.empty()) {
+        av_dict_set(&options, "x264-params", x264Params.c_str(), 0);
+    }
 
     auto err = avcodec_open2(_context, codec, &options);
     if (err < 0) {
@@ -59,6 +112,14 @@ void H264VideoEncoder::_beginEncoding(int inputWidth, int inputHeight, AVPixelFo
         _context = nullptr;
         return;
     }
+    _logger.with(
+        "preset", preset,
+        "threads", _context->thread_count,
+        "sliced_threads", threading.slicedThreads,
+        "zerolatency", threading.zeroLatency,
+        "intra_refresh", _configuration.x264.intraRefresh,
+        "x264_params", x264Params
+    ).info("opened h264 encoder");
 
     if (inputWidth != _configuration.width || inputHeight != _configuration.height) {
         _scaledFrame = av_frame_alloc();
@@ -143,6 +204,10 @@ void H264VideoEncoder::_handleEncodedPackets() {
             auto pts = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::duration<double>(packet.pts * av_q2d(_context->time_base)));
             auto dts = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::duration<double>(packet.dts * av_q2d(_context->time_base)));
 
+            if (_latencyTracer) {
+                _latencyTracer->stamp(LatencyTracer::Stage::Encoder, pts);
+            }
+
             _outputBuffer.clear();
             if (!h264::AnnexBToAVCC(&_outputBuffer, packet.data, packet.size)) {
                 _logger.error("unable to convert annex-b encoder output to avcc");
@@ -41,15 +41,46 @@ void H265VideoEncoder::_beginEncoding(int inputWidth, int inputHeight, AVPixelFo
     // @TODO: verify these are good for hevc
     _context->time_base = AVRational{1, 120};
     _context->ticks_per_frame = 2;
+    if (_configuration.maxFrameRate > 0.0) {
+        // lets rate control budget bits for the frames that are actually encoded
+        _context->framerate = av_d2q(_configuration.maxFrameRate, 1001);
+    }
+
+    // libx265 doesn't take x265's options directly, so everything but the tune goes through
+    // x265-params
+    auto& threading = _configuration.threading;
+    std::vector<std::string> params = {
+        "bframes=0",
+        "b-adapt=0",
+        "rc-lookahead=0",
+        "scenecut=0",
+        "cutree=0",
+        threading.wpp ? "wpp=1" : "wpp=0",
+    };
+    // x265 sizes these for the cores unless they're given
+    if (threading.poolThreads) {
+        params.emplace_back("pools=" + std::to_string(threading.poolThreads));
+    }
+    if (threading.frameThreads) {
+        params.emplace_back("frame-threads=" + std::to_string(threading.frameThreads));
+    }
+    if (threading.lookaheadThreads) {
+        params.emplace_back("lookahead-threads=" + std::to_string(threading.lookaheadThreads));
+    }
 
     AVDictionary* options = nullptr;
-    // @TODO: figure out options
-    av_dict_set(&options, "bframes", "0", 0);
-    av_dict_set(&options, "b-adapt", "0", 0);
-    av_dict_set(&options, "rc-lookahead", "0", 0);
-    av_dict_set(&options, "no-cenecut", "", 0);
-    av_dict_set(&options, "no-cutree", "", 0);
-    av_dict_set(&options, "frame-threads", "1", 0);
+    if (threading.zeroLatency) {
+        av_dict_set(&options, "tune", "zerolatency", 0);
+    }
+    if (_configuration.forceIDROnFlush) {
+        // idrs only go where flush puts them. libx265 forces plain i-frames, which x265 only turns
+        // into idrs if gops are closed and min-keyint lets every frame be a keyframe
+        params.emplace_back("keyint=-1");
+        params.emplace_back("min-keyint=1");
+        params.emplace_back("open-gop=0");
+    }
+    auto x265Params = _joinParams(params);
+    av_dict_set(&options, "x265-params", x265Params.c_str(), 0);
 
     auto err = avcodec_open2(_context, codec, &options);
     if (err < 0) {
@@ -59,6 +90,10 @@ void H265VideoEncoder::_beginEncoding(int inputWidth, int inputHeight, AVPixelFo
         _context = nullptr;
         return;
     }
+    _logger.with(
+        "zerolatency", threading.zeroLatency,
+        "x265_params", x265Params
+    ).info("opened h265 encoder");
 
     if (inputWidth != _configuration.width || inputHeight != _configuration.height) {
         _scaledFrame = av_frame_alloc();
@@ -148,6 +183,9 @@ void H265VideoEncoder::_handleEncodedPackets() {
             auto dts = std::chrono::duration_cast<std::chrono::microseconds>(
                     std::chrono::duration<double>(packet.dts * av_q2d(_context->time_base)));
 
+            if (_latencyTracer) {
+                _latencyTracer->stamp(LatencyTracer::Stage::Encoder, pts);
+            }
             _handler->handleEncodedVideo(pts, dts, packet.data, packet.size);
         }
         av_packet_unref(&packet);
@@ -0,0 +1,399 @@
+#include "yuv_scaler.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <map>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define YUV_SCALER_X86 1
+#include <immintrin.h>
+#endif
+
+namespace {
+
+constexpr int WeightBits = 14;
+
+// The vertical pass keeps 7 fractional bits so that its output still fits in an int16.
+constexpr int IntermediateBits = 7;
+constexpr int VerticalShift = WeightBits - IntermediateBits;
+constexpr int HorizontalShift = WeightBits + IntermediateBits;
+
+// Horizontal filters are padded to 4 taps or a multiple of 8 so that the vector kernels can take
+// whole halves or registers of taps. Vertical filters are padded to pairs.
+constexpr int HorizontalAlignment = 8;
+constexpr int ShortHorizontalAlignment = 4;
+constexpr int VerticalAlignment = 2;
+
+// BuildFilter returns the filter for scaling sourceSize pixels to size pixels. If components is
+// greater than one, the pixels are interleaved components (e.g. nv12's chroma) and the filter's
+// positions are in components rather than pixels. False is returned if the source is too small for
+// the padded filter.
+template <typename Filter1D>
+bool BuildFilter(Filter1D* filter, int sourceSize, int size, int components, int alignment, YUVScaler::Filter type) {
+    auto scale = static_cast<double>(sourceSize) / size;
+
+    std::vector<int> positions(size);
+    std::vector<std::vector<int16_t>> weights(size);
+    int taps = 1;
+
+    for (int i = 0; i < size; ++i) {
+        std::map<int, double> contributions;
+        if (type == YUVScaler::Filter::Area && scale > 1.0) {
+            auto begin = i * scale;
+            auto end = (i + 1) * scale;
+            for (int j = static_cast<int>(std::floor(begin)); j < end; ++j) {
+                auto w = std::min<double>(j + 1, end) - std::max<double>(j, begin);
+                if (w > 0.0) {
+                    contributions[std::min(j, sourceSize - 1)] += w;
+                }
+            }
+        } else {
+            auto center = (i + 0.5) * scale - 0.5;
+            auto radius = std::max(scale, 1.0);
+            for (int j = static_cast<int>(std::floor(center - radius)); j <= static_cast<int>(std::ceil(center + radius)); ++j) {
+                auto w = 1.0 - std::abs(j - center) / radius;
+                if (w > 0.0) {
+                    contributions[std::min(std::max(j, 0), sourceSize - 1)] += w;
+                }
+            }
+        }
+
+        double total = 0.0;
+        for (auto& kv : contributions) {
+            total += kv.second;
+        }
+
+        // quantize the running sum so that the weights always add up exactly
+        std::vector<int16_t> quantized;
+        double sum = 0.0;
+        int previous = 0;
+        for (auto& kv : contributions) {
+            sum += kv.second / total;
+            auto current = static_cast<int>(std::lround(sum * (1 << WeightBits)));
+            quantized.push_back(static_cast<int16_t>(current - previous));
+            previous = current;
+        }
+
+        auto position = contributions.begin()->first;
+        while (quantized.size() > 1 && quantized.front() == 0) {
+            quantized.erase(quantized.begin());
+            ++position;
+        }
+        while (quantized.size() > 1 && quantized.back() == 0) {
+            quantized.pop_back();
+        }
+
+        positions[i] = position;
+        taps = std::max(taps, static_cast<int>(quantized.size()));
+        weights[i] = std::move(quantized);
+    }
+
+    auto filterSize = (taps - 1) * components + 1;
+    if (alignment == HorizontalAlignment && filterSize <= ShortHorizontalAlignment) {
+        filterSize = ShortHorizontalAlignment;
+    } else {
+        filterSize = (filterSize + alignment - 1) / alignment * alignment;
+    }
+    auto sourceElements = sourceSize * components;
+    if (filterSize > sourceElements) {
+        return false;
+    }
+
+    filter->size = filterSize;
+    filter->positions.assign(size * components, 0);
+    filter->weights.assign(size * components * filterSize, 0);
+    for (int i = 0; i < size; ++i) {
+        for (int c = 0; c < components; ++c) {
+            auto output = i * components + c;
+            auto position = positions[i] * components + c;
+            // shift windows that would run past the end of the row back, so that the padding never
+            // reads outside of it
+            auto offset = std::max(0, position + filterSize - sourceElements);
+            filter->positions[output] = position - offset;
+            auto dest = &filter->weights[output * filterSize + offset];
+            for (size_t k = 0; k < weights[i].size(); ++k) {
+                dest[k * components] = weights[i][k];
+            }
+        }
+    }
+    return true;
+}
+
+void VerticalScalar(const uint8_t* const* rows, const int16_t* weights, int taps, int width, int16_t* dest, int x = 0) {
+    for (; x < width; ++x) {
+        int32_t sum = 0;
+        for (int k = 0; k < taps; ++k) {
+            sum += rows[k][x] * weights[k];
+        }
+        dest[x] = static_cast<int16_t>((sum + (1 << (VerticalShift - 1))) >> VerticalShift);
+    }
+}
+
+void HorizontalScalar(const int16_t* source, const int* positions, const int16_t* weights, int taps, int width, uint8_t* dest, int x = 0) {
+    for (; x < width; ++x) {
+        auto s = source + positions[x];
+        auto w = weights + x * taps;
+        int32_t sum = 0;
+        for (int k = 0; k < taps; ++k) {
+            sum += s[k] * w[k];
+        }
+        dest[x] = static_cast<uint8_t>(std::min(std::max((sum + (1 << (HorizontalShift - 1))) >> HorizontalShift, 0), 255));
+    }
+}
+
+#if YUV_SCALER_X86
+
+// The vector kernels interleave pairs of source rows so that each _madd_epi16 applies two taps.
+inline int32_t WeightPair(const int16_t* weights) {
+    return static_cast<int32_t>(static_cast<uint16_t>(weights[0])) | (static_cast<int32_t>(weights[1]) << 16);
+}
+
+__attribute__((target("sse4.1")))
+void VerticalSSE41(const uint8_t* const* rows, const int16_t* weights, int taps, int width, int16_t* dest) {
+    const auto rounding = _mm_set1_epi32(1 << (VerticalShift - 1));
+    int x = 0;
+    for (; x + 8 <= width; x += 8) {
+        auto lo = rounding;
+        auto hi = rounding;
+        for (int k = 0; k < taps; k += 2) {
+            auto a = _mm_cvtepu8_epi16(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(rows[k] + x)));
+            auto b = _mm_cvtepu8_epi16(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(rows[k + 1] + x)));
+            auto w = _mm_set1_epi32(WeightPair(weights + k));
+            lo = _mm_add_epi32(lo, _mm_madd_epi16(_mm_unpacklo_epi16(a, b), w));
+            hi = _mm_add_epi32(hi, _mm_madd_epi16(_mm_unpackhi_epi16(a, b), w));
+        }
+        lo = _mm_srai_epi32(lo, VerticalShift);
+        hi = _mm_srai_epi32(hi, VerticalShift);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dest + x), _mm_packs_epi32(lo, hi));
+    }
+    VerticalScalar(rows, weights, taps, width, dest, x);
+}
+
+__attribute__((target("sse4.1")))
+inline __m128i HorizontalSumSSE41(const int16_t* source, const int16_t* weights, int taps) {
+    auto sum = _mm_setzero_si128();
+    for (int k = 0; k < taps; k += 8) {
+        auto s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + k));
+        auto w = _mm_loadu_si128(reinterpret_cast<const __m128i*>(weights + k));
+        sum = _mm_add_epi32(sum, _mm_madd_epi16(s, w));
+    }
+    return sum;
+}
+
+__attribute__((target("sse4.1")))
+void HorizontalSSE41(const int16_t* source, const int* positions, const int16_t* weights, int taps, int width, uint8_t* dest) {
+    const auto rounding = _mm_set1_epi32(1 << (HorizontalShift - 1));
+    int x = 0;
+    for (; x + 4 <= width; x += 4) {
+        __m128i sums;
+        if (taps == ShortHorizontalAlignment) {
+            // two outputs' taps fit in each register
+            auto s01 = _mm_unpacklo_epi64(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(source + positions[x])), _mm_loadl_epi64(reinterpret_cast<const __m128i*>(source + positions[x + 1])));
+            auto s23 = _mm_unpacklo_epi64(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(source + positions[x + 2])), _mm_loadl_epi64(reinterpret_cast<const __m128i*>(source + positions[x + 3])));
+            auto w01 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(weights + x * taps));
+            auto w23 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(weights + (x + 2) * taps));
+            sums = _mm_hadd_epi32(_mm_madd_epi16(s01, w01), _mm_madd_epi16(s23, w23));
+        } else {
+            auto s0 = HorizontalSumSSE41(source + positions[x], weights + x * taps, taps);
+            auto s1 = HorizontalSumSSE41(source + positions[x + 1], weights + (x + 1) * taps, taps);
+            auto s2 = HorizontalSumSSE41(source + positions[x + 2], weights + (x + 2) * taps, taps);
+            auto s3 = HorizontalSumSSE41(source + positions[x + 3], weights + (x + 3) * taps, taps);
+            sums = _mm_hadd_epi32(_mm_hadd_epi32(s0, s1), _mm_hadd_epi32(s2, s3));
+        }
+        sums = _mm_srai_epi32(_mm_add_epi32(sums, rounding), HorizontalShift);
+        auto packed = _mm_packs_epi32(sums, sums);
+        packed = _mm_packus_epi16(packed, packed);
+        auto pixels = _mm_cvtsi128_si32(packed);
+        std::copy_n(reinterpret_cast<const uint8_t*>(&pixels), 4, dest + x);
+    }
+    HorizontalScalar(source, positions, weights, taps, width, dest, x);
+}
+
+__attribute__((target("avx2")))
+void VerticalAVX2(const uint8_t* const* rows, const int16_t* weights, int taps, int width, int16_t* dest) {
+    const auto rounding = _mm256_set1_epi32(1 << (VerticalShift - 1));
+    int x = 0;
+    for (; x + 16 <= width; x += 16) {
+        auto lo = rounding;
+        auto hi = rounding;
+        for (int k = 0; k < taps; k += 2) {
+            auto a = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(rows[k] + x)));
+            auto b = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(rows[k + 1] + x)));
+            auto w = _mm256_set1_epi32(WeightPair(weights + k));
+            lo = _mm256_add_epi32(lo, _mm256_madd_epi16(_mm256_unpacklo_epi16(a, b), w));
+            hi = _mm256_add_epi32(hi, _mm256_madd_epi16(_mm256_unpackhi_epi16(a, b), w));
+        }
+        lo = _mm256_srai_epi32(lo, VerticalShift);
+        hi = _mm256_srai_epi32(hi, VerticalShift);
+        // the unpacks and the pack both work within 128-bit lanes, so the order comes back out right
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dest + x), _mm256_packs_epi32(lo, hi));
+    }
+    VerticalScalar(rows, weights, taps, width, dest, x);
+}
+
+// HorizontalSumAVX2 computes the partial sums for outputs x (low lane) and x + 1 (high lane).
+__attribute__((target("avx2")))
+inline __m256i HorizontalSumAVX2(const int16_t* source, const int* positions, const int16_t* weights, int taps, int x) {
+    auto sum = _mm256_setzero_si256();
+    auto s0 = source + positions[x];
+    auto s1 = source + positions[x + 1];
+    auto w0 = weights + x * taps;
+    auto w1 = w0 + taps;
+    for (int k = 0; k < taps; k += 8) {
+        auto s = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(s0 + k))), _mm_loadu_si128(reinterpret_cast<const __m128i*>(s1 + k)), 1);
+        auto w = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(w0 + k))), _mm_loadu_si128(reinterpret_cast<const __m128i*>(w1 + k)), 1);
+        sum = _mm256_add_epi32(sum, _mm256_madd_epi16(s, w));
+    }
+    return sum;
+}
+
+__attribute__((target("avx2")))
+void HorizontalAVX2(const int16_t* source, const int* positions, const int16_t* weights, int taps, int width, uint8_t* dest) {
+    const auto rounding = _mm256_set1_epi32(1 << (HorizontalShift - 1));
+    const auto order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+    const auto shortOrder = _mm256_setr_epi32(0, 1, 4, 5, 2, 3, 6, 7);
+    int x = 0;
+    for (; x + 8 <= width; x += 8) {
+        __m256i sums;
+        if (taps == ShortHorizontalAlignment) {
+            // four outputs' taps fit in each register, two per lane
+            auto pair = [&](int i) {
+                return _mm_unpacklo_epi64(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(source + positions[i])), _mm_loadl_epi64(reinterpret_cast<const __m128i*>(source + positions[i + 1])));
+            };
+            auto s0123 = _mm256_inserti128_si256(_mm256_castsi128_si256(pair(x)), pair(x + 2), 1);
+            auto s4567 = _mm256_inserti128_si256(_mm256_castsi128_si256(pair(x + 4)), pair(x + 6), 1);
+            auto w0123 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(weights + x * taps));
+            auto w4567 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(weights + (x + 4) * taps));
+            // the low lane ends up with outputs 0, 1, 4, 5 and the high lane with 2, 3, 6, 7
+            sums = _mm256_hadd_epi32(_mm256_madd_epi16(s0123, w0123), _mm256_madd_epi16(s4567, w4567));
+            sums = _mm256_permutevar8x32_epi32(sums, shortOrder);
+        } else {
+            auto s01 = HorizontalSumAVX2(source, positions, weights, taps, x);
+            auto s23 = HorizontalSumAVX2(source, positions, weights, taps, x + 2);
+            auto s45 = HorizontalSumAVX2(source, positions, weights, taps, x + 4);
+            auto s67 = HorizontalSumAVX2(source, positions, weights, taps, x + 6);
+            // the low lane ends up with outputs 0, 2, 4, 6 and the high lane with 1, 3, 5, 7
+            sums = _mm256_hadd_epi32(_mm256_hadd_epi32(s01, s23), _mm256_hadd_epi32(s45, s67));
+            sums = _mm256_permutevar8x32_epi32(sums, order);
+        }
+        sums = _mm256_srai_epi32(_mm256_add_epi32(sums, rounding), HorizontalShift);
+        auto packed = _mm_packs_epi32(_mm256_castsi256_si128(sums), _mm256_extracti128_si256(sums, 1));
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(dest + x), _mm_packus_epi16(packed, packed));
+    }
+    HorizontalScalar(source, positions, weights, taps, width, dest, x);
+}
+
+#endif
+
+} // anonymous namespace
+
+YUVScaler::Kernel YUVScaler::BestKernel() {
+    if (IsKernelSupported(Kernel::AVX2)) {
+        return Kernel::AVX2;
+    } else if (IsKernelSupported(Kernel::SSE41)) {
+        return Kernel::SSE41;
+    }
+    return Kernel::Scalar;
+}
+
+bool YUVScaler::IsKernelSupported(Kernel kernel) {
+    switch (kernel) {
+        case Kernel::Scalar:
+            return true;
+#if YUV_SCALER_X86
+        case Kernel::SSE41:
+            return __builtin_cpu_supports("sse4.1");
+        case Kernel::AVX2:
+            return __builtin_cpu_supports("avx2");
+#endif
+        default:
+            return false;
+    }
+}
+
+bool YUVScaler::IsFormatSupported(AVPixelFormat format) {
+    return format == AV_PIX_FMT_YUV420P || format == AV_PIX_FMT_NV12;
+}
+
+bool YUVScaler::configure(int sourceWidth, int sourceHeight, int width, int height, AVPixelFormat format, Filter filter, Kernel kernel) {
+    _planes.clear();
+    if (!IsFormatSupported(format) || sourceWidth <= 0 || sourceHeight <= 0 || width <= 0 || height <= 0) {
+        return false;
+    }
+
+    _kernel = IsKernelSupported(kernel) ? kernel : BestKernel();
+
+    auto chromaSourceWidth = (sourceWidth + 1) / 2;
+    auto chromaSourceHeight = (sourceHeight + 1) / 2;
+    auto chromaWidth = (width + 1) / 2;
+    auto chromaHeight = (height + 1) / 2;
+
+    struct {
+        int sourceWidth, sourceHeight, width, height, components;
+    } planes[3] = {
+        {sourceWidth, sourceHeight, width, height, 1},
+        {chromaSourceWidth, chromaSourceHeight, chromaWidth, chromaHeight, 1},
+        {chromaSourceWidth, chromaSourceHeight, chromaWidth, chromaHeight, 1},
+    };
+    size_t planeCount = 3;
+    if (format == AV_PIX_FMT_NV12) {
+        planes[1].components = 2;
+        planeCount = 2;
+    }
+
+    size_t rowSize = 0;
+    for (size_t i = 0; i < planeCount; ++i) {
+        auto& p = planes[i];
+        Plane plane;
+        plane.sourceWidth = p.sourceWidth * p.components;
+        plane.sourceHeight = p.sourceHeight;
+        plane.width = p.width * p.components;
+        plane.height = p.height;
+        if (!BuildFilter(&plane.horizontal, p.sourceWidth, p.width, p.components, HorizontalAlignment, filter) ||
+            !BuildFilter(&plane.vertical, p.sourceHeight, p.height, 1, VerticalAlignment, filter)) {
+            _planes.clear();
+            return false;
+        }
+        rowSize = std::max<size_t>(rowSize, plane.sourceWidth);
+        _planes.emplace_back(std::move(plane));
+    }
+
+    _row.resize(rowSize);
+    return true;
+}
+
+void YUVScaler::scale(const AVFrame* source, AVFrame* destination) {
+    auto vertical = VerticalScalar;
+    auto horizontal = HorizontalScalar;
+#if YUV_SCALER_X86
+    if (_kernel == Kernel::AVX2) {
+        vertical = [](const uint8_t* const* rows, const int16_t* weights, int taps, int width, int16_t* dest, int) {
+            VerticalAVX2(rows, weights, taps, width, dest);
+        };
+        horizontal = [](const int16_t* source, const int* positions, const int16_t* weights, int taps, int width, uint8_t* dest, int) {
+            HorizontalAVX2(source, positions, weights, taps, width, dest);
+        };
+    } else if (_kernel == Kernel::SSE41) {
+        vertical = [](const uint8_t* const* rows, const int16_t* weights, int taps, int width, int16_t* dest, int) {
+            VerticalSSE41(rows, weights, taps, width, dest);
+        };
+        horizontal = [](const int16_t* source, const int* positions, const int16_t* weights, int taps, int width, uint8_t* dest, int) {
+            HorizontalSSE41(source, positions, weights, taps, width, dest);
+        };
+    }
+#endif
+
+    for (size_t i = 0; i < _planes.size(); ++i) {
+        auto& plane = _planes[i];
+        auto& v = plane.vertical;
+        auto& h = plane.horizontal;
+        _rows.resize(v.size);
+        for (int y = 0; y < plane.height; ++y) {
+            for (int k = 0; k < v.size; ++k) {
+                _rows[k] = source->data[i] + static_cast<ptrdiff_t>(v.positions[y] + k) * source->linesize[i];
+            }
+            vertical(_rows.data(), &v.weights[y * v.size], v.size, plane.sourceWidth, _row.data(), 0);
+            horizontal(_row.data(), h.positions.data(), h.weights.data(), h.size, plane.width, destination->data[i] + static_cast<ptrdiff_t>(y) * destination->linesize[i], 0);
+        }
+    }
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+extern "C" {
+    #include <libavutil/frame.h>
+}
+
+// YUVScaler resizes 8-bit yuv420p and nv12 frames. It's a faster alternative to libswscale for the
+// few filters and formats the encoding ladders actually use.
+//
+// Each output row is produced by a vertical pass over the source rows it needs, followed by a
+// horizontal pass over the result. Both passes use 14-bit fixed-point weights, and every kernel
+// produces exactly the same output.
+class YUVScaler {
+public:
+    enum class Filter {
+        // A triangle filter, widened to cover the whole source area when downscaling. This is
+        // comparable to libswscale's SWS_BILINEAR.
+        Bilinear,
+
+        // The average of the covered source area, comparable to libswscale's SWS_AREA. When
+        // upscaling, this is the same as Bilinear.
+        Area,
+    };
+
+    enum class Kernel {
+        Scalar,
+        SSE41,
+        AVX2,
+    };
+
+    // BestKernel returns the fastest kernel the cpu supports.
+    static Kernel BestKernel();
+    static bool IsKernelSupported(Kernel kernel);
+
+    static bool IsFormatSupported(AVPixelFormat format);
+
+    // configure prepares the scaler for the given resolutions and format. It returns false if they
+    // aren't supported. If the kernel isn't supported by the cpu, the best supported one is used.
+    bool configure(int sourceWidth, int sourceHeight, int width, int height, AVPixelFormat format, Filter filter, Kernel kernel = BestKernel());
+
+    // scale writes the scaled source into destination, which must already have its buffers. Frames
+    // must match the configured resolutions and format. Since scale uses a scratch buffer, a scaler
+    // can't be used from multiple threads at once.
+    void scale(const AVFrame* source, AVFrame* destination);
+
+    Kernel kernel() const { return _kernel; }
+
+private:
+    // Filter1D describes how each of a dimension's outputs is computed from the inputs. Output i is
+    // the sum of inputs positions[i] through positions[i] + size - 1, each multiplied by its weight.
+    // The weights for each output sum to 1 << 14.
+    struct Filter1D {
+        int size = 0;
+        std::vector<int> positions;
+        std::vector<int16_t> weights;
+    };
+
+    struct Plane {
+        // Widths are in bytes, so nv12's chroma plane is twice as wide as its chroma resolution.
+        int sourceWidth = 0;
+        int sourceHeight = 0;
+        int width = 0;
+        int height = 0;
+        Filter1D horizontal;
+        Filter1D vertical;
+    };
+
+    Kernel _kernel = Kernel::Scalar;
+    std::vector<Plane> _planes;
+    std::vector<int16_t> _row;
+    std::vector<const uint8_t*> _rows;
+};
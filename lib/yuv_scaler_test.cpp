@@ -0,0 +1,199 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+
+extern "C" {
+    #include <libswscale/swscale.h>
+}
+
+#include "yuv_scaler.hpp"
+
+namespace {
+
+struct Frame {
+    Frame(int width, int height, AVPixelFormat format) {
+        frame = av_frame_alloc();
+        frame->format = format;
+        frame->width = width;
+        frame->height = height;
+        av_frame_get_buffer(frame, 32);
+    }
+
+    ~Frame() {
+        av_frame_free(&frame);
+    }
+
+    int planes() const {
+        return frame->format == AV_PIX_FMT_NV12 ? 2 : 3;
+    }
+
+    // planeWidth returns the width of the given plane in bytes.
+    int planeWidth(int plane) const {
+        if (plane == 0) {
+            return frame->width;
+        }
+        return frame->format == AV_PIX_FMT_NV12 ? (frame->width + 1) / 2 * 2 : (frame->width + 1) / 2;
+    }
+
+    int planeHeight(int plane) const {
+        return plane == 0 ? frame->height : (frame->height + 1) / 2;
+    }
+
+    uint8_t* row(int plane, int y) const {
+        return frame->data[plane] + y * frame->linesize[plane];
+    }
+
+    template <typename F>
+    void fill(F&& f) {
+        for (int p = 0; p < planes(); ++p) {
+            for (int y = 0; y < planeHeight(p); ++y) {
+                for (int x = 0; x < planeWidth(p); ++x) {
+                    row(p, y)[x] = f(p, x, y);
+                }
+            }
+        }
+    }
+
+    AVFrame* frame;
+};
+
+struct Size {
+    int width;
+    int height;
+};
+
+// The ladders' usual ratios, plus an upscale and some odd sizes.
+const std::pair<Size, Size> Ratios[] = {
+    {{1920, 1080}, {1280, 720}},
+    {{1920, 1080}, {960, 540}},
+    {{1920, 1080}, {640, 360}},
+    {{1280, 720}, {854, 480}},
+    {{1280, 720}, {640, 360}},
+    {{640, 360}, {1280, 720}},
+    {{101, 77}, {37, 29}},
+};
+
+const AVPixelFormat Formats[] = {AV_PIX_FMT_YUV420P, AV_PIX_FMT_NV12};
+const YUVScaler::Filter Filters[] = {YUVScaler::Filter::Bilinear, YUVScaler::Filter::Area};
+
+} // anonymous namespace
+
+TEST(YUVScaler, kernelsMatch) {
+    std::mt19937 random{1};
+    const YUVScaler::Kernel kernels[] = {YUVScaler::Kernel::SSE41, YUVScaler::Kernel::AVX2};
+
+    for (auto& ratio : Ratios) {
+        for (auto format : Formats) {
+            Frame source{ratio.first.width, ratio.first.height, format};
+            source.fill([&](int, int, int) {
+                return static_cast<uint8_t>(random());
+            });
+
+            for (auto filter : Filters) {
+                YUVScaler scalar;
+                ASSERT_TRUE(scalar.configure(ratio.first.width, ratio.first.height, ratio.second.width, ratio.second.height, format, filter, YUVScaler::Kernel::Scalar));
+                Frame expected{ratio.second.width, ratio.second.height, format};
+                scalar.scale(source.frame, expected.frame);
+
+                for (auto kernel : kernels) {
+                    if (!YUVScaler::IsKernelSupported(kernel)) {
+                        continue;
+                    }
+                    YUVScaler scaler;
+                    ASSERT_TRUE(scaler.configure(ratio.first.width, ratio.first.height, ratio.second.width, ratio.second.height, format, filter, kernel));
+                    EXPECT_EQ(kernel, scaler.kernel());
+                    Frame actual{ratio.second.width, ratio.second.height, format};
+                    scaler.scale(source.frame, actual.frame);
+
+                    for (int p = 0; p < expected.planes(); ++p) {
+                        for (int y = 0; y < expected.planeHeight(p); ++y) {
+                            ASSERT_EQ(0, memcmp(expected.row(p, y), actual.row(p, y), expected.planeWidth(p)))
+                                << "kernel " << static_cast<int>(kernel) << ", plane " << p << ", row " << y
+                                << ", " << ratio.first.width << "x" << ratio.first.height << " to " << ratio.second.width << "x" << ratio.second.height;
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+TEST(YUVScaler, solidColor) {
+    for (auto& ratio : Ratios) {
+        for (auto format : Formats) {
+            for (auto filter : Filters) {
+                // nv12's chroma plane alternates between u and v
+                auto color = [format](int plane, int x) {
+                    auto isV = format == AV_PIX_FMT_NV12 ? x % 2 == 1 : plane == 2;
+                    return plane == 0 ? 235 : isV ? 16 : 128;
+                };
+                Frame source{ratio.first.width, ratio.first.height, format};
+                source.fill([&](int plane, int x, int) {
+                    return color(plane, x);
+                });
+
+                YUVScaler scaler;
+                ASSERT_TRUE(scaler.configure(ratio.first.width, ratio.first.height, ratio.second.width, ratio.second.height, format, filter));
+                Frame dest{ratio.second.width, ratio.second.height, format};
+                scaler.scale(source.frame, dest.frame);
+
+                for (int p = 0; p < dest.planes(); ++p) {
+                    for (int y = 0; y < dest.planeHeight(p); ++y) {
+                        for (int x = 0; x < dest.planeWidth(p); ++x) {
+                            ASSERT_EQ(color(p, x), dest.row(p, y)[x]);
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+TEST(YUVScaler, matchesSWScale) {
+    // the two can't be bit-exact since libswscale uses different intermediate precisions and
+    // chroma siting, but they should agree closely on smooth content
+    for (auto& ratio : Ratios) {
+        for (auto filter : Filters) {
+            auto format = AV_PIX_FMT_YUV420P;
+            Frame source{ratio.first.width, ratio.first.height, format};
+            source.fill([&](int plane, int x, int y) {
+                auto w = source.planeWidth(plane);
+                auto h = source.planeHeight(plane);
+                return static_cast<uint8_t>(16 + 100 * x / w + 100 * y / h);
+            });
+
+            YUVScaler scaler;
+            ASSERT_TRUE(scaler.configure(ratio.first.width, ratio.first.height, ratio.second.width, ratio.second.height, format, filter));
+            Frame actual{ratio.second.width, ratio.second.height, format};
+            scaler.scale(source.frame, actual.frame);
+
+            auto context = sws_getContext(
+                ratio.first.width, ratio.first.height, format,
+                ratio.second.width, ratio.second.height, format,
+                filter == YUVScaler::Filter::Area ? SWS_AREA : SWS_BILINEAR, nullptr, nullptr, nullptr
+            );
+            ASSERT_NE(nullptr, context);
+            Frame expected{ratio.second.width, ratio.second.height, format};
+            sws_scale(context, source.frame->data, source.frame->linesize, 0, ratio.first.height, expected.frame->data, expected.frame->linesize);
+            sws_freeContext(context);
+
+            for (int p = 0; p < expected.planes(); ++p) {
+                double totalDifference = 0.0;
+                int maxDifference = 0;
+                for (int y = 0; y < expected.planeHeight(p); ++y) {
+                    for (int x = 0; x < expected.planeWidth(p); ++x) {
+                        auto difference = std::abs(expected.row(p, y)[x] - actual.row(p, y)[x]);
+                        totalDifference += difference;
+                        maxDifference = std::max(maxDifference, difference);
+                    }
+                }
+                auto meanDifference = totalDifference / (expected.planeWidth(p) * expected.planeHeight(p));
+                EXPECT_LE(maxDifference, 2) << "plane " << p << ", " << ratio.first.width << "x" << ratio.first.height << " to " << ratio.second.width << "x" << ratio.second.height;
+                EXPECT_LT(meanDifference, 0.5) << "plane " << p << ", " << ratio.first.width << "x" << ratio.first.height << " to " << ratio.second.width << "x" << ratio.second.height;
+            }
+        }
+    }
+}
@@ -39,24 +39,25 @@ struct FileStorageParser {
 };
 
 struct EncodingConfiguration {
-    VideoEncoder::Configuration video;
+    VideoEncoderConfiguration video;
 };
 
 struct EncodingParser {
     void operator()(const std::string& name, const std::string& value, EncodingConfiguration& destination) {
         try {
             auto encoding = json::parse(value);
+            destination.video.codec = VideoCodec::x264;
             destination.video.bitrate = encoding["video"]["bitrate"].get<int>();
             destination.video.width = encoding["video"]["width"].get<int>();
             destination.video.height = encoding["video"]["height"].get<int>();
             if (encoding["video"]["h264_preset"].is_string()) {
-                destination.video.h264Preset = encoding["video"]["h264_preset"].get<std::string>();
+                destination.video.x264.h264Preset = encoding["video"]["h264_preset"].get<std::string>();
             }
             if (encoding["video"]["profile"].is_number()) {
-                destination.video.profileIDC = encoding["video"]["profile"].get<int>();
+                destination.video.x264.profileIDC = encoding["video"]["profile"].get<int>();
             }
             if (encoding["video"]["level"].is_number()) {
-                destination.video.levelIDC = encoding["video"]["level"].get<int>();
+                destination.video.x264.levelIDC = encoding["video"]["level"].get<int>();
             }
         } catch (...) {
             throw args::ParseError("invalid encoding");
@@ -65,15 +66,15 @@ struct EncodingParser {
 };
 
 struct EncodingResource {
-    EncodingResource(Logger logger, SegmentManager::Configuration smConfiguration, VideoEncoder::Configuration encoderConfiguration)
+    EncodingResource(Logger logger, SegmentManager::Configuration smConfiguration, VideoEncoderConfiguration encoderConfiguration)
         : segmentManager{logger, std::move(smConfiguration)}
         , packager{logger, &segmentManager}
         , videoEncoder{logger, &packager, std::move(encoderConfiguration)}
     {}
 
     SegmentManager segmentManager;
-    Packager packager;
-    VideoEncoder videoEncoder;
+    H264Packager packager;
+    H264VideoEncoder videoEncoder;
 };
 
 int main(int argc, const char* argv[]) {
@@ -85,6 +86,7 @@ int main(int argc, const char* argv[]) {
     args::HelpFlag help(parser, "help", "display this help", {'h', "help"});
     args::ValueFlag<std::string> input(parser, "input", "input path", {'i', "input"});
     args::ValueFlag<std::shared_ptr<FileStorage>, FileStorageParser> segmentStorage(parser, "uri", "uri to write segments to", {"segment-storage"});
+    args::ValueFlag<int> decodingThreads(parser, "count", "decode with this many threads (0 for one per core)", {"decoding-threads"}, 0);
     args::ValueFlagList<EncodingConfiguration, std::vector, EncodingParser> encodings(parser, "encoding", "a/v encoding configuration as json (see ingest-server)", {"encoding"});
     try {
         parser.ParseCLI(argc, argv);
@@ -100,7 +102,10 @@ int main(int argc, const char* argv[]) {
     std::vector<std::unique_ptr<EncodingResource>> encodingResources;
 
     VideoSplitter decodedSegmentSplitter;
-    VideoDecoder videoDecoder{gLogger, &decodedSegmentSplitter};
+    VideoDecoder::Configuration decoderConfiguration;
+    decoderConfiguration.reuseContext = true;
+    decoderConfiguration.threadCount = args::get(decodingThreads);
+    VideoDecoder videoDecoder{gLogger, &decodedSegmentSplitter, decoderConfiguration};
     EncodedAVSplitter segmentSplitter;
     segmentSplitter.addHandler(&videoDecoder);
 